@@ -1,91 +1,394 @@
-// #include "z16sim.h"
-// #include <iostream>
-// #include <vector>
-// #include <iomanip> // For std::hex, std::setw, std::setfill
-//
-// // Main entry point for the Z16 simulator executable
-// int main(int argc, char* argv[])
-// {
-//     // Check for correct command-line usage
-//     if (argc != 2) {
-//         std::cerr << "Usage: " << argv[0] << " <machine_code_file_name.bin>" << std::endl;
-//         return 1; // Indicate error
-//     }
-//
-//     z16sim simulator; // Create an instance of the simulator
-//
-//     // Load the machine code binary from the specified file
-//     simulator.loadMemoryFromFile(argv[1]);
-//
-//     // Run the simulation cycle by cycle
-//     // The cycle() method already prints the disassembly and execution trace
-//     while (simulator.cycle()) {
-//         // Continue simulation as long as cycle() returns true
-//         // (i.e., no termination ecall or error)
-//     }
-//
-//     // Final register state (for debugging/verification if needed)
-//     std::cout << "\n--- Final State ---" << std::endl;
-//     for (int i = 0; i < z16sim::NUM_REGS; ++i) { // Use z16sim::NUM_REGS
-//         std::cout << z16sim::regNames[i] << ": 0x" // Use z16sim::regNames
-//                   << std::hex << std::setw(4) << std::setfill('0')
-//                   << simulator.getReg(i) << std::endl; // Use getReg()
-//     }
-//     std::cout << "PC: 0x" << std::hex << std::setw(4) << std::setfill('0') << simulator.getPC() << std::endl;
-//     std::cout << "---------------------\n" << std::endl;
-//
-//     std::cout << "Simulation finished." << std::endl;
-//     return 0; // Indicate success
-// }
-//
-// // #include "z16sim.h"
-// // #include <cstdio>
-// // #include <cstdlib>
-// // #include <cstdint>
-// // #include <cstring>
-// //
-// // int main(int argc, char **argv) {
-// //     z16sim sim;
-// //     bool debug = false;
-// //
-// //     printf("If you only want to see the output without the instructions, press 1, otherwise; press 0\n");
-// //     char option;
-// //     scanf(" %c", &option);
-// //     while (option != '0' && option != '1') {
-// //         printf("Invalid option, press 0 or 1\n");
-// //         scanf(" %c", &option);
-// //     }
-// //
-// //     if (option == '0') {
-// //         printf("Do you want to debug? Press 1 if you want to see the register changes at each instruction, otherwise; press 0\n");
-// //         char debug_option;
-// //         scanf(" %c", &debug_option);
-// //         while (debug_option != '0' && debug_option != '1') {
-// //             printf("Invalid option, press 0 or 1\n");
-// //             scanf(" %c", &debug_option);
-// //         }
-// //         if (debug_option == '1') {
-// //             debug = true;
-// //         }
-// //     }
-// //
-// //     if (argc != 2) {
-// //         fprintf(stderr, "Usage: %s <machine_code_file>\n", argv[0]);
-// //         return 1;
-// //     }
-// //
-// //     sim.reset();
-// //     sim.loadMemoryFromFile(argv[1]);
-// //
-// //     while (sim.cycle()) {
-// //         if (debug) {
-// //             printf("Registers: ");
-// //             for (int i = 0; i < z16sim::NUM_REGS; ++i) {
-// //                 printf("%s=0x%04X ", z16sim::regNames[i], sim.getReg(i));
-// //             }
-// //             printf("\n");
-// //         }
-// //     }
-// //
-// //     return 0;
-// // }
+// zx16_simulator: command-line driver around the simulator core (libzx16)
+#include "z16sim.h"
+#include "z16gdb.h"
+#include "z16gfx.h"
+#include "z16irq.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+void printUsage(const char* progName) {
+    std::cerr << "Usage: " << progName << " [-i | --quiet | --trace] <machine_code_file_name.bin>" << std::endl;
+    std::cerr << "  -i: Interactive mode (single-stepping)" << std::endl;
+    std::cerr << "  --quiet: Run without the per-instruction trace" << std::endl;
+    std::cerr << "  --trace: Print every executed instruction (default)" << std::endl;
+    std::cerr << "  --engine=interp|blocks|jit: Execution engine for quiet runs (default interp)" << std::endl;
+    std::cerr << "  --stats: Print execution engine statistics at exit" << std::endl;
+    std::cerr << "  --profile=PREFIX: Profile the run; writes PREFIX.prof (hot spots) and PREFIX.folded (stacks)" << std::endl;
+    std::cerr << "  --timing[=SPEC]: Estimate cycles with the pipeline and cache model and report them at exit; SPEC is" << std::endl;
+    std::cerr << "                   key=value,... (alu, load, store, branch, jump, system, taken, direct, indirect, load-use," << std::endl;
+    std::cerr << "                   uncached, icache/dcache=SIZE:LINE:WAYS:PENALTY|off)" << std::endl;
+    std::cerr << "  --listing=FILE: zx16asm listing used to map profiled PCs to labels and source lines" << std::endl;
+    std::cerr << "  --gfx=PATH: Attach the tile graphics device; frames go to PATH (raw RGB24) or to one" << std::endl;
+    std::cerr << "              file per frame for a pattern such as out/f%05d.png or out/f%05d.ppm" << std::endl;
+    std::cerr << "  --irq: Attach the interrupt controller (0xFC00) and the timers (0xFD00)" << std::endl;
+    std::cerr << "  --format=auto|bin|ihex|verilog|mem: Program file format (default auto: from the extension or contents)" << std::endl;
+    std::cerr << "  --base=ADDR: Load the program at ADDR instead of 0x0000" << std::endl;
+    std::cerr << "  --entry=ADDR: Start at ADDR (default: the image's start address, else the base)" << std::endl;
+    std::cerr << "  --gdb=PORT|HOST:PORT|unix:PATH: Wait for GDB to attach and run under its control" << std::endl;
+    std::cerr << "  --trace-file=PATH: Write the trace to PATH in the binary trace format (see zx16_tracedump)" << std::endl;
+    std::cerr << "  --record[=N]: Log the last N instructions (default " << z16recorder::DEFAULT_CAPACITY << ") for reverse" << std::endl;
+    std::cerr << "                execution; faults print the instructions leading up to them" << std::endl;
+}
+
+// Prints the last count recorded instructions, oldest first
+static void printHistory(z16sim& simulator, const z16recorder& recorder, uint64_t count) {
+    uint64_t from = recorder.newest() - std::min(count, recorder.newest() - recorder.oldest());
+    std::cout << "Last " << std::dec << recorder.newest() - from << " instructions:" << std::endl;
+    for (uint64_t n = from; n < recorder.newest(); ++n) {
+        uint16_t pc = recorder.pcAt(n);
+        uint16_t inst = simulator.getMemory()[pc] | (simulator.getMemory()[pc + 1] << 8);
+        char disasm_buf[256];
+        simulator.disassemble(inst, pc, disasm_buf, sizeof(disasm_buf));
+        std::cout << "  " << std::dec << n << "  PC: 0x" << std::hex << std::setw(4) << std::setfill('0') << pc
+                  << " | " << disasm_buf << std::endl;
+    }
+}
+
+// Parses a 16-bit address given in decimal or 0x hex
+static bool parseAddress(const std::string& text, uint16_t& value) {
+    char* end = nullptr;
+    unsigned long parsed = std::strtoul(text.c_str(), &end, 0);
+    if (text.empty() || *end != '\0' || parsed > 0xFFFF) {
+        return false;
+    }
+    value = (uint16_t)parsed;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    std::ios::sync_with_stdio(false); // Buffered std::cin, so ecall 0x001 can read ahead
+    bool interactive = false;
+    bool trace = true;
+    bool stats = false;
+    z16engine engine = Z16_ENGINE_INTERP;
+    const char* filename = nullptr;
+    std::string profilePrefix;
+    const char* listingFile = nullptr;
+    const char* gfxOutput = nullptr;
+    bool irq = false;
+    z16loadOptions load;
+    std::string gdbAddress;
+    size_t recordCapacity = 0;
+    std::string traceFile;
+    std::unique_ptr<z16timingConfig> timingConfig;
+
+    // Parse command line arguments
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-i") {
+            interactive = true;
+        } else if (arg == "--quiet") {
+            trace = false;
+        } else if (arg == "--trace") {
+            trace = true;
+        } else if (arg == "--engine=interp") {
+            engine = Z16_ENGINE_INTERP;
+        } else if (arg == "--engine=blocks") {
+            engine = Z16_ENGINE_BLOCKS;
+        } else if (arg == "--engine=jit") {
+            engine = Z16_ENGINE_JIT;
+        } else if (arg == "--stats") {
+            stats = true;
+        } else if (arg.rfind("--profile=", 0) == 0) {
+            profilePrefix = arg.substr(10);
+        } else if (arg == "--timing" || arg.rfind("--timing=", 0) == 0) {
+            timingConfig.reset(new z16timingConfig());
+            std::string error;
+            if (arg.size() > 8 && !timingConfig->parse(arg.substr(9), error)) {
+                std::cerr << "Error: --timing: " << error << std::endl;
+                return 1;
+            }
+        } else if (arg.rfind("--listing=", 0) == 0) {
+            listingFile = argv[i] + 10;
+        } else if (arg.rfind("--gfx=", 0) == 0) {
+            gfxOutput = argv[i] + 6;
+        } else if (arg == "--irq") {
+            irq = true;
+        } else if (arg.rfind("--format=", 0) == 0) {
+            static const char* formats[] = {"auto", "bin", "ihex", "verilog", "mem"};
+            auto it = std::find(std::begin(formats), std::end(formats), arg.substr(9));
+            if (it == std::end(formats)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            load.format = (z16imageFormat)(it - std::begin(formats));
+        } else if (arg.rfind("--base=", 0) == 0) {
+            if (!parseAddress(arg.substr(7), load.base)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg.rfind("--entry=", 0) == 0) {
+            uint16_t entry;
+            if (!parseAddress(arg.substr(8), entry)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+            load.entry = entry;
+        } else if (arg.rfind("--gdb=", 0) == 0) {
+            gdbAddress = arg.substr(6);
+        } else if (arg.rfind("--trace-file=", 0) == 0) {
+            traceFile = arg.substr(13);
+            trace = true;
+        } else if (arg == "--record") {
+            recordCapacity = z16recorder::DEFAULT_CAPACITY;
+        } else if (arg.rfind("--record=", 0) == 0) {
+            char* end = nullptr;
+            recordCapacity = std::strtoull(argv[i] + 9, &end, 0);
+            if (recordCapacity == 0 || *end != '\0') {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (filename == nullptr && arg[0] != '-') {
+            filename = argv[i];
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (filename == nullptr) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (engine == Z16_ENGINE_JIT && !z16jit::available()) {
+        std::cerr << "Warning: no JIT backend for this host, using the block engine." << std::endl;
+        engine = Z16_ENGINE_BLOCKS;
+    }
+
+    z16sim simulator; // Create an instance of the simulator
+    simulator.setEngine(engine);
+
+    std::unique_ptr<z16profiler> profiler;
+    z16listing listing;
+    if (!profilePrefix.empty()) {
+        if (listingFile && !listing.load(listingFile, std::cerr)) {
+            return 1;
+        }
+        profiler.reset(new z16profiler());
+        simulator.setProfiler(profiler.get());
+    }
+
+    std::unique_ptr<z16timing> timing;
+    if (timingConfig) {
+        timing.reset(new z16timing(*timingConfig));
+        simulator.setTimingModel(timing.get());
+    }
+
+    std::unique_ptr<z16tileDevice> gfx;
+    if (gfxOutput) {
+        gfx.reset(new z16tileDevice());
+        if (!gfx->openOutput(gfxOutput, std::cerr)) {
+            return 1;
+        }
+        gfx->attach(simulator);
+    }
+    z16interruptController intc;
+    z16timer timers;
+    if (irq) {
+        intc.attach(simulator);
+        timers.attach(simulator);
+    }
+
+    // Load the machine code binary from the specified file
+    if (!simulator.loadImage(filename, load)) {
+        return 1;
+    }
+
+    z16traceWriter traceWriter;
+    if (!traceFile.empty()) {
+        if (!traceWriter.open(traceFile, std::cerr)) {
+            return 1;
+        }
+        simulator.setTraceWriter(&traceWriter);
+    }
+
+    std::unique_ptr<z16recorder> recorder;
+    if (recordCapacity) {
+        recorder.reset(new z16recorder(recordCapacity));
+        simulator.setRecorder(recorder.get());
+    }
+
+    if (!gdbAddress.empty()) {
+        z16gdbStub stub(simulator);
+        if (!stub.listen(gdbAddress, std::cerr)) {
+            return 1;
+        }
+        stub.serve();
+    } else if (interactive) {
+        std::cout << "Interactive mode enabled. Press ENTER to execute next instruction, 'q' then ENTER to quit." << std::endl;
+        std::cout << "'c' runs to the next breakpoint or watchpoint, 'b ADDR' toggles a breakpoint and" << std::endl;
+        std::cout << "'w ADDR' toggles a write watchpoint on the word at ADDR." << std::endl;
+        if (recorder) {
+            std::cout << "'rs' steps back, 'rc' runs back to the previous breakpoint or watchpoint and" << std::endl;
+            std::cout << "'who ADDR' shows the last instruction that wrote ADDR." << std::endl;
+        }
+        std::cout << "Initial state:" << std::endl;
+        simulator.dumpRegisters();
+        std::cout << "PC: 0x" << std::hex << std::setw(4) << std::setfill('0')
+                  << simulator.getPC() << std::endl;
+        std::cout << std::endl;
+
+        // Interactive simulation
+        while (true) {
+            std::cout << "--- Press ENTER to continue (q then ENTER to quit): ";
+            std::cout.flush();
+
+            std::string line;
+            std::getline(std::cin, line); // Read the whole line; at end of input, step until the program stops
+
+            if (line == "q" || line == "Q") {
+                std::cout << "Simulation terminated by user." << std::endl;
+                break;
+            }
+            if (line.size() > 2 && (line[0] == 'b' || line[0] == 'w') && line[1] == ' ') {
+                uint16_t addr;
+                if (!parseAddress(line.substr(2), addr)) {
+                    std::cout << "Bad address " << line.substr(2) << std::endl;
+                } else if (line[0] == 'b') {
+                    simulator.setBreakpoint(addr, !simulator.isBreakpoint(addr));
+                    std::cout << "Breakpoint at 0x" << std::hex << addr << (simulator.isBreakpoint(addr) ? " set" : " cleared") << std::endl;
+                } else {
+                    bool watched = !simulator.isWatched(addr & ~1, Z16_WATCH_WRITE);
+                    simulator.setWatchpoint(addr & ~1, 2, Z16_WATCH_WRITE, watched);
+                    std::cout << "Write watchpoint at 0x" << std::hex << (addr & ~1) << (watched ? " set" : " cleared") << std::endl;
+                }
+                continue;
+            }
+            if (recorder && line.rfind("who ", 0) == 0) {
+                uint16_t addr, writer_pc;
+                uint64_t count;
+                if (!parseAddress(line.substr(4), addr)) {
+                    std::cout << "Bad address " << line.substr(4) << std::endl;
+                } else if (simulator.lastWriter(addr, count, writer_pc)) {
+                    uint16_t inst = simulator.getMemory()[writer_pc] | (simulator.getMemory()[writer_pc + 1] << 8);
+                    char disasm_buf[256];
+                    simulator.disassemble(inst, writer_pc, disasm_buf, sizeof(disasm_buf));
+                    std::cout << "0x" << std::hex << addr << " last written by instruction " << std::dec << count
+                              << " at PC: 0x" << std::hex << writer_pc << " | " << disasm_buf << std::endl;
+                } else {
+                    std::cout << "No recorded write to 0x" << std::hex << addr << std::endl;
+                }
+                continue;
+            }
+            if (recorder && (line == "rs" || line == "rc")) {
+                if (line == "rs" ? !simulator.reverseStep() : simulator.reverseContinue() != 5) {
+                    std::cout << "At the start of the recording." << std::endl;
+                } else if (line == "rc") {
+                    z16stopReason why = simulator.getStopReason();
+                    std::cout << (why.kind == Z16_STOP_BREAKPOINT ? "Breakpoint at 0x" : "Watchpoint hit at 0x") << std::hex
+                              << why.addr << std::endl;
+                }
+                simulator.dumpRegisters();
+                std::cout << "PC: 0x" << std::hex << std::setw(4) << std::setfill('0')
+                          << simulator.getPC() << std::endl;
+                std::cout << std::endl;
+                continue;
+            }
+            if (line == "c") {
+                int status;
+                while ((status = simulator.run(UINT64_MAX)) == 0) {
+                }
+                if (status > 1 && recorder && std::cin) {
+                    std::cout << "Stopped by the error above; 'rs' and 'rc' go back from here." << std::endl;
+                    continue;
+                }
+                if (status != 5) {
+                    std::cout << "Simulation terminated by instruction." << std::endl;
+                    break;
+                }
+                z16stopReason why = simulator.getStopReason();
+                std::cout << (why.kind == Z16_STOP_BREAKPOINT ? "Breakpoint at 0x" : "Watchpoint hit at 0x") << std::hex
+                          << why.addr << std::endl;
+                simulator.dumpRegisters();
+                std::cout << "PC: 0x" << std::hex << std::setw(4) << std::setfill('0')
+                          << simulator.getPC() << std::endl;
+                std::cout << std::endl;
+                continue;
+            }
+
+            // Execute one instruction. Under recording an error (which does
+            // not retire) leaves the session open for going back.
+            uint64_t retired = simulator.getInstructionCount();
+            if (!simulator.cycle()) {
+                if (recorder && std::cin && simulator.getInstructionCount() == retired) {
+                    std::cout << "Stopped by the error above; 'rs' and 'rc' go back from here." << std::endl;
+                    continue;
+                }
+                std::cout << "Simulation terminated by instruction." << std::endl;
+                break;
+            }
+
+            // Dump register state
+            simulator.dumpRegisters();
+            std::cout << "PC: 0x" << std::hex << std::setw(4) << std::setfill('0')
+                      << simulator.getPC() << std::endl;
+            std::cout << std::endl;
+        }
+    } else {
+        // Normal simulation mode: run until exit or an error stops it
+        int status;
+        while ((status = simulator.run(UINT64_MAX, trace)) == 0) {
+        }
+        if (status > 1 && recorder) {
+            printHistory(simulator, *recorder, 16);
+        }
+    }
+
+    // Final register state
+    std::cout << "\n--- Final State ---" << std::endl;
+    simulator.dumpRegisters();
+    std::cout << "PC: 0x" << std::hex << std::setw(4) << std::setfill('0')
+              << simulator.getPC() << std::endl;
+    std::cout << "---------------------\n" << std::endl;
+
+    if (stats) {
+        z16blockStats block_stats = simulator.getBlockStats();
+        std::cout << std::dec << "Instructions retired: " << simulator.getInstructionCount() << std::endl;
+        std::cout << "Blocks built: " << block_stats.built << ", cache hits: " << block_stats.hits
+                  << " (chained: " << block_stats.chained << "), invalidations: " << block_stats.invalidations
+                  << ", translated: " << block_stats.translated << " (JIT buffer flushes: " << block_stats.jitFlushes
+                  << ", failures: " << block_stats.jitFailures << ")"
+                  << ", fast-forwarded: " << block_stats.fastForwarded << std::endl;
+        if (gfx) {
+            std::cout << "Frames presented: " << gfx->getFrameCount() << ", cells rendered: " << gfx->getCellsRendered() << std::endl;
+        }
+        std::cout << std::endl;
+    }
+
+    if (timing) {
+        std::cout << "--- Timing ---" << std::endl;
+        timing->writeReport(std::cout);
+        std::cout << std::endl;
+    }
+
+    if (traceWriter.isOpen()) {
+        if (!traceWriter.close(std::cerr)) {
+            return 1;
+        }
+        std::cout << std::dec << "Trace of " << traceWriter.getRecordCount() << " instructions written to " << traceFile << std::endl;
+    }
+
+    if (profiler) {
+        std::ofstream report(profilePrefix + ".prof");
+        std::ofstream folded(profilePrefix + ".folded");
+        if (!report || !folded) {
+            std::cerr << "Error: Could not write " << profilePrefix << ".prof / .folded" << std::endl;
+            return 1;
+        }
+        const z16listing* mapping = listingFile ? &listing : nullptr;
+        profiler->writeReport(report, simulator, mapping);
+        profiler->writeFolded(folded, mapping);
+        std::cout << "Profile written to " << profilePrefix << ".prof and " << profilePrefix << ".folded" << std::endl;
+    }
+
+    std::cout << "Simulation finished." << std::endl;
+    return 0;
+}
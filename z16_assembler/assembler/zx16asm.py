@@ -825,7 +825,7 @@ class ZX16Assembler:
                     else:
                         self.current_address += 4  # Expands to LI16 (LUI + ORI)
                 elif mnemonic in parser.pseudo_instructions:
-                    if mnemonic in ['li16', 'neg']:
+                    if mnemonic in ['li16', 'la', 'push', 'pop', 'neg']:
                         self.current_address += 4  # Expands to 2 instructions
                     else:
                         self.current_address += 2  # Most expand to 1 instruction
@@ -0,0 +1,289 @@
+// zx16_aot: ahead-of-time recompiler from a ZX16 memory image to C++.
+//
+// Every statically recovered basic block becomes a labelled region of one
+// function, with guest registers held in locals. Direct branches and jumps
+// are gotos; jr/jalr targets go through a switch over all block starts.
+// Anything the recompiled code cannot handle itself (ecall, invalid
+// encodings, faulting accesses, code that was not recovered) is handed to
+// z16sim one instruction at a time, and a store that rewrites recovered code
+// hands the rest of the run to the interpreter. Like the default z16sim bus,
+// the generated code treats all of memory as RAM.
+
+#include "z16sim.h"
+#include "z16cfg.h"
+#include "z16decode.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// FNV-1a over the loaded memory, used to check the generated program is run
+// against the image it was built from
+static uint64_t imageHash(const unsigned char* memory) {
+    uint64_t h = 1469598103934665603ULL;
+    for (int i = 0; i < z16sim::MEM_SIZE; ++i) {
+        h = (h ^ memory[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+static std::string hex4(uint16_t v) {
+    char buf[8];
+    std::snprintf(buf, sizeof(buf), "0x%04X", v);
+    return buf;
+}
+
+// Name of the local holding register n in the generated code
+static std::string reg(int n) {
+    std::string name = "x";
+    name += (char)('0' + n);
+    return name;
+}
+
+static std::string label(uint16_t pc) {
+    char buf[8];
+    std::snprintf(buf, sizeof(buf), "L_%04X", pc);
+    return buf;
+}
+
+class aotEmitter {
+public:
+    aotEmitter(z16sim& sim, const z16cfg& cfg, std::ostream& out) : sim(sim), cfg(cfg), out(out) {}
+
+    void emit(const std::string& input) {
+        const unsigned char* memory = sim.getMemory();
+        out << "// Generated by zx16_aot from " << input << ". Build it against the simulator core library:\n"
+            << "//   c++ -O2 -std=c++20 -I<zx16-simulator> <this file> <build dir>/libzx16.a\n"
+            << "// and run it with the same image: ./program " << input << "\n\n"
+            << "#include \"z16sim.h\"\n#include <cstdint>\n#include <iomanip>\n#include <iostream>\n\n";
+
+        out << "static const uint64_t IMAGE_HASH = 0x" << std::hex << imageHash(memory) << std::dec << "ULL;\n\n";
+
+        // Bitmap of recovered code bytes, for the self-modifying-code check
+        out << "static const uint8_t CODE_MAP[8192] = {";
+        for (int i = 0; i < 8192; ++i) {
+            uint8_t bits = 0;
+            for (int b = 0; b < 8; ++b) {
+                bits |= cfg.code[i * 8 + b] ? (1 << b) : 0;
+            }
+            out << (i % 32 == 0 ? "\n    " : "") << (int)bits << ",";
+        }
+        out << "\n};\n\n"
+            << "static inline bool isCode(uint16_t a) { return (CODE_MAP[a >> 3] >> (a & 7)) & 1; }\n\n"
+            << "static uint64_t imageHash(const unsigned char* memory) {\n"
+            << "    uint64_t h = 1469598103934665603ULL;\n"
+            << "    for (int i = 0; i < z16sim::MEM_SIZE; ++i) h = (h ^ memory[i]) * 1099511628211ULL;\n"
+            << "    return h;\n}\n\n";
+
+        emitRun();
+        emitMain();
+    }
+
+private:
+    z16sim& sim;
+    const z16cfg& cfg;
+    std::ostream& out;
+
+    // Transfer control to a constant PC
+    std::string jumpTo(uint16_t target) {
+        if (cfg.blocks.count(target)) {
+            return "goto " + label(target) + ";";
+        }
+        return "pc = " + hex4(target) + "; goto dispatch;";
+    }
+
+    void emitRun() {
+        out << "// Runs until an ecall or error stops the program; returns the z16sim::run() status\n"
+            << "static int runNative(z16sim& sim) {\n"
+            << "    unsigned char* mem = sim.getMemory();\n"
+            << "    uint16_t x0 = sim.getReg(0), x1 = sim.getReg(1), x2 = sim.getReg(2), x3 = sim.getReg(3);\n"
+            << "    uint16_t x4 = sim.getReg(4), x5 = sim.getReg(5), x6 = sim.getReg(6), x7 = sim.getReg(7);\n"
+            << "    uint16_t pc = sim.getPC();\n"
+            << "    int status;\n\n"
+            << "#define SYNC_OUT() (sim.setReg(0, x0), sim.setReg(1, x1), sim.setReg(2, x2), sim.setReg(3, x3), \\\n"
+            << "                   sim.setReg(4, x4), sim.setReg(5, x5), sim.setReg(6, x6), sim.setReg(7, x7), sim.setPC(pc))\n"
+            << "#define SYNC_IN() (x0 = sim.getReg(0), x1 = sim.getReg(1), x2 = sim.getReg(2), x3 = sim.getReg(3), \\\n"
+            << "                  x4 = sim.getReg(4), x5 = sim.getReg(5), x6 = sim.getReg(6), x7 = sim.getReg(7), pc = sim.getPC())\n\n"
+            << "dispatch:\n    switch (pc) {\n";
+        for (const auto& entry : cfg.blocks) {
+            out << "        case " << hex4(entry.first) << ": goto " << label(entry.first) << ";\n";
+        }
+        out << "        default: break;\n    }\n"
+            << "interpret: // Not recovered code, or something only the interpreter handles\n"
+            << "    SYNC_OUT();\n"
+            << "    status = sim.run(1);\n"
+            << "    if (status != 0) return status;\n"
+            << "    SYNC_IN();\n"
+            << "    goto dispatch;\n"
+            << "stale: // A store rewrote recovered code\n"
+            << "    SYNC_OUT();\n"
+            << "    return sim.run(UINT64_MAX);\n\n";
+
+        for (const auto& entry : cfg.blocks) {
+            emitBlock(entry.second);
+        }
+        out << "#undef SYNC_OUT\n#undef SYNC_IN\n}\n\n";
+    }
+
+    void emitBlock(const z16cfgBlock& block) {
+        const unsigned char* memory = sim.getMemory();
+        out << label(block.start) << ":\n";
+        uint16_t pc = block.start;
+        for (int i = 0; i < block.count; ++i, pc += 2) {
+            uint16_t inst = z16cfg::fetch(memory, pc);
+            const z16decoded& d = z16decodeTable[inst];
+            char disasm[64];
+            z16sim::disassemble(inst, pc, disasm, sizeof(disasm));
+            out << "    // " << hex4(pc) << ": " << disasm << "\n    ";
+            emitInstruction(d, pc);
+            out << "\n";
+        }
+        const z16decoded& last = z16decodeTable[z16cfg::fetch(memory, (uint16_t)(pc - 2))];
+        if (!z16cfg::endsBlock(last.op)) {
+            out << "    " << jumpTo(pc) << "\n"; // Fall through into the next leader
+        }
+        out << "\n";
+    }
+
+    void emitInstruction(const z16decoded& d, uint16_t pc) {
+        std::string rd = reg(d.rd);
+        std::string rs = reg(d.rs2);
+        std::string imm = "(int16_t)" + std::to_string(d.imm);
+        std::string uimm = "(uint16_t)" + hex4((uint16_t)d.imm);
+        uint16_t next = pc + 2;
+
+        switch (d.op) {
+            case Z16_ADD:  out << rd << " = (uint16_t)(" << rd << " + " << rs << ");"; break;
+            case Z16_SUB:  out << rd << " = (uint16_t)(" << rd << " - " << rs << ");"; break;
+            case Z16_SLT:  out << rd << " = (int16_t)" << rd << " < (int16_t)" << rs << ";"; break;
+            case Z16_SLTU: out << rd << " = " << rd << " < " << rs << ";"; break;
+            case Z16_SLL:  out << rd << " = (uint16_t)(" << rd << " << (" << rs << " & 0xF));"; break;
+            case Z16_SRL:  out << rd << " = (uint16_t)(" << rd << " >> (" << rs << " & 0xF));"; break;
+            case Z16_SRA:  out << rd << " = (uint16_t)((int16_t)" << rd << " >> (" << rs << " & 0xF));"; break;
+            case Z16_OR:   out << rd << " = " << rd << " | " << rs << ";"; break;
+            case Z16_AND:  out << rd << " = " << rd << " & " << rs << ";"; break;
+            case Z16_XOR:  out << rd << " = " << rd << " ^ " << rs << ";"; break;
+            case Z16_MV:   out << rd << " = " << rs << ";"; break;
+            case Z16_JR:   out << "pc = " << rd << "; goto dispatch;"; break;
+            case Z16_JALR: out << rd << " = " << hex4(next) << "; pc = " << rs << "; goto dispatch;"; break;
+
+            case Z16_ADDI:  out << rd << " = (uint16_t)(" << rd << " + " << imm << ");"; break;
+            case Z16_SLTI:  out << rd << " = (int16_t)" << rd << " < " << imm << ";"; break;
+            case Z16_SLTUI: out << rd << " = " << rd << " < " << uimm << ";"; break;
+            case Z16_SLLI:  out << rd << " = (uint16_t)(" << rd << " << " << d.imm << ");"; break;
+            case Z16_SRLI:  out << rd << " = (uint16_t)(" << rd << " >> " << d.imm << ");"; break;
+            case Z16_SRAI:  out << rd << " = (uint16_t)((int16_t)" << rd << " >> " << d.imm << ");"; break;
+            case Z16_ORI:   out << rd << " = " << rd << " | " << uimm << ";"; break;
+            case Z16_ANDI:  out << rd << " = " << rd << " & " << uimm << ";"; break;
+            case Z16_XORI:  out << rd << " = " << rd << " ^ " << uimm << ";"; break;
+            case Z16_LI:
+            case Z16_LUI:   out << rd << " = " << uimm << ";"; break;
+            case Z16_AUIPC: out << rd << " = " << hex4((uint16_t)(pc + d.imm)) << ";"; break;
+
+            case Z16_BEQ: case Z16_BNE: case Z16_BZ: case Z16_BNZ:
+            case Z16_BLT: case Z16_BGE: case Z16_BLTU: case Z16_BGEU: {
+                static const char* cond[8] = {"%s == %s", "%s != %s", "%s == 0", "%s != 0",
+                                              "(int16_t)%s < (int16_t)%s", "(int16_t)%s >= (int16_t)%s",
+                                              "%s < %s", "%s >= %s"};
+                char buf[64];
+                std::snprintf(buf, sizeof(buf), cond[d.op - Z16_BEQ], rd.c_str(), rs.c_str());
+                out << "if (" << buf << ") { " << jumpTo(pc + d.imm) << " } " << jumpTo(next);
+                break;
+            }
+
+            case Z16_SB:
+                out << "{ uint16_t a = " << rd << " + " << imm << "; mem[a] = (uint8_t)" << rs
+                    << "; if (isCode(a)) { pc = " << hex4(next) << "; goto stale; } }";
+                break;
+            case Z16_SW:
+                out << "{ uint16_t a = " << rd << " + " << imm << "; if (a & 1) { pc = " << hex4(pc)
+                    << "; goto interpret; } mem[a] = (uint8_t)" << rs << "; mem[a + 1] = (uint8_t)(" << rs
+                    << " >> 8); if (isCode(a) || isCode(a + 1)) { pc = " << hex4(next) << "; goto stale; } }";
+                break;
+            case Z16_LB:
+                out << "{ uint16_t a = " << rs << " + " << imm << "; " << rd << " = (uint16_t)(int8_t)mem[a]; }";
+                break;
+            case Z16_LW:
+                out << "{ uint16_t a = " << rs << " + " << imm << "; if (a & 1) { pc = " << hex4(pc)
+                    << "; goto interpret; } " << rd << " = (uint16_t)(mem[a] | (mem[a + 1] << 8)); }";
+                break;
+            case Z16_LBU:
+                out << "{ uint16_t a = " << rs << " + " << imm << "; " << rd << " = mem[a]; }";
+                break;
+
+            case Z16_JAL:
+                out << rd << " = " << hex4(next) << "; ";
+                [[fallthrough]];
+            case Z16_J:
+                out << jumpTo(pc + d.imm);
+                break;
+
+            default: // ecall and invalid encodings
+                out << "pc = " << hex4(pc) << "; goto interpret;";
+                break;
+        }
+    }
+
+    void emitMain() {
+        out << "int main(int argc, char* argv[]) {\n"
+            << "    if (argc != 2) {\n"
+            << "        std::cerr << \"Usage: \" << argv[0] << \" <machine_code_file_name.bin>\" << std::endl;\n"
+            << "        return 1;\n    }\n\n"
+            << "    z16sim simulator;\n"
+            << "    if (!simulator.loadMemoryFromFile(argv[1])) {\n        return 1;\n    }\n"
+            << "    if (imageHash(simulator.getMemory()) == IMAGE_HASH) {\n"
+            << "        runNative(simulator);\n"
+            << "    } else {\n"
+            << "        std::cerr << \"Warning: \" << argv[1] << \" is not the recompiled image, interpreting it instead.\" << std::endl;\n"
+            << "        while (simulator.run(UINT64_MAX) == 0) {\n        }\n"
+            << "    }\n\n"
+            << "    std::cout << \"\\n--- Final State ---\" << std::endl;\n"
+            << "    simulator.dumpRegisters();\n"
+            << "    std::cout << \"PC: 0x\" << std::hex << std::setw(4) << std::setfill('0')\n"
+            << "              << simulator.getPC() << std::endl;\n"
+            << "    std::cout << \"---------------------\\n\" << std::endl;\n\n"
+            << "    std::cout << \"Simulation finished.\" << std::endl;\n"
+            << "    return 0;\n}\n";
+    }
+};
+
+static void printUsage(const char* progName) {
+    std::cerr << "Usage: " << progName << " [-e <entry_pc>]... <machine_code_file_name.bin> <output.cpp>" << std::endl;
+    std::cerr << "  -e: Extra entry point for control-flow recovery (0x0000 is always one)" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<uint16_t> entries = {0x0000};
+    std::vector<const char*> files;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "-e" && i + 1 < argc) {
+            entries.push_back((uint16_t)std::strtoul(argv[++i], nullptr, 0));
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+    if (files.size() != 2) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    z16sim sim;
+    if (!sim.loadMemoryFromFile(files[0])) {
+        return 1;
+    }
+
+    z16cfg cfg;
+    cfg.recover(sim.getMemory(), entries);
+
+    std::ofstream out(files[1]);
+    if (!out) {
+        std::cerr << "Error: Could not open " << files[1] << " for writing" << std::endl;
+        return 1;
+    }
+    aotEmitter(sim, cfg, out).emit(files[0]);
+    std::cout << "Recompiled " << cfg.blocks.size() << " blocks into " << files[1] << std::endl;
+    return 0;
+}
@@ -0,0 +1,282 @@
+// zx16_batch: runs many independent ZX16 programs in parallel and writes one
+// JSON report. Each worker thread owns a z16sim and a deque of jobs; idle
+// workers steal from the back of other workers' deques. Everything a program
+// prints is captured per job instead of going to the console.
+
+#include "z16sim.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct batchJob {
+    std::string path;
+
+    // Filled in by the worker that runs the job
+    std::string reason;
+    int status = 0;
+    uint16_t regs[z16sim::NUM_REGS] = {0};
+    uint16_t pc = 0;
+    uint64_t retired = 0;
+    double wall_ms = 0;
+    std::string output;
+};
+
+struct batchOptions {
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    uint64_t budget = 100000000; // Instructions per program
+    double timeout = 10.0;       // Wall-clock seconds per program
+    z16engine engine = Z16_ENGINE_BLOCKS;
+};
+
+// One worker's share of the jobs
+struct batchQueue {
+    std::mutex lock;
+    std::deque<size_t> jobs;
+};
+
+class batchRunner {
+public:
+    batchRunner(std::vector<batchJob>& jobs, const batchOptions& options)
+        : jobs(jobs), options(options), queues(options.threads) {
+        for (size_t i = 0; i < jobs.size(); ++i) {
+            queues[i % queues.size()].jobs.push_back(i);
+        }
+    }
+
+    void run() {
+        std::vector<std::thread> workers;
+        for (unsigned id = 0; id < options.threads; ++id) {
+            workers.emplace_back(&batchRunner::worker, this, id);
+        }
+        for (std::thread& t : workers) {
+            t.join();
+        }
+    }
+
+private:
+    // Slice of the budget run between timeout checks
+    static const uint64_t SLICE = 1 << 20;
+
+    std::vector<batchJob>& jobs;
+    const batchOptions& options;
+    std::vector<batchQueue> queues;
+
+    // Own work from the front, stolen work from the back of a victim's deque.
+    // No jobs are added once workers start, so a full empty pass means done.
+    bool nextJob(unsigned id, size_t& job) {
+        for (size_t k = 0; k < queues.size(); ++k) {
+            batchQueue& q = queues[(id + k) % queues.size()];
+            std::lock_guard<std::mutex> guard(q.lock);
+            if (!q.jobs.empty()) {
+                if (k == 0) {
+                    job = q.jobs.front();
+                    q.jobs.pop_front();
+                } else {
+                    job = q.jobs.back();
+                    q.jobs.pop_back();
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void worker(unsigned id) {
+        std::unique_ptr<z16sim> sim(new z16sim());
+        sim->setEngine(options.engine);
+        z16snapshot clean = sim->snapshot();
+
+        size_t index;
+        while (nextJob(id, index)) {
+            batchJob& job = jobs[index];
+            z16bufferSink output;
+            std::istringstream input; // Programs that read the console get end of input
+            sim->setSink(&output);
+            sim->setInput(input);
+            sim->restore(clean);
+            auto start = std::chrono::steady_clock::now();
+
+            if (!sim->loadMemoryFromFile(job.path.c_str())) {
+                job.reason = "load-error"; // The reason is in the job's output
+                job.status = -1;
+            } else {
+                job.reason = "budget";
+                uint64_t left = options.budget;
+                while (left > 0) {
+                    uint64_t slice = std::min(left, (uint64_t)SLICE);
+                    job.status = sim->run(slice);
+                    left -= slice; // Status 0 means the whole slice ran
+                    if (job.status != 0) {
+                        static const char* reasons[] = {"budget", "halt", "illegal-instruction", "pc-fault", "memory-fault"};
+                        job.reason = job.status < 5 ? reasons[job.status] : "error";
+                        break;
+                    }
+                    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                    if (left > 0 && elapsed.count() > options.timeout) {
+                        job.reason = "timeout";
+                        break;
+                    }
+                }
+            }
+
+            sim->flushConsole(); // Output still buffered when the budget or timeout hit
+            job.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            for (int r = 0; r < z16sim::NUM_REGS; ++r) {
+                job.regs[r] = sim->getReg(r);
+            }
+            job.pc = sim->getPC();
+            job.retired = sim->getInstructionCount();
+            job.output = output.str();
+        }
+        sim->setSink(nullptr);
+        sim->setInput(std::cin);
+    }
+};
+
+static std::string jsonString(const std::string& s) {
+    std::string out = "\"";
+    for (unsigned char c : s) {
+        switch (c) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20 || c >= 0x7F) {
+                    char buf[8];
+                    std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                    out += buf;
+                } else {
+                    out += (char)c;
+                }
+        }
+    }
+    return out + "\"";
+}
+
+static void writeReport(std::ostream& os, const std::vector<batchJob>& jobs, const batchOptions& options, double wall_ms) {
+    os << "{\n  \"threads\": " << options.threads << ",\n  \"budget\": " << options.budget
+       << ",\n  \"wall_ms\": " << wall_ms << ",\n  \"jobs\": [";
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const batchJob& job = jobs[i];
+        os << (i ? "," : "") << "\n    {\"file\": " << jsonString(job.path)
+           << ", \"reason\": \"" << job.reason << "\", \"status\": " << job.status << ", \"regs\": [";
+        for (int r = 0; r < z16sim::NUM_REGS; ++r) {
+            os << (r ? ", " : "") << job.regs[r];
+        }
+        os << "], \"pc\": " << job.pc << ", \"retired\": " << job.retired << ", \"wall_ms\": " << job.wall_ms
+           << ", \"output\": " << jsonString(job.output) << "}";
+    }
+    os << "\n  ]\n}\n";
+}
+
+// A directory contributes its *.bin files, anything else is a manifest with
+// one path per line (relative to the manifest; blank lines and # comments skipped)
+static bool collectJobs(const std::string& arg, std::vector<batchJob>& jobs) {
+    namespace fs = std::filesystem;
+    std::vector<std::string> paths;
+    if (fs::is_directory(arg)) {
+        for (const fs::directory_entry& entry : fs::directory_iterator(arg)) {
+            if (entry.is_regular_file() && entry.path().extension() == ".bin") {
+                paths.push_back(entry.path().string());
+            }
+        }
+        std::sort(paths.begin(), paths.end());
+    } else {
+        std::ifstream manifest(arg);
+        if (!manifest) {
+            std::cerr << "Error: Could not open " << arg << std::endl;
+            return false;
+        }
+        fs::path base = fs::path(arg).parent_path();
+        std::string line;
+        while (std::getline(manifest, line)) {
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            fs::path p(line);
+            paths.push_back(p.is_absolute() ? line : (base / p).string());
+        }
+    }
+    for (const std::string& p : paths) {
+        jobs.push_back(batchJob());
+        jobs.back().path = p;
+    }
+    return true;
+}
+
+static void printUsage(const char* progName) {
+    std::cerr << "Usage: " << progName << " [options] <directory | manifest>..." << std::endl;
+    std::cerr << "  --jobs=N: Worker threads (default: all hardware threads)" << std::endl;
+    std::cerr << "  --budget=N: Instruction budget per program (default 100000000)" << std::endl;
+    std::cerr << "  --timeout=SEC: Wall-clock limit per program (default 10)" << std::endl;
+    std::cerr << "  --engine=interp|blocks|jit: Execution engine (default blocks)" << std::endl;
+    std::cerr << "  --report=FILE: Write the JSON report to FILE instead of stdout" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    batchOptions options;
+    std::string reportPath;
+    std::vector<batchJob> jobs;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--jobs=", 0) == 0) {
+            options.threads = std::max(1, std::atoi(arg.c_str() + 7));
+        } else if (arg.rfind("--budget=", 0) == 0) {
+            options.budget = std::strtoull(arg.c_str() + 9, nullptr, 0);
+        } else if (arg.rfind("--timeout=", 0) == 0) {
+            options.timeout = std::atof(arg.c_str() + 10);
+        } else if (arg == "--engine=interp") {
+            options.engine = Z16_ENGINE_INTERP;
+        } else if (arg == "--engine=blocks") {
+            options.engine = Z16_ENGINE_BLOCKS;
+        } else if (arg == "--engine=jit") {
+            options.engine = z16jit::available() ? Z16_ENGINE_JIT : Z16_ENGINE_BLOCKS;
+        } else if (arg.rfind("--report=", 0) == 0) {
+            reportPath = arg.substr(9);
+        } else if (arg[0] == '-') {
+            printUsage(argv[0]);
+            return 1;
+        } else if (!collectJobs(arg, jobs)) {
+            return 1;
+        }
+    }
+    if (jobs.empty()) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    options.threads = std::min<unsigned>(options.threads, jobs.size());
+
+    auto start = std::chrono::steady_clock::now();
+    batchRunner(jobs, options).run();
+    double wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    if (reportPath.empty()) {
+        writeReport(std::cout, jobs, options, wall_ms);
+    } else {
+        std::ofstream report(reportPath);
+        if (!report) {
+            std::cerr << "Error: Could not open " << reportPath << " for writing" << std::endl;
+            return 1;
+        }
+        writeReport(report, jobs, options, wall_ms);
+    }
+
+    size_t halted = std::count_if(jobs.begin(), jobs.end(), [](const batchJob& j) { return j.reason == "halt"; });
+    std::cerr << jobs.size() << " programs, " << halted << " halted, " << wall_ms << " ms on "
+              << options.threads << " threads" << std::endl;
+    return 0;
+}
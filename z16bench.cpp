@@ -0,0 +1,405 @@
+// zx16_bench: host-side microbenchmarks for the simulator core.
+//
+// Every benchmark is run --repeat times after one warm-up; each sample keeps
+// going until --min-time has passed and is reported per operation (an
+// instruction, a fetch, a formatted line, ...). The table shows the median,
+// min and relative standard deviation; --json writes the same numbers for
+// tracking across commits.
+
+#include "z16sim.h"
+#include "z16decode.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct benchResult {
+    std::string name;
+    std::vector<double> ns; // Per-operation time of each sample
+    double median = 0, min = 0, mean = 0, stddev = 0;
+};
+
+struct benchOptions {
+    int repeat = 10;
+    double min_ms = 50;
+    std::string filter;
+    std::string json;
+};
+
+static std::ostream nullStream(nullptr); // Discards simulator messages
+static volatile uint32_t benchSink;      // Keeps host-side loops from being optimized out
+
+// Runs body (which returns the operations it performed) until min_ms has
+// passed, repeat times, and summarizes ns per operation
+static benchResult measure(const std::string& name, const benchOptions& options, const std::function<uint64_t()>& body) {
+    typedef std::chrono::steady_clock clock;
+    benchResult result;
+    result.name = name;
+    body(); // Warm-up: caches, block translation, page faults
+
+    for (int rep = 0; rep < options.repeat; ++rep) {
+        uint64_t ops = 0;
+        clock::time_point start = clock::now();
+        double elapsed_ns = 0;
+        do {
+            ops += body();
+            elapsed_ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+        } while (elapsed_ns < options.min_ms * 1e6);
+        result.ns.push_back(elapsed_ns / (double)std::max<uint64_t>(ops, 1));
+    }
+
+    std::vector<double> sorted = result.ns;
+    std::sort(sorted.begin(), sorted.end());
+    size_t n = sorted.size();
+    result.median = n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+    result.min = sorted[0];
+    for (double v : sorted) {
+        result.mean += v / n;
+    }
+    for (double v : sorted) {
+        result.stddev += (v - result.mean) * (v - result.mean) / n;
+    }
+    result.stddev = std::sqrt(result.stddev);
+    return result;
+}
+
+// Minimal encoder for the guest programs. Branch offsets follow the
+// simulator: B-type target = pc + 2 + 4 * imm, J-type target = pc + imm.
+class benchProgram {
+public:
+    std::vector<uint16_t> code;
+
+    uint16_t here() const { return (uint16_t)(code.size() * 2); }
+    void emit(uint16_t inst) { code.push_back(inst); }
+
+    void R(int funct4, int funct3, int rd, int rs2) { emit((funct4 << 12) | (rs2 << 9) | (rd << 6) | (funct3 << 3)); }
+    void I(int funct3, int rd, int imm) { emit(((imm & 0x7F) << 9) | (rd << 6) | (funct3 << 3) | 0x1); }
+    void S(int funct3, int rs2, int off, int base) { emit(((off & 0xF) << 12) | (rs2 << 9) | (base << 6) | (funct3 << 3) | 0x3); }
+    void L(int funct3, int rd, int off, int base) { emit(((off & 0xF) << 12) | (base << 9) | (rd << 6) | (funct3 << 3) | 0x4); }
+    void lui(int rd, int u) { emit((((u >> 3) & 0x3F) << 9) | (rd << 6) | ((u & 0x7) << 3) | 0x6); }
+    void ecall(int svc) { emit((svc << 6) | 0x7); }
+    void nop() { I(0, 0, 0); } // addi x0, 0
+
+    // Forward branch over the next 2 * words instructions
+    void branchSkip(int funct3, int rs1, int rs2, int words) {
+        emit(((words & 0xF) << 12) | (rs2 << 9) | (rs1 << 6) | (funct3 << 3) | 0x2);
+    }
+    void jump(bool link, int rd, uint16_t target) {
+        int off = (target - here()) & 0x3FF;
+        emit(((link ? 1 : 0) << 15) | (((off >> 4) & 0x3F) << 9) | (rd << 6) | (((off >> 1) & 0x7) << 3) | 0x5);
+    }
+    // bnz reg, target for a backward target. Pads with a nop when the
+    // distance is not a multiple of 4, and goes through a j when it is out
+    // of B-type range.
+    void loopBack(int reg, uint16_t target) {
+        if ((here() - target) % 4 == 0) {
+            nop();
+        }
+        int s = (target - here() - 2) / 4;
+        if (s >= -8) {
+            branchSkip(B_BNZ, reg, 0, s);
+        } else {
+            branchSkip(B_BZ, reg, 0, 1); // Over the j and its pad
+            jump(false, 0, target);
+            nop();
+        }
+    }
+
+    enum { B_BZ = 2, B_BNZ = 3, B_BLT = 4 };
+};
+
+enum { F_ADD = 0, F_SUB = 1, F_SLTU = 3, F_OR = 7, F_AND = 8, F_XOR = 9, F_MV = 10, F_JR = 11 };
+enum { B_BZ = benchProgram::B_BZ, B_BNZ = benchProgram::B_BNZ, B_BLT = benchProgram::B_BLT };
+
+// Guest loops. x0 counts outer iterations, x7 inner ones; each ends with ecall 0x3FF.
+static benchProgram arithmeticLoop() {
+    benchProgram p;
+    p.lui(0, 1); // 256 outer iterations
+    uint16_t outer = p.here();
+    p.lui(7, 1); // 256 inner iterations
+    uint16_t inner = p.here();
+    p.R(F_ADD, 0, 1, 2);
+    p.R(F_XOR, 6, 3, 1);
+    p.I(0, 2, 3);
+    p.I(3, 3, 0x10 | 1); // slli x3, 1
+    p.R(F_SUB, 0, 4, 3);
+    p.R(F_OR, 4, 5, 4);
+    p.R(F_SLTU, 2, 6, 1);
+    p.I(0, 7, -1);
+    p.loopBack(7, inner);
+    p.I(0, 0, -1);
+    p.loopBack(0, outer);
+    p.ecall(0x3FF);
+    return p;
+}
+
+static benchProgram branchLoop() {
+    benchProgram p;
+    p.lui(0, 1);
+    uint16_t outer = p.here();
+    p.lui(7, 1);
+    uint16_t inner = p.here();
+    p.I(0, 1, 1);         // x1++
+    p.R(F_MV, 7, 2, 1);
+    p.I(5, 2, 1);         // andi x2, 1
+    p.branchSkip(B_BZ, 2, 0, 1);
+    p.I(0, 3, 1);         // Odd iterations: x3++
+    p.nop();
+    p.R(F_MV, 7, 4, 1);
+    p.I(5, 4, 6);         // andi x4, 6
+    p.branchSkip(B_BNZ, 4, 0, 1);
+    p.I(0, 5, 1);         // Every fourth pair: x5++
+    p.nop();
+    p.branchSkip(B_BLT, 5, 3, 1);
+    p.I(0, 6, 1);
+    p.nop();
+    p.I(0, 7, -1);
+    p.loopBack(7, inner);
+    p.I(0, 0, -1);
+    p.loopBack(0, outer);
+    p.ecall(0x3FF);
+    return p;
+}
+
+static benchProgram memoryLoop() {
+    benchProgram p;
+    p.lui(6, 0x40); // Data at 0x4000
+    p.lui(0, 1);
+    uint16_t outer = p.here();
+    p.lui(7, 1);
+    uint16_t inner = p.here();
+    p.L(1, 1, 0, 6);  // lw x1, 0(x6)
+    p.I(0, 1, 1);
+    p.S(1, 1, 0, 6);  // sw x1, 0(x6)
+    p.L(0, 2, 2, 6);  // lb x2, 2(x6)
+    p.S(0, 2, 3, 6);  // sb x2, 3(x6)
+    p.L(1, 3, 4, 6);  // lw x3, 4(x6)
+    p.R(F_ADD, 0, 3, 1);
+    p.S(1, 3, 4, 6);  // sw x3, 4(x6)
+    p.L(4, 4, 5, 6);  // lbu x4, 5(x6)
+    p.I(0, 7, -1);
+    p.loopBack(7, inner);
+    p.I(0, 0, -1);
+    p.loopBack(0, outer);
+    p.ecall(0x3FF);
+    return p;
+}
+
+static benchProgram callLoop() {
+    benchProgram p;
+    p.lui(0, 1);
+    uint16_t outer = p.here();
+    p.lui(7, 1);
+    uint16_t inner = p.here();
+    size_t call = p.code.size();
+    p.nop(); // Patched below to jal x1, leaf
+    p.I(0, 3, 1);
+    p.I(0, 7, -1);
+    p.loopBack(7, inner);
+    p.I(0, 0, -1);
+    p.loopBack(0, outer);
+    p.ecall(0x3FF);
+    uint16_t leaf = p.here();
+    p.I(0, 2, 1);
+    p.R(F_ADD, 0, 4, 2);
+    p.R(F_JR, 0, 1, 0); // jr x1
+
+    benchProgram patch;
+    patch.code.resize(call);
+    patch.jump(true, 1, leaf);
+    p.code[call] = patch.code.back();
+    return p;
+}
+
+static void printResult(const benchResult& r) {
+    std::printf("%-34s %10.3f %10.3f %9.1f %7.2f%%\n", r.name.c_str(), r.median, r.min, 1000.0 / r.median,
+                r.mean > 0 ? 100.0 * r.stddev / r.mean : 0.0);
+    std::fflush(stdout);
+}
+
+static void writeJson(const std::string& path, const std::vector<benchResult>& results, const benchOptions& options) {
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "Error: Could not open " << path << " for writing" << std::endl;
+        return;
+    }
+    out << "{\n  \"repeat\": " << options.repeat << ",\n  \"min_time_ms\": " << options.min_ms << ",\n  \"benchmarks\": [";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const benchResult& r = results[i];
+        out << (i ? "," : "") << "\n    {\"name\": \"" << r.name << "\", \"ns_per_op\": " << r.median
+            << ", \"ns_per_op_min\": " << r.min << ", \"ns_per_op_mean\": " << r.mean
+            << ", \"ns_per_op_stddev\": " << r.stddev << ", \"mips\": " << 1000.0 / r.median << ", \"samples\": [";
+        for (size_t k = 0; k < r.ns.size(); ++k) {
+            out << (k ? ", " : "") << r.ns[k];
+        }
+        out << "]}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+static void printUsage(const char* progName) {
+    std::cerr << "Usage: " << progName << " [--filter=SUBSTR] [--repeat=N] [--min-time=MS] [--json=FILE]" << std::endl;
+    std::cerr << "  --filter=SUBSTR: Only run benchmarks whose name contains SUBSTR" << std::endl;
+    std::cerr << "  --repeat=N: Samples per benchmark (default 10)" << std::endl;
+    std::cerr << "  --min-time=MS: Minimum duration of each sample (default 50)" << std::endl;
+    std::cerr << "  --json=FILE: Also write the results as JSON" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    benchOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--filter=", 0) == 0) {
+            options.filter = arg.substr(9);
+        } else if (arg.rfind("--repeat=", 0) == 0) {
+            options.repeat = std::max(1, std::atoi(arg.c_str() + 9));
+        } else if (arg.rfind("--min-time=", 0) == 0) {
+            options.min_ms = std::atof(arg.c_str() + 11);
+        } else if (arg.rfind("--json=", 0) == 0) {
+            options.json = arg.substr(7);
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+#ifndef __OPTIMIZE__
+    std::cerr << "Warning: zx16_bench was built without optimization; configure with -DCMAKE_BUILD_TYPE=Release" << std::endl;
+#endif
+
+    std::vector<benchResult> results;
+    auto run = [&](const std::string& name, const std::function<uint64_t()>& body) {
+        if (name.find(options.filter) == std::string::npos) {
+            return;
+        }
+        results.push_back(measure(name, options, body));
+        printResult(results.back());
+    };
+
+    std::printf("%-34s %10s %10s %9s %8s\n", "benchmark", "ns/op", "min ns/op", "Mops/s", "stddev");
+
+    z16sim sim;
+    sim.setOutput(nullStream, nullStream);
+
+    // Instruction fetch from memory[], the way step() does it
+    {
+        unsigned char* mem = sim.getMemory();
+        for (int i = 0; i < z16sim::MEM_SIZE; ++i) {
+            mem[i] = (unsigned char)(i * 131);
+        }
+        run("fetch", [&]() -> uint64_t {
+            uint32_t sum = 0;
+            for (uint32_t pc = 0; pc < z16sim::MEM_SIZE - 1; pc += 2) {
+                sum += (mem[pc + 1] << 8) | mem[pc];
+            }
+            benchSink = sum;
+            return z16sim::MEM_SIZE / 2;
+        });
+    }
+
+    // executeInstruction() dispatch, one representative encoding per class
+    {
+        benchProgram enc;
+        enc.R(F_ADD, 0, 1, 2);
+        enc.I(0, 1, 5);
+        enc.branchSkip(B_BNZ, 2, 0, 0);
+        enc.S(1, 1, 0, 6);
+        enc.L(1, 1, 0, 6);
+        enc.jump(false, 0, 0);
+        enc.lui(1, 0x40);
+        enc.ecall(0x3FF);
+        const char* classes[] = {"R", "I", "B", "S", "L", "J", "U", "SYS"};
+        for (int k = 0; k < 8; ++k) {
+            uint16_t inst = enc.code[k];
+            run(std::string("execute/") + classes[k], [&sim, inst]() -> uint64_t {
+                sim.setReg(6, 0x4000);
+                for (int i = 0; i < 4096; ++i) {
+                    sim.executeInstruction(inst);
+                }
+                return 4096;
+            });
+        }
+    }
+
+    // disassemble() over a spread of encodings
+    {
+        std::vector<uint16_t> insts;
+        for (uint32_t i = 0; i < 65536; i += 61) {
+            insts.push_back((uint16_t)i);
+        }
+        run("disassemble", [&]() -> uint64_t {
+            char buf[64];
+            for (uint16_t inst : insts) {
+                sim.disassemble(inst, 0x100, buf, sizeof(buf));
+            }
+            return insts.size();
+        });
+    }
+
+    // loadMemoryFromFile() of a full 64 KB image, and reset()
+    {
+        std::string path = (std::filesystem::temp_directory_path() / "zx16_bench_image.bin").string();
+        {
+            std::ofstream image(path, std::ios::binary);
+            std::vector<char> bytes(z16sim::MEM_SIZE, 0x11);
+            image.write(bytes.data(), bytes.size());
+        }
+        run("loadMemoryFromFile/64K", [&]() -> uint64_t {
+            sim.loadMemoryFromFile(path.c_str());
+            return 1;
+        });
+        std::remove(path.c_str());
+        run("reset", [&]() -> uint64_t {
+            sim.reset();
+            return 1;
+        });
+    }
+
+    // End-to-end guest loops on every engine; ops are retired instructions
+    {
+        struct { const char* name; benchProgram program; } programs[] = {
+            {"arith", arithmeticLoop()},
+            {"branch", branchLoop()},
+            {"memory", memoryLoop()},
+            {"call", callLoop()},
+        };
+        struct { const char* name; z16engine engine; } engines[] = {
+            {"interp", Z16_ENGINE_INTERP},
+            {"blocks", Z16_ENGINE_BLOCKS},
+            {"jit", Z16_ENGINE_JIT},
+        };
+        for (auto& prog : programs) {
+            for (auto& eng : engines) {
+                if (eng.engine == Z16_ENGINE_JIT && !z16jit::available()) {
+                    continue;
+                }
+                z16sim guest;
+                guest.setOutput(nullStream, nullStream);
+                guest.setEngine(eng.engine);
+                guest.writeMemory(0, prog.program.code.data(), prog.program.code.size() * 2);
+                z16snapshot start = guest.snapshot();
+                run(std::string("guest/") + prog.name + "/" + eng.name, [&]() -> uint64_t {
+                    guest.restore(start);
+                    int status = guest.run(UINT64_MAX);
+                    if (status != 1) {
+                        std::cerr << "Error: guest program " << prog.name << " stopped with status " << status << std::endl;
+                        std::exit(1);
+                    }
+                    return guest.getInstructionCount();
+                });
+            }
+        }
+    }
+
+    if (!options.json.empty()) {
+        writeJson(options.json, results, options);
+    }
+    return 0;
+}
@@ -0,0 +1,292 @@
+#include "z16sim.h"
+#include "z16exec.h"
+#include <algorithm>
+#include <cstring>
+
+// Does this operation end a basic block?
+static bool endsBlock(uint8_t op) {
+    return (op >= Z16_BEQ && op <= Z16_BGEU) || op == Z16_J || op == Z16_JAL ||
+           op == Z16_JR || op == Z16_JALR || op == Z16_ECALL || op == Z16_TRAP;
+}
+
+// getBlockStats method definition
+z16blockStats z16sim::getBlockStats() const {
+    return this->blockCache ? this->blockCache->stats : z16blockStats();
+}
+
+// flushBlockCache method definition: drop every cached block (memory was
+// replaced wholesale), keeping the statistics and the JIT with an emptied
+// code buffer.
+void z16sim::flushBlockCache() {
+    if (!this->blockCache) {
+        return;
+    }
+    z16blockStats stats = this->blockCache->stats;
+    uint32_t epoch = this->blockCache->epoch + 1;
+    std::unique_ptr<z16jit> jit = std::move(this->blockCache->jit);
+    this->blockCache.reset(new z16blockCache());
+    this->blockCache->stats = stats;
+    this->blockCache->epoch = epoch;
+    if (jit) {
+        jit->clear();
+        this->blockCache->jit = std::move(jit);
+    }
+    std::memset(this->codePages, 0, sizeof(this->codePages));
+}
+
+// dropNativeCode method definition: forget every translation so the JIT's
+// code buffer can start over. Blocks translate again once they are hot again.
+void z16sim::dropNativeCode() {
+    z16blockCache& cache = *this->blockCache;
+    for (std::unique_ptr<z16block>& block : cache.blocks) {
+        if (block) {
+            block->native = nullptr;
+            block->exec_count = 0;
+        }
+    }
+    for (std::unique_ptr<z16block>& block : cache.graveyard) {
+        block->native = nullptr;
+    }
+    cache.jit->clear();
+}
+
+// setJitCodeSize method definition
+void z16sim::setJitCodeSize(size_t bytes) {
+    this->jitCodeSize = bytes;
+    if (this->blockCache && this->blockCache->jit) {
+        z16sim::dropNativeCode();
+        this->blockCache->jit.reset();
+    }
+}
+
+// buildBlock method definition
+z16block* z16sim::buildBlock(uint16_t start_pc) {
+    z16blockCache& cache = *this->blockCache;
+    std::unique_ptr<z16block> block(new z16block());
+    block->start_pc = start_pc;
+
+    // Stop before an instruction whose second byte would run off the end of
+    // memory, and before a breakpoint so dispatch can check it
+    uint32_t addr = start_pc;
+    while (addr < (uint32_t)z16sim::MEM_SIZE - 1 && (int)block->insts.size() < z16block::MAX_INSTS) {
+        if (this->breakpointCount && addr != start_pc && z16sim::isBreakpoint(addr)) {
+            break;
+        }
+        uint16_t inst = (this->memory[addr + 1] << 8) | this->memory[addr];
+        const z16decoded& d = z16decodeTable[inst];
+        block->insts.push_back({d, inst});
+        addr += 2;
+        if (endsBlock(d.op)) {
+            break;
+        }
+    }
+    block->end_pc = addr;
+    z16sim::classifyLoop(*block);
+
+    for (uint32_t page = start_pc >> z16blockCache::PAGE_SHIFT; page <= (addr - 1) >> z16blockCache::PAGE_SHIFT; ++page) {
+        cache.pageBlocks[page].push_back(start_pc);
+        this->codePages[page] = 1;
+    }
+    ++cache.stats.built;
+    cache.blocks[start_pc] = std::move(block);
+    return cache.blocks[start_pc].get();
+}
+
+// lookupBlock method definition
+z16block* z16sim::lookupBlock(uint16_t start_pc) {
+    z16block* block = this->blockCache->blocks[start_pc].get();
+    if (block) {
+        ++this->blockCache->stats.hits;
+        return block;
+    }
+    return z16sim::buildBlock(start_pc);
+}
+
+// invalidateCode method definition: called from the store path when a write
+// lands on a page that holds cached code.
+void z16sim::invalidateCode(uint16_t addr, int len) {
+    z16blockCache& cache = *this->blockCache;
+    uint32_t first = addr;
+    uint32_t last = (uint32_t)addr + len - 1;
+
+    for (uint32_t page = first >> z16blockCache::PAGE_SHIFT; page <= last >> z16blockCache::PAGE_SHIFT; ++page) {
+        std::vector<uint16_t>& starts = cache.pageBlocks[page];
+        size_t kept = 0;
+        for (uint16_t start : starts) {
+            std::unique_ptr<z16block>& slot = cache.blocks[start];
+            if (!slot) {
+                continue; // Stale entry, already dropped
+            }
+            if (slot->start_pc <= last && slot->end_pc > first) {
+                cache.graveyard.push_back(std::move(slot));
+                ++cache.stats.invalidations;
+                ++cache.epoch;
+                this->codeInvalidated = true;
+                continue;
+            }
+            starts[kept++] = start;
+        }
+        starts.resize(kept);
+        this->codePages[page] = !starts.empty();
+    }
+}
+
+// runBlocks method definition
+int z16sim::runBlocks(uint64_t max_instructions, int32_t stop_pc) {
+    if (!this->blockCache) {
+        this->blockCache.reset(new z16blockCache());
+    }
+    z16blockCache& cache = *this->blockCache;
+    z16block* block = nullptr;
+    this->codeInvalidated = false;
+
+    // Run until the cycle count reaches end; stop is the sooner of end and
+    // the next event, so one comparison per block covers both
+    uint64_t end = this->retired + std::min(max_instructions, UINT64_MAX - this->retired);
+    uint64_t stop = std::min(end, this->nextEvent);
+    uint64_t started = this->retired;
+    uint16_t start_pc = this->pc;
+
+    // Last pass through a pure loop: its block, the retired count when it
+    // started and the registers it started with
+    const z16block* idleBlock = nullptr;
+    uint64_t idleAt = 0;
+    uint16_t idleRegs[z16sim::NUM_REGS];
+
+    while (true) {
+        if (this->retired >= stop) {
+            if (this->retired >= end) {
+                return this->stopRequested ? z16sim::serviceEvents() : 0; // A watchpoint on the last instruction
+            }
+            int status = z16sim::serviceEvents();
+            if (status != 0) {
+                return status;
+            }
+            stop = std::min(end, this->nextEvent);
+            idleBlock = nullptr;
+        }
+        if (this->pc == stop_pc) {
+            return 0;
+        }
+        if (this->breakpointCount && z16sim::isBreakpoint(this->pc) &&
+            (this->retired != started || this->pc != start_pc)) {
+            this->stopReason = {Z16_STOP_BREAKPOINT, this->pc};
+            return 5;
+        }
+        if (this->pc >= z16sim::MEM_SIZE - 1) {
+            return z16sim::step<false>(); // Reports the PC fault
+        }
+
+        // Follow a chain link from the previous block if one still applies
+        z16block* next = nullptr;
+        if (block) {
+            for (int slot = 0; slot < 2 && !next; ++slot) {
+                if (block->next[slot] && block->next_pc[slot] == this->pc && block->next_epoch[slot] == cache.epoch) {
+                    next = block->next[slot];
+                    ++cache.stats.hits;
+                    ++cache.stats.chained;
+                }
+            }
+            if (!next) {
+                next = z16sim::lookupBlock(this->pc);
+                int slot = (block->next[0] && block->next_epoch[0] == cache.epoch) ? 1 : 0;
+                block->next[slot] = next;
+                block->next_pc[slot] = this->pc;
+                block->next_epoch[slot] = cache.epoch;
+            }
+        } else {
+            next = z16sim::lookupBlock(this->pc);
+        }
+        block = next;
+        cache.graveyard.clear();
+
+        // Clip the block to the budget or next event and to a run_until
+        // target inside it
+        size_t count = block->insts.size();
+        if (count > stop - this->retired) {
+            count = stop - this->retired;
+        }
+        if (stop_pc > block->start_pc && (uint32_t)stop_pc < block->end_pc && ((stop_pc - block->start_pc) & 1) == 0) {
+            count = std::min<size_t>(count, (stop_pc - block->start_pc) / 2);
+        }
+
+        // Loops that cannot change anything before the next event skip ahead
+        // to it, or out of the loop (z16idle.cpp). Breakpoints and a
+        // run_until target inside the loop need every pass.
+        if (block->loop && count == block->insts.size() && !this->breakpointCount &&
+            !(stop_pc > block->start_pc && (uint32_t)stop_pc < block->end_pc)) {
+            uint64_t skipped = 0;
+            if (block->loop == Z16_LOOP_COUNTDOWN) {
+                skipped = z16sim::skipCountdown(*block, stop - this->retired);
+            } else if (block == idleBlock && this->retired == idleAt + count &&
+                       std::memcmp(this->regs, idleRegs, sizeof(idleRegs)) == 0 && z16sim::idleLoads(*block)) {
+                skipped = (stop - this->retired) / count * count;
+                this->retired += skipped;
+            } else {
+                idleBlock = block;
+                idleAt = this->retired;
+                std::memcpy(idleRegs, this->regs, sizeof(idleRegs));
+            }
+            if (skipped) {
+                cache.stats.fastForwarded += skipped;
+                continue;
+            }
+        }
+
+        // Hot, unclipped blocks run as native code; whatever the translation
+        // left untranslated (a trailing ecall, a faulting access) is interpreted
+        size_t first = 0;
+        if (this->engine == Z16_ENGINE_JIT && count == block->insts.size()) {
+            if (!block->native && block->exec_count < z16jit::HOT_THRESHOLD &&
+                ++block->exec_count == z16jit::HOT_THRESHOLD) {
+                if (!cache.jit) {
+                    cache.jit.reset(new z16jit(this->jitCodeSize));
+                }
+                block->native = cache.jit->compile(*block, this->busTrapPages != 0);
+                if (!block->native && cache.jit->failed()) {
+                    // Out of code space (self-modifying code, or a long-lived
+                    // simulator): start the buffer over
+                    z16sim::dropNativeCode();
+                    ++cache.stats.jitFlushes;
+                    block->exec_count = z16jit::HOT_THRESHOLD;
+                    block->native = cache.jit->compile(*block, this->busTrapPages != 0);
+                    cache.stats.jitFailures += cache.jit->failed() ? 1 : 0;
+                }
+                cache.stats.translated += block->native ? 1 : 0;
+            }
+            if (block->native) {
+                z16jitFrame frame = {this->regs, this->memory, this->codePages, this->dirtyPages, this->busFlags, this, 0, 0};
+                block->native(&frame);
+                this->pc = frame.pc;
+                this->retired += frame.executed;
+                if (this->codeInvalidated) {
+                    this->codeInvalidated = false;
+                    block = nullptr;
+                    stop = std::min(end, this->nextEvent);
+                    continue;
+                }
+                first = frame.executed;
+            }
+        }
+
+        const z16blockInst* inst = block->insts.data();
+        for (size_t i = first; i < count; ++i) {
+            int status = z16sim::execute(inst[i].d, inst[i].inst);
+            if (status != 0) {
+                if (status == 1) {
+                    ++this->retired;
+                }
+                return status;
+            }
+            ++this->retired;
+            if (this->codeInvalidated) {
+                // The store may have rewritten this very block, or an event
+                // moved closer; re-dispatch
+                this->codeInvalidated = false;
+                block = nullptr;
+                stop = std::min(end, this->nextEvent);
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef Z16BLOCK_H
+#define Z16BLOCK_H
+
+#include "z16decode.h"
+#include "z16jit.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// One predecoded instruction inside a cached block
+struct z16blockInst {
+    z16decoded d;
+    uint16_t inst;
+};
+
+// Loops the block engine can skip ahead in (z16idle.cpp): blocks whose last
+// instruction branches back to their own start
+enum z16loopKind : uint8_t {
+    Z16_LOOP_NONE,
+    Z16_LOOP_COUNTDOWN, // addi rX, k; bnz rX / bne rX, rY back: the exit is computed
+    Z16_LOOP_PURE       // Only ALU ops, loads with unwritten bases and the branch back
+};
+
+// A straight-line run of instructions ending at a B-type, J-type, jr/jalr,
+// ecall or invalid encoding (or after MAX_INSTS instructions).
+struct z16block {
+    static const int MAX_INSTS = 64;
+
+    uint16_t start_pc;
+    uint32_t end_pc; // One past the last byte; 32-bit so a block may end at 0x10000
+    std::vector<z16blockInst> insts;
+    z16loopKind loop = Z16_LOOP_NONE;
+
+    // Chained successors. Each slot remembers the PC it was resolved for and
+    // is only trusted while its epoch matches the cache's.
+    z16block* next[2] = {nullptr, nullptr};
+    uint16_t next_pc[2] = {0, 0};
+    uint32_t next_epoch[2] = {0, 0};
+
+    // Native translation, made once the block has run z16jit::HOT_THRESHOLD times
+    uint32_t exec_count = 0;
+    z16jitCode native = nullptr;
+};
+
+// Counters reported by the block engine
+struct z16blockStats {
+    uint64_t built = 0;         // Blocks decoded and inserted
+    uint64_t hits = 0;          // Dispatches served from the cache
+    uint64_t chained = 0;       // ... of which followed a chain link directly
+    uint64_t invalidations = 0; // Blocks dropped because a store hit their code
+    uint64_t translated = 0;    // Blocks compiled to native code by the JIT
+    uint64_t jitFlushes = 0;    // Times the JIT's code buffer filled up and every translation was dropped
+    uint64_t jitFailures = 0;   // Hot blocks left to the interpreter because translation failed
+    uint64_t fastForwarded = 0; // Instructions retired by skipping ahead in idle and countdown loops
+};
+
+// Block cache keyed by start PC, with a per-page index of the blocks that
+// cover each 256-byte page so stores can find what to invalidate.
+struct z16blockCache {
+    static const int PAGE_SHIFT = 8;
+    static const int NUM_PAGES = 65536 >> PAGE_SHIFT;
+
+    std::vector<std::unique_ptr<z16block> > blocks = std::vector<std::unique_ptr<z16block> >(65536);
+    std::vector<uint16_t> pageBlocks[NUM_PAGES]; // Start PCs, may hold stale entries
+    std::vector<std::unique_ptr<z16block> > graveyard; // Invalidated blocks still being executed
+    uint32_t epoch = 1; // Bumped on every invalidation to drop chain links
+    z16blockStats stats;
+    std::unique_ptr<z16jit> jit; // Created on first use by Z16_ENGINE_JIT
+};
+
+#endif // Z16BLOCK_H
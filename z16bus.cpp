@@ -0,0 +1,112 @@
+#include "z16sim.h"
+#include "z16decode.h"
+#include <algorithm>
+
+// mapPages method definition
+void z16sim::mapPages(uint16_t addr, uint32_t len, z16pageKind kind, z16device* device) {
+    if (len == 0) {
+        return;
+    }
+    uint32_t first = addr >> z16blockCache::PAGE_SHIFT;
+    uint32_t last = std::min<uint32_t>(addr + len - 1, z16sim::MEM_SIZE - 1) >> z16blockCache::PAGE_SHIFT;
+    for (uint32_t page = first; page <= last; ++page) {
+        this->pageKinds[page] = kind;
+        this->devices[page] = kind == Z16_PAGE_DEVICE ? device : nullptr;
+    }
+    z16sim::updateBusFlags();
+    this->serviceDevices.clear();
+    for (int page = 0; page < z16blockCache::NUM_PAGES; ++page) {
+        z16device* dev = this->devices[page];
+        if (dev && std::find(this->serviceDevices.begin(), this->serviceDevices.end(), dev) == this->serviceDevices.end()) {
+            this->serviceDevices.push_back(dev);
+        }
+    }
+    z16sim::flushBlockCache(); // Translations were made for the old map
+}
+
+// updateBusFlags method definition: trap bits from the page kinds plus the
+// pages holding a watched byte
+void z16sim::updateBusFlags() {
+    this->busTrapPages = 0;
+    const int words = (1 << z16blockCache::PAGE_SHIFT) / 64;
+    for (int page = 0; page < z16blockCache::NUM_PAGES; ++page) {
+        z16pageKind kind = this->pageKinds[page];
+        unsigned char flags = kind == Z16_PAGE_DEVICE ? (Z16_BUS_LOAD_TRAP | Z16_BUS_STORE_TRAP)
+                            : kind == Z16_PAGE_ROM    ? Z16_BUS_STORE_TRAP
+                                                      : 0;
+        for (int w = page * words; w < (page + 1) * words; ++w) {
+            flags |= this->watchBits[0][w] ? Z16_BUS_LOAD_TRAP : 0;
+            flags |= this->watchBits[1][w] ? Z16_BUS_STORE_TRAP : 0;
+        }
+        this->busFlags[page] = flags;
+        this->busTrapPages += flags != 0;
+    }
+}
+
+// busAccess method definition: the slow path for the accesses the fast path
+// traps (device loads, ROM and device stores, and any access to a page with a
+// watchpoint). Alignment was checked already.
+int z16sim::busAccess(const z16decoded& d, uint16_t mem_addr) {
+    uint16_t* r = this->regs;
+    int page = mem_addr >> z16blockCache::PAGE_SHIFT;
+    z16device* device = this->devices[page];
+    bool store = d.op == Z16_SB || d.op == Z16_SW;
+    int len = (d.op == Z16_SW || d.op == Z16_LW) ? 2 : 1;
+
+    if (store && this->pageKinds[page] == Z16_PAGE_ROM) {
+        return z16sim::memoryFault("to read-only memory", d.op == Z16_SW ? "word store" : "byte store", mem_addr);
+    }
+    if (!device) { // RAM or ROM, trapped for a watchpoint: same as the fast path
+        switch (d.op) {
+            case Z16_SB:
+                this->memory[mem_addr] = (unsigned char)(r[d.rs2] & 0xFF);
+                break;
+            case Z16_SW:
+                this->memory[mem_addr] = (unsigned char)(r[d.rs2] & 0xFF);
+                this->memory[mem_addr + 1] = (unsigned char)(r[d.rs2] >> 8);
+                break;
+            case Z16_LB:
+                r[d.rd] = (int8_t)this->memory[mem_addr];
+                break;
+            case Z16_LBU:
+                r[d.rd] = this->memory[mem_addr];
+                break;
+            case Z16_LW:
+                r[d.rd] = (this->memory[mem_addr + 1] << 8) | this->memory[mem_addr];
+                break;
+            default:
+                break;
+        }
+        if (store) {
+            this->dirtyPages[page] = 1;
+            if (this->codePages[page]) {
+                z16sim::invalidateCode(mem_addr, len);
+            }
+        }
+    } else {
+        switch (d.op) {
+            case Z16_SB:
+                device->write8(mem_addr, r[d.rs2] & 0xFF);
+                break;
+            case Z16_SW:
+                device->write16(mem_addr, r[d.rs2]);
+                break;
+            case Z16_LB:
+                r[d.rd] = (int8_t)device->read8(mem_addr);
+                break;
+            case Z16_LBU:
+                r[d.rd] = device->read8(mem_addr);
+                break;
+            case Z16_LW:
+                r[d.rd] = device->read16(mem_addr);
+                break;
+            default:
+                break;
+        }
+    }
+    if (this->watchpointCount) {
+        z16sim::checkWatchpoint(mem_addr, len, store);
+    }
+    this->pc += 2;
+    return 0;
+}
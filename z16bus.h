@@ -0,0 +1,58 @@
+#ifndef Z16BUS_H
+#define Z16BUS_H
+
+#include <cstdint>
+
+class z16sim;
+
+// Memory bus page kinds. The bus uses the block cache's 256-byte pages; every
+// page starts as RAM.
+enum z16pageKind : uint8_t {
+    Z16_PAGE_RAM,    // memory[] read and written directly
+    Z16_PAGE_ROM,    // memory[] read directly; guest stores fault
+    Z16_PAGE_DEVICE  // Loads and stores go to a z16device
+};
+
+// Per-page bits tested by the load/store fast paths (0 for RAM)
+enum : uint8_t {
+    Z16_BUS_LOAD_TRAP = 1,  // Loads take the slow path (device pages)
+    Z16_BUS_STORE_TRAP = 2  // Stores take the slow path (ROM and device pages)
+};
+
+// A peripheral attached with z16sim::mapDevice(). Handlers get the full
+// guest address. Word accesses are always aligned, so they never span two
+// pages (or two devices). ecall services the simulator does not provide
+// itself are offered to the mapped devices through service(). Devices with
+// a notion of time post events with z16sim::schedule() and get event() back
+// once the simulator's cycle count reaches them.
+class z16device {
+public:
+    virtual ~z16device() {}
+    virtual uint8_t read8(uint16_t addr) = 0;
+    virtual void write8(uint16_t addr, uint8_t value) = 0;
+    // Word accesses default to two byte accesses, low byte first
+    virtual uint16_t read16(uint16_t addr) { return read8(addr) | (read8(addr + 1) << 8); }
+    virtual void write16(uint16_t addr, uint16_t value) {
+        write8(addr, value & 0xFF);
+        write8(addr + 1, value >> 8);
+    }
+    // Returns true if the device implements ecall service svc
+    virtual bool service(z16sim& sim, uint16_t svc) {
+        (void)sim;
+        (void)svc;
+        return false;
+    }
+    virtual void event(z16sim& sim, uint32_t tag) {
+        (void)sim;
+        (void)tag;
+    }
+};
+
+// A pending device event (z16sim::schedule)
+struct z16event {
+    uint64_t when; // Cycle the event falls due
+    z16device* device;
+    uint32_t tag;  // Passed back to device->event()
+};
+
+#endif // Z16BUS_H
@@ -0,0 +1,82 @@
+#include "z16cfg.h"
+
+// recover method definition
+void z16cfg::recover(const unsigned char* memory, const std::vector<uint16_t>& entries) {
+    std::vector<bool> isInst(65536, false);
+    std::vector<bool> leader(65536, false);
+    std::vector<uint16_t> work(entries);
+    this->blocks.clear();
+    this->code.assign(65536, false);
+
+    for (uint16_t entry : entries) {
+        leader[entry] = true;
+    }
+    auto target = [&](uint16_t t) {
+        leader[t] = true;
+        work.push_back(t);
+    };
+
+    // Pass 1: find every reachable instruction and every block leader
+    while (!work.empty()) {
+        uint16_t pc = work.back();
+        work.pop_back();
+        while (pc != 0xFFFF && !isInst[pc]) { // An instruction at 0xFFFF is a PC fault
+            isInst[pc] = true;
+            this->code[pc] = true;
+            this->code[(uint16_t)(pc + 1)] = true;
+            const z16decoded& d = z16decodeTable[z16cfg::fetch(memory, pc)];
+            uint16_t next = pc + 2;
+
+            if (d.op >= Z16_BEQ && d.op <= Z16_BGEU) {
+                target(pc + d.imm);
+                target(next);
+            } else if (d.op == Z16_J) {
+                target(pc + d.imm);
+            } else if (d.op == Z16_JAL) {
+                target(pc + d.imm);
+                target(next); // Return site
+            } else if (d.op == Z16_JALR || (d.op == Z16_ECALL && d.imm != EXIT_SERVICE)) {
+                target(next);
+            }
+            if (z16cfg::endsBlock(d.op)) {
+                break;
+            }
+            pc = next;
+        }
+    }
+
+    // Pass 2: cut the instruction stream into blocks at leaders and terminators
+    for (uint32_t start = 0; start < 65536; ++start) {
+        if (!leader[start] || !isInst[start]) {
+            continue;
+        }
+        z16cfgBlock block = {(uint16_t)start, 0, {}, false, false};
+        uint16_t pc = start;
+        for (;;) {
+            const z16decoded& d = z16decodeTable[z16cfg::fetch(memory, pc)];
+            uint16_t next = pc + 2;
+            ++block.count;
+            if (z16cfg::endsBlock(d.op)) {
+                if (d.op >= Z16_BEQ && d.op <= Z16_BGEU) {
+                    block.succs.push_back(pc + d.imm);
+                    block.succs.push_back(next);
+                } else if (d.op == Z16_J || d.op == Z16_JAL) {
+                    block.succs.push_back(pc + d.imm);
+                } else if (d.op == Z16_ECALL && d.imm != EXIT_SERVICE) {
+                    block.succs.push_back(next);
+                }
+                block.indirect = d.op == Z16_JR || d.op == Z16_JALR;
+                block.halts = d.op == Z16_TRAP || (d.op == Z16_ECALL && d.imm == EXIT_SERVICE);
+                break;
+            }
+            if (next == 0xFFFF || !isInst[next] || leader[next]) {
+                if (next != 0xFFFF && isInst[next]) {
+                    block.succs.push_back(next);
+                }
+                break;
+            }
+            pc = next;
+        }
+        this->blocks[block.start] = block;
+    }
+}
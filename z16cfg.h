@@ -0,0 +1,40 @@
+#ifndef Z16CFG_H
+#define Z16CFG_H
+
+#include "z16decode.h"
+#include <cstdint>
+#include <map>
+#include <vector>
+
+// A basic block recovered statically from a memory image
+struct z16cfgBlock {
+    uint16_t start;
+    uint16_t count;              // Instructions in the block
+    std::vector<uint16_t> succs; // Static successors (branch/jump targets, fall-through)
+    bool indirect;               // Ends in jr/jalr: successor only known at run time
+    bool halts;                  // Ends in an invalid encoding or the exit ecall
+};
+
+// Control-flow recovery by recursive traversal: starting from the entry
+// points, follow B-type and J-type targets and fall-through edges. jal/jalr
+// return sites are treated as entries so that `jr ra` lands on a known block.
+// Other ecalls continue with the next instruction; the exit service does not.
+class z16cfg {
+public:
+    static const int EXIT_SERVICE = 0x3FF;
+
+    std::map<uint16_t, z16cfgBlock> blocks;
+    std::vector<bool> code; // Per byte: part of a recovered instruction
+
+    void recover(const unsigned char* memory, const std::vector<uint16_t>& entries);
+
+    static uint16_t fetch(const unsigned char* memory, uint16_t pc) {
+        return (memory[pc + 1] << 8) | memory[pc];
+    }
+    static bool endsBlock(uint8_t op) {
+        return (op >= Z16_BEQ && op <= Z16_BGEU) || op == Z16_J || op == Z16_JAL ||
+               op == Z16_JR || op == Z16_JALR || op == Z16_ECALL || op == Z16_TRAP;
+    }
+};
+
+#endif // Z16CFG_H
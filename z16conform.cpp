@@ -0,0 +1,538 @@
+// zx16_conform: checks the execution engines against the interpreter, and
+// the interpreter against a reference model.
+//
+// "sweep" runs every one of the 65,536 instruction encodings from a set of
+// random register states over random memory on the interpreter, then on the
+// block engine, the JIT (where the host has one) and the lockstep engine, and
+// reports every state an engine leaves differently. The instruction sits at
+// SWEEP_PC with an exit ecall behind it and each run gets a budget of two
+// instructions, so blocks are [instruction, ecall] and the JIT translates
+// them once they are hot. Encodings are spread over worker threads.
+//
+// The engines all share the decode table and execute() (z16exec.h), so a
+// slip there would go unnoticed between them. Each state therefore also
+// runs a single instruction on the interpreter, which is checked against
+// referenceStep(): the ISA written out from the instruction bits, as the
+// original executeInstruction switch did, sharing no code with the simulator.
+//
+// "diff" runs one program on the interpreter and an engine in lockstep
+// (z16diffChecker) and reports the first divergence.
+
+#include "z16diff.h"
+#include "z16lockstep.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const uint16_t SWEEP_PC = 0x0400;
+static const uint16_t EXIT_ECALL = (0x3FF << 6) | 0x7;
+static const int MAX_REPORTED = 20;
+
+struct sweepOptions {
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    int states = 16; // Register states per encoding; the JIT takes over after z16jit::HOT_THRESHOLD
+    uint64_t seed = 1;
+};
+
+// What the interpreter left after one register state
+struct sweepOutcome {
+    int status;
+    uint16_t regs[z16sim::NUM_REGS];
+    uint16_t pc;
+    uint64_t retired;
+    std::string output;
+    std::vector<int> pages;            // Pages written
+    std::vector<unsigned char> memory; // Their contents, page after page
+};
+
+// What one instruction does to a machine with no devices, worked out from
+// its bits alone. Ecall services are not modelled (the zx16_selftest ecall-*
+// cases check them on every engine); console output is not compared.
+struct referenceResult {
+    bool modelled;
+    int status;
+    uint16_t regs[z16sim::NUM_REGS];
+    uint16_t pc;
+    int storeLen; // Bytes written at storeAddr: 0, 1 or 2
+    uint16_t storeAddr;
+    uint16_t storeValue;
+};
+
+static int16_t signExtend(uint16_t value, int bits) {
+    return (int16_t)(value << (16 - bits)) >> (16 - bits);
+}
+
+static referenceResult referenceStep(uint16_t inst, const uint16_t* in, uint16_t pc, const unsigned char* memory) {
+    referenceResult out = {true, Z16_STATUS_OK, {0}, (uint16_t)(pc + 2), 0, 0, 0};
+    std::memcpy(out.regs, in, sizeof(out.regs));
+    uint16_t* r = out.regs;
+    int rd = (inst >> 6) & 0x7; // rs1 of branches, base of stores
+    int rs2 = (inst >> 9) & 0x7; // Base of loads
+    int funct3 = (inst >> 3) & 0x7;
+    bool known = true;
+
+    switch (inst & 0x7) {
+        case 0x0: { // R-type
+            int funct4 = inst >> 12;
+            uint16_t a = r[rd], b = r[rs2];
+            switch ((funct4 << 3) | funct3) {
+                case (0x0 << 3) | 0: r[rd] = a + b; break;
+                case (0x1 << 3) | 0: r[rd] = a - b; break;
+                case (0x2 << 3) | 1: r[rd] = (int16_t)a < (int16_t)b; break;
+                case (0x3 << 3) | 2: r[rd] = a < b; break;
+                case (0x4 << 3) | 3: r[rd] = a << (b & 0xF); break;
+                case (0x5 << 3) | 3: r[rd] = a >> (b & 0xF); break;
+                case (0x6 << 3) | 3: r[rd] = (int16_t)a >> (b & 0xF); break;
+                case (0x7 << 3) | 4: r[rd] = a | b; break;
+                case (0x8 << 3) | 5: r[rd] = a & b; break;
+                case (0x9 << 3) | 6: r[rd] = a ^ b; break;
+                case (0xA << 3) | 7: r[rd] = b; break;
+                case (0xB << 3) | 0: out.pc = a; break;                        // jr
+                case (0xC << 3) | 0: r[rd] = pc + 2; out.pc = r[rs2]; break; // jalr: link first
+                default: known = false; break;
+            }
+            break;
+        }
+        case 0x1: { // I-type
+            int16_t imm = signExtend((inst >> 9) & 0x7F, 7);
+            uint16_t a = r[rd];
+            switch (funct3) {
+                case 0: r[rd] = a + imm; break;
+                case 1: r[rd] = (int16_t)a < imm; break;
+                case 2: r[rd] = a < (uint16_t)imm; break;
+                case 3: { // Shifts: imm[6:4] picks the kind, imm[3:0] is the amount
+                    int shamt = imm & 0xF;
+                    switch ((imm >> 4) & 0x7) {
+                        case 1: r[rd] = a << shamt; break;
+                        case 2: r[rd] = a >> shamt; break;
+                        case 4: r[rd] = (int16_t)a >> shamt; break;
+                        default: known = false; break;
+                    }
+                    break;
+                }
+                case 4: r[rd] = a | imm; break;
+                case 5: r[rd] = a & imm; break;
+                case 6: r[rd] = a ^ imm; break;
+                default: r[rd] = imm; break; // li
+            }
+            break;
+        }
+        case 0x2: { // B-type: target = pc + 2 + 4 * imm[3:0]
+            uint16_t a = r[rd], b = r[rs2];
+            bool taken[8] = {a == b, a != b, a == 0, a != 0, (int16_t)a < (int16_t)b, (int16_t)a >= (int16_t)b, a < b, a >= b};
+            if (taken[funct3]) {
+                out.pc = pc + 2 + 4 * signExtend(inst >> 12, 4);
+            }
+            break;
+        }
+        case 0x3: { // S-type
+            uint16_t addr = r[rd] + signExtend(inst >> 12, 4);
+            if (funct3 > 1) {
+                known = false;
+            } else if (funct3 == 1 && (addr & 1)) {
+                out.status = Z16_STATUS_MEMORY_FAULT;
+            } else {
+                out.storeLen = funct3 + 1;
+                out.storeAddr = addr;
+                out.storeValue = r[rs2];
+            }
+            break;
+        }
+        case 0x4: { // L-type
+            uint16_t addr = r[rs2] + signExtend(inst >> 12, 4);
+            if (funct3 == 0) {
+                r[rd] = (int8_t)memory[addr];
+            } else if (funct3 == 4) {
+                r[rd] = memory[addr];
+            } else if (funct3 != 1) {
+                known = false;
+            } else if (addr & 1) {
+                out.status = Z16_STATUS_MEMORY_FAULT;
+            } else {
+                r[rd] = memory[addr] | (memory[addr + 1] << 8);
+            }
+            break;
+        }
+        case 0x5: { // J-type: offset imm[9:1] from bits [14:9] and [5:3]
+            int16_t offset = signExtend((((inst >> 9) & 0x3F) << 4) | (((inst >> 3) & 0x7) << 1), 10);
+            if (inst >> 15) {
+                r[rd] = pc + 2;
+            }
+            out.pc = pc + offset;
+            break;
+        }
+        case 0x6: { // U-type: imm[8:0] from bits [14:9] and [5:3], shifted up 8
+            uint16_t upper = ((((inst >> 9) & 0x3F) << 3) | funct3) << 8;
+            r[rd] = (inst >> 15) ? (uint16_t)(pc + upper) : upper;
+            break;
+        }
+        default: // SYS-type: only ecall (funct3 0) exists
+            out.modelled = funct3 != 0;
+            known = false;
+            break;
+    }
+    if (!known) {
+        out.status = Z16_STATUS_UNKNOWN_INSTRUCTION;
+    }
+    if (out.status != Z16_STATUS_OK) { // Not retired: nothing changes
+        std::memcpy(out.regs, in, sizeof(out.regs));
+        out.pc = pc;
+        out.storeLen = 0;
+    }
+    return out;
+}
+
+class sweepRunner {
+public:
+    explicit sweepRunner(const sweepOptions& options) : options(options), next(0), mismatches(0) {
+        engines.push_back(Z16_ENGINE_BLOCKS);
+        if (z16jit::available()) {
+            engines.push_back(Z16_ENGINE_JIT);
+        }
+    }
+
+    uint64_t run() {
+        std::vector<std::thread> workers;
+        for (unsigned id = 0; id < options.threads; ++id) {
+            workers.emplace_back(&sweepRunner::worker, this);
+        }
+        for (std::thread& t : workers) {
+            t.join();
+        }
+        return mismatches;
+    }
+
+    std::string engineNames() const {
+        std::string names;
+        for (z16engine engine : engines) {
+            names += engine == Z16_ENGINE_JIT ? "jit, " : "blocks, ";
+        }
+        return names + "lockstep, and the interpreter against the reference model";
+    }
+
+private:
+    static const uint32_t BATCH = 256; // Encodings taken by a worker at a time
+
+    const sweepOptions& options;
+    std::vector<z16engine> engines;
+    std::atomic<uint32_t> next;
+    std::atomic<uint64_t> mismatches;
+    std::mutex reportLock;
+
+    // One simulator per engine with its own console streams
+    struct sweepSim {
+        z16sim sim;
+        z16bufferSink output;
+        std::istringstream input;
+        z16snapshot start;
+    };
+
+    void worker() {
+        std::unique_ptr<sweepSim> ref(new sweepSim());
+        std::vector<std::unique_ptr<sweepSim> > cands;
+        for (z16engine engine : engines) {
+            cands.emplace_back(new sweepSim());
+            cands.back()->sim.setEngine(engine);
+        }
+        ref->sim.setSink(&ref->output);
+        for (auto& c : cands) {
+            c->sim.setSink(&c->output);
+        }
+
+        std::vector<unsigned char> image(z16sim::MEM_SIZE);
+        std::vector<std::vector<uint16_t> > states(options.states, std::vector<uint16_t>(z16sim::NUM_REGS));
+        std::vector<sweepOutcome> expected(options.states);
+        uint32_t first;
+        while ((first = next.fetch_add(BATCH)) < 0x10000) {
+            for (uint32_t inst = first; inst < first + BATCH; ++inst) {
+                makeCase((uint16_t)inst, image, states);
+                load(*ref, image);
+                checkReference(*ref, (uint16_t)inst, image, states);
+                for (int k = 0; k < options.states; ++k) {
+                    record(*ref, runState(*ref, states[k]), expected[k]);
+                }
+                sweepOutcome got;
+                for (size_t e = 0; e < cands.size(); ++e) {
+                    load(*cands[e], image);
+                    for (int k = 0; k < options.states; ++k) {
+                        record(*cands[e], runState(*cands[e], states[k]), got);
+                        check((uint16_t)inst, engines[e] == Z16_ENGINE_JIT ? "jit" : "blocks", k, expected[k], got);
+                    }
+                }
+                checkLockstep((uint16_t)inst, ref->start, states, expected);
+            }
+        }
+    }
+
+    // Random memory, the instruction and an exit behind it, and register
+    // values biased towards the edge cases and towards the code
+    void makeCase(uint16_t inst, std::vector<unsigned char>& image, std::vector<std::vector<uint16_t> >& states) {
+        uint64_t seed = options.seed * 0x9E3779B97F4A7C15ULL + inst;
+        auto rng = [&seed]() { // splitmix64: fast enough to fill 64 KB per encoding
+            uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            return z ^ (z >> 31);
+        };
+        for (size_t i = 0; i < image.size(); i += 8) {
+            uint64_t bits = rng();
+            std::memcpy(&image[i], &bits, 8);
+        }
+        image[SWEEP_PC] = inst & 0xFF;
+        image[SWEEP_PC + 1] = inst >> 8;
+        image[SWEEP_PC + 2] = EXIT_ECALL & 0xFF;
+        image[SWEEP_PC + 3] = EXIT_ECALL >> 8;
+        static const uint16_t edges[] = {0, 1, 0x7FFF, 0x8000, 0xFFFF, 0x000F, 0x0010};
+        for (std::vector<uint16_t>& regs : states) {
+            for (uint16_t& r : regs) {
+                switch (rng() % 4) {
+                    case 0: r = edges[rng() % (sizeof(edges) / sizeof(edges[0]))]; break;
+                    case 1: r = rng() % 64; break;
+                    case 2: r = SWEEP_PC + (int)(rng() % 64) - 32; break;
+                    default: r = (uint16_t)rng(); break;
+                }
+            }
+        }
+    }
+
+    static void load(sweepSim& s, const std::vector<unsigned char>& image) {
+        s.sim.writeMemory(0, image.data(), image.size());
+        s.start = s.sim.snapshot();
+    }
+
+    static int runState(sweepSim& s, const std::vector<uint16_t>& regs, uint64_t budget = 2) {
+        s.sim.restore(s.start);
+        for (int r = 0; r < z16sim::NUM_REGS; ++r) {
+            s.sim.setReg(r, regs[r]);
+        }
+        s.sim.setPC(SWEEP_PC);
+        s.output.clear();
+        s.sim.setInput(s.input); // Programs that read the console get end of input
+        int status = s.sim.run(budget);
+        s.sim.flushConsole();
+        return status;
+    }
+
+    // The outcome of the last run, with the pages it wrote, so stores to the
+    // wrong place show up as well as missing ones
+    static void record(sweepSim& s, int status, sweepOutcome& out) {
+        z16sim& sim = s.sim;
+        out.status = status;
+        for (int r = 0; r < z16sim::NUM_REGS; ++r) {
+            out.regs[r] = sim.getReg(r);
+        }
+        out.pc = sim.getPC();
+        out.retired = sim.getInstructionCount();
+        out.output = s.output.str();
+        out.pages.clear();
+        out.memory.clear();
+        const int pageSize = 1 << z16blockCache::PAGE_SHIFT;
+        for (int page = 0; page < z16blockCache::NUM_PAGES; ++page) {
+            if (sim.isPageDirty(page)) {
+                out.pages.push_back(page);
+                out.memory.insert(out.memory.end(), sim.getMemory() + page * pageSize, sim.getMemory() + (page + 1) * pageSize);
+            }
+        }
+    }
+
+    void check(uint16_t inst, const char* engine, int state, const sweepOutcome& want, const sweepOutcome& got,
+               const char* against = "interpreter") {
+        char what[128] = "";
+        if (got.status != want.status) {
+            std::snprintf(what, sizeof(what), "run status %d vs %d", want.status, got.status);
+        } else if (got.pc != want.pc || got.retired != want.retired) {
+            std::snprintf(what, sizeof(what), "pc 0x%04X after %llu vs 0x%04X after %llu", want.pc,
+                          (unsigned long long)want.retired, got.pc, (unsigned long long)got.retired);
+        } else if (got.output != want.output) {
+            std::snprintf(what, sizeof(what), "console output differs");
+        } else {
+            for (int r = 0; r < z16sim::NUM_REGS && !what[0]; ++r) {
+                if (got.regs[r] != want.regs[r]) {
+                    std::snprintf(what, sizeof(what), "%s: 0x%04X vs 0x%04X", z16sim::regNames[r], want.regs[r], got.regs[r]);
+                }
+            }
+            if (!what[0] && (got.pages != want.pages || got.memory != want.memory)) {
+                std::snprintf(what, sizeof(what), "memory written differs");
+            }
+        }
+        if (what[0]) {
+            report(inst, engine, state, what, against);
+        }
+    }
+
+    // One instruction on the interpreter against referenceStep()
+    void checkReference(sweepSim& ref, uint16_t inst, const std::vector<unsigned char>& image,
+                        const std::vector<std::vector<uint16_t> >& states) {
+        const int pageSize = 1 << z16blockCache::PAGE_SHIFT;
+        for (size_t k = 0; k < states.size(); ++k) {
+            referenceResult model = referenceStep(inst, states[k].data(), SWEEP_PC, image.data());
+            if (!model.modelled) {
+                continue;
+            }
+            sweepOutcome got;
+            record(ref, runState(ref, states[k], 1), got);
+            sweepOutcome want;
+            want.status = model.status;
+            std::memcpy(want.regs, model.regs, sizeof(want.regs));
+            want.pc = model.pc;
+            want.retired = ref.start.retired + (model.status == Z16_STATUS_OK ? 1 : 0);
+            want.output = got.output;
+            if (model.storeLen) {
+                int page = model.storeAddr / pageSize;
+                want.pages.push_back(page);
+                want.memory.assign(image.begin() + page * pageSize, image.begin() + (page + 1) * pageSize);
+                for (int i = 0; i < model.storeLen; ++i) {
+                    want.memory[model.storeAddr % pageSize + i] = (unsigned char)(model.storeValue >> (8 * i));
+                }
+            }
+            check(inst, "interpreter", (int)k, want, got, "reference");
+        }
+    }
+
+    // All states of one encoding run as lanes of one lockstep engine
+    void checkLockstep(uint16_t inst, const z16snapshot& start, const std::vector<std::vector<uint16_t> >& states,
+                       const std::vector<sweepOutcome>& expected) {
+        z16lockstep lanes(start, states.size());
+        for (size_t k = 0; k < states.size(); ++k) {
+            for (int r = 0; r < z16sim::NUM_REGS; ++r) {
+                lanes.setReg(k, r, states[k][r]);
+            }
+            lanes.setPC(k, SWEEP_PC);
+        }
+        lanes.run(2);
+        const int pageSize = 1 << z16blockCache::PAGE_SHIFT;
+        for (size_t k = 0; k < states.size(); ++k) {
+            const sweepOutcome& want = expected[k];
+            sweepOutcome got = want;
+            for (int r = 0; r < z16sim::NUM_REGS; ++r) {
+                got.regs[r] = lanes.getReg(k, r);
+            }
+            got.pc = lanes.getPC(k);
+            got.retired = lanes.getInstructionCount(k);
+            got.status = lanes.getStatus(k);
+            got.output = lanes.getOutput(k);
+            for (size_t p = 0; p < want.pages.size(); ++p) {
+                for (int i = 0; i < pageSize; ++i) {
+                    got.memory[p * pageSize + i] = lanes.readMemory(k, (uint16_t)(want.pages[p] * pageSize + i));
+                }
+            }
+            check(inst, "lockstep", (int)k, want, got);
+        }
+    }
+
+    void report(uint16_t inst, const char* engine, int state, const char* what, const char* against) {
+        if (mismatches++ >= (uint64_t)MAX_REPORTED) {
+            return;
+        }
+        z16sim disasm;
+        char buf[256];
+        disasm.disassemble(inst, SWEEP_PC, buf, sizeof(buf));
+        std::lock_guard<std::mutex> guard(reportLock);
+        std::printf("0x%04X %-24s %-11s state %2d: %s (%s vs %s)\n", inst, buf, engine, state, what, against, engine);
+    }
+};
+
+static void printUsage(const char* progName) {
+    std::cerr << "Usage: " << progName << " sweep [--states=N] [--seed=N] [--jobs=N]" << std::endl;
+    std::cerr << "       " << progName << " diff [--engine=blocks|jit] [--chunk=N] [--max=N] <program>" << std::endl;
+    std::cerr << "  sweep: Every instruction encoding from N random register states (default 16) on each engine" << std::endl;
+    std::cerr << "  diff: The program on the interpreter and an engine (default jit) in lockstep, compared" << std::endl;
+    std::cerr << "        every --chunk instructions (default " << z16diffChecker::DEFAULT_CHUNK << "; 1 for every instruction)" << std::endl;
+}
+
+static int sweep(int argc, char* argv[]) {
+    sweepOptions options;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--states=", 0) == 0) {
+            options.states = std::max(1, std::atoi(arg.c_str() + 9));
+        } else if (arg.rfind("--seed=", 0) == 0) {
+            options.seed = std::strtoull(arg.c_str() + 7, nullptr, 0);
+        } else if (arg.rfind("--jobs=", 0) == 0) {
+            options.threads = std::max(1, std::atoi(arg.c_str() + 7));
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    sweepRunner runner(options);
+    uint64_t mismatches = runner.run();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("Swept 65536 encodings x %d states on %s: %llu mismatches (%.1f s, %u threads)\n", options.states,
+                runner.engineNames().c_str(), (unsigned long long)mismatches, seconds, options.threads);
+    return mismatches ? 1 : 0;
+}
+
+static int diff(int argc, char* argv[]) {
+    z16engine engine = z16jit::available() ? Z16_ENGINE_JIT : Z16_ENGINE_BLOCKS;
+    uint64_t chunk = z16diffChecker::DEFAULT_CHUNK;
+    uint64_t max_instructions = 100000000;
+    const char* filename = nullptr;
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--engine=blocks") {
+            engine = Z16_ENGINE_BLOCKS;
+        } else if (arg == "--engine=jit") {
+            engine = z16jit::available() ? Z16_ENGINE_JIT : Z16_ENGINE_BLOCKS;
+        } else if (arg.rfind("--chunk=", 0) == 0) {
+            chunk = std::strtoull(arg.c_str() + 8, nullptr, 0);
+        } else if (arg.rfind("--max=", 0) == 0) {
+            max_instructions = std::strtoull(arg.c_str() + 6, nullptr, 0);
+        } else if (filename == nullptr && arg[0] != '-') {
+            filename = argv[i];
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (filename == nullptr) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // Program output is compared through memory and registers only
+    z16bufferSink refOutput, candOutput;
+    std::istringstream refInput, candInput;
+    z16sim reference, candidate;
+    reference.setSink(&refOutput);
+    candidate.setSink(&candOutput);
+    reference.setInput(refInput);
+    candidate.setInput(candInput);
+    candidate.setEngine(engine);
+    if (!reference.loadMemoryFromFile(filename) || !candidate.loadMemoryFromFile(filename)) {
+        return 1;
+    }
+
+    z16diffChecker checker(reference, candidate, chunk);
+    if (!checker.run(max_instructions)) {
+        checker.report(std::cout);
+        return 1;
+    }
+    std::cout << "No divergence in " << reference.getInstructionCount() << " instructions (run status "
+              << checker.getStatus() << ")" << std::endl;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    std::string mode = argc > 1 ? argv[1] : "";
+    if (mode == "sweep") {
+        return sweep(argc, argv);
+    }
+    if (mode == "diff") {
+        return diff(argc, argv);
+    }
+    printUsage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,74 @@
+#include "z16sim.h"
+#include <algorithm>
+#include <bitset>
+
+// setBreakpoint method definition. Blocks never run past a breakpoint, so
+// cached blocks spanning addr are dropped and rebuilt around it (or, once
+// it is cleared, without the split).
+void z16sim::setBreakpoint(uint16_t addr, bool enabled) {
+    uint64_t bit = 1ULL << (addr & 63);
+    uint64_t& word = this->breakBits[addr >> 6];
+    if (((word & bit) != 0) == enabled) {
+        return;
+    }
+    word ^= bit;
+    this->breakpointCount += enabled ? 1 : -1;
+    if (this->codePages[addr >> z16blockCache::PAGE_SHIFT]) {
+        z16sim::invalidateCode(addr, 1);
+    }
+}
+
+// setWatchpoint method definition: kinds is Z16_WATCH_READ, Z16_WATCH_WRITE
+// or both; the range is clipped to the end of memory
+void z16sim::setWatchpoint(uint16_t addr, uint32_t len, int kinds, bool enabled) {
+    uint32_t end = std::min<uint32_t>((uint32_t)addr + len, z16sim::MEM_SIZE);
+    for (int kind = 0; kind < 2; ++kind) {
+        if (!(kinds & (kind == 0 ? Z16_WATCH_READ : Z16_WATCH_WRITE))) {
+            continue;
+        }
+        for (uint32_t a = addr; a < end; ++a) {
+            uint64_t bit = 1ULL << (a & 63);
+            if (enabled) {
+                this->watchBits[kind][a >> 6] |= bit;
+            } else {
+                this->watchBits[kind][a >> 6] &= ~bit;
+            }
+        }
+    }
+
+    this->watchpointCount = 0;
+    for (int w = 0; w < z16sim::MEM_SIZE / 64; ++w) {
+        this->watchpointCount += (int)std::bitset<64>(this->watchBits[0][w] | this->watchBits[1][w]).count();
+    }
+    bool checked = this->busTrapPages != 0;
+    z16sim::updateBusFlags();
+    if (!checked && this->busTrapPages != 0) {
+        z16sim::flushBlockCache(); // Translations made without bus checks
+    }
+}
+
+// clearDebugPoints method definition
+void z16sim::clearDebugPoints() {
+    for (uint32_t addr = 0; this->breakpointCount && addr < z16sim::MEM_SIZE; ++addr) {
+        z16sim::setBreakpoint((uint16_t)addr, false);
+    }
+    if (this->watchpointCount) {
+        z16sim::setWatchpoint(0, z16sim::MEM_SIZE, Z16_WATCH_READ | Z16_WATCH_WRITE, false);
+    }
+}
+
+// checkWatchpoint method definition: called by busAccess after a load or
+// store on a page with watched bytes. The run loops see nextEvent reached
+// and serviceEvents() ends the run.
+void z16sim::checkWatchpoint(uint16_t mem_addr, int len, bool store) {
+    const uint64_t* bits = this->watchBits[store ? 1 : 0];
+    for (int i = 0; i < len; ++i) {
+        uint16_t a = mem_addr + i;
+        if ((bits[a >> 6] >> (a & 63)) & 1) {
+            this->stopReason = {store ? Z16_STOP_WATCH_WRITE : Z16_STOP_WATCH_READ, a};
+            this->stopRequested = true;
+            z16sim::updateNextEvent();
+            return;
+        }
+    }
+}
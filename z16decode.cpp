@@ -0,0 +1,14 @@
+#include "z16decode.h"
+
+constexpr std::array<z16decoded, 65536> z16decodeTable = z16buildDecodeTable();
+
+// Spot checks against the encodings used by the tests and the assembler
+static_assert(z16decodeTable[0x0440].op == Z16_ADD && z16decodeTable[0x0440].rd == 1 && z16decodeTable[0x0440].rs2 == 2);
+static_assert(z16decodeTable[0x8468].op == Z16_AND);
+static_assert(z16decodeTable[0x0000].op == Z16_ADD);
+static_assert(z16decodeTable[0xF641].op == Z16_ADDI && z16decodeTable[0xF641].imm == -5);
+static_assert(z16decodeTable[0x2859].op == Z16_SLLI && z16decodeTable[0x2859].imm == 4);
+static_assert(z16decodeTable[0x0E79].op == Z16_LI && z16decodeTable[0x0E79].imm == 7);
+static_assert(z16decodeTable[0xFFC7].op == Z16_ECALL && z16decodeTable[0xFFC7].imm == 0x3FF);
+static_assert(z16decodeTable[0xFFCF].op == Z16_TRAP);
+static_assert(z16decodeTable[0xF000].op == Z16_TRAP);
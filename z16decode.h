@@ -0,0 +1,127 @@
+#ifndef Z16DECODE_H
+#define Z16DECODE_H
+
+#include <array>
+#include <cstdint>
+
+// Handler index for every ZX16 operation. Encodings that executeInstruction()
+// would reject all map to Z16_TRAP.
+enum z16op : uint8_t {
+    // R-type
+    Z16_ADD, Z16_SUB, Z16_SLT, Z16_SLTU, Z16_SLL, Z16_SRL, Z16_SRA,
+    Z16_OR, Z16_AND, Z16_XOR, Z16_MV, Z16_JR, Z16_JALR,
+    // I-type
+    Z16_ADDI, Z16_SLTI, Z16_SLTUI, Z16_SLLI, Z16_SRLI, Z16_SRAI,
+    Z16_ORI, Z16_ANDI, Z16_XORI, Z16_LI,
+    // B-type
+    Z16_BEQ, Z16_BNE, Z16_BZ, Z16_BNZ, Z16_BLT, Z16_BGE, Z16_BLTU, Z16_BGEU,
+    // S-type / L-type
+    Z16_SB, Z16_SW,
+    Z16_LB, Z16_LW, Z16_LBU,
+    // J-type / U-type / SYS-type
+    Z16_J, Z16_JAL,
+    Z16_LUI, Z16_AUIPC,
+    Z16_ECALL,
+    // Shared handler for every invalid encoding
+    Z16_TRAP,
+    Z16_NUM_OPS
+};
+
+// One pre-decoded instruction. Field meaning follows the encoding:
+//   rd  - bits [8:6] (rd/rs1 for R/I/U/J, rs1 for B, base for S, rd for L)
+//   rs2 - bits [11:9] (rs2 for R/B, data for S, base for L)
+//   imm - already sign-extended: I/S/L immediates, the PC-relative byte offset
+//         for B/J (target = pc + imm), the shifted value for U, svc for SYS
+struct z16decoded {
+    uint8_t op;
+    uint8_t rd;
+    uint8_t rs2;
+    int16_t imm;
+};
+
+constexpr z16decoded z16decode(uint16_t inst) {
+    uint8_t opcode = inst & 0x7;
+    uint8_t rd = (inst >> 6) & 0x7;
+    uint8_t rs2 = (inst >> 9) & 0x7;
+    uint8_t funct3 = (inst >> 3) & 0x7;
+    z16decoded d = {Z16_TRAP, rd, rs2, 0};
+
+    switch (opcode) {
+        case 0x0: { // R-type: funct4 and funct3 must agree
+            constexpr uint8_t ops[16] = {Z16_ADD, Z16_SUB, Z16_SLT, Z16_SLTU, Z16_SLL, Z16_SRL, Z16_SRA, Z16_OR,
+                                         Z16_AND, Z16_XOR, Z16_MV, Z16_JR, Z16_JALR, Z16_TRAP, Z16_TRAP, Z16_TRAP};
+            constexpr uint8_t funct3s[16] = {0, 0, 1, 2, 3, 3, 3, 4, 5, 6, 7, 0, 0, 0xFF, 0xFF, 0xFF};
+            uint8_t funct4 = (inst >> 12) & 0xF;
+            if (funct3s[funct4] == funct3) d.op = ops[funct4];
+            break;
+        }
+        case 0x1: { // I-type
+            int16_t imm = (inst >> 9) & 0x7F;
+            if (imm & 0x40) imm |= (int16_t)0xFF80;
+            d.imm = imm;
+            constexpr uint8_t ops[8] = {Z16_ADDI, Z16_SLTI, Z16_SLTUI, Z16_TRAP, Z16_ORI, Z16_ANDI, Z16_XORI, Z16_LI};
+            d.op = ops[funct3];
+            if (funct3 == 0x3) { // Shift immediates: type in imm[6:4], shamt in imm[3:0]
+                uint8_t shift_type = (imm >> 4) & 0x7;
+                d.imm = imm & 0xF;
+                if (shift_type == 0x1) d.op = Z16_SLLI;
+                else if (shift_type == 0x2) d.op = Z16_SRLI;
+                else if (shift_type == 0x4) d.op = Z16_SRAI;
+            }
+            break;
+        }
+        case 0x2: { // B-type: imm[4:1] scaled the same way executeInstruction() always has
+            int16_t offset = ((inst >> 12) & 0xF) << 1;
+            if (offset & 0x10) offset |= (int16_t)0xFFE0;
+            d.imm = 2 + offset * 2;
+            d.op = Z16_BEQ + funct3;
+            break;
+        }
+        case 0x3: // S-type
+        case 0x4: { // L-type
+            uint8_t imm4 = (inst >> 12) & 0xF;
+            d.imm = (imm4 & 0x8) ? (int16_t)(imm4 | 0xFFF0) : imm4;
+            if (opcode == 0x3) {
+                if (funct3 == 0x0) d.op = Z16_SB;
+                else if (funct3 == 0x1) d.op = Z16_SW;
+            } else {
+                if (funct3 == 0x0) d.op = Z16_LB;
+                else if (funct3 == 0x1) d.op = Z16_LW;
+                else if (funct3 == 0x4) d.op = Z16_LBU;
+            }
+            break;
+        }
+        case 0x5: { // J-type
+            int16_t imm = (((inst >> 9) & 0x3F) << 4) | (funct3 << 1);
+            if (imm & 0x200) imm |= (int16_t)0xFC00;
+            d.imm = imm;
+            d.op = ((inst >> 15) & 0x1) ? Z16_JAL : Z16_J;
+            break;
+        }
+        case 0x6: { // U-type
+            uint16_t u_imm = ((inst >> 3) & 0x7) | ((inst >> 6) & 0x1F8);
+            d.imm = (int16_t)(uint16_t)(u_imm << 8);
+            d.op = ((inst >> 15) & 0x1) ? Z16_AUIPC : Z16_LUI;
+            break;
+        }
+        case 0x7: { // SYS-type
+            d.imm = (inst >> 6) & 0x3FF;
+            if (funct3 == 0x0) d.op = Z16_ECALL;
+            break;
+        }
+    }
+    return d;
+}
+
+constexpr std::array<z16decoded, 65536> z16buildDecodeTable() {
+    std::array<z16decoded, 65536> table{};
+    for (uint32_t inst = 0; inst < table.size(); ++inst) {
+        table[inst] = z16decode((uint16_t)inst);
+    }
+    return table;
+}
+
+// Decode of the whole 16-bit encoding space, built at compile time
+extern const std::array<z16decoded, 65536> z16decodeTable;
+
+#endif // Z16DECODE_H
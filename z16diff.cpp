@@ -0,0 +1,122 @@
+#include "z16diff.h"
+#include <algorithm>
+#include <cstdio>
+#include <ostream>
+
+// z16diffChecker constructor definition
+z16diffChecker::z16diffChecker(z16sim& reference, z16sim& candidate, uint64_t chunk)
+    : ref(reference), cand(candidate), chunk(chunk ? chunk : 1), status(0) {
+    this->ref.setEngine(Z16_ENGINE_INTERP);
+}
+
+// run method definition
+bool z16diffChecker::run(uint64_t max_instructions) {
+    uint64_t done = 0;
+    while (done < max_instructions) {
+        uint64_t len = std::min(this->chunk, max_instructions - done);
+        z16snapshot ref_start = this->ref.snapshot();
+        z16snapshot cand_start = this->cand.snapshot();
+        int ref_status = this->ref.run(len);
+        int cand_status = this->cand.run(len);
+        std::string what = z16diffChecker::compare(ref_status, cand_status);
+        if (!what.empty()) {
+            z16diffChecker::locate(ref_start, cand_start, len, what);
+            return false;
+        }
+        this->status = ref_status;
+        if (ref_status != 0) {
+            break;
+        }
+        done += len;
+    }
+    return true;
+}
+
+// compare method definition: empty when both states match
+std::string z16diffChecker::compare(int ref_status, int cand_status) {
+    char buf[96];
+    if (ref_status != cand_status) {
+        std::snprintf(buf, sizeof(buf), "run status %d vs %d", ref_status, cand_status);
+    } else if (this->ref.getInstructionCount() != this->cand.getInstructionCount()) {
+        std::snprintf(buf, sizeof(buf), "instruction count %llu vs %llu", (unsigned long long)this->ref.getInstructionCount(),
+                      (unsigned long long)this->cand.getInstructionCount());
+    } else if (this->ref.getPC() != this->cand.getPC()) {
+        std::snprintf(buf, sizeof(buf), "pc: 0x%04X vs 0x%04X", this->ref.getPC(), this->cand.getPC());
+    } else {
+        for (int i = 0; i < z16sim::NUM_REGS; ++i) {
+            if (this->ref.getReg(i) != this->cand.getReg(i)) {
+                std::snprintf(buf, sizeof(buf), "%s: 0x%04X vs 0x%04X", z16sim::regNames[i], this->ref.getReg(i), this->cand.getReg(i));
+                return buf;
+            }
+        }
+        if (this->ref.memoryHash() == this->cand.memoryHash()) {
+            return std::string();
+        }
+        const unsigned char* a = this->ref.getMemory();
+        const unsigned char* b = this->cand.getMemory();
+        int addr = 0;
+        while (addr < z16sim::MEM_SIZE - 1 && a[addr] == b[addr]) {
+            ++addr;
+        }
+        std::snprintf(buf, sizeof(buf), "memory at 0x%04X: 0x%02X vs 0x%02X", addr, a[addr], b[addr]);
+    }
+    return buf;
+}
+
+// locate method definition: bisects for the shortest prefix of the chunk
+// after which the two disagree, then leaves both just past it
+void z16diffChecker::locate(const z16snapshot& ref_start, const z16snapshot& cand_start, uint64_t len, const std::string& what) {
+    auto replay = [&](uint64_t n) {
+        this->ref.restore(ref_start);
+        this->cand.restore(cand_start);
+        int ref_status = this->ref.run(n);
+        int cand_status = this->cand.run(n);
+        return z16diffChecker::compare(ref_status, cand_status);
+    };
+
+    uint64_t lo = 0, hi = len; // Agree after lo instructions, disagree after hi
+    while (hi - lo > 1) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (replay(mid).empty()) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    // Context: the reference's last instructions up to the diverging one
+    this->divergence = z16divergence();
+    this->ref.restore(ref_start);
+    for (uint64_t i = 0; i < hi; ++i) {
+        uint16_t pc = this->ref.getPC();
+        if (i + z16diffChecker::CONTEXT >= hi && pc < z16sim::MEM_SIZE - 1) {
+            uint16_t inst = this->ref.getMemory()[pc] | (this->ref.getMemory()[pc + 1] << 8);
+            char disasm_buf[256];
+            this->ref.disassemble(inst, pc, disasm_buf, sizeof(disasm_buf));
+            char line[300];
+            std::snprintf(line, sizeof(line), "0x%04X: %04X  %s", pc, inst, disasm_buf);
+            this->divergence.context.push_back(line);
+        }
+        this->divergence.count = this->ref.getInstructionCount();
+        this->divergence.pc = pc;
+        if (this->ref.run(1) != 0) {
+            break;
+        }
+    }
+
+    this->divergence.what = replay(hi);
+    if (this->divergence.what.empty()) { // Only seen at chunk granularity
+        this->divergence.what = what + " (not reproduced by a shorter run)";
+    }
+}
+
+// report method definition
+void z16diffChecker::report(std::ostream& os) const {
+    char buf[96];
+    std::snprintf(buf, sizeof(buf), "Divergence after %llu instructions, at PC 0x%04X: ",
+                  (unsigned long long)this->divergence.count, this->divergence.pc);
+    os << buf << this->divergence.what << " (reference vs candidate)" << std::endl;
+    for (const std::string& line : this->divergence.context) {
+        os << "  " << line << std::endl;
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef Z16DIFF_H
+#define Z16DIFF_H
+
+#include "z16sim.h"
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// First point where a candidate engine left a different state than the
+// reference interpreter (z16diffChecker)
+struct z16divergence {
+    uint64_t count = 0;               // Instructions both retired before the diverging one
+    uint16_t pc = 0;                  // Address of the diverging instruction
+    std::string what;                 // "x3: 0x0004 vs 0x0005", "memory at 0x0120: ...", ...
+    std::vector<std::string> context; // Disassembly leading up to it, the diverging one last
+};
+
+// Differential lockstep check of one execution engine against the
+// interpreter. The caller sets up both simulators with the same program,
+// memory map and console input; the reference is switched to the
+// interpreter. run() gives both the same budget a chunk at a time and
+// compares run status, instruction count, PC, registers and a hash of memory
+// after each chunk (a chunk of 1 compares after every instruction). On a
+// mismatch both are put back to the snapshot taken at the start of the chunk
+// and the shortest prefix of it that already disagrees is found by
+// bisection, so the report names the first instruction the two differ
+// after. The JIT only runs whole blocks natively, so for translated code that
+// is the last instruction of the block the divergence shows up in, and a
+// chunk of 1 keeps it on the interpreted path. Device state and console
+// output are not rolled back by the search.
+class z16diffChecker {
+public:
+    static const uint64_t DEFAULT_CHUNK = 1024;
+    static const int CONTEXT = 8; // Instructions shown up to the divergence
+
+    z16diffChecker(z16sim& reference, z16sim& candidate, uint64_t chunk = DEFAULT_CHUNK);
+
+    // Runs both until they stop, disagree or retire max_instructions. Returns
+    // false on a divergence; otherwise getStatus() is the common run status.
+    bool run(uint64_t max_instructions);
+    int getStatus() const { return status; }
+    const z16divergence& getDivergence() const { return divergence; }
+    // Writes the divergence with its disassembled context
+    void report(std::ostream& os) const;
+
+private:
+    z16sim& ref;
+    z16sim& cand;
+    uint64_t chunk;
+    int status;
+    z16divergence divergence;
+
+    std::string compare(int ref_status, int cand_status);
+    void locate(const z16snapshot& ref_start, const z16snapshot& cand_start, uint64_t len, const std::string& what);
+};
+
+#endif // Z16DIFF_H
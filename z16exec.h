@@ -0,0 +1,145 @@
+#ifndef Z16EXEC_H
+#define Z16EXEC_H
+
+// Instruction semantics shared by every execution engine. Included only by the
+// simulator's own translation units so the hot loops can inline it.
+
+#include "z16sim.h"
+#include "z16decode.h"
+
+// execute method definition
+inline int z16sim::execute(const z16decoded& d, uint16_t inst) {
+    uint16_t* r = this->regs;
+    uint16_t mem_addr;
+
+    switch (d.op) {
+        // R-type: rd is both destination and first source
+        case Z16_ADD:  r[d.rd] = r[d.rd] + r[d.rs2]; break;
+        case Z16_SUB:  r[d.rd] = r[d.rd] - r[d.rs2]; break;
+        case Z16_SLT:  r[d.rd] = ((int16_t)r[d.rd] < (int16_t)r[d.rs2]) ? 1 : 0; break;
+        case Z16_SLTU: r[d.rd] = (r[d.rd] < r[d.rs2]) ? 1 : 0; break;
+        case Z16_SLL:  r[d.rd] = r[d.rd] << (r[d.rs2] & 0xF); break; // Only use lower 4 bits for shift amount
+        case Z16_SRL:  r[d.rd] = r[d.rd] >> (r[d.rs2] & 0xF); break;
+        case Z16_SRA:  r[d.rd] = (int16_t)r[d.rd] >> (r[d.rs2] & 0xF); break;
+        case Z16_OR:   r[d.rd] = r[d.rd] | r[d.rs2]; break;
+        case Z16_AND:  r[d.rd] = r[d.rd] & r[d.rs2]; break;
+        case Z16_XOR:  r[d.rd] = r[d.rd] ^ r[d.rs2]; break;
+        case Z16_MV:   r[d.rd] = r[d.rs2]; break;
+        case Z16_JR:
+            this->pc = r[d.rd];
+            return 0;
+        case Z16_JALR: // rd receives the link before rs2 is read
+            r[d.rd] = this->pc + 2;
+            this->pc = r[d.rs2];
+            return 0;
+
+        // I-type
+        case Z16_ADDI:  r[d.rd] = r[d.rd] + d.imm; break;
+        case Z16_SLTI:  r[d.rd] = ((int16_t)r[d.rd] < d.imm) ? 1 : 0; break;
+        case Z16_SLTUI: r[d.rd] = (r[d.rd] < (uint16_t)d.imm) ? 1 : 0; break;
+        case Z16_SLLI:  r[d.rd] = r[d.rd] << d.imm; break;
+        case Z16_SRLI:  r[d.rd] = r[d.rd] >> d.imm; break;
+        case Z16_SRAI:  r[d.rd] = (int16_t)r[d.rd] >> d.imm; break;
+        case Z16_ORI:   r[d.rd] = r[d.rd] | d.imm; break;
+        case Z16_ANDI:  r[d.rd] = r[d.rd] & d.imm; break;
+        case Z16_XORI:  r[d.rd] = r[d.rd] ^ d.imm; break;
+        case Z16_LI:    r[d.rd] = d.imm; break;
+
+        // B-type
+        case Z16_BEQ:  if (r[d.rd] == r[d.rs2]) goto branch_taken; break;
+        case Z16_BNE:  if (r[d.rd] != r[d.rs2]) goto branch_taken; break;
+        case Z16_BZ:   if (r[d.rd] == 0) goto branch_taken; break;
+        case Z16_BNZ:  if (r[d.rd] != 0) goto branch_taken; break;
+        case Z16_BLT:  if ((int16_t)r[d.rd] < (int16_t)r[d.rs2]) goto branch_taken; break;
+        case Z16_BGE:  if ((int16_t)r[d.rd] >= (int16_t)r[d.rs2]) goto branch_taken; break;
+        case Z16_BLTU: if (r[d.rd] < r[d.rs2]) goto branch_taken; break;
+        case Z16_BGEU: if (r[d.rd] >= r[d.rs2]) goto branch_taken; break;
+
+        // S-type: rd is the base register, rs2 the data. Stores to RAM stay
+        // inline; ROM and device pages take busAccess().
+        case Z16_SB:
+            mem_addr = r[d.rd] + d.imm;
+            if (this->busFlags[mem_addr >> z16blockCache::PAGE_SHIFT] & Z16_BUS_STORE_TRAP) {
+                return z16sim::busAccess(d, mem_addr);
+            }
+            this->memory[mem_addr] = (unsigned char)(r[d.rs2] & 0xFF);
+            this->dirtyPages[mem_addr >> z16blockCache::PAGE_SHIFT] = 1;
+            if (this->codePages[mem_addr >> z16blockCache::PAGE_SHIFT]) {
+                z16sim::invalidateCode(mem_addr, 1);
+            }
+            break;
+        case Z16_SW: // Aligned, so both bytes are in one page
+            mem_addr = r[d.rd] + d.imm;
+            if (mem_addr & 1) {
+                return z16sim::memoryFault("misaligned", "word store", mem_addr);
+            }
+            if (this->busFlags[mem_addr >> z16blockCache::PAGE_SHIFT] & Z16_BUS_STORE_TRAP) {
+                return z16sim::busAccess(d, mem_addr);
+            }
+            this->memory[mem_addr] = (unsigned char)(r[d.rs2] & 0xFF);
+            this->memory[mem_addr + 1] = (unsigned char)((r[d.rs2] >> 8) & 0xFF);
+            this->dirtyPages[mem_addr >> z16blockCache::PAGE_SHIFT] = 1;
+            if (this->codePages[mem_addr >> z16blockCache::PAGE_SHIFT]) {
+                z16sim::invalidateCode(mem_addr, 2);
+            }
+            break;
+
+        // L-type: rs2 is the base register. Loads from RAM and ROM stay inline.
+        case Z16_LB:
+            mem_addr = r[d.rs2] + d.imm;
+            if (this->busFlags[mem_addr >> z16blockCache::PAGE_SHIFT] & Z16_BUS_LOAD_TRAP) {
+                return z16sim::busAccess(d, mem_addr);
+            }
+            r[d.rd] = (int8_t)this->memory[mem_addr]; // Sign-extend byte to 16-bit
+            break;
+        case Z16_LW:
+            mem_addr = r[d.rs2] + d.imm;
+            if (mem_addr & 1) {
+                return z16sim::memoryFault("misaligned", "word load", mem_addr);
+            }
+            if (this->busFlags[mem_addr >> z16blockCache::PAGE_SHIFT] & Z16_BUS_LOAD_TRAP) {
+                return z16sim::busAccess(d, mem_addr);
+            }
+            r[d.rd] = (this->memory[mem_addr + 1] << 8) | this->memory[mem_addr];
+            break;
+        case Z16_LBU:
+            mem_addr = r[d.rs2] + d.imm;
+            if (this->busFlags[mem_addr >> z16blockCache::PAGE_SHIFT] & Z16_BUS_LOAD_TRAP) {
+                return z16sim::busAccess(d, mem_addr);
+            }
+            r[d.rd] = this->memory[mem_addr]; // Zero-extend byte to 16-bit
+            break;
+
+        // J-type
+        case Z16_JAL:
+            r[d.rd] = this->pc + 2;
+            [[fallthrough]];
+        case Z16_J:
+            this->pc = this->pc + d.imm;
+            return 0;
+
+        // U-type
+        case Z16_LUI:   r[d.rd] = d.imm; break;
+        case Z16_AUIPC: r[d.rd] = this->pc + d.imm; break;
+
+        // SYS-type
+        case Z16_ECALL: { // Services return 0 and continue; exit and errors stop here
+            int status = z16sim::ecall(d.imm);
+            if (status != 0) {
+                return status;
+            }
+            break;
+        }
+
+        default:
+            return z16sim::trap(inst);
+    }
+    this->pc += 2;
+    return 0;
+
+branch_taken:
+    this->pc = this->pc + d.imm;
+    return 0;
+}
+
+#endif // Z16EXEC_H
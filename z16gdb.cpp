@@ -0,0 +1,553 @@
+#include "z16gdb.h"
+#include "z16sim.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
+#include <vector>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char HEX[] = "0123456789abcdef";
+
+int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Reads hex digits from s at pos (advancing it); false if there are none
+// or more than fit in 32 bits
+bool parseHex(const std::string& s, size_t& pos, uint32_t& value) {
+    size_t start = pos;
+    value = 0;
+    for (; pos < s.size() && hexDigit(s[pos]) >= 0; ++pos) {
+        value = (value << 4) | hexDigit(s[pos]);
+    }
+    return pos > start && pos - start <= 8;
+}
+
+void appendByte(std::string& out, uint8_t b) {
+    out += HEX[b >> 4];
+    out += HEX[b & 15];
+}
+
+// Registers go over the wire in target (little-endian) byte order
+void appendWord(std::string& out, uint16_t w) {
+    appendByte(out, w & 0xFF);
+    appendByte(out, w >> 8);
+}
+
+bool parseWord(const std::string& s, size_t pos, uint16_t& w) {
+    if (pos + 4 > s.size()) {
+        return false;
+    }
+    int d[4];
+    for (int i = 0; i < 4; ++i) {
+        if ((d[i] = hexDigit(s[pos + i])) < 0) {
+            return false;
+        }
+    }
+    w = (uint16_t)((d[0] << 4 | d[1]) | (d[2] << 4 | d[3]) << 8);
+    return true;
+}
+
+} // namespace
+
+// z16gdbStub constructor
+z16gdbStub::z16gdbStub(z16sim& sim) : sim(sim), listenFd(-1), fd(-1), noAck(false), status(0), lastStop("S05") {
+}
+
+// z16gdbStub destructor
+z16gdbStub::~z16gdbStub() {
+    z16gdbStub::closeAll();
+}
+
+// closeAll method definition
+void z16gdbStub::closeAll() {
+#ifndef _WIN32
+    if (this->fd >= 0) {
+        close(this->fd);
+    }
+    if (this->listenFd >= 0) {
+        close(this->listenFd);
+    }
+    if (!this->unixPath.empty()) {
+        unlink(this->unixPath.c_str());
+        this->unixPath.clear();
+    }
+#endif
+    this->fd = this->listenFd = -1;
+}
+
+// listen method definition
+bool z16gdbStub::listen(const std::string& address, std::ostream& err) {
+#ifdef _WIN32
+    err << "Error: The GDB stub needs POSIX sockets, which this host does not have." << std::endl;
+    return false;
+#else
+    if (address.rfind("unix:", 0) == 0) {
+        std::string path = address.substr(5);
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+            err << "Error: Bad socket path " << path << std::endl;
+            return false;
+        }
+        std::memcpy(addr.sun_path, path.c_str(), path.size());
+        this->listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        unlink(path.c_str()); // A socket left behind by an earlier run
+        if (this->listenFd < 0 || bind(this->listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+            ::listen(this->listenFd, 1) != 0) {
+            err << "Error: Could not listen on " << path << ": " << std::strerror(errno) << std::endl;
+            z16gdbStub::closeAll();
+            return false;
+        }
+        this->unixPath = path;
+    } else {
+        size_t colon = address.rfind(':');
+        std::string host = colon == std::string::npos ? "127.0.0.1" : address.substr(0, colon);
+        std::string port = colon == std::string::npos ? address : address.substr(colon + 1);
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        char* end = nullptr;
+        unsigned long number = std::strtoul(port.c_str(), &end, 10);
+        if (port.empty() || *end != '\0' || number > 0xFFFF || inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+            err << "Error: Bad GDB address " << address << " (expected PORT, HOST:PORT or unix:PATH)" << std::endl;
+            return false;
+        }
+        addr.sin_port = htons((uint16_t)number);
+        this->listenFd = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        if (this->listenFd >= 0) {
+            setsockopt(this->listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        }
+        if (this->listenFd < 0 || bind(this->listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+            ::listen(this->listenFd, 1) != 0) {
+            err << "Error: Could not listen on " << address << ": " << std::strerror(errno) << std::endl;
+            z16gdbStub::closeAll();
+            return false;
+        }
+    }
+    err << "Waiting for GDB on " << address << std::endl;
+    return true;
+#endif
+}
+
+// serve method definition
+int z16gdbStub::serve() {
+#ifndef _WIN32
+    this->fd = accept(this->listenFd, nullptr, nullptr);
+    if (this->fd < 0) {
+        z16gdbStub::closeAll();
+        return this->status;
+    }
+    int one = 1;
+    setsockopt(this->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // Fails harmlessly on Unix sockets
+
+    std::string packet;
+    while (z16gdbStub::readPacket(packet)) {
+        std::string reply;
+        size_t pos = 1;
+        uint32_t n, value;
+        switch (packet[0]) {
+            case '?':
+                reply = this->lastStop;
+                break;
+            case 'g':
+                reply = z16gdbStub::readRegisters();
+                break;
+            case 'G': {
+                uint16_t w[z16sim::NUM_REGS + 1];
+                reply = "OK";
+                for (int i = 0; i <= z16sim::NUM_REGS && reply == "OK"; ++i) {
+                    if (!parseWord(packet, 1 + 4 * i, w[i])) {
+                        reply = "E01";
+                    }
+                }
+                if (reply == "OK") {
+                    for (int i = 0; i < z16sim::NUM_REGS; ++i) {
+                        this->sim.setReg(i, w[i]);
+                    }
+                    this->sim.setPC(w[z16sim::NUM_REGS]);
+                }
+                break;
+            }
+            case 'p':
+                if (parseHex(packet, pos, n) && n <= (uint32_t)z16sim::NUM_REGS) {
+                    appendWord(reply, n == z16sim::NUM_REGS ? this->sim.getPC() : this->sim.getReg(n));
+                } else {
+                    reply = "E01";
+                }
+                break;
+            case 'P': {
+                uint16_t w;
+                if (parseHex(packet, pos, n) && n <= (uint32_t)z16sim::NUM_REGS && pos < packet.size() &&
+                    packet[pos] == '=' && parseWord(packet, pos + 1, w)) {
+                    if (n == z16sim::NUM_REGS) {
+                        this->sim.setPC(w);
+                    } else {
+                        this->sim.setReg(n, w);
+                    }
+                    reply = "OK";
+                } else {
+                    reply = "E01";
+                }
+                break;
+            }
+            case 'm':
+                reply = z16gdbStub::readMemory(packet.substr(1));
+                break;
+            case 'M':
+                reply = z16gdbStub::writeMemory(packet.substr(1));
+                break;
+            case 'c':
+            case 's':
+                if (parseHex(packet, pos, value)) {
+                    this->sim.setPC((uint16_t)value);
+                }
+                reply = z16gdbStub::resume(packet[0] == 's');
+                break;
+            case 'b':
+                if (packet == "bs" || packet == "bc") {
+                    reply = z16gdbStub::reverse(packet[1] == 's');
+                }
+                break;
+            case 'Z':
+            case 'z':
+                reply = z16gdbStub::debugPoint(packet);
+                break;
+            case 'H':
+            case 'T':
+                reply = "OK"; // One thread
+                break;
+            case 'k':
+                z16gdbStub::closeAll();
+                return this->status;
+            case 'D':
+                z16gdbStub::sendPacket("OK");
+                z16gdbStub::closeAll();
+                return this->status;
+            case 'q':
+                if (packet.rfind("qSupported", 0) == 0) {
+                    reply = "PacketSize=4000;qXfer:features:read+;swbreak+;hwbreak+;QStartNoAckMode+";
+                    if (this->sim.getRecorder()) {
+                        reply += ";ReverseStep+;ReverseContinue+";
+                    }
+                } else if (packet.rfind("qXfer:features:read:", 0) == 0) {
+                    reply = z16gdbStub::readFeatures(packet.substr(20));
+                } else if (packet == "qAttached") {
+                    reply = "1";
+                } else if (packet == "qC") {
+                    reply = "QC1";
+                } else if (packet == "qfThreadInfo") {
+                    reply = "m1";
+                } else if (packet == "qsThreadInfo") {
+                    reply = "l";
+                } else if (packet == "qOffsets") {
+                    reply = "Text=0;Data=0;Bss=0";
+                }
+                break;
+            case 'Q':
+                if (packet == "QStartNoAckMode") {
+                    z16gdbStub::sendPacket("OK");
+                    this->noAck = true;
+                    continue;
+                }
+                break;
+            case 'v':
+                if (packet == "vCont?") {
+                    reply = "vCont;c;C;s;S";
+                } else if (packet.rfind("vCont;", 0) == 0 && packet.size() > 6) {
+                    char action = packet[6]; // The first action covers our one thread
+                    reply = z16gdbStub::resume(action == 's' || action == 'S');
+                } else if (packet.rfind("vKill", 0) == 0) {
+                    z16gdbStub::sendPacket("OK");
+                    z16gdbStub::closeAll();
+                    return this->status;
+                }
+                break;
+            default:
+                break; // Empty reply: not supported
+        }
+        z16gdbStub::sendPacket(reply);
+        if (reply[0] == 'W') {
+            break; // The program exited
+        }
+    }
+#endif
+    z16gdbStub::closeAll();
+    return this->status;
+}
+
+// receive method definition
+bool z16gdbStub::receive() {
+#ifndef _WIN32
+    char buf[4096];
+    ssize_t n = recv(this->fd, buf, sizeof(buf), 0);
+    if (n > 0) {
+        this->input.append(buf, n);
+        return true;
+    }
+#endif
+    return false;
+}
+
+// readPacket method definition: the next "$payload#cs", acknowledged
+// unless no-ack mode is on. Acks and interrupts outside a run are dropped.
+bool z16gdbStub::readPacket(std::string& packet) {
+    while (true) {
+        size_t start = this->input.find('$');
+        if (start == std::string::npos) {
+            this->input.clear();
+        } else {
+            this->input.erase(0, start);
+            size_t hash = this->input.find('#');
+            if (hash != std::string::npos && hash + 3 <= this->input.size()) {
+                packet = this->input.substr(1, hash - 1);
+                int hi = hexDigit(this->input[hash + 1]);
+                int lo = hexDigit(this->input[hash + 2]);
+                this->input.erase(0, hash + 3);
+                uint8_t sum = 0;
+                for (char c : packet) {
+                    sum += (uint8_t)c;
+                }
+                bool ok = hi >= 0 && lo >= 0 && sum == (hi << 4 | lo);
+                if (!this->noAck) {
+#ifndef _WIN32
+                    send(this->fd, ok ? "+" : "-", 1, 0);
+#endif
+                }
+                if (ok && !packet.empty()) {
+                    return true;
+                }
+                continue;
+            }
+        }
+        if (!z16gdbStub::receive()) {
+            return false;
+        }
+    }
+}
+
+// sendPacket method definition
+void z16gdbStub::sendPacket(const std::string& payload) {
+    uint8_t sum = 0;
+    for (char c : payload) {
+        sum += (uint8_t)c;
+    }
+    std::string frame = "$" + payload + "#";
+    appendByte(frame, sum);
+#ifndef _WIN32
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL; // A debugger that went away is a closed connection, not SIGPIPE
+#else
+    const int flags = 0;
+#endif
+    for (size_t sent = 0; sent < frame.size();) {
+        ssize_t n = send(this->fd, frame.data() + sent, frame.size() - sent, flags);
+        if (n <= 0) {
+            return;
+        }
+        sent += n;
+    }
+#endif
+}
+
+// interrupted method definition
+bool z16gdbStub::interrupted() {
+#ifndef _WIN32
+    pollfd p = {this->fd, POLLIN, 0};
+    if (poll(&p, 1, 0) > 0 && !z16gdbStub::receive()) {
+        return true; // Connection closed: stop so serve() notices
+    }
+    size_t pos = this->input.find('\x03');
+    if (pos != std::string::npos) {
+        this->input.erase(pos, 1);
+        return true;
+    }
+#endif
+    return false;
+}
+
+// resume method definition: one instruction, or slices until a stop
+std::string z16gdbStub::resume(bool single_step) {
+    if (single_step) {
+        this->status = this->sim.run(1);
+    } else {
+        while ((this->status = this->sim.run(SLICE)) == 0) {
+            if (z16gdbStub::interrupted()) {
+                this->sim.flushConsole();
+                this->lastStop = "S02"; // SIGINT
+                return this->lastStop;
+            }
+        }
+    }
+    this->sim.flushConsole();
+    this->lastStop = z16gdbStub::stopReply(this->status);
+    return this->lastStop;
+}
+
+// reverse method definition: bs/bc, answered like s/c, or with replaylog
+// once the start of the recording is reached
+std::string z16gdbStub::reverse(bool single_step) {
+    if (!this->sim.getRecorder()) {
+        return "E01";
+    }
+    if (single_step ? this->sim.reverseStep() : this->sim.reverseContinue() == 5) {
+        this->lastStop = z16gdbStub::stopReply(single_step ? 0 : 5);
+    } else {
+        this->lastStop = "T05replaylog:begin;";
+    }
+    return this->lastStop;
+}
+
+// stopReply method definition
+std::string z16gdbStub::stopReply(int run_status) {
+    char buf[32];
+    switch (run_status) {
+        case 0: return "S05";           // Single step done
+        case 1:                         // ecall exit, with the status the program left in a0
+            std::snprintf(buf, sizeof(buf), "W%02x", this->sim.getFault().code & 0xFF);
+            return buf;
+        case 2: return "S04";           // SIGILL: unknown instruction
+        case 3:
+        case 4: return "S0b";           // SIGSEGV: PC or memory fault
+        default: break;
+    }
+    z16stopReason why = this->sim.getStopReason();
+    if (why.kind == Z16_STOP_BREAKPOINT) {
+        return "T05swbreak:;";
+    }
+    const char* kind = why.kind == Z16_STOP_WATCH_READ ? "rwatch" : "watch";
+    if (this->sim.isWatched(why.addr, Z16_WATCH_READ) && this->sim.isWatched(why.addr, Z16_WATCH_WRITE)) {
+        kind = "awatch";
+    }
+    std::snprintf(buf, sizeof(buf), "T05%s:%x;", kind, why.addr);
+    return buf;
+}
+
+// readRegisters method definition: x0-x7, then the PC
+std::string z16gdbStub::readRegisters() const {
+    std::string out;
+    for (int i = 0; i < z16sim::NUM_REGS; ++i) {
+        appendWord(out, this->sim.getReg(i));
+    }
+    appendWord(out, this->sim.getPC());
+    return out;
+}
+
+// readMemory method definition: "ADDR,LEN" from the backing store (device
+// registers are not read, so the debugger causes no side effects)
+std::string z16gdbStub::readMemory(const std::string& args) const {
+    size_t pos = 0;
+    uint32_t addr, len;
+    if (!parseHex(args, pos, addr) || pos >= args.size() || args[pos++] != ',' || !parseHex(args, pos, len) ||
+        addr >= (uint32_t)z16sim::MEM_SIZE) {
+        return "E01";
+    }
+    len = std::min<uint32_t>(len, z16sim::MEM_SIZE - addr);
+    const unsigned char* memory = this->sim.getMemory();
+    std::string out;
+    for (uint32_t i = 0; i < len; ++i) {
+        appendByte(out, memory[addr + i]);
+    }
+    return out;
+}
+
+// writeMemory method definition: "ADDR,LEN:BYTES", tracked like a store so
+// cached and translated code is invalidated
+std::string z16gdbStub::writeMemory(const std::string& args) {
+    size_t pos = 0;
+    uint32_t addr, len;
+    if (!parseHex(args, pos, addr) || pos >= args.size() || args[pos++] != ',' || !parseHex(args, pos, len) ||
+        pos >= args.size() || args[pos++] != ':' || args.size() - pos != 2 * (size_t)len ||
+        addr >= (uint32_t)z16sim::MEM_SIZE || len > (uint32_t)z16sim::MEM_SIZE - addr) {
+        return "E01";
+    }
+    std::vector<unsigned char> bytes(len);
+    for (uint32_t i = 0; i < len; ++i) {
+        int hi = hexDigit(args[pos + 2 * i]);
+        int lo = hexDigit(args[pos + 2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            return "E01";
+        }
+        bytes[i] = (unsigned char)(hi << 4 | lo);
+    }
+    this->sim.writeMemory((uint16_t)addr, bytes.data(), len);
+    return "OK";
+}
+
+// debugPoint method definition: "Z<type>,ADDR,KIND" inserts, "z..." removes.
+// Types 0 and 1 are breakpoints; 2, 3 and 4 watch KIND bytes for writes,
+// reads or both.
+std::string z16gdbStub::debugPoint(const std::string& packet) {
+    size_t pos = 3;
+    uint32_t addr, kind;
+    if (packet.size() < 4 || packet[2] != ',' || !parseHex(packet, pos, addr) || pos >= packet.size() ||
+        packet[pos++] != ',' || !parseHex(packet, pos, kind) || addr >= (uint32_t)z16sim::MEM_SIZE) {
+        return "E01";
+    }
+    bool insert = packet[0] == 'Z';
+    switch (packet[1]) {
+        case '0':
+        case '1':
+            this->sim.setBreakpoint((uint16_t)addr, insert);
+            return "OK";
+        case '2':
+            this->sim.setWatchpoint((uint16_t)addr, kind, Z16_WATCH_WRITE, insert);
+            return "OK";
+        case '3':
+            this->sim.setWatchpoint((uint16_t)addr, kind, Z16_WATCH_READ, insert);
+            return "OK";
+        case '4':
+            this->sim.setWatchpoint((uint16_t)addr, kind, Z16_WATCH_READ | Z16_WATCH_WRITE, insert);
+            return "OK";
+        default:
+            return "";
+    }
+}
+
+// readFeatures method definition: "target.xml:OFFSET,LENGTH"
+std::string z16gdbStub::readFeatures(const std::string& annex) const {
+    if (annex.rfind("target.xml:", 0) != 0) {
+        return "E00";
+    }
+    std::string xml =
+        "<?xml version=\"1.0\"?>\n"
+        "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+        "<target version=\"1.0\">\n"
+        "  <feature name=\"org.zx16.core\">\n";
+    for (int i = 0; i < z16sim::NUM_REGS; ++i) {
+        xml += "    <reg name=\"" + std::string(z16sim::regNames[i]) + "\" bitsize=\"16\" type=\"int\"/>\n";
+    }
+    xml += "    <reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>\n"
+           "  </feature>\n"
+           "</target>\n";
+
+    size_t pos = 11;
+    uint32_t offset, length;
+    if (!parseHex(annex, pos, offset) || pos >= annex.size() || annex[pos++] != ',' || !parseHex(annex, pos, length)) {
+        return "E01";
+    }
+    if (offset >= xml.size()) {
+        return "l";
+    }
+    std::string chunk = xml.substr(offset, length);
+    return (offset + chunk.size() < xml.size() ? "m" : "l") + chunk;
+}
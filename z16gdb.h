@@ -0,0 +1,58 @@
+#ifndef Z16GDB_H
+#define Z16GDB_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+class z16sim;
+
+// GDB Remote Serial Protocol server for one simulator. The debugger sees
+// eight 16-bit registers x0-x7 and the PC (described to it by target.xml),
+// reads and writes memory, sets software/hardware breakpoints (Z0/Z1) and
+// write, read and access watchpoints (Z2-Z4), single-steps and continues,
+// and steps and continues backwards (bs/bc) while the simulator records.
+// Continuing runs the simulator's own engine in large slices, polling the
+// connection between them for an interrupt (Ctrl-C), so programs run at full
+// speed between stops. POSIX hosts only.
+class z16gdbStub {
+public:
+    static const uint64_t SLICE = 1 << 20; // Instructions between interrupt polls
+
+    explicit z16gdbStub(z16sim& sim);
+    ~z16gdbStub();
+
+    // Listens on "PORT" or "HOST:PORT" (TCP, host defaults to 127.0.0.1) or
+    // "unix:PATH" and prints where on err
+    bool listen(const std::string& address, std::ostream& err);
+    // Waits for a debugger and serves it until it detaches or kills the
+    // program, the program exits or the connection drops. Returns the last
+    // run status (see z16sim::run).
+    int serve();
+
+private:
+    z16sim& sim;
+    int listenFd;
+    int fd;
+    std::string unixPath; // Removed again on close
+    std::string input;    // Received, not yet parsed
+    bool noAck;
+    int status;           // Of the last run
+    std::string lastStop; // Reply to '?'
+
+    bool receive();       // Appends what arrives to input; false once closed
+    bool readPacket(std::string& packet);
+    void sendPacket(const std::string& payload);
+    bool interrupted();   // Ctrl-C received while running
+    std::string resume(bool single_step);
+    std::string reverse(bool single_step);
+    std::string stopReply(int run_status);
+    std::string readRegisters() const;
+    std::string readMemory(const std::string& args) const;
+    std::string writeMemory(const std::string& args);
+    std::string debugPoint(const std::string& packet);
+    std::string readFeatures(const std::string& annex) const;
+    void closeAll();
+};
+
+#endif // Z16GDB_H
@@ -0,0 +1,345 @@
+#include "z16gfx.h"
+#include "z16sim.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+// z16tileDevice constructor: blank map of tile 0, all-zero tiles and palette
+z16tileDevice::z16tileDevice()
+    : indexed(ROW_BYTES * HEIGHT, 0), rgb(WIDTH * HEIGHT * 3, 0),
+      frames(0), cellsRendered(0), output(OUT_NONE), host(nullptr) {
+    std::memset(this->map, 0, sizeof(this->map));
+    std::memset(this->tiles, 0, sizeof(this->tiles));
+    std::memset(this->palette, 0, sizeof(this->palette));
+    std::memset(this->pairRGB, 0, sizeof(this->pairRGB));
+    std::memset(this->cellDirty, 0, sizeof(this->cellDirty));
+    this->anyCellDirty = false;
+    this->tileDirty = 0;
+    this->paletteDirty = false;
+}
+
+// attach method definition
+void z16tileDevice::attach(z16sim& sim) {
+    sim.mapDevice(BASE, SIZE, this);
+    this->host = &sim;
+}
+
+// openOutput method definition
+bool z16tileDevice::openOutput(const std::string& path, std::ostream& err) {
+    z16tileDevice::closeOutput();
+    size_t conv = path.find('%');
+    if (conv == std::string::npos) {
+        this->stream.open(path, std::ios::binary | std::ios::trunc);
+        if (!this->stream) {
+            err << "Error: Could not open frame output " << path << std::endl;
+            return false;
+        }
+        this->output = OUT_RAW;
+        return true;
+    }
+
+    // One integer conversion ("%d", "%05d"), nothing else for printf to expand
+    size_t end = path.find_first_not_of("0123456789", conv + 1);
+    if (end == std::string::npos || path[end] != 'd' || path.find('%', end) != std::string::npos) {
+        err << "Error: Frame pattern " << path << " needs exactly one %d conversion" << std::endl;
+        return false;
+    }
+    size_t dot = path.rfind('.');
+    bool png = dot != std::string::npos && dot > end && path.compare(dot, std::string::npos, ".png") == 0;
+    this->pattern = path;
+    this->output = png ? OUT_PNG : OUT_PPM;
+    return true;
+}
+
+// closeOutput method definition
+void z16tileDevice::closeOutput() {
+    if (this->stream.is_open()) {
+        this->stream.close();
+    }
+    this->pattern.clear();
+    this->output = OUT_NONE;
+}
+
+// present method definition: with no output open a frame is only counted;
+// rendering waits until someone looks at it
+void z16tileDevice::present() {
+    if (this->output != OUT_NONE) {
+        z16tileDevice::render();
+        z16tileDevice::writeFrame();
+    }
+    ++this->frames;
+}
+
+// getRGB method definition
+const uint8_t* z16tileDevice::getRGB() {
+    z16tileDevice::render();
+    return this->rgb.data();
+}
+
+// read8 method definition
+uint8_t z16tileDevice::read8(uint16_t addr) {
+    if (addr >= TILE_MAP && addr < TILE_MAP + NUM_CELLS) {
+        return this->map[addr - TILE_MAP];
+    }
+    if (addr >= TILE_DATA && addr < TILE_DATA + sizeof(this->tiles)) {
+        return this->tiles[addr - TILE_DATA];
+    }
+    if (addr >= PALETTE && addr < PALETTE + NUM_COLORS) {
+        return this->palette[addr - PALETTE];
+    }
+    if (addr == FRAME_REG) {
+        return this->frames & 0xFF;
+    }
+    if (addr == FRAME_REG + 1) {
+        return (this->frames >> 8) & 0xFF;
+    }
+    return 0; // Unassigned device addresses read as zero
+}
+
+// write8 method definition: only changes that affect the picture mark
+// anything dirty
+void z16tileDevice::write8(uint16_t addr, uint8_t value) {
+    if (addr >= TILE_MAP && addr < TILE_MAP + NUM_CELLS) {
+        int cell = addr - TILE_MAP;
+        if ((this->map[cell] ^ value) & 0x0F) {
+            this->cellDirty[cell] = true;
+            this->anyCellDirty = true;
+        }
+        this->map[cell] = value;
+    } else if (addr >= TILE_DATA && addr < TILE_DATA + sizeof(this->tiles)) {
+        int offset = addr - TILE_DATA;
+        if (this->tiles[offset] != value) {
+            this->tiles[offset] = value;
+            this->tileDirty |= 1 << (offset / TILE_BYTES);
+        }
+    } else if (addr >= PALETTE && addr < PALETTE + NUM_COLORS) {
+        if (this->palette[addr - PALETTE] != value) {
+            this->palette[addr - PALETTE] = value;
+            this->paletteDirty = true;
+        }
+    } else if (addr == FRAME_REG) {
+        z16tileDevice::present();
+    }
+}
+
+// write16 method definition: a word store to FRAME presents once
+void z16tileDevice::write16(uint16_t addr, uint16_t value) {
+    if (addr == FRAME_REG) {
+        z16tileDevice::present();
+        return;
+    }
+    z16tileDevice::write8(addr, value & 0xFF);
+    z16tileDevice::write8(addr + 1, value >> 8);
+}
+
+// service method definition
+bool z16tileDevice::service(z16sim& sim, uint16_t svc) {
+    uint16_t a0 = sim.getReg(z16sim::A0_REG);
+    uint16_t a1 = sim.getReg(z16sim::A1_REG);
+    switch (svc) {
+        case 0x010: // Present a frame
+            z16tileDevice::present();
+            return true;
+        case 0x011: // Set cell a0 to tile a1
+            if (a0 < NUM_CELLS) {
+                z16tileDevice::write8(TILE_MAP + a0, a1 & 0xFF);
+            }
+            return true;
+        case 0x012: // Fill the whole map with tile a0
+            for (int cell = 0; cell < NUM_CELLS; ++cell) {
+                z16tileDevice::write8(TILE_MAP + cell, a0 & 0xFF);
+            }
+            return true;
+        case 0x013: // Set palette entry a0 to the RGB332 colour a1
+            if (a0 < NUM_COLORS) {
+                z16tileDevice::write8(PALETTE + a0, a1 & 0xFF);
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+// markTile method definition: every cell showing tile needs a re-render
+void z16tileDevice::markTile(int tile) {
+    for (int cell = 0; cell < NUM_CELLS; ++cell) {
+        if ((this->map[cell] & 0x0F) == tile) {
+            this->cellDirty[cell] = true;
+            this->anyCellDirty = true;
+        }
+    }
+}
+
+// render method definition: brings indexed[] and rgb[] up to date. A palette
+// change re-renders every cell, a tile change every cell showing that tile.
+void z16tileDevice::render() {
+    if (this->paletteDirty) {
+        uint8_t colors[NUM_COLORS][3];
+        for (int i = 0; i < NUM_COLORS; ++i) {
+            uint8_t c = this->palette[i];
+            colors[i][0] = ((c >> 5) & 7) * 255 / 7;
+            colors[i][1] = ((c >> 2) & 7) * 255 / 7;
+            colors[i][2] = (c & 3) * 85;
+        }
+        for (int pair = 0; pair < 256; ++pair) {
+            std::memcpy(this->pairRGB[pair], colors[pair & 0x0F], 3);
+            std::memcpy(this->pairRGB[pair] + 3, colors[pair >> 4], 3);
+        }
+        std::memset(this->cellDirty, 1, sizeof(this->cellDirty));
+        this->anyCellDirty = true;
+        this->paletteDirty = false;
+    }
+    if (this->tileDirty) {
+        for (int tile = 0; tile < NUM_TILES; ++tile) {
+            if (this->tileDirty & (1 << tile)) {
+                z16tileDevice::markTile(tile);
+            }
+        }
+        this->tileDirty = 0;
+    }
+    if (!this->anyCellDirty) {
+        return;
+    }
+    for (int cell = 0; cell < NUM_CELLS; ++cell) {
+        if (this->cellDirty[cell]) {
+            z16tileDevice::renderCell(cell);
+            this->cellDirty[cell] = false;
+        }
+    }
+    this->anyCellDirty = false;
+}
+
+// renderCell method definition
+void z16tileDevice::renderCell(int cell) {
+    int x = (cell % MAP_COLS) * TILE_SIZE;
+    int y = (cell / MAP_COLS) * TILE_SIZE;
+    const uint8_t* src = this->tiles + (this->map[cell] & 0x0F) * TILE_BYTES;
+    for (int row = 0; row < TILE_SIZE; ++row, src += TILE_SIZE / 2) {
+        uint8_t* idx = &this->indexed[(y + row) * ROW_BYTES + 1 + x / 2];
+        uint8_t* px = &this->rgb[((y + row) * WIDTH + x) * 3];
+        for (int i = 0; i < TILE_SIZE / 2; ++i) {
+            idx[i] = (uint8_t)((src[i] << 4) | (src[i] >> 4)); // PNG puts the left pixel high
+            std::memcpy(px + i * 6, this->pairRGB[src[i]], 6);
+        }
+    }
+    ++this->cellsRendered;
+}
+
+// writeFrame method definition: a failed write reports once and closes the
+// output; the guest keeps running
+void z16tileDevice::writeFrame() {
+    bool ok;
+    if (this->output == OUT_RAW) {
+        this->stream.write((const char*)this->rgb.data(), this->rgb.size());
+        ok = (bool)this->stream;
+    } else {
+        char name[4096];
+        std::snprintf(name, sizeof(name), this->pattern.c_str(), (int)this->frames);
+        std::ofstream file(name, std::ios::binary | std::ios::trunc);
+        if (this->output == OUT_PNG) {
+            ok = file && z16tileDevice::writePNG(file);
+        } else {
+            file << "P6\n" << WIDTH << " " << HEIGHT << "\n255\n";
+            file.write((const char*)this->rgb.data(), this->rgb.size());
+            ok = (bool)file;
+        }
+    }
+    if (!ok) {
+        z16sink& sink = this->host ? this->host->getSink() : z16sink::standard();
+        sink.print(Z16_CHAN_ERROR, "Error: Could not write frame %llu; frame output stopped.\n", (unsigned long long)this->frames);
+        z16tileDevice::closeOutput();
+    }
+}
+
+static uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t len) {
+    static const struct crcTable {
+        uint32_t entries[256];
+        crcTable() {
+            for (uint32_t n = 0; n < 256; ++n) {
+                uint32_t c = n;
+                for (int k = 0; k < 8; ++k) {
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                }
+                entries[n] = c;
+            }
+        }
+    } table;
+    for (size_t i = 0; i < len; ++i) {
+        crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static void putBE32(uint8_t* p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+// Writes one PNG chunk: length, type, data, CRC of type and data
+static void writeChunk(std::ostream& os, const char* type, const uint8_t* data, uint32_t len) {
+    uint8_t head[8];
+    putBE32(head, len);
+    std::memcpy(head + 4, type, 4);
+    uint32_t crc = crc32Update(0xFFFFFFFFu, head + 4, 4);
+    crc = crc32Update(crc, data, len);
+    uint8_t tail[4];
+    putBE32(tail, crc ^ 0xFFFFFFFFu);
+    os.write((const char*)head, 8);
+    os.write((const char*)data, len);
+    os.write((const char*)tail, 4);
+}
+
+// writePNG method definition: a 4-bit indexed PNG. indexed[] already holds
+// the filtered scanlines (filter 0), so the zlib stream is one stored deflate
+// block around it and no compressor is needed.
+bool z16tileDevice::writePNG(std::ostream& os) {
+    static_assert(ROW_BYTES * HEIGHT <= 0xFFFF, "frame must fit one stored deflate block");
+    static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    os.write((const char*)signature, sizeof(signature));
+
+    uint8_t ihdr[13];
+    putBE32(ihdr, WIDTH);
+    putBE32(ihdr + 4, HEIGHT);
+    ihdr[8] = 4;  // Bit depth
+    ihdr[9] = 3;  // Colour type: palette
+    ihdr[10] = 0; // Deflate
+    ihdr[11] = 0; // Adaptive filtering
+    ihdr[12] = 0; // No interlace
+    writeChunk(os, "IHDR", ihdr, sizeof(ihdr));
+
+    uint8_t plte[NUM_COLORS * 3];
+    for (int i = 0; i < NUM_COLORS; ++i) {
+        std::memcpy(plte + i * 3, this->pairRGB[i], 3); // Low nibble of pair i is colour i
+    }
+    writeChunk(os, "PLTE", plte, sizeof(plte));
+
+    const uint8_t* raw = this->indexed.data();
+    uint32_t len = this->indexed.size();
+    uint32_t a = 1, b = 0;
+    for (uint32_t i = 0; i < len;) {
+        uint32_t chunk_end = std::min<uint32_t>(len, i + 5552); // Largest run without 32-bit overflow
+        for (; i < chunk_end; ++i) {
+            a += raw[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+
+    std::vector<uint8_t> idat(2 + 5 + len + 4);
+    idat[0] = 0x78; // zlib: deflate, 32K window
+    idat[1] = 0x01;
+    idat[2] = 1; // Final stored block
+    idat[3] = len & 0xFF;
+    idat[4] = len >> 8;
+    idat[5] = ~len & 0xFF;
+    idat[6] = (~len >> 8) & 0xFF;
+    std::memcpy(&idat[7], raw, len);
+    putBE32(&idat[7 + len], (b << 16) | a);
+    writeChunk(os, "IDAT", idat.data(), idat.size());
+    writeChunk(os, "IEND", nullptr, 0);
+    return (bool)os;
+}
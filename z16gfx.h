@@ -0,0 +1,109 @@
+#ifndef Z16GFX_H
+#define Z16GFX_H
+
+#include "z16bus.h"
+#include <cstdint>
+#include <fstream>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+class z16sim;
+
+// Headless tile graphics device in the MMIO window. The 320x240 screen is a
+// 20x15 grid of cells, each showing one of 16 tiles of 16x16 pixels with 4
+// bits per pixel; the 16 colours are RGB332 palette entries.
+//
+//   0xF000-0xF12B  tile map, one byte per cell, row-major (low 4 bits: tile)
+//   0xF200-0xF9FF  tile definitions, 128 bytes per tile, 8 bytes per pixel
+//                  row, low nibble is the left pixel
+//   0xFA00-0xFA0F  palette, RGB332
+//   0xFA10         FRAME: a store presents a frame, a word load returns the
+//                  number of frames presented so far (low 16 bits)
+//
+// Writes only mark what changed (cells, tile definitions, the palette);
+// presenting re-renders just the cells they affect and hands the frame to the
+// output opened with openOutput().
+class z16tileDevice : public z16device {
+public:
+    static const uint16_t BASE = 0xF000;
+    static const uint32_t SIZE = 0xB00; // 11 pages
+    static const uint16_t TILE_MAP = 0xF000;
+    static const uint16_t TILE_DATA = 0xF200;
+    static const uint16_t PALETTE = 0xFA00;
+    static const uint16_t FRAME_REG = 0xFA10;
+    static const int MAP_COLS = 20;
+    static const int MAP_ROWS = 15;
+    static const int NUM_CELLS = MAP_COLS * MAP_ROWS;
+    static const int NUM_TILES = 16;
+    static const int NUM_COLORS = 16;
+    static const int TILE_SIZE = 16; // Pixels per side
+    static const int TILE_BYTES = TILE_SIZE * TILE_SIZE / 2;
+    static const int WIDTH = MAP_COLS * TILE_SIZE;
+    static const int HEIGHT = MAP_ROWS * TILE_SIZE;
+
+    z16tileDevice();
+
+    // Maps the device at BASE; frame write errors go to sim's sink
+    void attach(z16sim& sim);
+
+    // Where presented frames go. A path containing a printf-style integer
+    // conversion ("frames/f%05d.png") writes one file per frame, PNG for a
+    // .png extension and binary PPM otherwise; any other path is opened once
+    // and receives raw RGB24 frames back to back (a file, pipe or fifo).
+    bool openOutput(const std::string& path, std::ostream& err);
+    void closeOutput();
+
+    // Renders pending changes and writes the frame to the output
+    void present();
+    // Current screen, WIDTH * HEIGHT RGB24 pixels
+    const uint8_t* getRGB();
+
+    uint64_t getFrameCount() const { return frames; }
+    uint64_t getCellsRendered() const { return cellsRendered; }
+
+    uint8_t read8(uint16_t addr) override;
+    void write8(uint16_t addr, uint8_t value) override;
+    void write16(uint16_t addr, uint16_t value) override;
+    // Graphics ecalls: 0x010 present, 0x011 set cell a0 to tile a1,
+    // 0x012 fill the map with tile a0, 0x013 set palette entry a0 to a1
+    bool service(z16sim& sim, uint16_t svc) override;
+
+private:
+    static const int ROW_BYTES = 1 + WIDTH / 2; // PNG scanline: filter byte, 4bpp pixels
+
+    enum outputKind { OUT_NONE, OUT_RAW, OUT_PPM, OUT_PNG };
+
+    uint8_t map[NUM_CELLS];
+    uint8_t tiles[NUM_TILES * TILE_BYTES];
+    uint8_t palette[NUM_COLORS];
+
+    // Dirty state since the last render
+    bool cellDirty[NUM_CELLS];
+    bool anyCellDirty;
+    uint16_t tileDirty; // Bit per tile definition
+    bool paletteDirty;
+
+    // Rendered screen: palette indices laid out as PNG scanlines (filter byte
+    // 0, high nibble left) and the same pixels as RGB24. pairRGB expands one
+    // tile-definition byte (two pixels) to six RGB bytes.
+    std::vector<uint8_t> indexed;
+    std::vector<uint8_t> rgb;
+    uint8_t pairRGB[256][6];
+
+    uint64_t frames;
+    uint64_t cellsRendered;
+
+    outputKind output;
+    std::string pattern;
+    std::ofstream stream;
+    z16sim* host; // Set by attach()
+
+    void markTile(int tile);
+    void render();
+    void renderCell(int cell);
+    void writeFrame();
+    bool writePNG(std::ostream& os);
+};
+
+#endif // Z16GFX_H
@@ -0,0 +1,223 @@
+// zx16_golden: golden-output tests. Every <name>.bin in the test directory is
+// run in-process, on a pool of worker threads, and its output is compared
+// with <name>.expected. The output is what `zx16_simulator <name>.bin` prints
+// when run in that directory: the load message, the instruction trace,
+// errors, the final state and "Simulation finished.". Line endings are
+// normalised, so .expected files written on Windows match. --update writes
+// the current output to the .expected files instead.
+
+#include "z16sim.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct goldenTest {
+    std::string name; // File name without .bin
+    std::string bin;
+    std::string expected;
+
+    // Filled in by the worker that runs the test
+    std::string result; // PASS, FAIL, MISSING (no .expected), UPDATED
+    std::string detail; // First difference, for FAIL
+    double wall_ms = 0;
+};
+
+struct goldenOptions {
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    uint64_t budget = 10000000; // Instructions per test; a test that runs out fails
+    bool update = false;
+};
+
+// Compares expected, read line by line, with the captured output, ignoring a
+// CR before each line feed and a missing line feed at the end. On a mismatch
+// detail names the first differing line.
+static bool compareGolden(std::istream& expected, const std::string& actual, std::string& detail) {
+    std::string want;
+    size_t pos = 0;
+    for (int line = 1;; ++line) {
+        bool have_want = static_cast<bool>(std::getline(expected, want));
+        bool have_got = pos < actual.size();
+        if (!have_want && !have_got) {
+            return true;
+        }
+        size_t end = have_got ? actual.find('\n', pos) : pos;
+        if (end == std::string::npos) {
+            end = actual.size();
+        }
+        std::string got = actual.substr(pos, end - pos);
+        pos = end + 1;
+        if (have_want && !want.empty() && want.back() == '\r') {
+            want.pop_back();
+        }
+        if (have_got && !got.empty() && got.back() == '\r') {
+            got.pop_back();
+        }
+        if (have_want != have_got || want != got) {
+            detail = "line " + std::to_string(line) + ":\n        expected: " + (have_want ? want : "<end of file>") +
+                     "\n        actual:   " + (have_got ? got : "<end of output>");
+            return false;
+        }
+    }
+}
+
+class goldenRunner {
+public:
+    goldenRunner(std::vector<goldenTest>& tests, const goldenOptions& options)
+        : tests(tests), options(options), next(0) {}
+
+    void run() {
+        std::vector<std::thread> workers;
+        for (unsigned id = 0; id < options.threads; ++id) {
+            workers.emplace_back(&goldenRunner::worker, this);
+        }
+        for (std::thread& t : workers) {
+            t.join();
+        }
+    }
+
+private:
+    std::vector<goldenTest>& tests;
+    const goldenOptions& options;
+    std::atomic<size_t> next;
+
+    void worker() {
+        std::unique_ptr<z16sim> sim(new z16sim());
+        size_t index;
+        while ((index = next++) < tests.size()) {
+            goldenTest& test = tests[index];
+            auto start = std::chrono::steady_clock::now();
+            z16bufferSink output;
+            std::istringstream input; // Programs that read the console get end of input
+            sim->setSink(&output);
+            sim->setInput(input);
+            sim->reset();
+            output.clear(); // Drop "Simulator reset."
+            runTest(*sim, test, output);
+            sim->setSink(nullptr);
+            sim->setInput(std::cin);
+
+            if (options.update) {
+                std::ofstream out(test.expected, std::ios::binary);
+                out << output.str();
+                test.result = out ? "UPDATED" : "FAIL";
+                test.detail = out ? "" : "could not write " + test.expected;
+            } else {
+                std::ifstream expected(test.expected, std::ios::binary);
+                if (!expected) {
+                    test.result = "MISSING";
+                } else {
+                    test.result = compareGolden(expected, output.str(), test.detail) ? "PASS" : "FAIL";
+                }
+            }
+            test.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+
+    // Everything zx16_simulator prints for the test, into output. The image
+    // is read once, through the shared image cache.
+    void runTest(z16sim& sim, const goldenTest& test, z16sink& output) {
+        std::string error;
+        std::shared_ptr<const z16image> image = z16imageCache::shared().get(test.bin, Z16_FORMAT_AUTO, error);
+        if (!image) {
+            output.print(Z16_CHAN_ERROR, "Error: %s\n", error.c_str());
+            return;
+        }
+        if (!sim.loadImage(*image, z16loadOptions())) {
+            return;
+        }
+        output.print(Z16_CHAN_STATUS, "Loaded %zu bytes from %s.bin into memory.\n",
+                     std::min<size_t>(image->size(), z16sim::MEM_SIZE), test.name.c_str());
+
+        int status = Z16_STATUS_OK;
+        uint64_t left = options.budget;
+        while (left > 0 && status == Z16_STATUS_OK) {
+            uint64_t slice = std::min<uint64_t>(left, 1 << 20);
+            status = sim.run(slice, true);
+            left -= slice;
+        }
+        sim.flushConsole();
+        if (status == Z16_STATUS_OK) {
+            output.print(Z16_CHAN_STATUS, "Budget of %llu instructions exhausted.\n", (unsigned long long)options.budget);
+        }
+
+        output.print(Z16_CHAN_STATUS, "\n--- Final State ---\n");
+        sim.dumpRegisters();
+        output.print(Z16_CHAN_STATUS, "PC: 0x%04x\n---------------------\n\nSimulation finished.\n", sim.getPC());
+    }
+};
+
+static void printUsage(const char* progName) {
+    std::cerr << "Usage: " << progName << " [options] [directory]" << std::endl;
+    std::cerr << "  Runs every <name>.bin in the directory (default Tests) and compares its output with <name>.expected" << std::endl;
+    std::cerr << "  --jobs=N: Worker threads (default: all hardware threads)" << std::endl;
+    std::cerr << "  --budget=N: Instruction budget per test (default 10000000)" << std::endl;
+    std::cerr << "  --update: Write the current output to the .expected files" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    namespace fs = std::filesystem;
+    goldenOptions options;
+    std::string dir = "Tests";
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--jobs=", 0) == 0) {
+            options.threads = std::max(1, std::atoi(arg.c_str() + 7));
+        } else if (arg.rfind("--budget=", 0) == 0) {
+            options.budget = std::strtoull(arg.c_str() + 9, nullptr, 0);
+        } else if (arg == "--update") {
+            options.update = true;
+        } else if (arg[0] != '-') {
+            dir = arg;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (!fs::is_directory(dir)) {
+        std::cerr << "Error: " << dir << " is not a directory" << std::endl;
+        return 1;
+    }
+
+    std::vector<goldenTest> tests;
+    for (const fs::directory_entry& entry : fs::directory_iterator(dir)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".bin") {
+            tests.push_back(goldenTest());
+            tests.back().name = entry.path().stem().string();
+            tests.back().bin = entry.path().string();
+            tests.back().expected = (entry.path().parent_path() / (tests.back().name + ".expected")).string();
+        }
+    }
+    std::sort(tests.begin(), tests.end(), [](const goldenTest& a, const goldenTest& b) { return a.name < b.name; });
+    options.threads = std::max(1u, std::min<unsigned>(options.threads, tests.size()));
+
+    auto start = std::chrono::steady_clock::now();
+    goldenRunner(tests, options).run();
+    double wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    size_t width = 0;
+    for (const goldenTest& test : tests) {
+        width = std::max(width, test.name.size());
+    }
+    size_t failed = 0;
+    for (const goldenTest& test : tests) {
+        std::printf("%-8s %-*s %8.2f ms\n", test.result.c_str(), (int)width, test.name.c_str(), test.wall_ms);
+        if (!test.detail.empty()) {
+            std::printf("        %s\n", test.detail.c_str());
+        }
+        failed += test.result == "FAIL" || test.result == "MISSING";
+    }
+    std::printf("%zu tests, %zu passed, %zu failed (%.2f ms on %u threads)\n", tests.size(),
+                (size_t)std::count_if(tests.begin(), tests.end(), [](const goldenTest& t) { return t.result == "PASS"; }),
+                failed, wall_ms, options.threads);
+    return failed ? 1 : 0;
+}
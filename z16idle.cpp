@@ -0,0 +1,118 @@
+#include "z16sim.h"
+
+// Idle-loop fast-forward for the block engine. Guest programs wait in two
+// kinds of loop that retire millions of instructions without doing anything
+// an observer could see between two events:
+//
+//   countdown   addi rX, k; bnz rX, loop (or bne rX, rY, loop): the exit
+//               iteration is solved for directly, so the loop runs to its
+//               exit, or to the budget, in one step
+//   pure        ALU ops and loads, then a branch or j back to the start:
+//               if a pass leaves the registers exactly as it found them and
+//               no event fired in between, every later pass until the next
+//               event does the same, so runBlocks retires whole passes up
+//               to the event without running them
+//
+// Either way the registers, PC and retired count end up where step-by-step
+// execution would have left them; only events can break a pure loop, and
+// runBlocks never skips past one.
+
+// classifyLoop method definition: called by buildBlock once the block is
+// complete
+void z16sim::classifyLoop(z16block& block) const {
+    block.loop = Z16_LOOP_NONE;
+    size_t n = block.insts.size();
+    const z16decoded& last = block.insts[n - 1].d;
+    bool branch = last.op >= Z16_BEQ && last.op <= Z16_BGEU;
+    if (!(branch || last.op == Z16_J) || (uint16_t)(block.end_pc - 2 + last.imm) != block.start_pc) {
+        return;
+    }
+
+    const z16decoded& first = block.insts[0].d;
+    if (n == 2 && first.op == Z16_ADDI && first.imm != 0 &&
+        ((last.op == Z16_BNZ && last.rd == first.rd) ||
+         (last.op == Z16_BNE && (last.rd == first.rd) != (last.rs2 == first.rd)))) {
+        block.loop = Z16_LOOP_COUNTDOWN;
+        return;
+    }
+
+    // A load's address must follow from the registers at the loop head, so
+    // idleLoads() can check it before the pass runs
+    uint8_t written = 0;
+    for (size_t i = 0; i + 1 < n; ++i) {
+        const z16decoded& d = block.insts[i].d;
+        bool alu = (d.op <= Z16_LI && d.op != Z16_JR && d.op != Z16_JALR) || d.op == Z16_LUI || d.op == Z16_AUIPC;
+        if (d.op >= Z16_LB && d.op <= Z16_LBU) {
+            if (written & (1 << d.rs2)) {
+                return;
+            }
+        } else if (!alu) {
+            return; // Stores and jal
+        }
+        written |= 1 << d.rd;
+    }
+    block.loop = Z16_LOOP_PURE;
+}
+
+// skipCountdown method definition: runs a countdown block for as many whole
+// passes as it takes to exit, or as fit in limit instructions. Returns the
+// instructions retired.
+uint64_t z16sim::skipCountdown(const z16block& block, uint64_t limit) {
+    const z16decoded& add = block.insts[0].d;
+    const z16decoded& branch = block.insts[1].d;
+    uint16_t k = (uint16_t)add.imm;
+    uint16_t x = this->regs[add.rd];
+    uint16_t y = branch.op == Z16_BNZ ? 0 : this->regs[branch.rd == add.rd ? branch.rs2 : branch.rd];
+    uint64_t avail = limit / 2;
+    if (avail == 0) {
+        return 0;
+    }
+
+    // The loop exits after the first n >= 1 passes with x + n*k == y (mod
+    // 2^16). With k = 2^t * odd this needs 2^t | y - x, and then n is
+    // (y - x) / 2^t times the inverse of odd, mod 2^(16-t).
+    int t = 0;
+    while (!((k >> t) & 1)) {
+        ++t;
+    }
+    uint16_t diff = y - x;
+    uint64_t passes = UINT64_MAX; // Never exits
+    if ((diff & ((1u << t) - 1)) == 0) {
+        uint32_t odd = k >> t;
+        uint32_t inverse = odd; // Newton's iteration; each step doubles the correct low bits
+        for (int i = 0; i < 4; ++i) {
+            inverse *= 2 - odd * inverse;
+        }
+        uint32_t mask = (1u << (16 - t)) - 1;
+        passes = ((uint32_t)(diff >> t) * inverse) & mask;
+        if (passes == 0) {
+            passes = mask + 1;
+        }
+    }
+
+    if (passes <= avail) {
+        this->regs[add.rd] = y;
+        this->pc = block.end_pc;
+    } else {
+        passes = avail;
+        this->regs[add.rd] = (uint16_t)(x + passes * k);
+    }
+    this->retired += 2 * passes;
+    return 2 * passes;
+}
+
+// idleLoads method definition: true if every load of a pure block reads
+// plain memory with the current registers; a device or watchpoint could
+// change what the next pass sees, or needs to see every access
+bool z16sim::idleLoads(const z16block& block) const {
+    for (size_t i = 0; i + 1 < block.insts.size(); ++i) {
+        const z16decoded& d = block.insts[i].d;
+        if (d.op >= Z16_LB && d.op <= Z16_LBU) {
+            uint16_t addr = this->regs[d.rs2] + d.imm;
+            if (this->busFlags[addr >> z16blockCache::PAGE_SHIFT] & Z16_BUS_LOAD_TRAP) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
@@ -0,0 +1,289 @@
+#include "z16irq.h"
+#include "z16sim.h"
+#include <algorithm>
+#include <cstring>
+
+// Orders the event heap so the earliest event is at the front
+static bool laterEvent(const z16event& a, const z16event& b) {
+    return a.when > b.when;
+}
+
+// schedule method definition
+void z16sim::schedule(uint64_t when, z16device* device, uint32_t tag) {
+    this->events.push_back({when, device, tag});
+    std::push_heap(this->events.begin(), this->events.end(), laterEvent);
+    z16sim::updateNextEvent();
+}
+
+// cancel method definition. Devices that reprogram an event cancel the old
+// one, so the heap never holds more than their live events.
+void z16sim::cancel(z16device* device, uint32_t tag) {
+    for (size_t i = 0; i < this->events.size(); ++i) {
+        if (this->events[i].device == device && this->events[i].tag == tag) {
+            this->events[i] = this->events.back();
+            this->events.pop_back();
+            std::make_heap(this->events.begin(), this->events.end(), laterEvent);
+            z16sim::updateNextEvent();
+            return;
+        }
+    }
+}
+
+// updateNextEvent method definition. The block engine clips each block to
+// nextEvent before running it, so when a device access or ecall moves it
+// earlier, the running block ends and is clipped again.
+void z16sim::updateNextEvent() {
+    uint64_t next;
+    if (this->stopRequested || (this->irqEnabled && (this->irqPending & this->irqMask))) {
+        next = this->retired; // Taken after the current instruction
+    } else {
+        next = this->events.empty() ? UINT64_MAX : this->events.front().when;
+    }
+    if (next < this->nextEvent) {
+        this->codeInvalidated = true;
+    }
+    this->nextEvent = next;
+}
+
+// serviceEvents method definition: called by the run loops once the cycle
+// count reaches nextEvent. A watchpoint stop comes first, so the debugger
+// sees the machine before any event or interrupt moves it on.
+int z16sim::serviceEvents() {
+    if (this->stopRequested) {
+        this->stopRequested = false;
+        z16sim::updateNextEvent();
+        this->codeInvalidated = false;
+        return 5;
+    }
+    while (!this->events.empty() && this->events.front().when <= this->retired) {
+        std::pop_heap(this->events.begin(), this->events.end(), laterEvent);
+        z16event due = this->events.back();
+        this->events.pop_back();
+        due.device->event(*this, due.tag);
+    }
+
+    uint16_t ready = this->irqPending & this->irqMask;
+    if (this->irqEnabled && ready) {
+        int line = 0;
+        while (!(ready & (1 << line))) {
+            ++line; // Lowest line first
+        }
+        this->epc = this->pc;
+        this->irqEnabled = false;
+        this->pc = line * 2;
+    }
+    z16sim::updateNextEvent();
+    this->codeInvalidated = false; // Whatever was due has been handled
+    return 0;
+}
+
+// raiseInterrupt method definition
+void z16sim::raiseInterrupt(int line) {
+    if (line <= 0 || line >= z16sim::NUM_VECTORS) {
+        return; // Vector 0 is reset
+    }
+    this->irqPending |= 1 << line;
+    z16sim::updateNextEvent();
+}
+
+// clearInterrupts method definition
+void z16sim::clearInterrupts(uint16_t lines) {
+    this->irqPending &= ~lines;
+    z16sim::updateNextEvent();
+}
+
+// setInterruptMask method definition
+void z16sim::setInterruptMask(uint16_t mask) {
+    this->irqMask = mask & ~1;
+    z16sim::updateNextEvent();
+}
+
+// setInterruptsEnabled method definition
+void z16sim::setInterruptsEnabled(bool enabled) {
+    this->irqEnabled = enabled;
+    z16sim::updateNextEvent();
+}
+
+// z16interruptController constructor
+z16interruptController::z16interruptController() : sim(nullptr) {
+}
+
+// attach method definition
+void z16interruptController::attach(z16sim& sim) {
+    this->sim = &sim;
+    sim.mapDevice(BASE, SIZE, this);
+}
+
+// read16 method definition
+uint16_t z16interruptController::read16(uint16_t addr) {
+    switch (addr - BASE) {
+        case REG_PENDING: return this->sim->getPendingInterrupts();
+        case REG_MASK:    return this->sim->getInterruptMask();
+        case REG_STATUS:  return this->sim->getInterruptsEnabled() ? 1 : 0;
+        case REG_EPC:     return this->sim->getEPC();
+        default:          return 0;
+    }
+}
+
+// read8 method definition
+uint8_t z16interruptController::read8(uint16_t addr) {
+    uint16_t value = z16interruptController::read16(addr & ~1);
+    return (addr & 1) ? value >> 8 : value & 0xFF;
+}
+
+// write16 method definition
+void z16interruptController::write16(uint16_t addr, uint16_t value) {
+    z16interruptController::writeReg(addr - BASE, value, 0xFFFF);
+}
+
+// write8 method definition
+void z16interruptController::write8(uint16_t addr, uint8_t value) {
+    uint16_t reg = (addr - BASE) & ~1;
+    if (addr & 1) {
+        z16interruptController::writeReg(reg, value << 8, 0xFF00);
+    } else {
+        z16interruptController::writeReg(reg, value, 0x00FF);
+    }
+}
+
+// writeReg method definition
+void z16interruptController::writeReg(uint16_t reg, uint16_t value, uint16_t mask) {
+    z16sim& s = *this->sim;
+    switch (reg) {
+        case REG_PENDING: // Write 1 to clear
+            s.clearInterrupts(value & mask);
+            break;
+        case REG_MASK:
+            s.setInterruptMask((s.getInterruptMask() & ~mask) | (value & mask));
+            break;
+        case REG_STATUS:
+            if (mask & 1) {
+                s.setInterruptsEnabled(value & 1);
+            }
+            break;
+        case REG_EPC:
+            s.setEPC((s.getEPC() & ~mask) | (value & mask));
+            break;
+        case REG_RAISE:
+            if (mask & 0xFF) {
+                s.raiseInterrupt(value & 0xFF);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// z16timer constructor: every channel stopped
+z16timer::z16timer(int first_line) : sim(nullptr), firstLine(first_line) {
+    std::memset(this->channels, 0, sizeof(this->channels));
+}
+
+// attach method definition
+void z16timer::attach(z16sim& sim) {
+    this->sim = &sim;
+    sim.mapDevice(BASE, SIZE, this);
+}
+
+// interval method definition: cycles from start to expiry
+uint64_t z16timer::interval(const channel& ch) const {
+    uint64_t ticks = ch.period ? ch.period : 0x10000;
+    return ticks * ((uint64_t)ch.prescale + 1);
+}
+
+// tag method definition: identifies channel n's current expiry event
+uint32_t z16timer::tag(int n) const {
+    return ((this->channels[n].generation & 0x3FFFFFFF) << 2) | n;
+}
+
+// start method definition: replaces the queued expiry of channel n with one
+// from now
+void z16timer::start(int n) {
+    channel& ch = this->channels[n];
+    this->sim->cancel(this, z16timer::tag(n));
+    ++ch.generation;
+    ch.deadline = this->sim->getCycle() + z16timer::interval(ch);
+    this->sim->schedule(ch.deadline, this, z16timer::tag(n));
+}
+
+// event method definition: expiry of a channel. Restarting or stopping a
+// channel cancels its queued event, so only the live one gets here; the
+// checks are a cheap guard all the same.
+void z16timer::event(z16sim& sim, uint32_t tag) {
+    channel& ch = this->channels[tag & 3];
+    if (!(ch.ctrl & CTRL_RUN) || tag != z16timer::tag(tag & 3)) {
+        return;
+    }
+    sim.raiseInterrupt(this->firstLine + (tag & 3));
+    if (ch.ctrl & CTRL_PERIODIC) {
+        ch.deadline += z16timer::interval(ch); // From the expiry, so periods do not drift
+        sim.schedule(ch.deadline, this, tag);
+    } else {
+        ch.ctrl &= ~CTRL_RUN;
+    }
+}
+
+// read16 method definition
+uint16_t z16timer::read16(uint16_t addr) {
+    int n = ((addr - BASE) >> 3) & 0x1F;
+    if (n >= NUM_CHANNELS) {
+        return 0;
+    }
+    const channel& ch = this->channels[n];
+    switch (addr & 7) {
+        case 0: return ch.ctrl;
+        case 2: return ch.period;
+        case 4: return ch.prescale;
+        default: { // COUNT: whole ticks left, rounded up
+            if (!(ch.ctrl & CTRL_RUN)) {
+                return 0;
+            }
+            uint64_t left = ch.deadline - this->sim->getCycle();
+            uint64_t scale = (uint64_t)ch.prescale + 1;
+            return (uint16_t)((left + scale - 1) / scale);
+        }
+    }
+}
+
+// read8 method definition
+uint8_t z16timer::read8(uint16_t addr) {
+    uint16_t value = z16timer::read16(addr & ~1);
+    return (addr & 1) ? value >> 8 : value & 0xFF;
+}
+
+// write16 method definition
+void z16timer::write16(uint16_t addr, uint16_t value) {
+    z16timer::writeReg(addr, value, 0xFFFF);
+}
+
+// write8 method definition
+void z16timer::write8(uint16_t addr, uint8_t value) {
+    if (addr & 1) {
+        z16timer::writeReg(addr & ~1, value << 8, 0xFF00);
+    } else {
+        z16timer::writeReg(addr, value, 0x00FF);
+    }
+}
+
+// writeReg method definition
+void z16timer::writeReg(uint16_t addr, uint16_t value, uint16_t mask) {
+    int n = ((addr - BASE) >> 3) & 0x1F;
+    if (n >= NUM_CHANNELS) {
+        return;
+    }
+    channel& ch = this->channels[n];
+    uint16_t* reg;
+    switch (addr & 7) {
+        case 0: reg = &ch.ctrl; break;
+        case 2: reg = &ch.period; break;
+        case 4: reg = &ch.prescale; break;
+        default: return; // COUNT is read only
+    }
+    *reg = (*reg & ~mask) | (value & mask);
+    ch.ctrl &= CTRL_RUN | CTRL_PERIODIC;
+    if (ch.ctrl & CTRL_RUN) {
+        z16timer::start(n);
+    } else {
+        this->sim->cancel(this, z16timer::tag(n));
+    }
+}
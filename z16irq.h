@@ -0,0 +1,95 @@
+#ifndef Z16IRQ_H
+#define Z16IRQ_H
+
+#include "z16bus.h"
+#include <cstdint>
+
+class z16sim;
+
+// MMIO window onto the simulator's interrupt state. Registers are 16 bits;
+// byte stores change only the byte written.
+//
+//   0xFC00  PENDING  pending lines; writing 1s clears those lines
+//   0xFC02  MASK     lines allowed to interrupt
+//   0xFC04  STATUS   bit 0: interrupts enabled
+//   0xFC06  EPC      PC the interrupted program resumes at
+//   0xFC08  RAISE    writing n raises line n (software interrupt)
+class z16interruptController : public z16device {
+public:
+    static const uint16_t BASE = 0xFC00;
+    static const uint32_t SIZE = 0x100;
+    static const uint16_t REG_PENDING = 0x0;
+    static const uint16_t REG_MASK = 0x2;
+    static const uint16_t REG_STATUS = 0x4;
+    static const uint16_t REG_EPC = 0x6;
+    static const uint16_t REG_RAISE = 0x8;
+
+    z16interruptController();
+
+    // Maps the controller at BASE
+    void attach(z16sim& sim);
+
+    uint8_t read8(uint16_t addr) override;
+    void write8(uint16_t addr, uint8_t value) override;
+    uint16_t read16(uint16_t addr) override;
+    void write16(uint16_t addr, uint16_t value) override;
+
+private:
+    z16sim* sim;
+
+    // Sets the bits of register reg selected by mask to value
+    void writeReg(uint16_t reg, uint16_t value, uint16_t mask);
+};
+
+// Programmable interval timers. Channel n has four registers at
+// 0xFD00 + 8 * n and raises interrupt line firstLine + n when it expires.
+//
+//   +0  CTRL      bit 0: running, bit 1: periodic (reload and keep running)
+//   +2  PERIOD    ticks until expiry (0: 65536)
+//   +4  PRESCALE  cycles per tick, minus one
+//   +6  COUNT     ticks left (read only)
+//
+// A write to CTRL, PERIOD or PRESCALE (re)starts a running channel. Nothing
+// runs per instruction: each running channel keeps exactly one event queued
+// for its expiry, replaced on restart and cancelled on stop, and COUNT is
+// computed from it when read. One-shot channels clear their running bit
+// when they expire.
+class z16timer : public z16device {
+public:
+    static const uint16_t BASE = 0xFD00;
+    static const uint32_t SIZE = 0x100;
+    static const int NUM_CHANNELS = 4;
+    static const uint16_t CTRL_RUN = 1;
+    static const uint16_t CTRL_PERIODIC = 2;
+
+    explicit z16timer(int first_line = 1);
+
+    // Maps the timers at BASE
+    void attach(z16sim& sim);
+
+    uint8_t read8(uint16_t addr) override;
+    void write8(uint16_t addr, uint8_t value) override;
+    uint16_t read16(uint16_t addr) override;
+    void write16(uint16_t addr, uint16_t value) override;
+    void event(z16sim& sim, uint32_t tag) override;
+
+private:
+    struct channel {
+        uint16_t ctrl;
+        uint16_t period;
+        uint16_t prescale;
+        uint64_t deadline;   // Cycle of the next expiry while running
+        uint32_t generation; // Bumped on every restart; part of the event tag
+    };
+
+    z16sim* sim;
+    int firstLine;
+    channel channels[NUM_CHANNELS];
+
+    uint64_t interval(const channel& ch) const;
+    uint32_t tag(int n) const;
+    void start(int n);
+    void writeReg(uint16_t addr, uint16_t value, uint16_t mask);
+};
+
+#endif // Z16IRQ_H
@@ -0,0 +1,346 @@
+#include "z16jit.h"
+#include "z16sim.h"
+#include <cstring>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#define Z16_JIT_X86_64 1
+#include <sys/mman.h>
+#endif
+
+#ifdef Z16_JIT_X86_64
+
+namespace {
+
+// Host register numbers
+enum { RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7 };
+
+// Guest register i lives in host register r(8 + i)
+inline int hostReg(int guest) { return 8 + guest; }
+
+// Minimal x86-64 encoder for the handful of forms the translator needs
+class emitter {
+public:
+    std::vector<unsigned char> buf;
+
+    void byte(unsigned v) { buf.push_back((unsigned char)v); }
+    void word(unsigned v) { byte(v & 0xFF); byte((v >> 8) & 0xFF); }
+    void dword(uint32_t v) { word(v & 0xFFFF); word(v >> 16); }
+    void qword(uint64_t v) { dword((uint32_t)v); dword((uint32_t)(v >> 32)); }
+
+    void rex(bool w, int reg, int rm, bool force = false) {
+        unsigned v = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+        if (v != 0x40 || force) byte(v);
+    }
+    void modrm(int mod, int reg, int rm) { byte((mod << 6) | ((reg & 7) << 3) | (rm & 7)); }
+
+    // op r/m16, r16 (add 01, or 09, and 21, sub 29, xor 31, cmp 39)
+    void alu16(unsigned op, int dst, int src) { byte(0x66); rex(false, src, dst); byte(op); modrm(3, src, dst); }
+    // op r/m16, imm16 (81 /ext)
+    void alu16i(int ext, int dst, uint16_t imm) { byte(0x66); rex(false, 0, dst); byte(0x81); modrm(3, ext, dst); word(imm); }
+    // shift r/m16 by imm8 (C1 /ext) or by cl (D3 /ext)
+    void shift16i(int ext, int dst, uint8_t imm) { byte(0x66); rex(false, 0, dst); byte(0xC1); modrm(3, ext, dst); byte(imm); }
+    void shift16cl(int ext, int dst) { byte(0x66); rex(false, 0, dst); byte(0xD3); modrm(3, ext, dst); }
+    void mov32(int dst, int src) { rex(false, src, dst); byte(0x89); modrm(3, src, dst); }
+    void mov32i(int dst, uint32_t imm) { rex(false, 0, dst); byte(0xB8 + (dst & 7)); dword(imm); }
+    void and32i(int dst, uint32_t imm) { rex(false, 0, dst); byte(0x81); modrm(3, 4, dst); dword(imm); }
+    void shr32i(int dst, uint8_t imm) { rex(false, 0, dst); byte(0xC1); modrm(3, 5, dst); byte(imm); }
+    void cmp32i(int dst, uint32_t imm) { rex(false, 0, dst); byte(0x81); modrm(3, 7, dst); dword(imm); }
+    // setcc al; movzx dst32, al
+    void setcc(unsigned cc, int dst) {
+        byte(0x0F); byte(0x90 | cc); modrm(3, 0, RAX);
+        rex(false, dst, RAX); byte(0x0F); byte(0xB6); modrm(3, dst, RAX);
+    }
+    // cmovcc dst32, src32
+    void cmov(unsigned cc, int dst, int src) { rex(false, dst, src); byte(0x0F); byte(0x40 | cc); modrm(3, dst, src); }
+
+    // Loads/stores addressed as [rbx + rax] (rbx = guest memory, rax = address)
+    void loadIndexed(bool w16, unsigned op2, int dst) { if (w16) byte(0x66); rex(false, dst, 0); byte(0x0F); byte(op2); modrm(0, dst, 4); byte(0x03); }
+    void storeIndexed8(int src) { rex(false, src, 0, true); byte(0x88); modrm(0, src, 4); byte(0x03); }
+    void storeIndexed16(int src) { byte(0x66); rex(false, src, 0); byte(0x89); modrm(0, src, 4); byte(0x03); }
+
+    // Frame field access through rbp
+    void loadFrame64(int dst, int disp) { rex(true, dst, RBP); byte(0x8B); modrm(1, dst, RBP); byte(disp); }
+    void storeFramePc(uint16_t pc) { byte(0x66); byte(0xC7); modrm(1, 0, RBP); byte(offsetof(z16jitFrame, pc)); word(pc); }
+    void storeFramePcAx() { byte(0x66); byte(0x89); modrm(1, RAX, RBP); byte(offsetof(z16jitFrame, pc)); }
+    void storeFrameExecuted(uint32_t n) { byte(0xC7); modrm(1, 0, RBP); byte(offsetof(z16jitFrame, executed)); dword(n); }
+
+    void push(int r) { rex(false, 0, r); byte(0x50 + (r & 7)); }
+    void pop(int r) { rex(false, 0, r); byte(0x58 + (r & 7)); }
+
+    // Forward jumps: emit with a zero displacement, patch once the target is known
+    size_t jcc(unsigned cc) { byte(0x0F); byte(0x80 | cc); dword(0); return buf.size(); }
+    size_t jmp() { byte(0xE9); dword(0); return buf.size(); }
+    void patch(size_t after, size_t target) {
+        int32_t rel = (int32_t)(target - after);
+        std::memcpy(&buf[after - 4], &rel, 4);
+    }
+};
+
+// Condition codes
+enum { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xC, CC_GE = 0xD };
+
+// A side exit that leaves the block with a constant pc and retired count
+struct sideExit {
+    size_t jump; // Offset just after the jcc/jmp to patch
+    uint16_t pc;
+    uint32_t executed;
+};
+
+} // namespace
+
+// available method definition
+bool z16jit::available() {
+    return true;
+}
+
+// z16jit constructor: the buffer is only ever writable or executable, never both
+z16jit::z16jit(size_t capacity) : code(nullptr), capacity(capacity), used(0), lastFailed(false) {
+    void* mem = mmap(nullptr, capacity, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem != MAP_FAILED) {
+        this->code = static_cast<unsigned char*>(mem);
+    }
+}
+
+z16jit::~z16jit() {
+    if (this->code) {
+        munmap(this->code, this->capacity);
+    }
+}
+
+// storeHook method definition: slow path of a translated store to a page holding cached code
+int z16jit::storeHook(z16sim* sim, uint32_t addr, uint32_t len) {
+    sim->invalidateCode((uint16_t)addr, (int)len);
+    return sim->codeInvalidated ? 1 : 0;
+}
+
+// compile method definition
+z16jitCode z16jit::compile(const z16block& block, bool bus_checks) {
+    // ecall and invalid encodings (always last in a block) stay with the interpreter
+    size_t count = block.insts.size();
+    if (count > 0 && (block.insts[count - 1].d.op == Z16_ECALL || block.insts[count - 1].d.op == Z16_TRAP)) {
+        --count;
+    }
+    this->lastFailed = false;
+    if (count == 0 || !this->code) {
+        return nullptr;
+    }
+
+    emitter e;
+    std::vector<sideExit> exits;
+    std::vector<size_t> toEpilogue;
+
+    // Prologue: save callee-saved registers, keep rsp 16-byte aligned for calls
+    e.push(RBX); e.push(RBP); e.push(12); e.push(13); e.push(14); e.push(15);
+    e.rex(true, 0, RSP); e.byte(0x83); e.modrm(3, 5, RSP); e.byte(8); // sub rsp, 8
+    e.rex(true, RDI, RBP); e.byte(0x89); e.modrm(3, RDI, RBP);       // mov rbp, rdi
+    e.loadFrame64(RBX, offsetof(z16jitFrame, memory));
+    e.loadFrame64(RAX, offsetof(z16jitFrame, regs));
+    for (int i = 0; i < z16sim::NUM_REGS; ++i) { // movzx r(8+i)d, word [rax + 2i]
+        e.rex(false, hostReg(i), RAX); e.byte(0x0F); e.byte(0xB7); e.modrm(1, hostReg(i), RAX); e.byte(2 * i);
+    }
+
+    uint16_t pc = block.start_pc;
+    bool dynamicPc = false; // Final pc left in ax by a control-transfer instruction
+    for (size_t i = 0; i < count; ++i, pc += 2) {
+        const z16decoded& d = block.insts[i].d;
+        int rd = hostReg(d.rd);
+        int rs = hostReg(d.rs2);
+        uint16_t imm = (uint16_t)d.imm;
+        uint16_t next = pc + 2;
+
+        switch (d.op) {
+            case Z16_ADD: e.alu16(0x01, rd, rs); break;
+            case Z16_SUB: e.alu16(0x29, rd, rs); break;
+            case Z16_OR:  e.alu16(0x09, rd, rs); break;
+            case Z16_AND: e.alu16(0x21, rd, rs); break;
+            case Z16_XOR: e.alu16(0x31, rd, rs); break;
+            case Z16_MV:  e.mov32(rd, rs); break;
+            case Z16_SLT:  e.alu16(0x39, rd, rs); e.setcc(CC_L, rd); break;
+            case Z16_SLTU: e.alu16(0x39, rd, rs); e.setcc(CC_B, rd); break;
+            case Z16_SLL:
+            case Z16_SRL:
+            case Z16_SRA:
+                e.mov32(RCX, rs);
+                e.and32i(RCX, 0xF);
+                e.shift16cl(d.op == Z16_SLL ? 4 : d.op == Z16_SRL ? 5 : 7, rd);
+                break;
+
+            case Z16_ADDI: e.alu16i(0, rd, imm); break;
+            case Z16_ORI:  e.alu16i(1, rd, imm); break;
+            case Z16_ANDI: e.alu16i(4, rd, imm); break;
+            case Z16_XORI: e.alu16i(6, rd, imm); break;
+            case Z16_SLTI:  e.alu16i(7, rd, imm); e.setcc(CC_L, rd); break;
+            case Z16_SLTUI: e.alu16i(7, rd, imm); e.setcc(CC_B, rd); break;
+            case Z16_SLLI: e.shift16i(4, rd, (uint8_t)imm); break;
+            case Z16_SRLI: e.shift16i(5, rd, (uint8_t)imm); break;
+            case Z16_SRAI: e.shift16i(7, rd, (uint8_t)imm); break;
+            case Z16_LI:
+            case Z16_LUI:   e.mov32i(rd, imm); break;
+            case Z16_AUIPC: e.mov32i(rd, (uint16_t)(pc + imm)); break;
+
+            case Z16_LB:
+            case Z16_LW:
+            case Z16_LBU:
+                e.mov32(RAX, rs);
+                e.alu16i(0, RAX, imm); // 16-bit effective address
+                if (d.op == Z16_LW) {
+                    e.byte(0xA8); e.byte(1); // test al, 1: misaligned
+                    exits.push_back({e.jcc(CC_NE), pc, (uint32_t)i});
+                }
+                if (bus_checks) { // Device pages: busFlags[addr >> 8] & Z16_BUS_LOAD_TRAP
+                    e.loadFrame64(RSI, offsetof(z16jitFrame, busFlags));
+                    e.mov32(RCX, RAX); e.shr32i(RCX, 8);
+                    e.byte(0xF6); e.modrm(0, 0, 4); e.byte(0x0E); e.byte(Z16_BUS_LOAD_TRAP); // test byte [rsi+rcx], imm8
+                    exits.push_back({e.jcc(CC_NE), pc, (uint32_t)i});
+                }
+                if (d.op == Z16_LW) {
+                    e.loadIndexed(false, 0xB7, rd); // movzx rd32, word [rbx+rax]
+                } else if (d.op == Z16_LB) {
+                    e.loadIndexed(true, 0xBE, rd);  // movsx rd16, byte [rbx+rax]
+                } else {
+                    e.loadIndexed(false, 0xB6, rd); // movzx rd32, byte [rbx+rax]
+                }
+                break;
+
+            case Z16_SB:
+            case Z16_SW: {
+                e.mov32(RAX, rd);
+                e.alu16i(0, RAX, imm);
+                if (d.op == Z16_SW) {
+                    e.byte(0xA8); e.byte(1); // test al, 1: misaligned (an aligned word stays in one page)
+                    exits.push_back({e.jcc(CC_NE), pc, (uint32_t)i});
+                }
+                e.mov32(RCX, RAX); e.shr32i(RCX, 8);
+                if (bus_checks) { // ROM and device pages: busFlags[addr >> 8] & Z16_BUS_STORE_TRAP
+                    e.loadFrame64(RSI, offsetof(z16jitFrame, busFlags));
+                    e.byte(0xF6); e.modrm(0, 0, 4); e.byte(0x0E); e.byte(Z16_BUS_STORE_TRAP); // test byte [rsi+rcx], imm8
+                    exits.push_back({e.jcc(CC_NE), pc, (uint32_t)i});
+                }
+                if (d.op == Z16_SW) {
+                    e.storeIndexed16(rs);
+                } else {
+                    e.storeIndexed8(rs);
+                }
+                // Mark dirtyPages[addr >> 8]
+                e.loadFrame64(RSI, offsetof(z16jitFrame, dirtyPages));
+                e.byte(0xC6); e.modrm(0, 0, 4); e.byte(0x0E); e.byte(1); // mov byte [rsi+rcx], 1
+                // Self-modifying code check: codePages[addr >> 8]
+                e.loadFrame64(RSI, offsetof(z16jitFrame, codePages));
+                e.byte(0x80); e.modrm(0, 7, 4); e.byte(0x0E); e.byte(0); // cmp byte [rsi+rcx], 0
+                size_t skip = e.jcc(CC_E);
+                for (int r = 8; r <= 11; ++r) e.push(r);
+                e.loadFrame64(RDI, offsetof(z16jitFrame, sim));
+                e.mov32(RSI, RAX);
+                e.mov32i(RDX, d.op == Z16_SW ? 2 : 1);
+                e.rex(true, 0, RAX); e.byte(0xB8); e.qword((uint64_t)(uintptr_t)&z16jit::storeHook); // mov rax, imm64
+                e.byte(0xFF); e.modrm(3, 2, RAX);                                                      // call rax
+                for (int r = 11; r >= 8; --r) e.pop(r);
+                e.byte(0x85); e.modrm(3, RAX, RAX); // test eax, eax
+                exits.push_back({e.jcc(CC_NE), next, (uint32_t)i + 1});
+                e.patch(skip, e.buf.size());
+                break;
+            }
+
+            // Control transfers: these only ever end a block
+            case Z16_BEQ: case Z16_BNE: case Z16_BZ: case Z16_BNZ:
+            case Z16_BLT: case Z16_BGE: case Z16_BLTU: case Z16_BGEU: {
+                static const unsigned cc[8] = {CC_E, CC_NE, CC_E, CC_NE, CC_L, CC_GE, CC_B, CC_AE};
+                e.mov32i(RAX, next);
+                e.mov32i(RDX, (uint16_t)(pc + imm));
+                if (d.op == Z16_BZ || d.op == Z16_BNZ) {
+                    e.alu16i(7, rd, 0);
+                } else {
+                    e.alu16(0x39, rd, rs);
+                }
+                e.cmov(cc[d.op - Z16_BEQ], RAX, RDX);
+                dynamicPc = true;
+                break;
+            }
+            case Z16_JAL:
+                e.mov32i(rd, next);
+                [[fallthrough]];
+            case Z16_J:
+                e.mov32i(RAX, (uint16_t)(pc + imm));
+                dynamicPc = true;
+                break;
+            case Z16_JR:
+                e.mov32(RAX, rd);
+                dynamicPc = true;
+                break;
+            case Z16_JALR:
+                e.mov32i(rd, next);
+                e.mov32(RAX, rs);
+                dynamicPc = true;
+                break;
+
+            default:
+                return nullptr; // Not reachable: ecall/trap were trimmed above
+        }
+    }
+
+    // Fall-through exit
+    if (dynamicPc) {
+        e.storeFramePcAx();
+    } else {
+        e.storeFramePc(pc);
+    }
+    e.storeFrameExecuted((uint32_t)count);
+    toEpilogue.push_back(e.jmp());
+
+    // Cold side exits
+    for (const sideExit& x : exits) {
+        e.patch(x.jump, e.buf.size());
+        e.storeFramePc(x.pc);
+        e.storeFrameExecuted(x.executed);
+        toEpilogue.push_back(e.jmp());
+    }
+
+    // Epilogue: write the guest registers back and restore the host ones
+    size_t epilogue = e.buf.size();
+    for (size_t j : toEpilogue) {
+        e.patch(j, epilogue);
+    }
+    e.loadFrame64(RAX, offsetof(z16jitFrame, regs));
+    for (int i = 0; i < z16sim::NUM_REGS; ++i) { // mov word [rax + 2i], r(8+i)w
+        e.byte(0x66); e.rex(false, hostReg(i), RAX); e.byte(0x89); e.modrm(1, hostReg(i), RAX); e.byte(2 * i);
+    }
+    e.rex(true, 0, RSP); e.byte(0x83); e.modrm(3, 0, RSP); e.byte(8); // add rsp, 8
+    e.pop(15); e.pop(14); e.pop(13); e.pop(12); e.pop(RBP); e.pop(RBX);
+    e.byte(0xC3);
+
+    if (this->used + e.buf.size() > this->capacity) {
+        this->lastFailed = true;
+        return nullptr;
+    }
+    unsigned char* dst = this->code + this->used;
+    if (mprotect(this->code, this->capacity, PROT_READ | PROT_WRITE) != 0) {
+        this->lastFailed = true;
+        return nullptr;
+    }
+    std::memcpy(dst, e.buf.data(), e.buf.size());
+    mprotect(this->code, this->capacity, PROT_READ | PROT_EXEC);
+    this->used += (e.buf.size() + 15) & ~(size_t)15;
+    return reinterpret_cast<z16jitCode>(dst);
+}
+
+#else // !Z16_JIT_X86_64
+
+bool z16jit::available() {
+    return false;
+}
+
+z16jit::z16jit(size_t capacity) : code(nullptr), capacity(capacity), used(0), lastFailed(false) {
+}
+
+z16jit::~z16jit() {
+}
+
+int z16jit::storeHook(z16sim*, uint32_t, uint32_t) {
+    return 0;
+}
+
+z16jitCode z16jit::compile(const z16block&, bool) {
+    return nullptr;
+}
+
+#endif // Z16_JIT_X86_64
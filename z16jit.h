@@ -0,0 +1,70 @@
+#ifndef Z16JIT_H
+#define Z16JIT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class z16sim;
+struct z16block;
+
+// State passed to a translated block. The block loads regs[] into host
+// registers on entry and writes them back, with pc and the number of
+// instructions it retired, on exit.
+struct z16jitFrame {
+    uint16_t* regs;
+    unsigned char* memory;
+    const unsigned char* codePages;
+    unsigned char* dirtyPages;
+    const unsigned char* busFlags;
+    z16sim* sim;
+    uint32_t executed;
+    uint16_t pc;
+};
+
+typedef void (*z16jitCode)(z16jitFrame* frame);
+
+// x86-64 translator for cached basic blocks. Guest x0-x7 live in r8d-r15d
+// (zero-extended) for the whole block and are operated on with 16-bit
+// instructions, which gives the same wraparound as the interpreter.
+//
+// ecall and invalid encodings are never translated: a block stops just before
+// them and the dispatcher interprets the rest. Misaligned word accesses and
+// accesses the memory bus traps (device pages, ROM stores) also leave the
+// block before retiring, so the interpreter faults or calls the device, and
+// a store that hits cached code calls back into z16sim::invalidateCode().
+class z16jit {
+public:
+    static const uint32_t HOT_THRESHOLD = 8;      // Block executions before translating
+    static const size_t CODE_SIZE = 4 << 20;      // Executable buffer size
+
+    explicit z16jit(size_t capacity = CODE_SIZE);
+    ~z16jit();
+    z16jit(const z16jit&) = delete;
+    z16jit& operator=(const z16jit&) = delete;
+
+    // False on hosts without an x86-64 backend; compile() then returns nullptr
+    static bool available();
+
+    // Translate a block. Returns nullptr when nothing in it can be
+    // translated or the code buffer is full.
+    // bus_checks: some pages are ROM or devices, so loads and stores test busFlags
+    z16jitCode compile(const z16block& block, bool bus_checks);
+    // The last compile() returned nullptr for want of buffer space (or
+    // because the buffer could not be made writable), not for want of
+    // anything to translate
+    bool failed() const { return lastFailed; }
+    // Empties the code buffer. Every pointer compile() returned is invalid
+    // afterwards; the caller drops them first.
+    void clear() { used = 0; }
+
+private:
+    unsigned char* code;
+    size_t capacity;
+    size_t used;
+    bool lastFailed;
+
+    static int storeHook(z16sim* sim, uint32_t addr, uint32_t len);
+};
+
+#endif // Z16JIT_H
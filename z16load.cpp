@@ -0,0 +1,445 @@
+#include "z16load.h"
+#include "z16sim.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// size method definition
+size_t z16image::size() const {
+    size_t total = 0;
+    for (const segment& seg : this->segments) {
+        total += seg.bytes.size();
+    }
+    return total;
+}
+
+namespace {
+
+// Appends bytes at addr, extending the last segment when they follow it
+void appendBytes(z16image& image, uint32_t addr, const unsigned char* data, size_t len) {
+    if (image.segments.empty() ||
+        image.segments.back().addr + image.segments.back().bytes.size() != addr) {
+        image.segments.push_back({addr, {}});
+    }
+    std::vector<unsigned char>& bytes = image.segments.back().bytes;
+    bytes.insert(bytes.end(), data, data + len);
+}
+
+int hexDigit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Reads hex digits at p (advancing it); false if there are none or more
+// than max_digits
+bool readHex(const char*& p, const char* end, int max_digits, uint32_t& value) {
+    value = 0;
+    int digits = 0;
+    for (; p < end && hexDigit(*p) >= 0; ++p, ++digits) {
+        value = (value << 4) | hexDigit(*p);
+    }
+    return digits > 0 && digits <= max_digits;
+}
+
+bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+// Splits text into lines; each handler gets the line with surrounding blanks
+// removed and its 1-based number
+template <typename F>
+bool forEachLine(const char* data, size_t len, F handle) {
+    const char* p = data;
+    const char* end = data + len;
+    for (int line = 1; p < end; ++line) {
+        const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if (!eol) {
+            eol = end;
+        }
+        const char* a = p;
+        const char* b = eol;
+        while (a < b && isSpace(*a)) ++a;
+        while (b > a && isSpace(b[-1])) --b;
+        if (!handle(a, b, line)) {
+            return false;
+        }
+        p = eol + 1;
+    }
+    return true;
+}
+
+std::string where(const std::string& name, int line) {
+    return name + ":" + std::to_string(line) + ": ";
+}
+
+bool parseIntelHex(const char* data, size_t len, const std::string& name, z16image& image, std::string& error) {
+    uint32_t upper = 0; // From extended segment/linear address records
+    bool done = false;
+    return forEachLine(data, len, [&](const char* p, const char* end, int line) {
+        if (p == end || done) {
+            return true;
+        }
+        if (*p != ':' || (end - p) % 2 != 1 || end - p < 11) {
+            error = where(name, line) + "not an Intel HEX record";
+            return false;
+        }
+        unsigned char rec[261];
+        size_t n = (end - p) / 2;
+        if (n > sizeof(rec)) {
+            error = where(name, line) + "record too long";
+            return false;
+        }
+        unsigned char sum = 0;
+        for (size_t i = 0; i < n; ++i) {
+            int hi = hexDigit(p[1 + 2 * i]);
+            int lo = hexDigit(p[2 + 2 * i]);
+            if (hi < 0 || lo < 0) {
+                error = where(name, line) + "bad hex digit";
+                return false;
+            }
+            rec[i] = (unsigned char)(hi << 4 | lo);
+            sum += rec[i];
+        }
+        if (rec[0] != n - 5) {
+            error = where(name, line) + "record length does not match its byte count";
+            return false;
+        }
+        if (sum != 0) {
+            error = where(name, line) + "checksum mismatch";
+            return false;
+        }
+        const unsigned char* payload = rec + 4;
+        uint32_t offset = (rec[1] << 8) | rec[2];
+        switch (rec[3]) {
+            case 0x00: { // Data
+                uint32_t addr = upper + offset;
+                if (addr + rec[0] > z16sim::MEM_SIZE) {
+                    error = where(name, line) + "data beyond the 64 KB address space";
+                    return false;
+                }
+                appendBytes(image, addr, payload, rec[0]);
+                return true;
+            }
+            case 0x01: // End of file
+                done = true;
+                return true;
+            case 0x02: // Extended segment address
+            case 0x04: // Extended linear address
+                if (rec[0] != 2) {
+                    break;
+                }
+                upper = ((payload[0] << 8) | payload[1]) << (rec[3] == 0x02 ? 4 : 16);
+                return true;
+            case 0x03: // Start segment address (CS:IP)
+            case 0x05: { // Start linear address
+                if (rec[0] != 4) {
+                    break;
+                }
+                uint32_t hi = (payload[0] << 8) | payload[1];
+                uint32_t lo = (payload[2] << 8) | payload[3];
+                uint32_t entry = rec[3] == 0x03 ? (hi << 4) + lo : (hi << 16) | lo;
+                if (entry >= z16sim::MEM_SIZE) {
+                    error = where(name, line) + "start address beyond the 64 KB address space";
+                    return false;
+                }
+                image.hasEntry = true;
+                image.entry = (uint16_t)entry;
+                return true;
+            }
+            default:
+                break;
+        }
+        error = where(name, line) + "unsupported record type";
+        return false;
+    });
+}
+
+bool parseVerilog(const char* data, size_t len, const std::string& name, z16image& image, std::string& error) {
+    return forEachLine(data, len, [&](const char* p, const char* end, int line) {
+        // Only "16'hADDR: data = 16'hWORD;" lines carry data
+        if (end - p < 4 || std::memcmp(p, "16'h", 4) != 0) {
+            return true;
+        }
+        p += 4;
+        uint32_t addr, word;
+        const char* next = p;
+        if (!readHex(next, end, 4, addr) || next == end || *next != ':') {
+            error = where(name, line) + "expected 16'hADDR:";
+            return false;
+        }
+        const char* value = std::search(next, end, "16'h", "16'h" + 4);
+        if (value == end) {
+            error = where(name, line) + "expected a 16'h data word";
+            return false;
+        }
+        value += 4;
+        if (!readHex(value, end, 4, word) || (addr & 1)) {
+            error = where(name, line) + "bad data word or odd address";
+            return false;
+        }
+        unsigned char bytes[2] = {(unsigned char)(word & 0xFF), (unsigned char)(word >> 8)};
+        appendBytes(image, addr, bytes, 2);
+        return true;
+    });
+}
+
+bool parseMemFile(const char* data, size_t len, const std::string& name, z16image& image, std::string& error) {
+    uint32_t addr = 0; // Byte address, as zx16asm writes both the dense and sparse forms
+    return forEachLine(data, len, [&](const char* p, const char* end, int line) {
+        while (p < end) {
+            if (*p == '#' || (*p == '/' && p + 1 < end && p[1] == '/')) {
+                return true; // Comment to end of line
+            }
+            if (isSpace(*p)) {
+                ++p;
+                continue;
+            }
+            uint32_t value;
+            if (*p == '@') {
+                ++p;
+                if (!readHex(p, end, 4, value) || (value & 1)) {
+                    error = where(name, line) + "bad @address";
+                    return false;
+                }
+                addr = value;
+            } else {
+                if (!readHex(p, end, 4, value) || (p < end && !isSpace(*p))) {
+                    error = where(name, line) + "expected a hex word";
+                    return false;
+                }
+                if (addr >= z16sim::MEM_SIZE) {
+                    error = where(name, line) + "data beyond the 64 KB address space";
+                    return false;
+                }
+                unsigned char bytes[2] = {(unsigned char)(value & 0xFF), (unsigned char)(value >> 8)};
+                appendBytes(image, addr, bytes, 2);
+                addr += 2;
+            }
+        }
+        return true;
+    });
+}
+
+bool endsWith(const std::string& s, const char* suffix) {
+    size_t n = std::strlen(suffix);
+    if (s.size() < n) {
+        return false;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (std::tolower((unsigned char)s[s.size() - n + i]) != suffix[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Format from the extension; text files without a known one are recognised
+// by their first record
+z16imageFormat detectFormat(const char* data, size_t len, const std::string& name) {
+    if (endsWith(name, ".bin")) return Z16_FORMAT_BIN;
+    if (endsWith(name, ".hex") || endsWith(name, ".ihex")) return Z16_FORMAT_IHEX;
+    if (endsWith(name, ".v") || endsWith(name, ".sv")) return Z16_FORMAT_VERILOG;
+    if (endsWith(name, ".mem")) return Z16_FORMAT_MEM;
+
+    size_t probe = std::min<size_t>(len, 4096);
+    for (size_t i = 0; i < probe; ++i) {
+        unsigned char c = data[i];
+        if ((c < 0x20 && c != '\n' && c != '\r' && c != '\t') || c > 0x7E) {
+            return Z16_FORMAT_BIN;
+        }
+    }
+    size_t first = 0;
+    while (first < len && std::isspace((unsigned char)data[first])) {
+        ++first;
+    }
+    if (first == len) {
+        return Z16_FORMAT_BIN;
+    }
+    if (data[first] == ':') {
+        return Z16_FORMAT_IHEX;
+    }
+    if (std::search(data, data + probe, "16'h", "16'h" + 4) != data + probe) {
+        return Z16_FORMAT_VERILOG;
+    }
+    return Z16_FORMAT_MEM;
+}
+
+// Calls parse with the file's contents, mapped read-only where possible
+template <typename F>
+bool withFileContents(const std::string& filename, std::string& error, F parse) {
+#ifndef _WIN32
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "Could not open file " + filename;
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        error = "Could not read file " + filename;
+        return false;
+    }
+    size_t len = (size_t)st.st_size;
+    if (len == 0) {
+        close(fd);
+        return parse("", 0);
+    }
+    void* map = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map != MAP_FAILED) {
+        bool ok = parse(static_cast<const char*>(map), len);
+        munmap(map, len);
+        return ok;
+    }
+#endif
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        error = "Could not open file " + filename;
+        return false;
+    }
+    std::vector<char> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return parse(contents.data(), contents.size());
+}
+
+} // namespace
+
+// z16parseImage function definition
+bool z16parseImage(const char* data, size_t len, const std::string& name, z16imageFormat format,
+                   z16image& image, std::string& error) {
+    image = z16image();
+    if (format == Z16_FORMAT_AUTO) {
+        format = detectFormat(data, len, name);
+    }
+    image.format = format;
+    switch (format) {
+        case Z16_FORMAT_IHEX:
+            return parseIntelHex(data, len, name, image, error);
+        case Z16_FORMAT_VERILOG:
+            return parseVerilog(data, len, name, image, error);
+        case Z16_FORMAT_MEM:
+            return parseMemFile(data, len, name, image, error);
+        default:
+            appendBytes(image, 0, reinterpret_cast<const unsigned char*>(data), len);
+            return true;
+    }
+}
+
+// shared method definition
+z16imageCache& z16imageCache::shared() {
+    static z16imageCache cache;
+    return cache;
+}
+
+// get method definition
+std::shared_ptr<const z16image> z16imageCache::get(const std::string& filename, z16imageFormat format, std::string& error) {
+    std::error_code ec;
+    uintmax_t size = std::filesystem::file_size(filename, ec);
+    int64_t mtime = ec ? 0 : (int64_t)std::filesystem::last_write_time(filename, ec).time_since_epoch().count();
+    if (ec) {
+        error = "Could not open file " + filename;
+        return nullptr;
+    }
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        auto it = this->entries.find(filename);
+        if (it != this->entries.end() && it->second.size == size && it->second.mtime == mtime &&
+            it->second.format == format) {
+            ++this->hits;
+            return it->second.image;
+        }
+    }
+
+    // Parse outside the lock; two threads missing at once both parse, and
+    // the later result wins
+    std::shared_ptr<z16image> image(new z16image());
+    bool ok = withFileContents(filename, error, [&](const char* data, size_t len) {
+        return z16parseImage(data, len, filename, format, *image, error);
+    });
+    if (!ok) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->entries[filename] = {size, mtime, format, image};
+    ++this->misses;
+    return image;
+}
+
+// getHits method definition
+uint64_t z16imageCache::getHits() const {
+    std::lock_guard<std::mutex> guard(this->lock);
+    return this->hits;
+}
+
+// getMisses method definition
+uint64_t z16imageCache::getMisses() const {
+    std::lock_guard<std::mutex> guard(this->lock);
+    return this->misses;
+}
+
+// clear method definition
+void z16imageCache::clear() {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->entries.clear();
+}
+
+// loadImage method definition: checks that the whole image fits before
+// writing any of it. A raw binary running past the end of memory is cut off
+// with a warning; addressed formats placed beyond it are an error.
+bool z16sim::loadImage(const z16image& image, const z16loadOptions& options) {
+    for (const z16image::segment& seg : image.segments) {
+        if (image.format != Z16_FORMAT_BIN && options.base + seg.addr + seg.bytes.size() > z16sim::MEM_SIZE) {
+            this->sink->print(Z16_CHAN_ERROR, "Error: Image data at 0x%x does not fit in memory when loaded at base 0x%x.\n",
+                              (unsigned)seg.addr, options.base);
+            return false;
+        }
+    }
+    for (const z16image::segment& seg : image.segments) {
+        size_t len = seg.bytes.size();
+        uint32_t addr = options.base + seg.addr;
+        if (addr + len > z16sim::MEM_SIZE) {
+            this->sink->print(Z16_CHAN_ERROR, "Warning: Image size (%zu bytes) exceeds the memory above 0x%x. Only loading %u bytes.\n",
+                              len, (unsigned)addr, (unsigned)(z16sim::MEM_SIZE - addr));
+            len = z16sim::MEM_SIZE - addr;
+        }
+        std::memcpy(this->memory + addr, seg.bytes.data(), len);
+    }
+    this->dirtyBase = 0; // Memory no longer matches any snapshot
+    z16sim::flushBlockCache();
+    if (options.entry >= 0) {
+        this->pc = (uint16_t)options.entry;
+    } else {
+        this->pc = image.hasEntry ? (uint16_t)(options.base + image.entry) : options.base;
+    }
+    return true;
+}
+
+// loadImage method definition
+bool z16sim::loadImage(const char* filename, const z16loadOptions& options) {
+    std::string error;
+    std::shared_ptr<const z16image> image = z16imageCache::shared().get(filename, options.format, error);
+    if (!image) {
+        this->sink->print(Z16_CHAN_ERROR, "Error: %s\n", error.c_str());
+        return false;
+    }
+    if (!z16sim::loadImage(*image, options)) {
+        return false;
+    }
+    size_t loaded = 0;
+    for (const z16image::segment& seg : image->segments) {
+        loaded += std::min<size_t>(seg.bytes.size(), z16sim::MEM_SIZE - std::min<uint32_t>(options.base + seg.addr, z16sim::MEM_SIZE));
+    }
+    this->sink->print(Z16_CHAN_STATUS, "Loaded %zu bytes from %s into memory.\n", loaded, filename);
+    return true;
+}
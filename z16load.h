@@ -0,0 +1,75 @@
+#ifndef Z16LOAD_H
+#define Z16LOAD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Program image formats written by zx16asm.py
+enum z16imageFormat {
+    Z16_FORMAT_AUTO,    // From the file name, else from the contents
+    Z16_FORMAT_BIN,     // Raw bytes (get_binary_output)
+    Z16_FORMAT_IHEX,    // Intel HEX (get_intel_hex_output)
+    Z16_FORMAT_VERILOG, // "16'hADDR: data = 16'hWORD;" case items (get_verilog_output)
+    Z16_FORMAT_MEM      // $readmemh words, dense or "@ADDR WORD" sparse (get_memory_file_output)
+};
+
+// A parsed program: runs of bytes at addresses relative to the load base
+struct z16image {
+    struct segment {
+        uint32_t addr;
+        std::vector<unsigned char> bytes;
+    };
+    std::vector<segment> segments;
+    z16imageFormat format = Z16_FORMAT_BIN;
+    bool hasEntry = false; // Intel HEX start address record
+    uint16_t entry = 0;
+
+    size_t size() const;
+};
+
+// Where and how z16sim::loadImage() places an image. The entry PC defaults
+// to the image's own start address, else to base.
+struct z16loadOptions {
+    z16imageFormat format = Z16_FORMAT_AUTO;
+    uint16_t base = 0;
+    int32_t entry = -1; // -1: default
+};
+
+// Parses an image held in memory. name is only used for detection and in
+// error messages ("name:line: problem").
+bool z16parseImage(const char* data, size_t len, const std::string& name, z16imageFormat format,
+                   z16image& image, std::string& error);
+
+// Parsed images by file name, shared by every simulator in the process.
+// A file is mapped and parsed again only when its size or modification
+// time changed, so loading the same firmware repeatedly costs one stat()
+// and the copy into memory. Safe to use from several threads.
+class z16imageCache {
+public:
+    static z16imageCache& shared();
+
+    std::shared_ptr<const z16image> get(const std::string& filename, z16imageFormat format, std::string& error);
+    void clear();
+    uint64_t getHits() const;
+    uint64_t getMisses() const;
+
+private:
+    struct entry {
+        uintmax_t size;
+        int64_t mtime;
+        z16imageFormat format;
+        std::shared_ptr<const z16image> image;
+    };
+
+    mutable std::mutex lock;
+    std::unordered_map<std::string, entry> entries;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+
+#endif // Z16LOAD_H
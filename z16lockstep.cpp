@@ -0,0 +1,466 @@
+#include "z16lockstep.h"
+#include "z16decode.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+// Lanes of 16-bit state per host vector register: 16 with AVX2 (-mavx2),
+// otherwise 8 (SSE2, or NEON on ARM)
+#ifdef __AVX2__
+#define Z16_VECTOR_BYTES 32
+#else
+#define Z16_VECTOR_BYTES 16
+#endif
+typedef uint16_t z16lanes __attribute__((vector_size(Z16_VECTOR_BYTES), __may_alias__));
+typedef int16_t z16slanes __attribute__((vector_size(Z16_VECTOR_BYTES), __may_alias__));
+
+static const int VEC = sizeof(z16lanes) / sizeof(uint16_t);
+static const int NVEC = z16lockstep::CHUNK / VEC;
+
+// Budget accounting is batched: lane counters are 16-bit and folded into
+// left[] at least this often
+static const uint64_t FLUSH_STEPS = 0x8000;
+
+// Working state of up to CHUNK lanes while they are being stepped. Lanes past
+// n are never live, so whole vectors can always be processed.
+struct z16lockstep::chunk {
+    size_t first;
+    int n;
+    z16lanes r[z16sim::NUM_REGS][NVEC];
+    z16lanes pc[NVEC];
+    z16lanes live[NVEC];   // 0xFFFF while the lane is running
+    z16lanes mask[NVEC];   // 0xFFFF for lanes in the group being executed
+    z16lanes target[NVEC]; // Next PC of each lane after a control transfer
+    z16lanes count[NVEC];  // Instructions retired since the last flush
+    uint64_t left[CHUNK];  // Budget left as of the last flush
+
+    // Private pages: slot[i][page] indexes pool, 0 means the shared base page
+    std::vector<uint32_t> slot = std::vector<uint32_t>(CHUNK * NUM_PAGES);
+    std::vector<std::array<unsigned char, PAGE_SIZE> > pool;
+    int privatePages[NUM_PAGES]; // Lanes holding a private copy of each page
+};
+
+// One lane of a vector array
+static inline uint16_t& lane(z16lanes* v, int i) {
+    return reinterpret_cast<uint16_t*>(v)[i];
+}
+
+static inline z16lanes select(z16lanes mask, z16lanes a, z16lanes b) {
+    return (a & mask) | (b & ~mask);
+}
+
+// z16lockstep Constructor
+z16lockstep::z16lockstep(const z16snapshot& base, size_t lanes) : base(base) {
+    for (int r = 0; r < z16sim::NUM_REGS; ++r) {
+        this->regs[r].assign(lanes, base.regs[r]);
+    }
+    this->pcs.assign(lanes, base.pc);
+    this->status.assign(lanes, 0);
+    this->retired.assign(lanes, base.retired);
+    this->output.resize(lanes);
+    this->pages.resize(lanes);
+}
+
+// writeMemory method definition
+void z16lockstep::writeMemory(size_t lane, uint16_t addr, const void* data, size_t len) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    len = std::min(len, (size_t)(z16sim::MEM_SIZE - addr));
+    for (size_t k = 0; k < len; ++k) {
+        uint32_t a = addr + k;
+        std::vector<lanePage>& own = this->pages[lane];
+        auto it = std::find_if(own.begin(), own.end(), [&](const lanePage& p) { return p.page == a >> PAGE_SHIFT; });
+        if (it == own.end()) {
+            own.push_back(lanePage());
+            own.back().page = (uint8_t)(a >> PAGE_SHIFT);
+            std::memcpy(own.back().bytes, this->base.memory.data() + (a & ~(PAGE_SIZE - 1)), PAGE_SIZE);
+            it = own.end() - 1;
+        }
+        it->bytes[a & (PAGE_SIZE - 1)] = bytes[k];
+    }
+}
+
+// readMemory method definition
+uint8_t z16lockstep::readMemory(size_t lane, uint16_t addr) const {
+    for (const lanePage& p : this->pages[lane]) {
+        if (p.page == addr >> PAGE_SHIFT) {
+            return p.bytes[addr & (PAGE_SIZE - 1)];
+        }
+    }
+    return this->base.memory[addr];
+}
+
+// run method definition
+void z16lockstep::run(uint64_t max_instructions) {
+    for (size_t first = 0; first < this->pcs.size(); first += CHUNK) {
+        z16lockstep::runChunk(first, std::min<size_t>(CHUNK, this->pcs.size() - first), max_instructions);
+    }
+}
+
+// runChunk method definition
+void z16lockstep::runChunk(size_t first, size_t count, uint64_t max_instructions) {
+    std::unique_ptr<chunk> owner(new chunk());
+    chunk& c = *owner;
+    const unsigned char* shared = this->base.memory.data();
+    c.first = first;
+    c.n = (int)count;
+    c.pool.resize(1);
+    std::memset(c.privatePages, 0, sizeof(c.privatePages));
+    for (int i = 0; i < CHUNK; ++i) {
+        bool used = i < c.n;
+        for (int r = 0; r < z16sim::NUM_REGS; ++r) {
+            lane(c.r[r], i) = used ? this->regs[r][first + i] : 0;
+        }
+        lane(c.pc, i) = used ? this->pcs[first + i] : 0;
+        lane(c.live, i) = used && max_instructions > 0 ? 0xFFFF : 0;
+        lane(c.count, i) = 0;
+        c.left[i] = max_instructions;
+        if (!used) {
+            continue;
+        }
+        this->status[first + i] = 0;
+        for (const lanePage& p : this->pages[first + i]) {
+            c.slot[i * NUM_PAGES + p.page] = (uint32_t)c.pool.size();
+            c.pool.emplace_back();
+            std::memcpy(c.pool.back().data(), p.bytes, PAGE_SIZE);
+            ++c.privatePages[p.page];
+        }
+    }
+
+    auto load8 = [&](int i, uint16_t a) -> uint8_t {
+        uint32_t s = c.slot[i * NUM_PAGES + (a >> PAGE_SHIFT)];
+        return s ? c.pool[s][a & (PAGE_SIZE - 1)] : shared[a];
+    };
+    auto store8 = [&](int i, uint16_t a, uint8_t v) {
+        uint32_t& s = c.slot[i * NUM_PAGES + (a >> PAGE_SHIFT)];
+        if (!s) { // Copy on write
+            s = (uint32_t)c.pool.size();
+            c.pool.emplace_back();
+            std::memcpy(c.pool.back().data(), shared + (a & ~(PAGE_SIZE - 1)), PAGE_SIZE);
+            ++c.privatePages[a >> PAGE_SHIFT];
+        }
+        c.pool[s][a & (PAGE_SIZE - 1)] = v;
+    };
+    auto fetch = [&](int i, uint16_t a) -> uint16_t {
+        return (load8(i, a + 1) << 8) | load8(i, a);
+    };
+
+    // Fold the 16-bit counters into the budgets and stop lanes that used
+    // theirs up. Returns how many steps can run before the next flush.
+    auto flush = [&]() -> uint64_t {
+        uint64_t window = FLUSH_STEPS;
+        for (int i = 0; i < c.n; ++i) {
+            uint16_t done = lane(c.count, i);
+            c.left[i] -= done;
+            this->retired[first + i] += done;
+            this->stats.laneInsts += done;
+            lane(c.count, i) = 0;
+            if (c.left[i] == 0) {
+                lane(c.live, i) = 0;
+            }
+            if (lane(c.live, i)) {
+                window = std::min(window, c.left[i]);
+            }
+        }
+        return window;
+    };
+    // A handed-off lane settles its counter first
+    auto handoffLane = [&](int i) {
+        uint16_t done = lane(c.count, i);
+        c.left[i] -= done;
+        this->retired[first + i] += done;
+        this->stats.laneInsts += done;
+        lane(c.count, i) = 0;
+        z16lockstep::handoff(c, i, c.left[i]);
+    };
+
+    uint64_t window = flush();
+    uint64_t steps = 0;
+    for (;;) {
+        if (steps == window) {
+            window = flush();
+            steps = 0;
+        }
+
+        // The group is every live lane at the lowest PC
+        z16lanes lowest = ~z16lanes{};
+        z16lanes anyLive = z16lanes{};
+        for (int v = 0; v < NVEC; ++v) {
+            z16lanes key = c.pc[v] | ~c.live[v];
+            lowest = select((z16lanes)(key < lowest), key, lowest);
+            anyLive |= c.live[v];
+        }
+        uint16_t at = 0xFFFF;
+        bool running = false;
+        for (int k = 0; k < VEC; ++k) {
+            at = std::min<uint16_t>(at, lowest[k]);
+            running = running || anyLive[k];
+        }
+        if (!running) {
+            break;
+        }
+        for (int v = 0; v < NVEC; ++v) {
+            c.mask[v] = (z16lanes)(c.pc[v] == at) & c.live[v];
+        }
+        ++this->stats.steps;
+        ++steps;
+
+        int leader = 0;
+        while (!lane(c.mask, leader)) {
+            ++leader;
+        }
+        if (at >= z16sim::MEM_SIZE - 1) { // The scalar simulator reports the PC fault
+            for (int i = leader; i < c.n; ++i) {
+                if (lane(c.mask, i)) {
+                    handoffLane(i);
+                }
+            }
+            continue;
+        }
+
+        // Lanes that rewrote this code may see a different instruction; the
+        // leader's instruction runs now, the others in a later step
+        uint16_t inst = fetch(leader, at);
+        if (c.privatePages[at >> PAGE_SHIFT] || c.privatePages[(at + 1) >> PAGE_SHIFT]) {
+            for (int i = leader + 1; i < c.n; ++i) {
+                if (lane(c.mask, i) && fetch(i, at) != inst) {
+                    lane(c.mask, i) = 0;
+                }
+            }
+        }
+        const z16decoded& d = z16decodeTable[inst];
+        z16lanes* rd = c.r[d.rd];
+        z16lanes* rs = c.r[d.rs2];
+        const z16lanes* m = c.mask;
+        const uint16_t imm = (uint16_t)d.imm;
+        const int16_t simm = d.imm;
+        const uint16_t next = at + 2;
+        bool control = false; // Set when target[] holds each lane's next PC
+
+// rd = expr for the lanes in the group; expr may use v (the vector index)
+#define Z16_LANES(expr)                                     \
+        for (int v = 0; v < NVEC; ++v) {                    \
+            rd[v] = select(m[v], (z16lanes)(expr), rd[v]);  \
+        }                                                   \
+        break
+
+        switch (d.op) {
+            // R-type
+            case Z16_ADD:  Z16_LANES(rd[v] + rs[v]);
+            case Z16_SUB:  Z16_LANES(rd[v] - rs[v]);
+            case Z16_SLT:  Z16_LANES((z16lanes)((z16slanes)rd[v] < (z16slanes)rs[v]) & 1);
+            case Z16_SLTU: Z16_LANES((z16lanes)(rd[v] < rs[v]) & 1);
+            case Z16_SLL:  Z16_LANES(rd[v] << (rs[v] & 0xF));
+            case Z16_SRL:  Z16_LANES(rd[v] >> (rs[v] & 0xF));
+            case Z16_SRA:  Z16_LANES((z16slanes)rd[v] >> (z16slanes)(rs[v] & 0xF));
+            case Z16_OR:   Z16_LANES(rd[v] | rs[v]);
+            case Z16_AND:  Z16_LANES(rd[v] & rs[v]);
+            case Z16_XOR:  Z16_LANES(rd[v] ^ rs[v]);
+            case Z16_MV:   Z16_LANES(rs[v]);
+            case Z16_JR:
+                std::memcpy(c.target, rd, sizeof(c.target));
+                control = true;
+                break;
+            case Z16_JALR: // rd receives the link before rs2 is read
+                for (int v = 0; v < NVEC; ++v) {
+                    rd[v] = select(m[v], next + z16lanes{}, rd[v]);
+                }
+                std::memcpy(c.target, rs, sizeof(c.target));
+                control = true;
+                break;
+
+            // I-type
+            case Z16_ADDI:  Z16_LANES(rd[v] + imm);
+            case Z16_SLTI:  Z16_LANES((z16lanes)((z16slanes)rd[v] < simm) & 1);
+            case Z16_SLTUI: Z16_LANES((z16lanes)(rd[v] < imm) & 1);
+            case Z16_SLLI:  Z16_LANES(rd[v] << imm);
+            case Z16_SRLI:  Z16_LANES(rd[v] >> imm);
+            case Z16_SRAI:  Z16_LANES((z16slanes)rd[v] >> simm);
+            case Z16_ORI:   Z16_LANES(rd[v] | imm);
+            case Z16_ANDI:  Z16_LANES(rd[v] & imm);
+            case Z16_XORI:  Z16_LANES(rd[v] ^ imm);
+            case Z16_LI:
+            case Z16_LUI:   Z16_LANES(imm + z16lanes{});
+            case Z16_AUIPC: Z16_LANES((uint16_t)(at + imm) + z16lanes{});
+
+            // B-type
+            case Z16_BEQ: case Z16_BNE: case Z16_BZ: case Z16_BNZ:
+            case Z16_BLT: case Z16_BGE: case Z16_BLTU: case Z16_BGEU: {
+                const z16lanes taken = (uint16_t)(at + imm) + z16lanes{};
+                const z16lanes fallthrough = next + z16lanes{};
+                for (int v = 0; v < NVEC; ++v) {
+                    z16lanes a = rd[v], b = rs[v];
+                    z16lanes t;
+                    switch (d.op) {
+                        case Z16_BEQ:  t = (z16lanes)(a == b); break;
+                        case Z16_BNE:  t = (z16lanes)(a != b); break;
+                        case Z16_BZ:   t = (z16lanes)(a == 0); break;
+                        case Z16_BNZ:  t = (z16lanes)(a != 0); break;
+                        case Z16_BLT:  t = (z16lanes)((z16slanes)a < (z16slanes)b); break;
+                        case Z16_BGE:  t = (z16lanes)((z16slanes)a >= (z16slanes)b); break;
+                        case Z16_BLTU: t = (z16lanes)(a < b); break;
+                        default:       t = (z16lanes)(a >= b); break;
+                    }
+                    c.target[v] = select(t, taken, fallthrough);
+                }
+                control = true;
+                break;
+            }
+
+            // S-type and L-type: per lane, through the lane's pages
+            case Z16_SB: case Z16_SW: case Z16_LB: case Z16_LW: case Z16_LBU: {
+                bool word = d.op == Z16_SW || d.op == Z16_LW;
+                bool store = d.op == Z16_SB || d.op == Z16_SW;
+                for (int i = leader; i < c.n; ++i) {
+                    if (!lane(c.mask, i)) {
+                        continue;
+                    }
+                    uint16_t a = (store ? lane(rd, i) : lane(rs, i)) + imm;
+                    uint16_t data = lane(rs, i);
+                    if (word && (a & 1)) { // Misaligned: the scalar simulator reports the fault
+                        lane(c.mask, i) = 0;
+                        handoffLane(i);
+                        continue;
+                    }
+                    switch (d.op) {
+                        case Z16_SB: store8(i, a, (uint8_t)data); break;
+                        case Z16_SW: store8(i, a, (uint8_t)data); store8(i, a + 1, (uint8_t)(data >> 8)); break;
+                        case Z16_LB: lane(rd, i) = (uint16_t)(int8_t)load8(i, a); break;
+                        case Z16_LW: lane(rd, i) = (load8(i, a + 1) << 8) | load8(i, a); break;
+                        default:     lane(rd, i) = load8(i, a); break;
+                    }
+                }
+                break;
+            }
+
+            // J-type
+            case Z16_JAL:
+                for (int v = 0; v < NVEC; ++v) {
+                    rd[v] = select(m[v], next + z16lanes{}, rd[v]);
+                }
+                [[fallthrough]];
+            case Z16_J:
+                for (int v = 0; v < NVEC; ++v) {
+                    c.target[v] = (uint16_t)(at + imm) + z16lanes{};
+                }
+                control = true;
+                break;
+
+            default: // ecall and invalid encodings
+                for (int i = leader; i < c.n; ++i) {
+                    if (lane(c.mask, i)) {
+                        handoffLane(i);
+                    }
+                }
+                continue;
+        }
+#undef Z16_LANES
+
+        // Retire the group: move each lane to its next PC
+        if (control) {
+            z16lanes low = ~z16lanes{}, high = z16lanes{};
+            for (int v = 0; v < NVEC; ++v) {
+                c.pc[v] = select(m[v], c.target[v], c.pc[v]);
+                low = select((z16lanes)(c.target[v] < low) & m[v], c.target[v], low);
+                high = select((z16lanes)(c.target[v] > high) & m[v], c.target[v], high);
+            }
+            uint16_t lo = 0xFFFF, hi = 0;
+            for (int k = 0; k < VEC; ++k) {
+                lo = std::min<uint16_t>(lo, low[k]);
+                hi = std::max<uint16_t>(hi, high[k]);
+            }
+            if (lo < hi) {
+                ++this->stats.divergences;
+            }
+        } else {
+            for (int v = 0; v < NVEC; ++v) {
+                c.pc[v] = select(m[v], next + z16lanes{}, c.pc[v]);
+            }
+        }
+        for (int v = 0; v < NVEC; ++v) {
+            c.count[v] += m[v] & 1;
+        }
+    }
+    flush();
+
+    // Write the lanes back, keeping private pages for the next run()
+    for (int i = 0; i < c.n; ++i) {
+        for (int r = 0; r < z16sim::NUM_REGS; ++r) {
+            this->regs[r][first + i] = lane(c.r[r], i);
+        }
+        this->pcs[first + i] = lane(c.pc, i);
+        std::vector<lanePage>& own = this->pages[first + i];
+        own.clear();
+        for (int page = 0; page < NUM_PAGES; ++page) {
+            uint32_t s = c.slot[i * NUM_PAGES + page];
+            if (s) {
+                own.push_back(lanePage());
+                own.back().page = (uint8_t)page;
+                std::memcpy(own.back().bytes, c.pool[s].data(), PAGE_SIZE);
+            }
+        }
+    }
+}
+
+// handoff method definition: runs one instruction of lane i on the scalar
+// simulator, loaded with the lane's registers and memory
+void z16lockstep::handoff(chunk& c, int i, uint64_t& left) {
+    size_t index = c.first + i;
+    if (!this->scalar) {
+        this->scalar.reset(new z16sim());
+        this->scalar->setInput(this->noInput);
+    }
+    z16sim& sim = *this->scalar;
+    sim.restore(this->base); // Only copies back what the previous handoff changed
+    for (int page = 0; page < NUM_PAGES; ++page) {
+        uint32_t s = c.slot[i * NUM_PAGES + page];
+        if (s) {
+            sim.writeMemory((uint16_t)(page << PAGE_SHIFT), c.pool[s].data(), PAGE_SIZE);
+        }
+    }
+    for (int r = 0; r < z16sim::NUM_REGS; ++r) {
+        sim.setReg(r, lane(c.r[r], i));
+    }
+    sim.setPC(lane(c.pc, i));
+
+    z16bufferSink captured;
+    z16sink* previous = &sim.getSink();
+    sim.setSink(&captured);
+    uint64_t before = sim.getInstructionCount();
+    int st = sim.run(1);
+    sim.flushConsole();
+    uint64_t done = sim.getInstructionCount() - before;
+    this->output[index] += captured.str();
+    sim.setSink(previous);
+
+    for (int r = 0; r < z16sim::NUM_REGS; ++r) {
+        lane(c.r[r], i) = sim.getReg(r);
+    }
+    lane(c.pc, i) = sim.getPC();
+    this->retired[index] += done;
+    this->stats.laneInsts += done;
+    ++this->stats.handoffs;
+    left -= std::min(left, done);
+    this->status[index] = st;
+    if (st != 0 || left == 0) {
+        lane(c.live, i) = 0;
+    }
+
+    // Bring back anything the instruction wrote
+    const unsigned char* mem = sim.getMemory();
+    for (int page = 0; page < NUM_PAGES; ++page) {
+        if (!sim.isPageDirty(page)) {
+            continue;
+        }
+        uint32_t& s = c.slot[i * NUM_PAGES + page];
+        const unsigned char* current = s ? c.pool[s].data() : this->base.memory.data() + (page << PAGE_SHIFT);
+        if (std::memcmp(current, mem + (page << PAGE_SHIFT), PAGE_SIZE) == 0) {
+            continue;
+        }
+        if (!s) {
+            s = (uint32_t)c.pool.size();
+            c.pool.emplace_back();
+            ++c.privatePages[page];
+        }
+        std::memcpy(c.pool[s].data(), mem + (page << PAGE_SHIFT), PAGE_SIZE);
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef Z16LOCKSTEP_H
+#define Z16LOCKSTEP_H
+
+#include "z16sim.h"
+#include <cstdint>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Counters reported by the lockstep engine
+struct z16lockstepStats {
+    uint64_t steps = 0;       // Instructions issued, each covering a group of lanes
+    uint64_t laneInsts = 0;   // Instructions retired summed over lanes
+    uint64_t divergences = 0; // Branches or indirect jumps whose lanes split up
+    uint64_t handoffs = 0;    // Lane instructions executed by the scalar simulator
+};
+
+// Runs many copies ("lanes") of one program in lockstep. Registers and PCs
+// are kept as structure-of-arrays; each step picks the lowest PC among the
+// running lanes of a chunk and executes that instruction for every lane at
+// it, so diverged lanes regroup as soon as they reach the same PC again.
+// Register and PC updates are masked blends over GCC/Clang vector types (8
+// lanes per SSE2 register by default, 16 per AVX2 register with -mavx2).
+//
+// Lanes share the initial memory image; a lane's stores go to private
+// copy-on-write pages. ecall, invalid encodings and faulting accesses are
+// handed to a scalar z16sim one instruction at a time, so every lane ends in
+// exactly the state (and with the output) a z16sim run would. Lanes see an
+// empty console input and an all-RAM memory bus.
+class z16lockstep {
+public:
+    static const int CHUNK = 256; // Lanes stepped together
+    static const int PAGE_SHIFT = z16blockCache::PAGE_SHIFT;
+    static const int PAGE_SIZE = 1 << PAGE_SHIFT;
+    static const int NUM_PAGES = z16blockCache::NUM_PAGES;
+
+    // Every lane starts from the snapshot's registers, PC and memory
+    z16lockstep(const z16snapshot& base, size_t lanes);
+
+    size_t getLanes() const { return pcs.size(); }
+    void setReg(size_t lane, int idx, uint16_t value) { regs[idx][lane] = value; }
+    void setPC(size_t lane, uint16_t value) { pcs[lane] = value; }
+    void writeMemory(size_t lane, uint16_t addr, const void* data, size_t len);
+
+    // Runs every lane until it stops or has retired max_instructions in this
+    // call. Lane statuses follow z16sim::run().
+    void run(uint64_t max_instructions);
+
+    int getStatus(size_t lane) const { return status[lane]; }
+    uint16_t getReg(size_t lane, int idx) const { return regs[idx][lane]; }
+    uint16_t getPC(size_t lane) const { return pcs[lane]; }
+    uint64_t getInstructionCount(size_t lane) const { return retired[lane]; }
+    const std::string& getOutput(size_t lane) const { return output[lane]; }
+    uint8_t readMemory(size_t lane, uint16_t addr) const;
+    z16lockstepStats getStats() const { return stats; }
+
+private:
+    struct lanePage {
+        uint8_t page;
+        unsigned char bytes[PAGE_SIZE];
+    };
+    struct chunk;
+
+    z16snapshot base;
+    std::vector<uint16_t> regs[z16sim::NUM_REGS];
+    std::vector<uint16_t> pcs;
+    std::vector<int> status;
+    std::vector<uint64_t> retired;
+    std::vector<std::string> output;
+    std::vector<std::vector<lanePage> > pages; // Private pages per lane
+    std::unique_ptr<z16sim> scalar;            // Executes handed-off instructions
+    std::istringstream noInput;                // Console input of the scalar simulator
+    z16lockstepStats stats;
+
+    void runChunk(size_t first, size_t count, uint64_t max_instructions);
+    void handoff(chunk& c, int i, uint64_t& left);
+};
+
+#endif // Z16LOCKSTEP_H
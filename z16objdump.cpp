@@ -0,0 +1,404 @@
+// zx16_objdump: whole-image disassembler. Control flow is recovered
+// statically (z16cfg) from the entry points by following B-type and J-type
+// targets, which separates code from data without running the program. The
+// listing labels every basic block and prints data as bytes; the block graph
+// can also be written as Graphviz DOT or JSON for other tools. The listing
+// is formatted in 4 KiB chunks on all hardware threads.
+
+#include "z16sim.h"
+#include "z16cfg.h"
+#include "z16decode.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct objdumpOptions {
+    std::vector<uint16_t> entries;
+    bool vectors = false; // Interrupt vector slots are entries too
+    bool listing = true;
+    std::string dotFile;
+    std::string jsonFile;
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+// Writes v as digits uppercase hex digits and returns the end
+static char* putHex(char* p, unsigned v, int digits) {
+    static const char hex[] = "0123456789ABCDEF";
+    for (int i = digits - 1; i >= 0; --i) {
+        p[i] = hex[v & 0xF];
+        v >>= 4;
+    }
+    return p + digits;
+}
+
+// How control leaves a block along one edge
+enum objdumpEdge { EDGE_TAKEN, EDGE_FALLTHROUGH, EDGE_JUMP, EDGE_CALL };
+static const char* edgeNames[] = {"taken", "fallthrough", "jump", "call"};
+
+// The recovered program with the per-address facts the outputs share
+class objdumpImage {
+public:
+    static const int CHUNK = 4096; // Bytes per listing job
+
+    objdumpImage(const unsigned char* memory, const objdumpOptions& options) : memory(memory), options(options) {
+        std::vector<uint16_t> entries = options.entries;
+        if (options.vectors) {
+            for (int v = 1; v < z16sim::NUM_VECTORS; ++v) {
+                entries.push_back((uint16_t)(2 * v));
+            }
+        }
+        cfg.recover(memory, entries);
+
+        instStart.assign(z16sim::MEM_SIZE, 0);
+        function.assign(z16sim::MEM_SIZE, 0);
+        preds.assign(z16sim::MEM_SIZE, 0);
+        for (uint16_t entry : entries) {
+            function[entry] = 1;
+        }
+        for (const auto& it : cfg.blocks) {
+            const z16cfgBlock& block = it.second;
+            for (int i = 0; i < block.count; ++i) {
+                instStart[(uint16_t)(block.start + 2 * i)] = 1;
+            }
+            instructions += block.count;
+            std::vector<objdumpEdge> kinds = edgeKinds(block);
+            for (size_t i = 0; i < block.succs.size(); ++i) {
+                ++preds[block.succs[i]];
+                if (kinds[i] == EDGE_CALL) {
+                    function[block.succs[i]] = 1;
+                }
+            }
+        }
+        for (int addr = 0; addr < z16sim::MEM_SIZE; ++addr) {
+            codeBytes += cfg.code[addr];
+        }
+    }
+
+    const z16cfg& getCFG() const { return cfg; }
+    size_t getInstructions() const { return instructions; }
+    size_t getCodeBytes() const { return codeBytes; }
+
+    uint16_t lastPC(const z16cfgBlock& block) const { return block.start + 2 * (block.count - 1); }
+
+    // Kind of each of block.succs, in order
+    std::vector<objdumpEdge> edgeKinds(const z16cfgBlock& block) const {
+        const z16decoded& d = z16decodeTable[z16cfg::fetch(memory, lastPC(block))];
+        std::vector<objdumpEdge> kinds;
+        if (d.op >= Z16_BEQ && d.op <= Z16_BGEU) {
+            kinds = {EDGE_TAKEN, EDGE_FALLTHROUGH};
+        } else if (d.op == Z16_J) {
+            kinds = {EDGE_JUMP};
+        } else if (d.op == Z16_JAL) {
+            kinds = {EDGE_CALL};
+        } else {
+            kinds = {EDGE_FALLTHROUGH}; // ecall, or running into the next leader
+        }
+        kinds.resize(block.succs.size(), EDGE_FALLTHROUGH);
+        return kinds;
+    }
+
+    // Listing of [lo, hi). An instruction belongs to the chunk it starts in.
+    std::string formatChunk(int lo, int hi) const {
+        std::string text;
+        char line[160];
+        char disasm[128];
+        int addr = lo;
+        while (addr < hi) {
+            if (instStart[addr]) {
+                auto block = cfg.blocks.find((uint16_t)addr);
+                if (block != cfg.blocks.end()) {
+                    std::snprintf(line, sizeof(line), "\nL_%04X:%s  ; %u instructions, %u predecessors\n", addr,
+                                  function[addr] ? " (function)" : "", block->second.count, preds[addr]);
+                    text += line;
+                }
+                uint16_t inst = z16cfg::fetch(memory, (uint16_t)addr);
+                const z16decoded& d = z16decodeTable[inst];
+                z16sim::disassemble(inst, (uint16_t)addr, disasm, sizeof(disasm));
+                const char* note = d.op == Z16_JR || d.op == Z16_JALR ? "  ; indirect" : d.op == Z16_TRAP ? "  ; invalid" : "";
+                char* p = line;
+                p = putHex((char*)std::memcpy(p, "    ", 4) + 4, addr, 4);
+                p = putHex((char*)std::memcpy(p, ":  ", 3) + 3, inst, 4);
+                text.append(line, p - line);
+                text += "  ";
+                text += disasm;
+                text += note;
+                text += '\n';
+                addr += instStart[addr + 1] ? 1 : 2; // An entry inside this instruction gets its own line
+            } else if (cfg.code[addr]) {
+                ++addr; // Second byte of an instruction from the previous chunk
+            } else {
+                int end = addr;
+                while (end < hi && !cfg.code[end]) {
+                    ++end;
+                }
+                formatData(text, addr, end);
+                addr = end;
+            }
+        }
+        return text;
+    }
+
+    void writeListing(std::ostream& os) const {
+        const int chunks = z16sim::MEM_SIZE / CHUNK;
+        std::vector<std::string> parts(chunks);
+        std::atomic<int> next(0);
+        auto worker = [&]() {
+            int c;
+            while ((c = next++) < chunks) {
+                parts[c] = formatChunk(c * CHUNK, (c + 1) * CHUNK);
+            }
+        };
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < std::min<unsigned>(options.threads, chunks); ++t) {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for (std::thread& t : workers) {
+            t.join();
+        }
+        // A zero run that crosses a chunk boundary becomes one line again
+        static const char ZERO[] = ":  .zero ";
+        size_t last = 0;
+        for (int c = 1; c < chunks; ++c) {
+            std::string& prev = parts[last];
+            std::string& part = parts[c];
+            size_t tail = prev.rfind('\n', prev.size() - 2) + 1; // npos + 1 is 0
+            if (!prev.empty() && prev.compare(tail + 8, sizeof(ZERO) - 1, ZERO) == 0 &&
+                part.compare(8, sizeof(ZERO) - 1, ZERO) == 0) {
+                long total = std::atol(prev.c_str() + tail + 8 + sizeof(ZERO) - 1) + std::atol(part.c_str() + 8 + sizeof(ZERO) - 1);
+                prev.resize(tail + 8 + sizeof(ZERO) - 1);
+                prev += std::to_string(total) + "\n";
+                part.erase(0, part.find('\n') + 1);
+            }
+            if (!part.empty()) {
+                last = c;
+            }
+        }
+        for (const std::string& part : parts) {
+            os << part;
+        }
+    }
+
+    void writeDOT(std::ostream& os) const {
+        char disasm[128];
+        os << "digraph zx16 {\n  node [shape=box, fontname=\"monospace\"];\n";
+        for (const auto& it : cfg.blocks) {
+            const z16cfgBlock& block = it.second;
+            char name[16];
+            std::snprintf(name, sizeof(name), "L_%04X", block.start);
+            os << "  " << name << " [label=\"" << name << ":\\l";
+            for (int i = 0; i < block.count; ++i) {
+                uint16_t pc = block.start + 2 * i;
+                z16sim::disassemble(z16cfg::fetch(memory, pc), pc, disasm, sizeof(disasm));
+                os << disasm << "\\l";
+            }
+            os << "\"" << (function[block.start] ? ", peripheries=2" : "") << (block.halts ? ", color=red" : "") << "];\n";
+            std::vector<objdumpEdge> kinds = edgeKinds(block);
+            for (size_t i = 0; i < block.succs.size(); ++i) {
+                char target[16];
+                std::snprintf(target, sizeof(target), "L_%04X", block.succs[i]);
+                os << "  " << name << " -> " << target << " [label=\"" << edgeNames[kinds[i]] << "\""
+                   << (kinds[i] == EDGE_CALL ? ", style=dashed" : "") << "];\n";
+            }
+        }
+        os << "}\n";
+    }
+
+    void writeJSON(std::ostream& os, const std::string& image) const {
+        os << "{\n  \"image\": \"";
+        for (char c : image) {
+            if (c == '"' || c == '\\') {
+                os << '\\';
+            }
+            os << c;
+        }
+        os << "\",\n  \"instructions\": " << instructions << ",\n  \"code_bytes\": " << codeBytes
+           << ",\n  \"functions\": [";
+        bool first = true;
+        for (int addr = 0; addr < z16sim::MEM_SIZE; ++addr) {
+            if (function[addr] && instStart[addr]) {
+                os << (first ? "" : ", ") << addr;
+                first = false;
+            }
+        }
+        os << "],\n  \"blocks\": [";
+        first = true;
+        for (const auto& it : cfg.blocks) {
+            const z16cfgBlock& block = it.second;
+            const z16decoded& d = z16decodeTable[z16cfg::fetch(memory, lastPC(block))];
+            const char* exit = block.indirect ? "indirect" : d.op == Z16_TRAP ? "invalid" : block.halts ? "exit"
+                             : d.op == Z16_ECALL ? "ecall" : z16cfg::endsBlock(d.op) ? "branch" : "fallthrough";
+            os << (first ? "" : ",") << "\n    {\"start\": " << block.start << ", \"end\": " << (block.start + 2 * block.count)
+               << ", \"instructions\": " << block.count << ", \"exit\": \"" << exit << "\", \"succs\": [";
+            std::vector<objdumpEdge> kinds = edgeKinds(block);
+            for (size_t i = 0; i < block.succs.size(); ++i) {
+                os << (i ? ", " : "") << "{\"to\": " << block.succs[i] << ", \"kind\": \"" << edgeNames[kinds[i]] << "\"}";
+            }
+            os << "]}";
+            first = false;
+        }
+        os << "\n  ]\n}\n";
+    }
+
+private:
+    const unsigned char* memory;
+    const objdumpOptions& options;
+    z16cfg cfg;
+    std::vector<uint8_t> instStart; // Per byte: a recovered instruction starts here
+    std::vector<uint8_t> function;  // Per byte: an entry point or jal target
+    std::vector<uint16_t> preds;    // Per byte: static edges into the block starting here
+    size_t instructions = 0;
+    size_t codeBytes = 0;
+
+    // Data bytes [lo, hi): runs of 16 or more zero bytes collapse into one line
+    void formatData(std::string& text, int lo, int hi) const {
+        char line[128];
+        int addr = lo;
+        while (addr < hi) {
+            int zeros = addr;
+            while (zeros < hi && memory[zeros] == 0) {
+                ++zeros;
+            }
+            if (zeros - addr >= 16) {
+                std::snprintf(line, sizeof(line), "    %04X:  .zero %d\n", addr, zeros - addr);
+                text += line;
+                addr = zeros;
+                continue;
+            }
+            int end = std::min(hi, (addr & ~15) + 16);
+            char* p = putHex((char*)std::memcpy(line, "    ", 4) + 4, addr, 4);
+            p = (char*)std::memcpy(p, ":  .byte", 8) + 8;
+            for (int a = addr; a < end; ++a) {
+                p = (char*)std::memcpy(p, a == addr ? " 0x" : ", 0x", a == addr ? 3 : 4) + (a == addr ? 3 : 4);
+                p = putHex(p, memory[a], 2);
+            }
+            *p++ = '\n';
+            text.append(line, p - line);
+            addr = end;
+        }
+    }
+};
+
+static bool openOutput(const std::string& path, std::ofstream& file, std::ostream*& os) {
+    if (path == "-") {
+        os = &std::cout;
+        return true;
+    }
+    file.open(path);
+    if (!file) {
+        std::cerr << "Error: Could not open " << path << " for writing" << std::endl;
+        return false;
+    }
+    os = &file;
+    return true;
+}
+
+static void printUsage(const char* progName) {
+    std::cerr << "Usage: " << progName << " [options] <image>" << std::endl;
+    std::cerr << "  -e PC: Extra entry point for control-flow recovery (0x0000 and the image's start address always are)" << std::endl;
+    std::cerr << "  --vectors: Treat the interrupt vector slots 0x0002-0x001E as entry points" << std::endl;
+    std::cerr << "  --format=auto|bin|ihex|verilog|mem, --base=ADDR: As for zx16_simulator" << std::endl;
+    std::cerr << "  --dot=FILE: Write the basic-block graph as Graphviz DOT ('-': standard output)" << std::endl;
+    std::cerr << "  --json=FILE: Write the basic-block graph as JSON ('-': standard output)" << std::endl;
+    std::cerr << "  --no-listing: Skip the listing" << std::endl;
+    std::cerr << "  --jobs=N: Threads formatting the listing (default: all hardware threads)" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    objdumpOptions options;
+    options.entries.push_back(0x0000);
+    z16loadOptions load;
+    const char* filename = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-e" && i + 1 < argc) {
+            options.entries.push_back((uint16_t)std::strtoul(argv[++i], nullptr, 0));
+        } else if (arg == "--vectors") {
+            options.vectors = true;
+        } else if (arg == "--no-listing") {
+            options.listing = false;
+        } else if (arg.rfind("--dot=", 0) == 0) {
+            options.dotFile = arg.substr(6);
+        } else if (arg.rfind("--json=", 0) == 0) {
+            options.jsonFile = arg.substr(7);
+        } else if (arg.rfind("--jobs=", 0) == 0) {
+            options.threads = std::max(1, std::atoi(arg.c_str() + 7));
+        } else if (arg.rfind("--base=", 0) == 0) {
+            load.base = (uint16_t)std::strtoul(arg.c_str() + 7, nullptr, 0);
+        } else if (arg.rfind("--format=", 0) == 0) {
+            std::string format = arg.substr(9);
+            if (format == "bin") {
+                load.format = Z16_FORMAT_BIN;
+            } else if (format == "ihex") {
+                load.format = Z16_FORMAT_IHEX;
+            } else if (format == "verilog") {
+                load.format = Z16_FORMAT_VERILOG;
+            } else if (format == "mem") {
+                load.format = Z16_FORMAT_MEM;
+            } else if (format != "auto") {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (arg[0] != '-' && filename == nullptr) {
+            filename = argv[i];
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (filename == nullptr) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::unique_ptr<z16sim> sim(new z16sim());
+    z16streamSink diagnostics(std::cerr, std::cerr); // Keep standard output for the listing
+    sim->setSink(&diagnostics);
+    std::string error;
+    std::shared_ptr<const z16image> image = z16imageCache::shared().get(filename, load.format, error);
+    if (!image) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    if (!sim->loadImage(*image, load)) {
+        return 1;
+    }
+    if (sim->getPC() != 0) {
+        options.entries.push_back(sim->getPC());
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    objdumpImage program(sim->getMemory(), options);
+    if (options.listing) {
+        std::cout << "; " << filename << ": " << program.getCFG().blocks.size() << " blocks, " << program.getInstructions()
+                  << " instructions, " << program.getCodeBytes() << " code bytes\n";
+        program.writeListing(std::cout);
+    }
+    std::ofstream dotFile, jsonFile;
+    std::ostream* os;
+    if (!options.dotFile.empty()) {
+        if (!openOutput(options.dotFile, dotFile, os)) {
+            return 1;
+        }
+        program.writeDOT(*os);
+    }
+    if (!options.jsonFile.empty()) {
+        if (!openOutput(options.jsonFile, jsonFile, os)) {
+            return 1;
+        }
+        program.writeJSON(*os, filename);
+    }
+    std::cout.flush();
+    double wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::fprintf(stderr, "%zu blocks, %zu instructions in %.2f ms\n", program.getCFG().blocks.size(), program.getInstructions(), wall_ms);
+    return 0;
+}
@@ -0,0 +1,441 @@
+#include "z16prof.h"
+#include "z16sim.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+const char* z16profiler::classNames[z16profiler::NUM_CLASSES] = {"R", "I", "B", "S", "L", "J", "U", "SYS"};
+
+// Section start addresses of zx16asm.py. The listing's symbol table
+// carries the first as CODE_START; the others are only in the assembler.
+static const uint16_t TEXT_START = 0x0020;
+static const uint16_t DATA_START = 0x8000;
+static const uint16_t BSS_START = 0x9000;
+
+// Integer operand as the assembler's tokenizer reads it: decimal, 0x hex,
+// 0b binary, or a character literal
+static bool parseNumber(const std::string& s, long& value) {
+    if (s.size() >= 3 && s[0] == '\'') {
+        value = (unsigned char)s[1];
+        return true;
+    }
+    const char* p = s.c_str();
+    bool negative = (*p == '-');
+    if (negative || *p == '+') {
+        ++p;
+    }
+    int base = 10;
+    if (p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        base = 16;
+        p += 2;
+    } else if (p[0] == '0' && (p[1] == 'b' || p[1] == 'B')) {
+        base = 2;
+        p += 2;
+    }
+    char* end;
+    value = std::strtol(p, &end, base);
+    if (end == p || *end != '\0') {
+        return false;
+    }
+    value = negative ? -value : value;
+    return true;
+}
+
+static std::string trim(const std::string& s) {
+    size_t b = s.find_first_not_of(" \t\r");
+    if (b == std::string::npos) {
+        return "";
+    }
+    return s.substr(b, s.find_last_not_of(" \t\r") - b + 1);
+}
+
+// Comma-separated operands after the mnemonic or directive
+static std::vector<std::string> splitOperands(const std::string& s) {
+    std::vector<std::string> ops;
+    std::string cur;
+    for (char c : s) {
+        if (c == ',') {
+            ops.push_back(trim(cur));
+            cur.clear();
+        } else {
+            cur += c;
+        }
+    }
+    if (!trim(cur).empty()) {
+        ops.push_back(trim(cur));
+    }
+    return ops;
+}
+
+// load method definition
+bool z16listing::load(const char* filename, std::ostream& err) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        err << "Error: Could not open listing " << filename << std::endl;
+        return false;
+    }
+
+    // Numbered source lines ("%4d      text") come first, then the symbol
+    // table ("name = 0xXXXX  (scope)") after its header, then the statistics
+    std::map<std::string, uint16_t> symbols;
+    std::string line;
+    bool inSymbols = false, inStatistics = false;
+    long codeSize = -1;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line == "Symbol Table:") {
+            inSymbols = true;
+        } else if (line == "Statistics:") {
+            inStatistics = true;
+        } else if (inStatistics) {
+            std::sscanf(line.c_str(), " Code size: %ld", &codeSize);
+        } else if (inSymbols) {
+            char name[256];
+            unsigned value;
+            if (std::sscanf(line.c_str(), "%255s = 0x%x", name, &value) == 2) {
+                symbols[name] = (uint16_t)value;
+            }
+        } else if (line.size() >= 10 && std::isdigit((unsigned char)line[3]) && line.compare(4, 6, "      ") == 0) {
+            size_t number = std::strtoul(line.c_str(), nullptr, 10);
+            if (number == this->source.size() + 1) {
+                this->source.push_back(line.substr(10));
+            }
+        }
+    }
+    if (this->source.empty()) {
+        err << "Error: " << filename << " is not a zx16asm listing" << std::endl;
+        return false;
+    }
+
+    this->lines.assign(z16sim::MEM_SIZE, 0);
+    this->labels.clear();
+    auto codeStart = symbols.find("CODE_START");
+    uint32_t addr = codeStart != symbols.end() ? codeStart->second : TEXT_START;
+    bool inText = true;
+    long textBytes = 0; // Checked against the listing's code size
+    bool inBlockComment = false;
+    for (size_t n = 0; n < this->source.size(); ++n) {
+        // Strip comments; '#' inside a string or character literal is data
+        std::string text;
+        char quote = 0;
+        const std::string& src = this->source[n];
+        for (size_t i = 0; i < src.size(); ++i) {
+            if (inBlockComment) {
+                if (src.compare(i, 2, "*/") == 0) {
+                    inBlockComment = false;
+                    ++i;
+                }
+            } else if (quote) {
+                text += src[i];
+                if (src[i] == '\\' && i + 1 < src.size()) {
+                    text += src[++i];
+                } else if (src[i] == quote) {
+                    quote = 0;
+                }
+            } else if (src[i] == '#') {
+                break;
+            } else if (src.compare(i, 2, "/*") == 0) {
+                inBlockComment = true;
+                ++i;
+            } else {
+                if (src[i] == '"' || src[i] == '\'') {
+                    quote = src[i];
+                }
+                text += src[i];
+            }
+        }
+        text = trim(text);
+
+        // Leading labels re-anchor the address
+        while (true) {
+            size_t len = 0;
+            while (len < text.size() && (std::isalnum((unsigned char)text[len]) || text[len] == '_' || text[len] == '.')) {
+                ++len;
+            }
+            if (len == 0 || len >= text.size() || text[len] != ':') {
+                break;
+            }
+            auto it = symbols.find(text.substr(0, len));
+            if (it != symbols.end()) {
+                addr = it->second;
+                this->labels.emplace(it->second, it->first);
+            }
+            text = trim(text.substr(len + 1));
+        }
+        if (text.empty()) {
+            continue;
+        }
+
+        size_t split = text.find_first_of(" \t");
+        std::string word = text.substr(0, split);
+        std::transform(word.begin(), word.end(), word.begin(), [](unsigned char c) { return std::tolower(c); });
+        std::string rest = split == std::string::npos ? "" : trim(text.substr(split));
+        std::vector<std::string> ops = splitOperands(rest);
+        long value;
+
+        uint32_t before = addr;
+        if (word[0] == '.') {
+            if (word == ".org" && !ops.empty() && parseNumber(ops[0], value)) {
+                addr = (uint16_t)value;
+                before = addr;
+            } else if (word == ".text") {
+                addr = before = codeStart != symbols.end() ? codeStart->second : TEXT_START;
+                inText = true;
+            } else if (word == ".data") {
+                addr = before = DATA_START;
+                inText = false;
+            } else if (word == ".bss") {
+                addr = before = BSS_START;
+                inText = false;
+            } else if (word == ".byte") {
+                addr += ops.size();
+            } else if (word == ".word") {
+                addr += 2 * ops.size();
+            } else if ((word == ".string" || word == ".ascii") && rest.size() >= 2 && rest[0] == '"') {
+                size_t chars = 0;
+                for (size_t i = 1; i < rest.size() && rest[i] != '"'; ++i) {
+                    i += (rest[i] == '\\');
+                    ++chars;
+                }
+                addr += chars + (word == ".string");
+            } else if (word == ".space" && !ops.empty() && parseNumber(ops[0], value)) {
+                addr += value;
+            }
+            textBytes += inText ? addr - before : 0;
+            continue;
+        }
+
+        // Pseudo-instructions that expand to two instructions
+        int size = 2;
+        if (word == "li16" || word == "la" || word == "push" || word == "pop" || word == "neg") {
+            size = 4;
+        } else if (word == "li" && ops.size() == 2 && parseNumber(ops[1], value) && (value < -64 || value > 63)) {
+            size = 4;
+        }
+        for (int i = 0; i < size; ++i) {
+            this->lines[(uint16_t)(addr + i)] = n + 1;
+        }
+        addr += size;
+        textBytes += inText ? size : 0;
+    }
+    if (codeSize >= 0 && codeSize != textBytes) {
+        err << "Warning: " << filename << " has " << codeSize << " bytes of code but its lines add up to " << textBytes
+            << "; source lines may be attributed to the wrong PCs" << std::endl;
+    }
+    return true;
+}
+
+// sourceLine method definition
+const std::string& z16listing::sourceLine(int line) const {
+    static const std::string none;
+    return line >= 1 && (size_t)line <= this->source.size() ? this->source[line - 1] : none;
+}
+
+// labelAt method definition
+bool z16listing::labelAt(uint16_t pc, std::string& name, uint16_t& offset) const {
+    auto it = this->labels.upper_bound(pc);
+    if (it == this->labels.begin()) {
+        return false;
+    }
+    --it;
+    name = it->second;
+    offset = pc - it->first;
+    return true;
+}
+
+// nameOf method definition
+std::string z16listing::nameOf(uint16_t pc) const {
+    auto it = this->labels.find(pc);
+    if (it != this->labels.end()) {
+        return it->second;
+    }
+    char buf[8];
+    std::snprintf(buf, sizeof(buf), "0x%04x", pc);
+    return buf;
+}
+
+// z16profiler Constructor
+z16profiler::z16profiler() {
+    z16profiler::clear();
+}
+
+// clear method definition
+void z16profiler::clear() {
+    this->pcCounts.assign(z16sim::MEM_SIZE, 0);
+    this->taken.assign(z16sim::MEM_SIZE, 0);
+    this->notTaken.assign(z16sim::MEM_SIZE, 0);
+    std::memset(this->classCounts, 0, sizeof(this->classCounts));
+    this->nodes.assign(1, stackNode{0, 0, 0});
+    this->children.clear();
+    this->stack.clear();
+    this->current = 0;
+}
+
+// control method definition
+// Out of line: only jal, jalr and jr get here.
+void z16profiler::control(uint16_t pc, uint16_t inst, uint16_t next_pc) {
+    const z16decoded& d = z16decodeTable[inst];
+    if (d.op != Z16_JR && d.op != Z16_JALR && d.op != Z16_JAL) {
+        return;
+    }
+
+    // Returning to a frame on the stack (searched from the top)
+    if (d.op != Z16_JAL) {
+        for (size_t i = this->stack.size(); i-- > 0;) {
+            if (this->stack[i].ret == next_pc) {
+                this->current = this->stack[i].node;
+                this->stack.resize(i);
+                return;
+            }
+        }
+    }
+    if (d.op == Z16_JR || this->stack.size() >= z16profiler::MAX_DEPTH) {
+        return; // Computed jump, or too deep to track
+    }
+
+    this->stack.push_back(frame{this->current, (uint16_t)(pc + 2)});
+    auto key = std::make_pair(this->current, next_pc);
+    auto it = this->children.find(key);
+    if (it == this->children.end()) {
+        it = this->children.emplace(key, (uint32_t)this->nodes.size()).first;
+        this->nodes.push_back(stackNode{this->current, next_pc, 0});
+    }
+    this->current = it->second;
+}
+
+// getTotal method definition
+uint64_t z16profiler::getTotal() const {
+    uint64_t total = 0;
+    for (int c = 0; c < z16profiler::NUM_CLASSES; ++c) {
+        total += this->classCounts[c];
+    }
+    return total;
+}
+
+// path method definition
+std::vector<uint32_t> z16profiler::path(uint32_t node) const {
+    std::vector<uint32_t> p;
+    for (; node != 0; node = this->nodes[node].parent) {
+        p.push_back(node);
+    }
+    p.push_back(0);
+    std::reverse(p.begin(), p.end());
+    return p;
+}
+
+// frameName method definition
+std::string z16profiler::frameName(uint32_t node, const z16listing* listing) const {
+    if (node == 0) {
+        return "zx16";
+    }
+    uint16_t entry = this->nodes[node].entry;
+    if (listing) {
+        return listing->nameOf(entry);
+    }
+    char buf[8];
+    std::snprintf(buf, sizeof(buf), "0x%04x", entry);
+    return buf;
+}
+
+// writeReport method definition
+void z16profiler::writeReport(std::ostream& os, z16sim& sim, const z16listing* listing, size_t top) const {
+    uint64_t total = z16profiler::getTotal();
+    auto percent = [total](uint64_t n) { return total ? 100.0 * n / total : 0.0; };
+    char buf[512];
+
+    std::snprintf(buf, sizeof(buf), "Instructions retired: %llu\n\nBy class:\n", (unsigned long long)total);
+    os << buf;
+    for (int c = 0; c < z16profiler::NUM_CLASSES; ++c) {
+        std::snprintf(buf, sizeof(buf), "  %-4s %14llu  %6.2f%%\n", z16profiler::classNames[c],
+                      (unsigned long long)this->classCounts[c], percent(this->classCounts[c]));
+        os << buf;
+    }
+    uint64_t takenTotal = 0, branchTotal = 0;
+    for (int pc = 0; pc < z16sim::MEM_SIZE; ++pc) {
+        takenTotal += this->taken[pc];
+        branchTotal += this->taken[pc] + this->notTaken[pc];
+    }
+    std::snprintf(buf, sizeof(buf), "\nBranches: %llu executed, %llu taken (%.2f%%)\n", (unsigned long long)branchTotal,
+                  (unsigned long long)takenTotal, branchTotal ? 100.0 * takenTotal / branchTotal : 0.0);
+    os << buf;
+
+    // Hot spots
+    std::vector<uint16_t> pcs;
+    for (int pc = 0; pc < z16sim::MEM_SIZE; ++pc) {
+        if (this->pcCounts[pc]) {
+            pcs.push_back(pc);
+        }
+    }
+    std::sort(pcs.begin(), pcs.end(), [this](uint16_t a, uint16_t b) {
+        return this->pcCounts[a] != this->pcCounts[b] ? this->pcCounts[a] > this->pcCounts[b] : a < b;
+    });
+    pcs.resize(std::min(pcs.size(), top));
+    os << "\nHot spots:\n       PC           count        %  instruction               taken";
+    os << (listing ? "   location            source\n" : "\n");
+    const unsigned char* memory = sim.getMemory();
+    for (uint16_t pc : pcs) {
+        char disasm[64];
+        sim.disassemble((memory[(uint16_t)(pc + 1)] << 8) | memory[pc], pc, disasm, sizeof(disasm));
+        char takenStr[16] = "";
+        uint64_t branches = this->taken[pc] + this->notTaken[pc];
+        if (branches) {
+            std::snprintf(takenStr, sizeof(takenStr), "%.1f%%", 100.0 * this->taken[pc] / branches);
+        }
+        std::snprintf(buf, sizeof(buf), "  0x%04x  %14llu  %6.2f%%  %-24s %6s", pc, (unsigned long long)this->pcCounts[pc],
+                      percent(this->pcCounts[pc]), disasm, takenStr);
+        os << buf;
+        if (listing) {
+            std::string name;
+            uint16_t offset;
+            std::string where;
+            if (listing->labelAt(pc, name, offset)) {
+                where = offset ? name + "+" + std::to_string(offset) : name;
+            }
+            int line = listing->lineAt(pc);
+            std::snprintf(buf, sizeof(buf), "   %-18s  ", where.c_str());
+            os << buf;
+            if (line) {
+                os << line << ": " << trim(listing->sourceLine(line));
+            }
+        }
+        os << "\n";
+    }
+
+    // Self instructions per function, merged over all stacks it appears in
+    std::map<std::string, uint64_t> functions;
+    for (uint32_t n = 0; n < this->nodes.size(); ++n) {
+        if (this->nodes[n].self) {
+            functions[z16profiler::frameName(n, listing)] += this->nodes[n].self;
+        }
+    }
+    std::vector<std::pair<std::string, uint64_t> > sorted(functions.begin(), functions.end());
+    std::sort(sorted.begin(), sorted.end(), [](const std::pair<std::string, uint64_t>& a, const std::pair<std::string, uint64_t>& b) {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    sorted.resize(std::min(sorted.size(), top));
+    os << "\nFunctions (self):\n";
+    for (const auto& f : sorted) {
+        std::snprintf(buf, sizeof(buf), "  %-24s %14llu  %6.2f%%\n", f.first.c_str(), (unsigned long long)f.second, percent(f.second));
+        os << buf;
+    }
+}
+
+// writeFolded method definition
+void z16profiler::writeFolded(std::ostream& os, const z16listing* listing) const {
+    for (uint32_t n = 0; n < this->nodes.size(); ++n) {
+        if (!this->nodes[n].self) {
+            continue;
+        }
+        std::vector<uint32_t> p = z16profiler::path(n);
+        for (size_t i = 0; i < p.size(); ++i) {
+            os << (i ? ";" : "") << z16profiler::frameName(p[i], listing);
+        }
+        os << " " << this->nodes[n].self << "\n";
+    }
+}
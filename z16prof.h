@@ -0,0 +1,108 @@
+#ifndef Z16PROF_H
+#define Z16PROF_H
+
+#include "z16decode.h"
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+class z16sim;
+
+// PC-to-source mapping read from a zx16asm.py listing (get_listing_output()).
+// The listing has the numbered source and the symbol table but no addresses
+// per line, so load() re-derives them the way the assembler's first pass
+// does: each label line is anchored at the label's address from the symbol
+// table, and every following line advances by its size (2 bytes per
+// instruction, 4 for li16, la, push, pop, neg and li with an immediate
+// outside -64..63, the data size for .byte/.word/.string/.ascii/.space).
+// The total is checked against the listing's code size, with a warning on
+// the error stream when the two disagree.
+class z16listing {
+public:
+    bool load(const char* filename, std::ostream& err);
+
+    // Source line (1-based) of the instruction at pc, 0 if unknown
+    int lineAt(uint16_t pc) const { return lines.empty() ? 0 : lines[pc]; }
+    const std::string& sourceLine(int line) const;
+    // Closest label at or below pc and the distance from it; false if none
+    bool labelAt(uint16_t pc, std::string& name, uint16_t& offset) const;
+    // Label defined exactly at pc, or "0xXXXX"
+    std::string nameOf(uint16_t pc) const;
+
+private:
+    std::vector<std::string> source;        // Source line n at index n - 1
+    std::map<uint16_t, std::string> labels; // Address -> first label defined there
+    std::vector<int> lines;                 // Per PC: source line or 0
+};
+
+// Profile of one simulator run: retired instructions per PC (flat arrays
+// indexed by PC), per opcode class, taken/not-taken counts per branch, and
+// instructions per call stack. Stacks are built from the control flow: jal
+// and jalr push a frame for the callee, a jr (or jalr) to the return address
+// of a frame on the stack pops back to its caller. Calls nested deeper than
+// MAX_DEPTH are attributed to the frame at that depth.
+class z16profiler {
+public:
+    static const int NUM_CLASSES = 8; // Primary opcode bits [2:0]
+    static const size_t MAX_DEPTH = 256;
+    static const char* classNames[NUM_CLASSES];
+
+    z16profiler();
+
+    // Called by the simulator for every retired instruction
+    void record(uint16_t pc, uint16_t inst, uint16_t next_pc) {
+        ++this->pcCounts[pc];
+        ++this->classCounts[inst & 0x7];
+        ++this->nodes[this->current].self;
+        if ((inst & 0x7) == 0x2) { // B-type
+            ++(next_pc != (uint16_t)(pc + 2) ? this->taken : this->notTaken)[pc];
+        } else if (((inst & 0x7) == 0x0 && (uint16_t)((inst >> 12) - 11) < 2) || // jr, jalr
+                   ((inst & 0x7) == 0x5 && (inst & 0x8000))) {                    // jal
+            z16profiler::control(pc, inst, next_pc);
+        }
+    }
+    void clear();
+
+    uint64_t getCount(uint16_t pc) const { return pcCounts[pc]; }
+    uint64_t getClassCount(int cls) const { return classCounts[cls]; }
+    uint64_t getTaken(uint16_t pc) const { return taken[pc]; }
+    uint64_t getNotTaken(uint16_t pc) const { return notTaken[pc]; }
+    uint64_t getTotal() const;
+
+    // Hot-spot report: class and branch totals, then the top PCs with their
+    // disassembly (and source line when a listing is given), then the
+    // instructions spent per function (by listing label, or entry PC)
+    void writeReport(std::ostream& os, z16sim& sim, const z16listing* listing, size_t top = 30) const;
+    // Folded stacks ("main;f;g count" per line) for flamegraph.pl and friends
+    void writeFolded(std::ostream& os, const z16listing* listing) const;
+
+private:
+    struct stackNode {
+        uint32_t parent;
+        uint16_t entry; // Callee PC (unused for the root)
+        uint64_t self;  // Instructions retired while this was the innermost frame
+    };
+    struct frame {
+        uint32_t node;
+        uint16_t ret; // Return address pushed by the call
+    };
+
+    std::vector<uint64_t> pcCounts;
+    std::vector<uint64_t> taken;
+    std::vector<uint64_t> notTaken;
+    uint64_t classCounts[NUM_CLASSES];
+
+    std::vector<stackNode> nodes; // nodes[0] is the root
+    std::map<std::pair<uint32_t, uint16_t>, uint32_t> children; // (parent, entry) -> node
+    std::vector<frame> stack;
+    uint32_t current;
+
+    void control(uint16_t pc, uint16_t inst, uint16_t next_pc);
+    std::vector<uint32_t> path(uint32_t node) const; // Root first
+    std::string frameName(uint32_t node, const z16listing* listing) const;
+};
+
+#endif // Z16PROF_H
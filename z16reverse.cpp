@@ -0,0 +1,155 @@
+#include "z16sim.h"
+
+// z16recorder constructor definition
+z16recorder::z16recorder(size_t capacity) {
+    size_t size = 64;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    this->ring.resize(size);
+    this->mask = size - 1;
+    this->first = this->end = 0;
+    this->interval = size / 8;
+    this->nextCheckpoint = 0;
+}
+
+// setRecorder method definition: the log starts empty at the current state
+void z16sim::setRecorder(z16recorder* r) {
+    this->recorder = r;
+    if (r) {
+        z16sim::restartRecording();
+    }
+}
+
+// restartRecording method definition: drops the log, e.g. when the host
+// moved the machine to a state the log does not lead to (reset, restore)
+void z16sim::restartRecording() {
+    z16recorder& rec = *this->recorder;
+    rec.first = rec.end = this->retired;
+    rec.checkpoints.clear();
+    z16sim::takeCheckpoint();
+}
+
+// takeCheckpoint method definition: checkpoints older than the log are of
+// no use any more and go
+void z16sim::takeCheckpoint() {
+    z16recorder& rec = *this->recorder;
+    while (!rec.checkpoints.empty() && rec.checkpoints.front().retired < rec.first) {
+        rec.checkpoints.pop_front();
+    }
+    rec.checkpoints.push_back(z16sim::snapshot());
+    rec.nextCheckpoint = this->retired + rec.interval;
+}
+
+// undoLast method definition: puts back what the newest logged instruction
+// overwrote. Memory goes through writeMemory so cached blocks and dirty
+// pages stay right.
+void z16sim::undoLast() {
+    z16recorder& rec = *this->recorder;
+    const z16recorder::entry& e = rec.ring[(rec.end - 1) & rec.mask];
+    switch (e.kind) {
+        case z16recorder::UNDO_REG:
+            this->regs[e.reg] = e.old;
+            break;
+        case z16recorder::UNDO_BYTE: {
+            unsigned char byte = (unsigned char)e.old;
+            z16sim::writeMemory(e.addr, &byte, 1);
+            break;
+        }
+        case z16recorder::UNDO_WORD: {
+            unsigned char bytes[2] = {(unsigned char)(e.old & 0xFF), (unsigned char)(e.old >> 8)};
+            z16sim::writeMemory(e.addr, bytes, 2);
+            break;
+        }
+        default:
+            break;
+    }
+    this->pc = e.pc;
+    --this->retired;
+    --rec.end;
+}
+
+// reverseStep method definition
+bool z16sim::reverseStep() {
+    if (!this->recorder || this->recorder->end == this->recorder->first) {
+        return false;
+    }
+    return z16sim::reverseTo(this->recorder->end - 1);
+}
+
+// reverseTo method definition. Restores the first checkpoint at or after
+// count when that saves undoing entries, then undoes the rest one by one.
+bool z16sim::reverseTo(uint64_t count) {
+    z16recorder* rec = this->recorder;
+    if (!rec || rec->end != this->retired || count < rec->first || count > rec->end) {
+        return false;
+    }
+    for (const z16snapshot& checkpoint : rec->checkpoints) {
+        if (checkpoint.retired >= count) {
+            if (checkpoint.retired < rec->end) {
+                z16sim::restore(checkpoint);
+                rec->end = checkpoint.retired;
+            }
+            break;
+        }
+    }
+    while (rec->end > count) {
+        z16sim::undoLast();
+    }
+    while (!rec->checkpoints.empty() && rec->checkpoints.back().retired > count) {
+        rec->checkpoints.pop_back();
+    }
+    rec->nextCheckpoint = rec->checkpoints.empty() ? count : rec->checkpoints.back().retired + rec->interval;
+    this->stopRequested = false;
+    z16sim::updateNextEvent();
+    return true;
+}
+
+// reverseContinue method definition: goes back to the latest logged state
+// that sits at a breakpoint or just before a store to a write-watched byte.
+// Returns 5 there (see getStopReason) or 0 after going back to the oldest
+// logged state; read watchpoints are not checked.
+int z16sim::reverseContinue() {
+    z16recorder* rec = this->recorder;
+    if (!rec || rec->end != this->retired) {
+        return 0;
+    }
+    for (uint64_t n = rec->end; n-- > rec->first;) {
+        const z16recorder::entry& e = rec->ring[n & rec->mask];
+        if (z16sim::isBreakpoint(e.pc)) {
+            z16sim::reverseTo(n);
+            this->stopReason = {Z16_STOP_BREAKPOINT, e.pc};
+            return 5;
+        }
+        if (this->watchpointCount && (e.kind == z16recorder::UNDO_BYTE || e.kind == z16recorder::UNDO_WORD)) {
+            for (int i = 0; i < (e.kind == z16recorder::UNDO_WORD ? 2 : 1); ++i) {
+                uint16_t a = e.addr + i;
+                if (z16sim::isWatched(a, Z16_WATCH_WRITE)) {
+                    z16sim::reverseTo(n);
+                    this->stopReason = {Z16_STOP_WATCH_WRITE, a};
+                    return 5;
+                }
+            }
+        }
+    }
+    z16sim::reverseTo(rec->first);
+    return 0;
+}
+
+// lastWriter method definition: the newest logged store covering addr
+bool z16sim::lastWriter(uint16_t addr, uint64_t& count, uint16_t& writer_pc) const {
+    const z16recorder* rec = this->recorder;
+    if (!rec) {
+        return false;
+    }
+    for (uint64_t n = rec->end; n-- > rec->first;) {
+        const z16recorder::entry& e = rec->ring[n & rec->mask];
+        if ((e.kind == z16recorder::UNDO_BYTE && e.addr == addr) ||
+            (e.kind == z16recorder::UNDO_WORD && (e.addr == addr || e.addr + 1 == addr))) {
+            count = n;
+            writer_pc = e.pc;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,64 @@
+#ifndef Z16REVERSE_H
+#define Z16REVERSE_H
+
+#include "z16snapshot.h"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Undo log for reverse execution (z16sim::setRecorder). For every retired
+// instruction it keeps, in a ring of 8-byte entries, the PC the instruction
+// ran at and the old value of the one register or memory location it wrote.
+// Once the ring is full the oldest entries are overwritten, so the machine
+// can go back at most capacity instructions. Every capacity / 8 instructions
+// a full checkpoint (a z16snapshot) is taken as well; going back a long way
+// restores the nearest checkpoint past the target and undoes only the
+// entries between the two.
+//
+// Only registers, the PC, memory and the instruction count are rewound.
+// Device and interrupt-controller state and console I/O are not, and writes
+// made by the host (writeMemory, setReg) are not logged.
+class z16recorder {
+public:
+    static const size_t DEFAULT_CAPACITY = 1 << 20;
+
+    // capacity is rounded up to a power of two
+    explicit z16recorder(size_t capacity = DEFAULT_CAPACITY);
+
+    // The machine can go back to any instruction count in [oldest(), newest()]
+    uint64_t oldest() const { return first; }
+    uint64_t newest() const { return end; }
+    // PC of the instruction that ran at count n, oldest() <= n < newest()
+    uint16_t pcAt(uint64_t n) const { return ring[n & mask].pc; }
+    size_t getCapacity() const { return ring.size(); }
+    size_t getCheckpointCount() const { return checkpoints.size(); }
+
+private:
+    friend class z16sim;
+
+    enum : uint8_t {
+        UNDO_NONE, // Branches, jumps, and stores that went to a device
+        UNDO_REG,  // regs[reg] was old
+        UNDO_BYTE, // memory[addr] was old
+        UNDO_WORD  // memory[addr], memory[addr + 1] were old
+    };
+
+    struct entry {
+        uint16_t pc;
+        uint16_t addr;
+        uint16_t old;
+        uint8_t kind;
+        uint8_t reg;
+    };
+
+    std::vector<entry> ring;
+    uint64_t mask;
+    uint64_t first; // Instruction count of the oldest entry
+    uint64_t end;   // One past the newest; equals the simulator's count while in step
+    uint64_t interval;
+    uint64_t nextCheckpoint;
+    std::deque<z16snapshot> checkpoints; // Oldest first
+};
+
+#endif // Z16REVERSE_H
@@ -0,0 +1,1532 @@
+// zx16_selftest: focused behaviour tests for the parts of the simulator the
+// golden programs and the encoding sweep do not reach. Each case is a
+// subcommand so that ctest lists them separately; "all" runs every case.
+// Guest programs are built with a small encoder rather than assembled, so
+// the tests need nothing but the library.
+
+#include "z16sim.h"
+#include "z16gdb.h"
+#include "z16gfx.h"
+#include "z16irq.h"
+#include "z16timing.h"
+#include "z16tracefile.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+static int failures = 0;
+static std::filesystem::path toolDir; // Where the other zx16 tools were built
+
+#define CHECK(cond)                                                                      \
+    do {                                                                                 \
+        if (!(cond)) {                                                                   \
+            std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);         \
+            ++failures;                                                                  \
+        }                                                                                \
+    } while (0)
+
+// Minimal encoder for the guest programs (as in zx16_bench). Branch offsets
+// follow the simulator: B-type target = pc + 2 + 4 * imm, J-type target = pc + imm.
+class testProgram {
+public:
+    std::vector<uint16_t> code;
+    uint16_t origin;
+
+    explicit testProgram(uint16_t origin = 0) : origin(origin) {}
+
+    uint16_t here() const { return (uint16_t)(origin + code.size() * 2); }
+    void emit(uint16_t inst) { code.push_back(inst); }
+
+    void R(int funct4, int funct3, int rd, int rs2) { emit((funct4 << 12) | (rs2 << 9) | (rd << 6) | (funct3 << 3)); }
+    void I(int funct3, int rd, int imm) { emit(((imm & 0x7F) << 9) | (rd << 6) | (funct3 << 3) | 0x1); }
+    void S(int funct3, int rs2, int off, int base) { emit(((off & 0xF) << 12) | (rs2 << 9) | (base << 6) | (funct3 << 3) | 0x3); }
+    void L(int funct3, int rd, int off, int base) { emit(((off & 0xF) << 12) | (base << 9) | (rd << 6) | (funct3 << 3) | 0x4); }
+    void lui(int rd, int u) { emit((((u >> 3) & 0x3F) << 9) | (rd << 6) | ((u & 0x7) << 3) | 0x6); }
+    void ecall(int svc) { emit((svc << 6) | 0x7); }
+    void addi(int rd, int imm) { I(0, rd, imm); }
+    void li(int rd, int imm) { I(7, rd, imm); }
+    void sw(int rs2, int off, int base) { S(1, rs2, off, base); }
+    void lw(int rd, int off, int base) { L(1, rd, off, base); }
+    void nop() { addi(0, 0); }
+
+    // Branch over the next 2 * words instructions (negative: backwards)
+    void branchSkip(int funct3, int rs1, int rs2, int words) {
+        emit(((words & 0xF) << 12) | (rs2 << 9) | (rs1 << 6) | (funct3 << 3) | 0x2);
+    }
+    void jump(bool link, int rd, uint16_t target) {
+        int off = (target - here()) & 0x3FF;
+        emit(((link ? 1 : 0) << 15) | (((off >> 4) & 0x3F) << 9) | (rd << 6) | (((off >> 1) & 0x7) << 3) | 0x5);
+    }
+    // bnz reg, target for a backward target, padded with a nop when the
+    // distance is not a multiple of 4; j when it is out of B-type range
+    void loopBack(int reg, uint16_t target) {
+        if ((here() - target) % 4 == 0) {
+            nop();
+        }
+        int s = (target - here() - 2) / 4;
+        if (s >= -8) {
+            branchSkip(B_BNZ, reg, 0, s);
+        } else {
+            branchSkip(B_BZ, reg, 0, 1);
+            jump(false, 0, target);
+            nop();
+        }
+    }
+    void jr(int rs) { R(11, 0, rs, 0); }
+    void halt() { ecall(0x3FF); }
+
+    void load(z16sim& sim) const {
+        sim.writeMemory(origin, code.data(), code.size() * 2);
+        sim.setPC(origin);
+    }
+
+    enum { B_BEQ = 0, B_BNE = 1, B_BZ = 2, B_BNZ = 3, B_BLT = 4 };
+};
+
+// Architectural state after a run, for comparing engines
+struct testOutcome {
+    int status;
+    uint16_t regs[z16sim::NUM_REGS];
+    uint16_t pc;
+    uint64_t retired;
+    uint64_t memory;
+    z16blockStats stats;
+    size_t events; // Queued device events at the end
+
+    bool operator==(const testOutcome& o) const {
+        return status == o.status && pc == o.pc && retired == o.retired && memory == o.memory &&
+               std::memcmp(regs, o.regs, sizeof(regs)) == 0;
+    }
+};
+
+static void report(const char* what, const testOutcome& o) {
+    std::printf("  %-12s status %d pc 0x%04X retired %llu memory %016llx regs", what, o.status, o.pc,
+                (unsigned long long)o.retired, (unsigned long long)o.memory);
+    for (int r = 0; r < z16sim::NUM_REGS; ++r) {
+        std::printf(" %04X", o.regs[r]);
+    }
+    std::printf("\n");
+}
+
+static testOutcome outcome(const z16sim& sim, int status) {
+    testOutcome o;
+    o.status = status;
+    for (int r = 0; r < z16sim::NUM_REGS; ++r) {
+        o.regs[r] = sim.getReg(r);
+    }
+    o.pc = sim.getPC();
+    o.retired = sim.getInstructionCount();
+    o.memory = sim.memoryHash();
+    o.stats = sim.getBlockStats();
+    o.events = sim.getEventCount();
+    return o;
+}
+
+// Runs the program on one engine; setup maps devices and the like
+static testOutcome runOn(z16engine engine, const testProgram& prog, uint64_t budget,
+                         const std::function<void(z16sim&)>& setup = nullptr) {
+    z16nullSink quiet;
+    z16sim sim;
+    sim.setSink(&quiet);
+    sim.setEngine(engine);
+    prog.load(sim);
+    if (setup) {
+        setup(sim);
+    }
+    return outcome(sim, sim.run(budget));
+}
+
+// The engines to compare against the interpreter on this host
+static std::vector<z16engine> engines() {
+    std::vector<z16engine> list(1, Z16_ENGINE_BLOCKS);
+    if (z16jit::available()) {
+        list.push_back(Z16_ENGINE_JIT);
+    }
+    return list;
+}
+
+static const char* engineName(z16engine engine) {
+    return engine == Z16_ENGINE_JIT ? "jit" : engine == Z16_ENGINE_BLOCKS ? "blocks" : "interpreter";
+}
+
+// Runs on the interpreter and every engine, checks each engine against the
+// interpreter and returns the outcomes, the interpreter's first
+static std::vector<testOutcome> checkEngines(const testProgram& prog, uint64_t budget,
+                                             const std::function<void(z16sim&)>& setup = nullptr) {
+    std::vector<testOutcome> results(1, runOn(Z16_ENGINE_INTERP, prog, budget, setup));
+    for (z16engine engine : engines()) {
+        results.push_back(runOn(engine, prog, budget, setup));
+        if (!(results.back() == results[0])) {
+            std::printf("%s differs from the interpreter:\n", engineName(engine));
+            report("interpreter", results[0]);
+            report(engineName(engine), results.back());
+            ++failures;
+        }
+    }
+    return results;
+}
+
+// A JIT with a code buffer far too small for the program must flush and
+// keep translating, and still match the interpreter
+static void testJitBuffer() {
+    if (!z16jit::available()) {
+        std::printf("jit-buffer: no JIT on this host, skipped\n");
+        return;
+    }
+    testProgram prog(0x0100);
+    prog.lui(3, 0x40);      // s0 = 0x4000: data for the stores
+    prog.li(7, 60);         // Outer iterations; blocks get hot again after every flush
+    uint16_t top = prog.here();
+    for (int b = 0; b < 80; ++b) { // Distinct blocks: addi, an occasional store, j to the next
+        prog.addi(6, (b % 60) + 1);
+        if (b % 8 == 0) {
+            prog.sw(6, (b / 8) % 8 * 2, 3);
+        }
+        prog.jump(false, 0, prog.here() + 2);
+    }
+    prog.addi(7, -1);
+    prog.loopBack(7, top);
+    prog.halt();
+
+    testOutcome want = runOn(Z16_ENGINE_INTERP, prog, 1000000);
+    testOutcome got = runOn(Z16_ENGINE_JIT, prog, 1000000, [](z16sim& sim) { sim.setJitCodeSize(1024); });
+    if (!(got == want)) {
+        std::printf("jit with a 1 KB buffer differs from the interpreter:\n");
+        report("interpreter", want);
+        report("jit", got);
+        ++failures;
+    }
+    CHECK(want.status == Z16_STATUS_HALT);
+    CHECK(got.stats.jitFlushes > 1); // Filled up again after a flush
+    CHECK(got.stats.translated > got.stats.jitFlushes);
+    CHECK(got.stats.jitFailures == 0);
+}
+
+// A zx16asm.py listing of a program with the two-instruction pseudo-ops la,
+// push, pop and li16; the code is the same program from the encoder
+static const char* profileListing =
+    "ZX16 Assembler Listing\n"
+    "==================================================\n"
+    "\n"
+    "   1      .text\n"
+    "   2      main:\n"
+    "   3          li sp, 60\n"
+    "   4          la a0, msg\n"
+    "   5          push a0\n"
+    "   6          pop a1\n"
+    "   7          jal ra, func\n"
+    "   8          ecall 0x3FF\n"
+    "   9      func:\n"
+    "  10          li16 a0, 300\n"
+    "  11          ret\n"
+    "  12      .data\n"
+    "  13      msg: .string \"hi\"\n"
+    "\n"
+    "Symbol Table:\n"
+    "------------------------------\n"
+    "CODE_START           = 0x0020  (global)\n"
+    "func                 = 0x0032  (local)\n"
+    "main                 = 0x0020  (local)\n"
+    "msg                  = 0x8000  (local)\n"
+    "\n"
+    "Statistics:\n"
+    "  Code size:    24 bytes\n"
+    "  Data size:    3 bytes\n"
+    "  Total size:   27 bytes\n"
+    "  Symbols:      4\n"
+    "  Lines:        13\n";
+
+// Every PC of the program is charged to its own source line and label
+static void testProfile() {
+    testProgram prog(0x0020);
+    prog.li(2, 60);                        // 3: li sp, 60
+    prog.lui(6, 0x80);                     // 4: la a0, msg
+    prog.addi(6, 0);
+    prog.addi(2, -2);                      // 5: push a0
+    prog.sw(6, 0, 2);
+    prog.lw(7, 0, 2);                      // 6: pop a1
+    prog.addi(2, 2);
+    prog.jump(true, 1, 0x0032);            // 7: jal ra, func
+    prog.halt();                           // 8: ecall 0x3FF
+    prog.lui(6, 300 >> 8);                 // 10: li16 a0, 300
+    prog.I(4, 6, 300 & 0xFF);
+    prog.jr(1);                            // 11: ret
+
+    std::filesystem::path file = std::filesystem::temp_directory_path() / "zx16_selftest_profile.lst";
+    {
+        std::ofstream out(file);
+        out << profileListing;
+    }
+    z16listing listing;
+    std::ostringstream err;
+    CHECK(listing.load(file.string().c_str(), err));
+    std::filesystem::remove(file);
+    CHECK(err.str().empty()); // Sizes add up to the listing's code size
+
+    static const struct { uint16_t pc; int line; const char* label; uint16_t offset; } expected[] = {
+        {0x20, 3, "main", 0},   {0x22, 4, "main", 2},   {0x24, 4, "main", 4},  {0x26, 5, "main", 6},
+        {0x28, 5, "main", 8},   {0x2A, 6, "main", 10},  {0x2C, 6, "main", 12}, {0x2E, 7, "main", 14},
+        {0x30, 8, "main", 16},  {0x32, 10, "func", 0},  {0x34, 10, "func", 2}, {0x36, 11, "func", 4},
+    };
+    for (const auto& e : expected) {
+        std::string name;
+        uint16_t offset = 0;
+        if (listing.lineAt(e.pc) != e.line || !listing.labelAt(e.pc, name, offset) || name != e.label ||
+            offset != e.offset) {
+            std::printf("0x%04X: line %d, %s+%u; expected line %d, %s+%u\n", e.pc, listing.lineAt(e.pc),
+                        name.c_str(), offset, e.line, e.label, e.offset);
+            ++failures;
+        }
+    }
+
+    z16nullSink quiet;
+    z16sim sim;
+    z16profiler profiler;
+    sim.setSink(&quiet);
+    sim.setProfiler(&profiler);
+    prog.load(sim);
+    CHECK(sim.run(1000) == Z16_STATUS_HALT);
+    CHECK(sim.getReg(6) == 300);
+    CHECK(profiler.getCount(0x0032) == 1 && profiler.getCount(0x0036) == 1);
+    std::ostringstream folded;
+    profiler.writeFolded(folded, &listing);
+    CHECK(folded.str().find("zx16;func 3\n") != std::string::npos);
+}
+
+// Interrupt controller and timers, mapped fresh for every run
+struct testDevices {
+    std::unique_ptr<z16interruptController> controller;
+    std::unique_ptr<z16timer> timers;
+
+    void attach(z16sim& sim) {
+        controller.reset(new z16interruptController());
+        timers.reset(new z16timer());
+        controller->attach(sim);
+        timers->attach(sim);
+    }
+};
+
+// Vectors, a handler for line 1 that counts in t1 (x5), and the start of a
+// main program that runs timer 0 with the given period and CTRL and
+// enables line 1
+static void interruptProgram(testProgram& prog, int period, int ctrl) {
+    prog.jump(false, 0, 0x0040); // 0x00: reset
+    prog.jump(false, 0, 0x0020); // 0x02: line 1
+    while (prog.here() < 0x0020) {
+        prog.nop();
+    }
+    prog.addi(5, 1); // 0x20: handler
+    prog.lui(3, 0xFC);
+    prog.li(4, 2);
+    prog.sw(4, z16interruptController::REG_PENDING, 3); // Clear line 1
+    prog.ecall(0x3FD);
+    while (prog.here() < 0x0040) {
+        prog.nop();
+    }
+    prog.lui(3, 0xFD); // 0x40: main
+    prog.li(4, period);
+    prog.sw(4, 2, 3); // PERIOD
+    prog.sw(0, 4, 3); // PRESCALE
+    prog.li(4, ctrl);
+    prog.sw(4, 0, 3); // CTRL
+    prog.lui(3, 0xFC);
+    prog.li(4, 2);
+    prog.sw(4, z16interruptController::REG_MASK, 3);
+    prog.li(4, 1);
+    prog.sw(4, z16interruptController::REG_STATUS, 3);
+}
+
+// A periodic timer interrupts a busy loop at the same instructions on every
+// engine; a loop that keeps restarting a timer never lets it expire and
+// never has more than its one event queued
+static void testInterrupts() {
+    testDevices devices;
+    auto setup = [&devices](z16sim& sim) { devices.attach(sim); };
+
+    testProgram periodic;
+    interruptProgram(periodic, 50, z16timer::CTRL_RUN | z16timer::CTRL_PERIODIC);
+    uint16_t loop = periodic.here();
+    periodic.addi(7, 1);
+    periodic.jump(false, 0, loop);
+    std::vector<testOutcome> results = checkEngines(periodic, 10000, setup);
+    CHECK(results[0].status == Z16_STATUS_OK);
+    CHECK(results[0].regs[5] >= 195 && results[0].regs[5] <= 200); // Every 50 cycles
+    CHECK(results[0].events == 1);
+
+    testProgram restart;
+    interruptProgram(restart, 50, z16timer::CTRL_RUN);
+    restart.lui(3, 0xFD);
+    restart.li(4, z16timer::CTRL_RUN);
+    loop = restart.here();
+    restart.sw(4, 0, 3); // Restart timer 0
+    restart.addi(7, 1);
+    restart.jump(false, 0, loop);
+    results = checkEngines(restart, 100000, setup);
+    CHECK(results[0].regs[5] == 0);
+    for (const testOutcome& o : results) {
+        CHECK(o.events == 1);
+    }
+}
+
+// Countdown loops and a loop polling for timer interrupts end where the
+// interpreter ends them, with the block engines skipping most of the passes
+static void testIdle() {
+    testProgram countdown(0x0100);
+    countdown.li(7, 1);
+    uint16_t loop = countdown.here();
+    countdown.addi(7, 3); // Exits after 21845 passes, when 1 + 3n wraps to 0
+    countdown.loopBack(7, loop);
+    countdown.li(5, 1);
+    countdown.li(4, 0);
+    loop = countdown.here();
+    countdown.addi(5, 2); // Odd forever: never equals 0, runs to the budget
+    countdown.branchSkip(testProgram::B_BNE, 5, 4, (loop - countdown.here() - 2) / 4);
+    std::vector<testOutcome> results = checkEngines(countdown, 100001); // Ends inside a pass
+    CHECK(results[0].status == Z16_STATUS_OK && results[0].regs[7] == 0);
+    for (size_t e = 1; e < results.size(); ++e) {
+        CHECK(results[e].stats.fastForwarded > 0);
+    }
+
+    // Waits in a pure loop (a load and ALU ops) until the handler has run
+    // ten times; timer 0 expires every 63 * 64 cycles
+    testDevices devices;
+    auto setup = [&devices](z16sim& sim) { devices.attach(sim); };
+    testProgram poll;
+    interruptProgram(poll, 63, z16timer::CTRL_RUN | z16timer::CTRL_PERIODIC);
+    poll.lui(3, 0xFD);
+    poll.li(4, 63);
+    poll.sw(4, 4, 3);  // PRESCALE
+    poll.lui(1, 0x40); // The handler uses s0, s1 and t1
+    loop = poll.here();
+    poll.lw(6, 0, 1);
+    poll.R(10, 7, 2, 5); // mv sp, t1
+    poll.addi(2, -10);
+    poll.loopBack(2, loop);
+    poll.halt();
+    results = checkEngines(poll, 1000000, setup);
+    CHECK(results[0].status == Z16_STATUS_HALT && results[0].regs[5] == 10);
+    CHECK(results[0].retired > 10 * 63 * 64);
+    for (size_t e = 1; e < results.size(); ++e) {
+        CHECK(results[e].stats.fastForwarded > results[0].retired / 2);
+    }
+}
+
+#ifndef _WIN32
+// The debugger's end of a GDB remote connection over a Unix socket
+class gdbClient {
+public:
+    gdbClient() : fd(-1) {}
+    ~gdbClient() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    bool connect(const std::string& path) {
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::memcpy(addr.sun_path, path.c_str(), path.size());
+        for (int attempt = 0; attempt < 500; ++attempt) { // Until the stub listens
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0) {
+                return true;
+            }
+            close(fd);
+            fd = -1;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return false;
+    }
+
+    // Sends "$payload#cs" and returns the payload of the reply; acks are skipped
+    std::string request(const std::string& payload) {
+        uint8_t sum = 0;
+        for (char c : payload) {
+            sum += (uint8_t)c;
+        }
+        char cs[4];
+        std::snprintf(cs, sizeof(cs), "%02x", sum);
+        std::string frame = "$" + payload + "#" + cs;
+#ifdef MSG_NOSIGNAL
+        const int flags = MSG_NOSIGNAL;
+#else
+        const int flags = 0;
+#endif
+        if (send(fd, frame.data(), frame.size(), flags) != (ssize_t)frame.size()) {
+            return "<send failed>";
+        }
+        while (true) {
+            size_t start = input.find('$');
+            size_t hash = start == std::string::npos ? start : input.find('#', start);
+            if (hash != std::string::npos && hash + 3 <= input.size()) {
+                std::string reply = input.substr(start + 1, hash - start - 1);
+                input.erase(0, hash + 3);
+                return reply;
+            }
+            char buf[4096];
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if (n <= 0) {
+                return "<closed>";
+            }
+            input.append(buf, n);
+        }
+    }
+
+private:
+    int fd;
+    std::string input;
+};
+#endif
+
+// A debugger session over the remote protocol: registers, memory,
+// breakpoints, watchpoints, stepping, and the exit status in the W reply
+static void testGdb() {
+#ifdef _WIN32
+    std::printf("gdb: no POSIX sockets on this host, skipped\n");
+#else
+    testProgram prog(0x0100);
+    prog.lui(3, 0x40);  // 0x100: s0 = 0x4000
+    prog.li(6, 5);      // 0x102
+    prog.sw(6, 0, 3);   // 0x104: watched
+    prog.addi(6, 37);   // 0x106
+    prog.halt();        // 0x108: breakpoint; exit with a0 = 42
+
+    z16nullSink quiet;
+    z16sim sim;
+    sim.setSink(&quiet);
+    prog.load(sim);
+    z16gdbStub stub(sim);
+    std::string path = (std::filesystem::temp_directory_path() / "zx16_selftest_gdb.sock").string();
+    std::ostringstream err;
+    if (!stub.listen("unix:" + path, err)) {
+        std::printf("gdb: %s", err.str().c_str());
+        ++failures;
+        return;
+    }
+    int served = -1;
+    std::thread server([&stub, &served]() { served = stub.serve(); });
+
+    gdbClient gdb;
+    if (!gdb.connect(path)) {
+        std::printf("gdb: could not connect to %s\n", path.c_str());
+        std::exit(1); // serve() is still waiting in accept()
+    }
+    CHECK(gdb.request("QStartNoAckMode") == "OK");
+    CHECK(gdb.request("qSupported:swbreak+").find("qXfer:features:read+") != std::string::npos);
+    CHECK(gdb.request("qXfer:features:read:target.xml:0,1000").find("<reg name=\"pc\"") != std::string::npos);
+    CHECK(gdb.request("?") == "S05");
+    CHECK(gdb.request("p8") == "0001"); // PC 0x0100, little-endian
+    char code[16];
+    std::snprintf(code, sizeof(code), "%02x%02x%02x%02x", prog.code[0] & 0xFF, prog.code[0] >> 8, prog.code[1] & 0xFF,
+                  prog.code[1] >> 8);
+    CHECK(gdb.request("m100,4") == code);
+    CHECK(gdb.request("M4002,2:3412") == "OK");
+    CHECK(gdb.request("m4002,2") == "3412");
+    CHECK(gdb.request("MFFFFFFFF,2:abcd") == "E01"); // addr + len wraps around 32 bits
+    CHECK(gdb.request("MFFFF,2:abcd") == "E01");     // Runs past the end of memory
+    CHECK(gdb.request("M10000,1:ab") == "E01");
+    CHECK(gdb.request("M000004002,2:abcd") == "E01"); // More digits than 32 bits hold
+    CHECK(gdb.request("m100000100,4") == "E01");
+    CHECK(sim.getMemory()[0xFFFF] == 0 && gdb.request("m4002,2") == "3412");
+    CHECK(gdb.request("MFFFF,1:ab") == "OK");
+    CHECK(gdb.request("mFFFF,1") == "ab");
+    CHECK(gdb.request("P7=cdab") == "OK");
+    CHECK(sim.getReg(7) == 0xABCD);
+    CHECK(gdb.request("s") == "S05");
+    CHECK(gdb.request("p8") == "0201");
+    CHECK(gdb.request("Z2,4000,2") == "OK");
+    CHECK(gdb.request("Z0,108,2") == "OK");
+    CHECK(gdb.request("c") == "T05watch:4000;"); // Stops after the store
+    CHECK(gdb.request("p8") == "0601");
+    CHECK(gdb.request("z2,4000,2") == "OK");
+    CHECK(gdb.request("c") == "T05swbreak:;");
+    CHECK(gdb.request("p8") == "0801");
+    CHECK(gdb.request("p6") == "2a00");
+    CHECK(gdb.request("g").substr(0, 4) == "0000");
+    CHECK(gdb.request("Z9,0,0").empty()); // Unsupported: empty reply
+    CHECK(gdb.request("c") == "W2a");
+    server.join();
+    CHECK(served == Z16_STATUS_HALT);
+#endif
+}
+
+// Going back to any logged instruction count, long jumps through a
+// checkpoint included, gives the state the program had there; running back
+// stops at breakpoints and before stores to watched bytes; lastWriter names
+// the newest store
+static void testReverse() {
+    testProgram prog(0x0100);
+    prog.lui(3, 0x40); // s0 = 0x4000
+    prog.li(7, 20);
+    prog.li(6, 0);
+    uint16_t top = prog.here();
+    prog.addi(6, 3);
+    uint16_t store = prog.here();
+    prog.sw(6, 0, 3);
+    prog.addi(7, -1);
+    prog.loopBack(7, top);
+    uint16_t last = prog.here();
+    prog.sw(7, 2, 3); // Overwrites 0x4002 with 0
+    prog.halt();
+
+    // The state after every instruction count, one instruction at a time
+    std::vector<testOutcome> states;
+    z16nullSink quiet;
+    {
+        z16sim sim;
+        sim.setSink(&quiet);
+        prog.load(sim);
+        sim.writeMemory(0x4002, "\x55\x55", 2);
+        states.push_back(outcome(sim, 0));
+        int status = 0;
+        while (status == 0) {
+            status = sim.run(1);
+            states.push_back(outcome(sim, status));
+        }
+    }
+    auto at = [&](const z16sim& sim) {
+        uint64_t n = sim.getInstructionCount();
+        return n < states.size() && outcome(sim, states[n].status) == states[n];
+    };
+    auto lastAt = [&](uint16_t pc) {
+        uint64_t n = states.size() - 1;
+        while (n > 0 && states[n].pc != pc) {
+            --n;
+        }
+        return n;
+    };
+
+    z16sim sim;
+    sim.setSink(&quiet);
+    prog.load(sim);
+    sim.writeMemory(0x4002, "\x55\x55", 2);
+    z16recorder rec(32); // Smaller than the run: the ring wraps, checkpoints every 4
+    sim.setRecorder(&rec);
+    CHECK(sim.run(1000) == Z16_STATUS_HALT);
+    CHECK(sim.getInstructionCount() == states.size() - 1);
+    CHECK(at(sim));
+    CHECK(rec.newest() == sim.getInstructionCount());
+    CHECK(rec.oldest() > 0);
+    CHECK(rec.getCheckpointCount() > 1);
+
+    // One long jump back, forward again, then back one instruction at a time
+    CHECK(!sim.reverseTo(rec.oldest() - 1));
+    CHECK(sim.reverseTo(rec.oldest()));
+    CHECK(at(sim));
+    CHECK(sim.run(1000) == Z16_STATUS_HALT);
+    CHECK(at(sim));
+    uint64_t oldest = rec.oldest();
+    while (sim.reverseStep()) {
+        CHECK(at(sim));
+    }
+    CHECK(sim.getInstructionCount() == oldest);
+
+    // Newest writers of 0x4000 (the loop's last store) and 0x4002
+    CHECK(sim.run(1000) == Z16_STATUS_HALT);
+    uint64_t count = 0;
+    uint16_t writer = 0;
+    CHECK(sim.lastWriter(0x4001, count, writer));
+    CHECK(count == lastAt(store) && writer == store);
+    CHECK(sim.lastWriter(0x4002, count, writer));
+    CHECK(count == lastAt(last) && writer == last);
+    CHECK(!sim.lastWriter(0x4004, count, writer));
+
+    // Back to just before the last store to 0x4002, then to the last pass
+    // through the loop's store
+    sim.setWatchpoint(0x4002, 2, Z16_WATCH_WRITE, true);
+    CHECK(sim.reverseContinue() == Z16_STATUS_DEBUG_STOP);
+    CHECK(sim.getStopReason().kind == Z16_STOP_WATCH_WRITE && sim.getStopReason().addr == 0x4002);
+    CHECK(sim.getPC() == last && sim.getMemory()[0x4002] == 0x55);
+    CHECK(at(sim));
+    sim.clearDebugPoints();
+    sim.setBreakpoint(store, true);
+    CHECK(sim.reverseContinue() == Z16_STATUS_DEBUG_STOP);
+    CHECK(sim.getStopReason().kind == Z16_STOP_BREAKPOINT && sim.getPC() == store);
+    CHECK(sim.getInstructionCount() == lastAt(store));
+    CHECK(at(sim));
+    sim.clearDebugPoints();
+    CHECK(sim.reverseContinue() == 0); // Nothing left: back to the log start
+    CHECK(sim.getInstructionCount() == rec.oldest());
+}
+
+// Runs the program under a timing model built from spec, on every engine
+// setting (timed runs always interpret), and checks the cycle count
+static z16timing timeProgram(const testProgram& prog, const char* spec, uint64_t cycles) {
+    z16timingConfig config;
+    std::string error;
+    CHECK(config.parse(spec, error));
+    z16timing first(config);
+    std::vector<z16engine> list = engines();
+    list.insert(list.begin(), Z16_ENGINE_INTERP);
+    for (z16engine engine : list) {
+        z16timing timing(config);
+        runOn(engine, prog, 1000, [&timing](z16sim& sim) { sim.setTimingModel(&timing); });
+        if (timing.getCycles() != cycles) {
+            std::printf("%s: %llu cycles, expected %llu\n", engineName(engine), (unsigned long long)timing.getCycles(),
+                        (unsigned long long)cycles);
+            ++failures;
+        }
+        if (engine == Z16_ENGINE_INTERP) {
+            first = timing;
+        }
+    }
+    return first;
+}
+
+// Cycle counts and cache counters worked out by hand for the default
+// pipeline: branch, jump and load-use penalties with the I-cache on, then
+// hits, conflict misses and dirty write-backs of a small direct-mapped D-cache
+static void testTiming() {
+    testProgram loop(0x0100);
+    loop.li(7, 3);                            // 1
+    loop.lui(3, 0x40);                        // 1
+    uint16_t top = loop.here();
+    loop.sw(7, 0, 3);                         // 1
+    loop.lw(5, 0, 3);                         // 1
+    loop.R(0, 0, 5, 5);                       // add a5, a5: 1 + load-use 1
+    loop.addi(7, -1);                         // 1
+    loop.loopBack(7, top);                    // nop 1, bnz 1 + taken 2 (twice)
+    uint16_t call = loop.here();
+    loop.jump(true, 1, call + 4);             // jal: 1 + direct 1
+    loop.halt();                              // 1
+    loop.jr(1);                               // 1 + indirect 2
+    // 2 + 3 * 7 + 2 * 2 + 2 + 1 + 3 = 33, and two I-cache line fills
+    z16timing t = timeProgram(loop, "dcache=off", 33 + 2 * 10);
+    CHECK(t.getInstructions() == 23);
+    CHECK(t.getICache().getMisses() == 2 && t.getICache().getHits() == 21);
+    CHECK(t.getDCache().getHits() + t.getDCache().getMisses() == 0);
+
+    // 64 bytes, 16-byte lines, one way: 0x4000 and 0x4040 share set 0
+    testProgram mem(0x0100);
+    mem.lui(3, 0x40);  // s0 = 0x4000
+    mem.lui(4, 0x40);
+    mem.addi(4, 32);
+    mem.addi(4, 32);   // 0x4040
+    mem.lui(2, 0x40);
+    mem.addi(2, 16);   // 0x4010
+    mem.sw(3, 0, 3);   // Miss
+    mem.lw(5, 2, 3);   // Hit
+    mem.sw(3, 0, 4);   // Miss, writes back 0x4000
+    mem.lw(5, 0, 3);   // Miss, writes back 0x4040
+    mem.lw(5, 0, 2);   // Miss into set 1
+    mem.halt();
+    // 12 instructions, 4 misses and 2 write-backs at 10 cycles each
+    t = timeProgram(mem, "icache=off,dcache=64:16:1:10", 12 + 6 * 10);
+    CHECK(t.getDCache().getHits() == 1);
+    CHECK(t.getDCache().getMisses() == 4);
+    CHECK(t.getDCache().getWritebacks() == 2);
+
+    z16timingConfig config;
+    std::string error;
+    CHECK(!config.parse("icache=1000:16:1:10", error) && !error.empty());
+    CHECK(!config.parse("fetch=2", error));
+}
+
+// Reads a whole file, "" if it cannot
+static std::string readFile(const std::filesystem::path& file) {
+    std::ifstream in(file, std::ios::binary);
+    std::ostringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+// Runs one of the other zx16 tools with stdout and stderr going to output;
+// its exit status
+static int runTool(const char* tool, const std::string& args, const std::filesystem::path& output) {
+    std::string command = "\"" + (toolDir / tool).string() + "\" " + args + " > \"" + output.string() + "\" 2>&1";
+    return std::system(command.c_str());
+}
+
+// zx16_tracedump turns a binary trace back into the text trace, from the
+// start and from instruction counts that need a seek through the index
+static void testTraceFile() {
+    testProgram prog(0x0100);
+    uint16_t func = 0x0102, body = 0x0106;
+    prog.jump(false, 0, body);
+    prog.addi(4, 1); // func
+    prog.jr(1);
+    CHECK(prog.here() == body);
+    prog.lui(3, 0x40);
+    prog.li(7, 50);
+    uint16_t top = prog.here();
+    prog.addi(6, 5);
+    prog.sw(6, 0, 3);
+    prog.S(0, 7, 3, 3); // sb
+    prog.lw(5, 0, 3);
+    prog.jump(true, 1, func);
+    prog.addi(7, -1);
+    prog.loopBack(7, top);
+    prog.halt();
+
+    // The text trace, and the same run again into a binary trace
+    std::string text;
+    z16callbackSink traceSink([&text](z16channel channel, const char* data, size_t len) {
+        if (channel == Z16_CHAN_TRACE) {
+            text.append(data, len);
+        }
+    });
+    z16sim traced;
+    traced.setSink(&traceSink);
+    prog.load(traced);
+    CHECK(traced.run(100000, true) == Z16_STATUS_HALT);
+
+    std::filesystem::path file = std::filesystem::temp_directory_path() / "zx16_selftest_trace.bin";
+    std::filesystem::path dump = std::filesystem::temp_directory_path() / "zx16_selftest_trace.txt";
+    z16nullSink quiet;
+    z16sim sim;
+    sim.setSink(&quiet);
+    prog.load(sim);
+    z16traceWriter writer(64);
+    std::ostringstream err;
+    CHECK(writer.open(file.string(), err));
+    sim.setTraceWriter(&writer);
+    CHECK(sim.run(100000, true) == Z16_STATUS_HALT);
+    CHECK(writer.close(err));
+    CHECK(writer.getRecordCount() == sim.getInstructionCount());
+
+    z16traceReader reader;
+    CHECK(reader.open(file.string(), err));
+    CHECK(reader.hasIndex() && reader.getKeyframes().size() > 4);
+    z16traceRecord rec;
+    while (reader.next(rec)) {
+    }
+    CHECK(rec.count + 1 == sim.getInstructionCount());
+    for (int r = 0; r < z16sim::NUM_REGS; ++r) {
+        CHECK(reader.getRegs()[r] == sim.getReg(r));
+    }
+
+    // Lines of the text trace from instruction count n on
+    std::vector<size_t> lineStart;
+    for (size_t at = 0; at < text.size(); at = text.find('\n', at) + 1) {
+        lineStart.push_back(at);
+    }
+    CHECK(lineStart.size() == sim.getInstructionCount());
+    for (uint64_t from : {0, 1, 63, 64, 65, 200, 300}) {
+        CHECK(runTool("zx16_tracedump", "--from=" + std::to_string(from) + " \"" + file.string() + "\"", dump) == 0);
+        std::string want = from < lineStart.size() ? text.substr(lineStart[from]) : "";
+        if (readFile(dump) != want) {
+            std::printf("zx16_tracedump --from=%llu differs from the text trace\n", (unsigned long long)from);
+            ++failures;
+        }
+    }
+    std::filesystem::remove(file);
+    std::filesystem::remove(dump);
+}
+
+// Every Tests/*.bin, recompiled at build time (zx16_aot_<name>), prints
+// the output the interpreter does
+static void testAot() {
+    std::filesystem::path native = std::filesystem::temp_directory_path() / "zx16_selftest_aot.txt";
+    std::filesystem::path interpreted = std::filesystem::temp_directory_path() / "zx16_selftest_interp.txt";
+    int images = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(ZX16_TESTS_DIR)) {
+        if (entry.path().extension() != ".bin") {
+            continue;
+        }
+        ++images;
+        std::string name = "zx16_aot_" + entry.path().stem().string();
+        std::string image = "\"" + entry.path().string() + "\"";
+        CHECK(runTool(name.c_str(), image, native) == 0);
+        CHECK(runTool("zx16_simulator", "--quiet " + image, interpreted) == 0);
+        std::string got = readFile(native);
+        CHECK(got.find("--- Final State ---") != std::string::npos);
+        if (got != readFile(interpreted)) {
+            std::printf("%s and zx16_simulator --quiet differ on %s\n", name.c_str(), entry.path().filename().string().c_str());
+            ++failures;
+        }
+    }
+    CHECK(images > 0);
+    std::filesystem::remove(native);
+    std::filesystem::remove(interpreted);
+}
+
+// Everything a run wrote to the sink, write by write, and the state it ended in
+struct consoleRun {
+    testOutcome state;
+    std::vector<std::pair<z16channel, std::string> > writes;
+    std::string console; // The Z16_CHAN_CONSOLE writes joined
+
+    // The writes to one channel, joined
+    std::string channel(z16channel which) const {
+        std::string text;
+        for (const auto& w : writes) {
+            if (w.first == which) {
+                text += w.second;
+            }
+        }
+        return text;
+    }
+};
+
+static consoleRun runConsole(z16engine engine, const testProgram& prog, const std::string& input,
+                             const std::function<void(z16sim&)>& setup) {
+    consoleRun out;
+    z16callbackSink sink([&out](z16channel channel, const char* data, size_t len) {
+        out.writes.push_back({channel, std::string(data, len)});
+    });
+    std::istringstream in(input);
+    z16sim sim;
+    sim.setSink(&sink);
+    sim.setInput(in);
+    sim.setEngine(engine);
+    prog.load(sim);
+    if (setup) {
+        setup(sim);
+    }
+    out.state = outcome(sim, sim.run(100000));
+    out.console = out.channel(Z16_CHAN_CONSOLE);
+    return out;
+}
+
+// Runs the program with input on stdin on the interpreter and every engine;
+// each must make the same writes, in the same order, and end in the same
+// state. Returns the interpreter's run.
+static consoleRun checkConsole(const testProgram& prog, const std::string& input,
+                               const std::function<void(z16sim&)>& setup = nullptr) {
+    consoleRun want = runConsole(Z16_ENGINE_INTERP, prog, input, setup);
+    CHECK(want.state.status == Z16_STATUS_HALT);
+    for (z16engine engine : engines()) {
+        consoleRun got = runConsole(engine, prog, input, setup);
+        if (!(got.state == want.state) || got.writes != want.writes) {
+            std::printf("%s differs from the interpreter (console \"%s\" vs \"%s\"):\n", engineName(engine),
+                        want.console.c_str(), got.console.c_str());
+            report("interpreter", want.state);
+            report(engineName(engine), got.state);
+            ++failures;
+        }
+    }
+    return want;
+}
+
+// a0 = c, for any c up to 126
+static void setA0(testProgram& prog, int c) {
+    prog.li(6, c / 2);
+    prog.addi(6, c - c / 2);
+}
+
+static const int A0 = 6;
+
+// 0x000 prints the low byte of a0. Output is buffered, and comes out in one
+// write ahead of the halt message.
+static void testPutChar() {
+    testProgram prog(0x0100);
+    for (char c : std::string("Hi!\n")) {
+        setA0(prog, c);
+        prog.ecall(0x000);
+    }
+    prog.lui(A0, 1); // 0x141: only the low byte counts
+    prog.addi(A0, 0x20);
+    prog.addi(A0, 0x21);
+    prog.ecall(0x000);
+    prog.halt();
+    consoleRun run = checkConsole(prog, "");
+    CHECK(run.console == "Hi!\nA");
+    CHECK(run.writes.size() == 2);
+    CHECK(run.writes[0].first == Z16_CHAN_CONSOLE);
+    CHECK(run.writes.back().first == Z16_CHAN_STATUS);
+}
+
+// 0x001 reads ahead: the first read flushes the prompt and takes all the
+// input there is; later reads come from the read-ahead without flushing,
+// until the input runs out and a0 gets 0xFFFF
+static void testGetChar() {
+    testProgram prog(0x0100);
+    setA0(prog, '>');
+    prog.ecall(0x000);
+    prog.ecall(0x001); // 'x'
+    prog.ecall(0x000);
+    setA0(prog, '>');
+    prog.ecall(0x000);
+    prog.ecall(0x001); // 'y', from the read-ahead
+    prog.ecall(0x000);
+    prog.ecall(0x001); // End of input
+    prog.R(10, 7, 5, A0); // mv t1, a0
+    prog.ecall(0x001); // Still at the end
+    prog.halt();
+    consoleRun run = checkConsole(prog, "xy");
+    CHECK(run.console == ">x>y");
+    CHECK(run.writes.size() == 3); // ">" at the first read, "x>y" at the end of input, the halt
+    CHECK(run.writes[0] == std::make_pair(Z16_CHAN_CONSOLE, std::string(">")));
+    CHECK(run.writes[1] == std::make_pair(Z16_CHAN_CONSOLE, std::string("x>y")));
+    CHECK(run.state.regs[5] == 0xFFFF && run.state.regs[A0] == 0xFFFF);
+}
+
+// 0x002 prints up to the NUL, or up to the end of memory without one
+static void testPutString() {
+    testProgram prog(0x0100);
+    prog.lui(A0, 0x40);
+    prog.ecall(0x002);
+    prog.li(A0, -2); // 0xFFFE: "ok", then memory ends
+    prog.ecall(0x002);
+    prog.halt();
+    consoleRun run = checkConsole(prog, "", [](z16sim& sim) {
+        sim.writeMemory(0x4000, "hello, \0world", 14);
+        sim.writeMemory(0xFFFE, "ok", 2);
+    });
+    CHECK(run.console == "hello, ok");
+}
+
+// 0x003 prints a0 as a signed decimal
+static void testPutInt() {
+    testProgram prog(0x0100);
+    auto print = [&prog]() {
+        prog.ecall(0x003);
+        prog.li(A0, ' ');
+        prog.ecall(0x000);
+    };
+    prog.li(A0, 0);
+    print();
+    prog.li(A0, -1);
+    print();
+    prog.lui(A0, 0x80); // 0x8000
+    print();
+    prog.lui(A0, 0x80);
+    prog.addi(A0, -1); // 0x7FFF
+    print();
+    prog.li(A0, 42);
+    prog.ecall(0x003);
+    prog.halt();
+    CHECK(checkConsole(prog, "").console == "0 -1 -32768 32767 42");
+}
+
+// 0x3FC dumps the registers on the status channel, after the console
+// output before it
+static void testDumpRegisters() {
+    testProgram prog(0x0100);
+    setA0(prog, '!');
+    prog.ecall(0x000);
+    prog.lui(1, 0x12);
+    prog.addi(1, 0x34);
+    prog.ecall(0x3FC);
+    prog.halt();
+    consoleRun run = checkConsole(prog, "");
+    CHECK(run.writes.size() == 3);
+    CHECK(run.writes[0] == std::make_pair(Z16_CHAN_CONSOLE, std::string("!")));
+    CHECK(run.writes[1].first == Z16_CHAN_STATUS);
+    CHECK(run.writes[1].second.find("x1: 0x1234\n") != std::string::npos);
+    CHECK(run.writes[1].second.find("x6: 0x0021\n") != std::string::npos);
+}
+
+// A device page that logs every access and answers each read with a fresh
+// value, so an engine that skipped, repeated or reordered an access shows
+class loggingDevice : public z16device {
+public:
+    std::vector<std::string> log;
+    uint8_t next = 0x41;
+
+    uint8_t read8(uint16_t addr) override {
+        log.push_back("r " + std::to_string(addr));
+        return next++;
+    }
+    void write8(uint16_t addr, uint8_t value) override {
+        log.push_back("w " + std::to_string(addr) + " " + std::to_string(value));
+    }
+};
+
+// A loop that loads from a ROM page, reads and writes a device page and
+// stores to RAM, run long enough for the JIT to translate it with bus checks
+// (so every device access is a side exit), then a store to the ROM page.
+// Every engine must make the interpreter's device accesses and fault on the
+// ROM store with the ROM unchanged.
+static void testBus() {
+    const uint16_t rom = 0x7000, device = 0x8000;
+    const int iterations = 3 * z16jit::HOT_THRESHOLD;
+    testProgram prog(0x0100);
+    prog.lui(3, device >> 8);
+    prog.lui(4, rom >> 8);
+    prog.lui(1, 0x40);       // ra = 0x4000: RAM for the results
+    prog.li(7, iterations);
+    uint16_t top = prog.here();
+    prog.lw(6, 0, 4);        // ROM: the fast path
+    prog.lw(2, 2, 3);        // Device word read
+    prog.R(0, 0, 6, 2);      // add a0, sp
+    prog.sw(6, 0, 3);        // Device word write
+    prog.S(0, 7, 5, 3);      // sb a1, 5(s0)
+    prog.L(0, 2, 7, 3);      // lb sp, 7(s0)
+    prog.R(0, 0, 6, 2);
+    prog.sw(6, 0, 1);        // RAM
+    prog.addi(1, 2);
+    prog.addi(7, -1);
+    prog.loopBack(7, top);
+    uint16_t romStore = prog.here();
+    prog.sw(6, 0, 4);
+    prog.halt();
+
+    std::vector<std::string> want;
+    testOutcome wantState = {};
+    std::vector<z16engine> all(1, Z16_ENGINE_INTERP);
+    for (z16engine engine : engines()) {
+        all.push_back(engine);
+    }
+    for (z16engine engine : all) {
+        z16nullSink quiet;
+        loggingDevice dev;
+        z16sim sim;
+        sim.setSink(&quiet);
+        sim.setEngine(engine);
+        prog.load(sim);
+        sim.writeMemory(rom, "\x34\x12", 2); // Host writes fill ROM
+        sim.mapROM(rom, 0x100);
+        sim.mapDevice(device, 0x100, &dev);
+        testOutcome got = outcome(sim, sim.run(100000));
+
+        CHECK(got.status == Z16_STATUS_MEMORY_FAULT);
+        CHECK(got.pc == romStore);
+        CHECK(sim.getFault().addr == rom);
+        CHECK(sim.getMemory()[rom] == 0x34 && sim.getMemory()[rom + 1] == 0x12);
+        CHECK(dev.log.size() == (size_t)iterations * 6);
+        if (engine == Z16_ENGINE_INTERP) {
+            want = dev.log;
+            wantState = got;
+            continue;
+        }
+        if (engine == Z16_ENGINE_JIT) {
+            CHECK(got.stats.translated > 0);
+        }
+        if (!(got == wantState) || dev.log != want) {
+            std::printf("%s differs from the interpreter:\n", engineName(engine));
+            report("interpreter", wantState);
+            report(engineName(engine), got);
+            ++failures;
+        }
+    }
+    CHECK(want.size() > 6 && want[0] == "r 32770" && want[2] == "w 32768 " + std::to_string((0x1234 + 0x4241) & 0xFF));
+}
+
+// The tile device driven through the bus: palette, two tile definitions and
+// the map written with stores, frames presented by a word store, a byte
+// store and ecall 0x010. Each frame re-renders only the cells that changed.
+// The last frame must match Tests/gfx.png byte for byte on every engine; the
+// PPM and raw outputs must hold the same pixels.
+static void testGfx() {
+    testProgram prog(0x0100);
+    prog.lui(3, 0xFA);       // s0 = palette
+    prog.li(6, -32);         // Palette: 1 red, 2 green, 3 blue, 4 white
+    prog.S(0, 6, 1, 3);
+    prog.li(6, 28);
+    prog.S(0, 6, 2, 3);
+    prog.li(6, 3);
+    prog.S(0, 6, 3, 3);
+    prog.li(6, -1);
+    prog.S(0, 6, 4, 3);
+    prog.lui(4, 0xF2);       // s1 = tile 1's definition
+    prog.addi(4, 63);
+    prog.addi(4, 63);
+    prog.addi(4, 2);
+    prog.lui(6, 0x12);       // Tile 1: stripes of red and green
+    prog.addi(6, 0x21);
+    prog.li(7, z16tileDevice::TILE_BYTES / 4); // Two words an iteration
+    uint16_t tile1 = prog.here();
+    prog.sw(6, 0, 4);
+    prog.sw(6, 2, 4);
+    prog.addi(4, 4);
+    prog.addi(7, -1);
+    prog.loopBack(7, tile1);
+    prog.lui(5, 0x01);       // Tile 2: a gradient through the palette
+    prog.addi(5, 0x11);
+    prog.li(7, z16tileDevice::TILE_BYTES / 4);
+    uint16_t tile2 = prog.here();
+    prog.sw(6, 0, 4);
+    prog.R(0, 0, 6, 5);      // add a0, t1
+    prog.sw(6, 2, 4);
+    prog.R(0, 0, 6, 5);
+    prog.addi(4, 4);
+    prog.addi(7, -1);
+    prog.loopBack(7, tile2);
+    prog.li(6, 1);           // Every cell tile 1, then cells 0 and 21 tile 2
+    prog.ecall(0x012);
+    prog.lui(3, 0xF0);
+    prog.li(6, 2);
+    prog.S(0, 6, 0, 3);
+    prog.addi(3, 21);
+    prog.S(0, 6, 0, 3);
+    prog.lui(1, 0xFA);       // ra = FRAME
+    prog.addi(1, 0x10);
+    prog.sw(0, 0, 1);        // Frame 0: the palette changed, so every cell
+    prog.addi(3, 1);
+    prog.S(0, 6, 0, 3);      // Cell 22 tile 2
+    prog.li(7, 0x12);
+    prog.S(0, 7, -1, 3);     // Cell 21 still tile 2: not a change
+    prog.S(0, 0, 0, 1);      // Frame 1: cell 22
+    prog.lui(4, 0xF3);
+    prog.S(0, 0, 0, 4);      // First byte of tile 2
+    prog.ecall(0x010);       // Frame 2: cells 0, 21 and 22
+    prog.lw(7, 0, 1);        // Frames presented
+    prog.halt();
+
+    const size_t frameBytes = z16tileDevice::WIDTH * z16tileDevice::HEIGHT * 3;
+    std::string reference = readFile(std::filesystem::path(ZX16_TESTS_DIR) / "gfx.png");
+    CHECK(reference.size() > 8 && reference.compare(1, 3, "PNG") == 0);
+    std::filesystem::path dir = std::filesystem::temp_directory_path();
+    std::vector<z16engine> all(1, Z16_ENGINE_INTERP);
+    for (z16engine engine : engines()) {
+        all.push_back(engine);
+    }
+    for (z16engine engine : all) {
+        z16nullSink quiet;
+        z16tileDevice gfx;
+        z16sim sim;
+        sim.setSink(&quiet);
+        sim.setEngine(engine);
+        prog.load(sim);
+        gfx.attach(sim);
+        CHECK(gfx.openOutput((dir / "zx16_selftest_gfx%d.png").string(), std::cerr));
+        int status = sim.run(100000);
+        gfx.closeOutput();
+        CHECK(status == Z16_STATUS_HALT);
+        CHECK(sim.getReg(7) == 3 && gfx.getFrameCount() == 3);
+        CHECK(gfx.getCellsRendered() == z16tileDevice::NUM_CELLS + 1 + 3);
+        if (readFile(dir / "zx16_selftest_gfx2.png") != reference) {
+            std::printf("%s: frame 2 differs from Tests/gfx.png\n", engineName(engine));
+            ++failures;
+        }
+        CHECK(readFile(dir / "zx16_selftest_gfx0.png") != reference); // Before tile 2 changed
+        for (int frame = 0; frame < 3; ++frame) {
+            std::filesystem::remove(dir / ("zx16_selftest_gfx" + std::to_string(frame) + ".png"));
+        }
+    }
+
+    // The same frames as PPM files and as a raw stream
+    for (bool raw : {false, true}) {
+        z16nullSink quiet;
+        z16tileDevice gfx;
+        z16sim sim;
+        sim.setSink(&quiet);
+        prog.load(sim);
+        gfx.attach(sim);
+        std::filesystem::path out = dir / (raw ? "zx16_selftest_gfx.rgb" : "zx16_selftest_gfx%d.ppm");
+        CHECK(gfx.openOutput(out.string(), std::cerr));
+        CHECK(sim.run(100000) == Z16_STATUS_HALT);
+        gfx.closeOutput();
+        std::string pixels((const char*)gfx.getRGB(), frameBytes);
+        CHECK(pixels.compare(16 * 3, 3, "\xFF\x00\x00", 3) == 0); // Cell 1, top left: red
+        CHECK(pixels.compare(0, 3, "\x00\x00\x00", 3) == 0);       // Cell 0: tile 2's first byte cleared
+        if (raw) {
+            std::string stream = readFile(out);
+            CHECK(stream.size() == 3 * frameBytes && stream.compare(2 * frameBytes, frameBytes, pixels) == 0);
+            std::filesystem::remove(out);
+        } else {
+            CHECK(readFile(dir / "zx16_selftest_gfx2.ppm") == "P6\n320 240\n255\n" + pixels);
+            for (int frame = 0; frame < 3; ++frame) {
+                std::filesystem::remove(dir / ("zx16_selftest_gfx" + std::to_string(frame) + ".ppm"));
+            }
+        }
+    }
+}
+
+// One Intel HEX record with its checksum
+static std::string hexRecord(int type, uint16_t offset, const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> rec = {(uint8_t)data.size(), (uint8_t)(offset >> 8), (uint8_t)offset, (uint8_t)type};
+    rec.insert(rec.end(), data.begin(), data.end());
+    uint8_t sum = 0;
+    for (uint8_t b : rec) {
+        sum += b;
+    }
+    rec.push_back((uint8_t)-sum);
+    std::string text = ":";
+    char digits[3];
+    for (uint8_t b : rec) {
+        std::snprintf(digits, sizeof(digits), "%02X", b);
+        text += digits;
+    }
+    return text + "\n";
+}
+
+static void writeFile(const std::filesystem::path& file, const std::string& contents) {
+    std::ofstream out(file, std::ios::binary | std::ios::trunc);
+    out << contents;
+}
+
+// A program and a data word 0x40 bytes in, in each format zx16asm writes:
+// raw, Intel HEX, Verilog case items, and dense and sparse $readmemh
+struct loaderImages {
+    testProgram prog;
+    std::string bin, hex, verilog, mem, sparse;
+
+    loaderImages() {
+        prog.li(6, 5);
+        prog.addi(6, 7);
+        prog.li(7, -3);
+        prog.halt();
+        std::vector<uint16_t> words = prog.code;
+        words.resize(0x20, 0);
+        words.push_back(0xBEEF);
+        char line[64];
+        for (size_t i = 0; i < words.size(); ++i) {
+            uint16_t addr = (uint16_t)(i * 2);
+            bin += (char)(words[i] & 0xFF);
+            bin += (char)(words[i] >> 8);
+            std::snprintf(line, sizeof(line), "        16'h%04X: data = 16'h%04X;\n", addr, words[i]);
+            verilog += line;
+            std::snprintf(line, sizeof(line), "%04X\n", words[i]);
+            mem += line;
+            if (words[i] != 0) {
+                std::snprintf(line, sizeof(line), "@%04X %04X\n", addr, words[i]);
+                sparse += line;
+            }
+        }
+        verilog = "module program_memory(\n    input [15:0] addr,\n    output reg [15:0] data\n);\n"
+                  "always @(*) begin\n    case (addr)\n" + verilog + "    endcase\nend\nendmodule\n";
+        mem = "// ZX16 Memory File\n" + mem;
+        sparse = "# ZX16 Sparse Memory File\n" + sparse;
+        hex = hexRecord(0x04, 0, {0, 0});
+        for (size_t i = 0; i < prog.code.size() * 2; i += 4) { // Four bytes a record: one segment
+            hex += hexRecord(0x00, (uint16_t)i, std::vector<uint8_t>(bin.begin() + i, bin.begin() + std::min(i + 4, prog.code.size() * 2)));
+        }
+        hex += hexRecord(0x00, 0x40, {0xEF, 0xBE});
+        hex += hexRecord(0x01, 0, {});
+    }
+};
+
+// The same program loaded from every format, by extension, by contents and
+// with the format given, lands at --base with the same memory and PC, and
+// runs the same. The image cache parses a file again only after it changed.
+static void testLoad() {
+    loaderImages images;
+    std::filesystem::path dir = std::filesystem::temp_directory_path();
+    struct imageFile {
+        const char* name;
+        const std::string* contents;
+        z16imageFormat format;
+    } files[] = {
+        {"zx16_selftest_load.bin", &images.bin, Z16_FORMAT_BIN},
+        {"zx16_selftest_load.hex", &images.hex, Z16_FORMAT_IHEX},
+        {"zx16_selftest_load.v", &images.verilog, Z16_FORMAT_VERILOG},
+        {"zx16_selftest_load.mem", &images.mem, Z16_FORMAT_MEM},
+        {"zx16_selftest_sparse.mem", &images.sparse, Z16_FORMAT_MEM},
+    };
+
+    z16sim want;
+    want.writeMemory(0x0200, images.bin.data(), images.bin.size());
+    want.setPC(0x0200);
+    std::string wantOutput;
+    for (const imageFile& file : files) {
+        std::filesystem::path path = dir / file.name;
+        writeFile(path, *file.contents);
+
+        // Detected from the extension, from the contents, and given
+        z16image image;
+        std::string error;
+        CHECK(z16parseImage(file.contents->data(), file.contents->size(), file.name, Z16_FORMAT_AUTO, image, error));
+        CHECK(image.format == file.format);
+        if (file.format != Z16_FORMAT_BIN) {
+            CHECK(z16parseImage(file.contents->data(), file.contents->size(), "firmware", Z16_FORMAT_AUTO, image, error));
+            CHECK(image.format == file.format);
+        }
+        CHECK(z16parseImage(file.contents->data(), file.contents->size(), "firmware", file.format, image, error));
+        CHECK(image.format == file.format && !image.hasEntry);
+        CHECK(image.segments.size() == (file.contents == &images.hex || file.contents == &images.sparse ? 2u : 1u));
+
+        z16nullSink quiet;
+        z16sim sim;
+        sim.setSink(&quiet);
+        z16loadOptions options;
+        options.base = 0x0200;
+        CHECK(sim.loadImage(path.string().c_str(), options));
+        if (sim.memoryHash() != want.memoryHash() || sim.getPC() != 0x0200) {
+            std::printf("%s loads differently from the raw binary\n", file.name);
+            ++failures;
+        }
+
+        std::filesystem::path output = dir / "zx16_selftest_load.txt";
+        CHECK(runTool("zx16_simulator", "--quiet --base=0x200 \"" + path.string() + "\"", output) == 0);
+        std::string got = readFile(output);
+        got.erase(0, got.find('\n') + 1); // "Loaded N bytes from <file>"
+        if (wantOutput.empty()) {
+            wantOutput = got;
+            CHECK(got.find("x6: 0x000c\n") != std::string::npos && got.find("x7: 0xfffd\n") != std::string::npos);
+        } else if (got != wantOutput) {
+            std::printf("zx16_simulator --base runs %s differently from the raw binary\n", file.name);
+            ++failures;
+        }
+        std::filesystem::remove(output);
+    }
+
+    // The Intel HEX start address, relative to the base, and --entry over it
+    std::string started = images.hex;
+    started.insert(started.rfind(':'), hexRecord(0x05, 0, {0, 0, 0, 2}));
+    z16image image;
+    std::string error;
+    CHECK(z16parseImage(started.data(), started.size(), "start.hex", Z16_FORMAT_AUTO, image, error));
+    CHECK(image.hasEntry && image.entry == 2);
+    z16nullSink quiet;
+    z16sim sim;
+    sim.setSink(&quiet);
+    z16loadOptions options;
+    options.base = 0x0200;
+    CHECK(sim.loadImage(image, options) && sim.getPC() == 0x0202);
+    options.entry = 0x0204;
+    CHECK(sim.loadImage(image, options) && sim.getPC() == 0x0204);
+    CHECK(sim.run(100) == Z16_STATUS_HALT && sim.getReg(6) == 0 && sim.getReg(7) == 0xFFFD);
+
+    // The cache: a hit while the file is unchanged, a miss after it grows,
+    // after its time changes at the same size, and for another format
+    std::filesystem::path path = dir / "zx16_selftest_load.bin";
+    z16imageCache& cache = z16imageCache::shared();
+    cache.clear();
+    uint64_t misses = cache.getMisses(), hits = cache.getHits();
+    std::shared_ptr<const z16image> first = cache.get(path.string(), Z16_FORMAT_AUTO, error);
+    std::shared_ptr<const z16image> again = cache.get(path.string(), Z16_FORMAT_AUTO, error);
+    CHECK(first && first == again && cache.getMisses() == misses + 1 && cache.getHits() == hits + 1);
+    writeFile(path, images.bin + "\x01\x02");
+    std::shared_ptr<const z16image> grown = cache.get(path.string(), Z16_FORMAT_AUTO, error);
+    CHECK(grown && grown != first && grown->size() == images.bin.size() + 2 && cache.getMisses() == misses + 2);
+    writeFile(path, images.bin + "\x03\x04");
+    std::filesystem::last_write_time(path, std::filesystem::last_write_time(path) + std::chrono::seconds(2));
+    std::shared_ptr<const z16image> touched = cache.get(path.string(), Z16_FORMAT_AUTO, error);
+    CHECK(touched && touched != grown && touched->segments[0].bytes.back() == 0x04 && cache.getMisses() == misses + 3);
+    std::shared_ptr<const z16image> other = cache.get(path.string(), Z16_FORMAT_MEM, error);
+    CHECK(!other && cache.getMisses() == misses + 3); // Not text: parsed, rejected, not cached
+    CHECK(cache.get(path.string(), Z16_FORMAT_AUTO, error) == touched);
+    cache.clear();
+
+    for (const imageFile& file : files) {
+        std::filesystem::remove(dir / file.name);
+    }
+}
+
+// Malformed images are rejected with the file and line of the problem, and
+// images or bases that put data past the end of memory are refused
+static void testLoadErrors() {
+    struct badImage {
+        const char* name;
+        std::string contents;
+        const char* problem;
+    } bad[] = {
+        {"a.hex", ":0200000001020", "not an Intel HEX record"},
+        {"a.hex", hexRecord(0, 0, {1, 2}) + "0200000001020B\n", "not an Intel HEX record"},
+        {"a.hex", ":02000000010G0B\n", "bad hex digit"},
+        {"a.hex", ":04000000010203F6\n", "record length does not match"},
+        {"a.hex", ":0200000001020C\n", "checksum mismatch"},
+        {"a.hex", hexRecord(0x06, 0, {}), "unsupported record type"},
+        {"a.hex", hexRecord(0, 0xFFFF, {1, 2}), "beyond the 64 KB address space"},
+        {"a.hex", hexRecord(0x04, 0, {0, 1}) + hexRecord(0, 0, {1, 2}), "beyond the 64 KB address space"},
+        {"a.hex", hexRecord(0x05, 0, {0, 1, 0, 0}), "start address beyond"},
+        {"a.v", "16'h0000 data = 16'h1234;\n", "expected 16'hADDR:"},
+        {"a.v", "16'h10000: data = 16'h1234;\n", "expected 16'hADDR:"},
+        {"a.v", "16'h0000: data = 16'h12345;\n", "bad data word or odd address"},
+        {"a.v", "16'h0001: data = 16'h1234;\n", "bad data word or odd address"},
+        {"a.v", "16'h0000: data = x;\n", "expected a 16'h data word"},
+        {"a.mem", "1234\n@0003 5678\n", "bad @address"},
+        {"a.mem", "@10000 5678\n", "bad @address"},
+        {"a.mem", "@ 5678\n", "bad @address"},
+        {"a.mem", "12345\n", "expected a hex word"},
+        {"a.mem", "12G4\n", "expected a hex word"},
+        {"a.mem", "@FFFE 1234 5678\n", "beyond the 64 KB address space"},
+    };
+    for (const badImage& b : bad) {
+        z16image image;
+        std::string error;
+        if (z16parseImage(b.contents.data(), b.contents.size(), b.name, Z16_FORMAT_AUTO, image, error) ||
+            error.find(b.problem) == std::string::npos || error.rfind(std::string(b.name) + ":", 0) != 0) {
+            std::printf("%s \"%s\": expected \"%s\", got \"%s\"\n", b.name, b.contents.c_str(), b.problem, error.c_str());
+            ++failures;
+        }
+    }
+    z16image image;
+    std::string error;
+    std::string twoLines = "1234\n\n@0002 12 x\n";
+    CHECK(!z16parseImage(twoLines.data(), twoLines.size(), "b.mem", Z16_FORMAT_AUTO, image, error));
+    CHECK(error.rfind("b.mem:3: ", 0) == 0);
+
+    // An addressed image that does not fit at its base is refused without
+    // touching memory; a raw binary is cut off at the end of memory
+    std::string top = "@FFF0 1234\n";
+    CHECK(z16parseImage(top.data(), top.size(), "top.mem", Z16_FORMAT_AUTO, image, error));
+    z16nullSink quiet;
+    z16sim sim;
+    sim.setSink(&quiet);
+    z16loadOptions options;
+    options.base = 0x000E;
+    CHECK(sim.loadImage(image, options));
+    options.base = 0x0010;
+    CHECK(!sim.loadImage(image, options));
+    CHECK(sim.getMemory()[0x0000] == 0 && sim.getMemory()[0xFFFE] == 0x34);
+    std::string raw = "\x11\x22\x33\x44";
+    CHECK(z16parseImage(raw.data(), raw.size(), "raw.bin", Z16_FORMAT_AUTO, image, error));
+    options.base = 0xFFFE;
+    CHECK(sim.loadImage(image, options) && sim.getMemory()[0xFFFF] == 0x22 && sim.getMemory()[0x0000] == 0);
+
+    // Bases and entries the command line cannot represent
+    loaderImages images;
+    std::filesystem::path dir = std::filesystem::temp_directory_path();
+    std::filesystem::path path = dir / "zx16_selftest_load.bin";
+    std::filesystem::path output = dir / "zx16_selftest_load.txt";
+    writeFile(path, images.bin);
+    for (const char* arg : {"--base=0x10000", "--base=-1", "--base=", "--base=0x20q", "--entry=65536"}) {
+        if (runTool("zx16_simulator", std::string("--quiet ") + arg + " \"" + path.string() + "\"", output) == 0) {
+            std::printf("zx16_simulator accepted %s\n", arg);
+            ++failures;
+        }
+    }
+    CHECK(runTool("zx16_simulator", "--quiet --base=0xFFFF \"" + path.string() + "\"", output) == 0);
+    std::filesystem::remove(path);
+    std::filesystem::remove(output);
+}
+
+struct testCase {
+    const char* name;
+    void (*run)();
+};
+
+static const testCase cases[] = {
+    {"jit-buffer", testJitBuffer},
+    {"profile", testProfile},
+    {"irq", testInterrupts},
+    {"gdb", testGdb},
+    {"reverse", testReverse},
+    {"trace-file", testTraceFile},
+    {"timing", testTiming},
+    {"idle", testIdle},
+    {"aot", testAot},
+    {"ecall-putc", testPutChar},
+    {"ecall-getc", testGetChar},
+    {"ecall-puts", testPutString},
+    {"ecall-putint", testPutInt},
+    {"ecall-regs", testDumpRegisters},
+    {"bus", testBus},
+    {"gfx", testGfx},
+    {"load", testLoad},
+    {"load-errors", testLoadErrors},
+};
+
+int main(int argc, char* argv[]) {
+    std::string name = argc > 1 ? argv[1] : "";
+    toolDir = std::filesystem::path(argv[0]).parent_path();
+    bool found = false;
+    for (const testCase& c : cases) {
+        if (name == "all" || name == c.name) {
+            found = true;
+            int before = failures;
+            c.run();
+            std::printf("%s: %s\n", c.name, failures == before ? "ok" : "FAILED");
+        }
+    }
+    if (!found) {
+        std::cerr << "Usage: " << argv[0] << " all | <case>" << std::endl;
+        std::cerr << "Cases:";
+        for (const testCase& c : cases) {
+            std::cerr << " " << c.name;
+        }
+        std::cerr << std::endl;
+        return 1;
+    }
+    return failures ? 1 : 0;
+}
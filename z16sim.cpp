@@ -1,13 +1,11 @@
 #include "z16sim.h"
+#include "z16exec.h"
 #include <iostream>
-#include <iomanip>
-#include <fstream>
 #include <cstring>
 #include <string>
 #include <cstdio>
-#include <sstream>
 #include <algorithm>
-#include <cctype>
+#include <charconv>
 
 const char* z16sim::regNames[z16sim::NUM_REGS] = {"x0", "x1", "x2", "x3", "x4", "x5", "x6", "x7"};
 
@@ -17,6 +15,33 @@ z16sim::z16sim() {
     std::memset(this->regs, 0, sizeof(this->regs));
     this->pc = 0x0000;
     this->debug = false;
+    this->retired = 0;
+    this->engine = Z16_ENGINE_INTERP;
+    this->jitCodeSize = z16jit::CODE_SIZE;
+    std::memset(this->codePages, 0, sizeof(this->codePages));
+    this->codeInvalidated = false;
+    this->sink = &z16sink::standard();
+    this->profiler = nullptr;
+    this->timing = nullptr;
+    this->recorder = nullptr;
+    this->traceWriter = nullptr;
+    this->in = &std::cin;
+    this->conInPos = 0;
+    this->conInLen = 0;
+    std::memset(this->dirtyPages, 0, sizeof(this->dirtyPages));
+    this->dirtyBase = 0;
+    this->nextEvent = UINT64_MAX;
+    this->irqPending = 0;
+    this->irqMask = 0;
+    this->irqEnabled = false;
+    this->epc = 0;
+    std::memset(this->breakBits, 0, sizeof(this->breakBits));
+    std::memset(this->watchBits, 0, sizeof(this->watchBits));
+    this->breakpointCount = 0;
+    this->watchpointCount = 0;
+    this->stopRequested = false;
+    this->stopReason = {Z16_STOP_NONE, 0};
+    z16sim::mapRAM(0, z16sim::MEM_SIZE);
     initializeRegisterMap();
 }
 
@@ -39,365 +64,363 @@ void z16sim::initializeRegisterMap() {
 
 // dumpRegisters method definition
 void z16sim::dumpRegisters() const {
+    char buf[z16sim::NUM_REGS * 16];
+    int len = 0;
     for (int i = 0; i < z16sim::NUM_REGS; ++i) {
-        std::cout << regNames[i] << ": 0x"
-                  << std::hex << std::setw(4) << std::setfill('0')
-                  << regs[i] << std::endl;
+        len += std::snprintf(buf + len, sizeof(buf) - len, "%s: 0x%04x\n", regNames[i], this->regs[i]);
     }
+    this->sink->write(Z16_CHAN_STATUS, buf, len);
 }
 
-// loadMemoryFromFile method definition
-void z16sim::loadMemoryFromFile(const char* filename) {
-    std::ifstream file(filename, std::ios::binary | std::ios::ate);
-    if (!file.is_open()) {
-        std::cerr << "Error: Could not open file " << filename << std::endl;
-        exit(1); // Exit if file cannot be opened
-    }
-
-    std::streamsize size = file.tellg();
-    file.seekg(0, std::ios::beg);
+// setSink method definition
+void z16sim::setSink(z16sink* new_sink) {
+    z16sim::flushConsole();
+    this->sink = new_sink ? new_sink : &z16sink::standard();
+}
 
-    if (size > z16sim::MEM_SIZE) {
-        std::cerr << "Warning: File size (" << size << " bytes) exceeds memory size (" << z16sim::MEM_SIZE << " bytes). Only loading " << z16sim::MEM_SIZE << " bytes." << std::endl;
-        size = z16sim::MEM_SIZE;
-    }
+// setOutput method definition
+void z16sim::setOutput(std::ostream& new_out, std::ostream& new_err) {
+    std::unique_ptr<z16sink> stream(new z16streamSink(new_out, new_err));
+    z16sim::setSink(stream.get());
+    this->ownedSink = std::move(stream);
+}
 
-    file.read(reinterpret_cast<char*>(this->memory), size);
-    if (!file && file.gcount() != size) { // Check for read errors or incomplete read
-        std::cerr << "Error: Failed to read " << size << " bytes from " << filename << " completely. Read " << file.gcount() << " bytes." << std::endl;
-        exit(1);
-    }
-    std::cout << "Loaded " << file.gcount() << " bytes from " << filename << " into memory." << std::endl;
-    this->pc = 0; // Initialize PC to 0 after loading the program
+// loadMemoryFromFile method definition: any zx16asm output format at
+// address 0 (see z16load.cpp)
+bool z16sim::loadMemoryFromFile(const char* filename) {
+    return z16sim::loadImage(filename, z16loadOptions());
 }
 
 // cycle method definition
 bool z16sim::cycle() {
-    // Check for PC out of bounds before fetching instruction
-    if (this->pc >= z16sim::MEM_SIZE - 1) { // -1 because 16-bit instructions need 2 bytes
-        std::cerr << "Error: Program Counter out of bounds (0x" << std::hex << this->pc << ") at end of memory." << std::endl;
-        return false; // Stop simulation
+    if (this->retired >= this->nextEvent) {
+        z16sim::serviceEvents(); // A watchpoint stop is moot when stepping anyway
     }
+    if (this->traceWriter) {
+        this->traceWriter->sync(this->retired, this->regs);
+    }
+    bool running;
+    if (this->recorder) {
+        if (this->recorder->end != this->retired) {
+            z16sim::restartRecording();
+        }
+        running = z16sim::step<true, false, true>() == 0;
+    } else {
+        running = z16sim::step<true>() == 0;
+    }
+    z16sim::flushConsole();
+    return running;
+}
 
-    uint16_t instruction = (this->memory[this->pc + 1] << 8) | this->memory[this->pc];
-
-    char disasm_buf[256];
-
-    z16sim::disassemble(instruction, this->pc, disasm_buf, sizeof(disasm_buf));
-
-    std::cout << "PC: 0x" << std::hex << std::setw(4) << std::setfill('0') << this->pc
-              << " | Inst: 0x" << std::setw(4) << std::setfill('0') << instruction
-              << " | " << disasm_buf << std::endl;
-
-    // Execute the instruction and check its return status
-    int status = z16sim::executeInstruction(instruction);
-
-    if (status == 0) {
-        return true; // Continue simulation
+// recordUndo method definition: logs what the instruction at pc is about to
+// overwrite. Stores to device pages overwrite nothing in memory; stores to
+// ROM and misaligned words fault and are dropped from the log again.
+inline void z16sim::recordUndo(uint16_t inst) {
+    z16recorder& rec = *this->recorder;
+    if (this->retired >= rec.nextCheckpoint) {
+        z16sim::takeCheckpoint();
+    }
+    const z16decoded& d = z16decodeTable[inst];
+    z16recorder::entry& e = rec.ring[rec.end & rec.mask];
+    e.pc = this->pc;
+    switch (d.op) {
+        case Z16_SB:
+        case Z16_SW: {
+            uint16_t mem_addr = this->regs[d.rd] + d.imm;
+            if (this->pageKinds[mem_addr >> z16blockCache::PAGE_SHIFT] != Z16_PAGE_RAM) {
+                e.kind = z16recorder::UNDO_NONE;
+            } else if (d.op == Z16_SB) {
+                e.kind = z16recorder::UNDO_BYTE;
+                e.addr = mem_addr;
+                e.old = this->memory[mem_addr];
+            } else {
+                e.kind = z16recorder::UNDO_WORD;
+                e.addr = mem_addr;
+                e.old = (mem_addr & 1) ? 0 : (this->memory[mem_addr + 1] << 8) | this->memory[mem_addr];
+            }
+            break;
+        }
+        case Z16_JR:
+        case Z16_BEQ: case Z16_BNE: case Z16_BZ: case Z16_BNZ:
+        case Z16_BLT: case Z16_BGE: case Z16_BLTU: case Z16_BGEU:
+        case Z16_J:
+        case Z16_TRAP:
+            e.kind = z16recorder::UNDO_NONE;
+            break;
+        case Z16_ECALL: // Services only write a0
+            e.kind = z16recorder::UNDO_REG;
+            e.reg = z16sim::A0_REG;
+            e.old = this->regs[z16sim::A0_REG];
+            break;
+        default: // Everything else writes rd
+            e.kind = z16recorder::UNDO_REG;
+            e.reg = d.rd;
+            e.old = this->regs[d.rd];
+            break;
     }
-    else {
-        return false; // Stop simulation
+    if (++rec.end - rec.first > rec.ring.size()) {
+        ++rec.first;
     }
 }
 
-// executeInstruction method definition
-int z16sim::executeInstruction(uint16_t inst) {
-    uint8_t opcode = inst & 0x7; // Opcode is bits [2:0]
-    uint8_t rs1_rd = (inst >> 6) & 0x7; // For R-type: RD, for B/S/L-type: RS1/RD
-    uint8_t rs2 = (inst >> 9) & 0x7; // For R-type: RS2, for B/S/L-type: RS2/Base
-    uint8_t funct3 = (inst >> 3) & 0x7;
+// step method definition
+template <bool Trace, bool Profile, bool Record>
+int z16sim::step() {
+    // Check for PC out of bounds before fetching instruction
+    if (this->pc >= z16sim::MEM_SIZE - 1) { // -1 because 16-bit instructions need 2 bytes
+        z16sim::flushConsole();
+        this->sink->print(Z16_CHAN_ERROR, "Error: Program Counter out of bounds (0x%x) at end of memory.\n", this->pc);
+        this->fault = {Z16_STATUS_PC_FAULT, this->pc, 0, 0};
+        return Z16_STATUS_PC_FAULT;
+    }
 
-    int16_t imm; // Signed immediate for I, S, L, J, U types
+    uint16_t instruction = (this->memory[this->pc + 1] << 8) | this->memory[this->pc];
 
-    switch(opcode) {
-        case 0x0: { // R-type (add, sub, slt, sll, etc.)
-            uint8_t funct4 = (inst >> 12) & 0xF;
-            // For R-type, rs1_rd is RD (destination), rs2 is RS2
-            uint16_t val1 = this->regs[rs1_rd]; // Value of RS1 (source for most R-types)
-            uint16_t val2 = this->regs[rs2];    // Value of RS2
-
-            if (funct4 == 0x0 && funct3 == 0x0) { // add
-                this->regs[rs1_rd] = val1 + val2;
-                this->pc += 2; // Advance PC for sequential instruction
-            }
-            else if (funct4 == 0x1 && funct3 == 0x0) { // sub
-                this->regs[rs1_rd] = val1 - val2;
-                this->pc += 2;
-            }
-            else if (funct4 == 0x2 && funct3 == 0x1) { // slt (set less than signed)
-                this->regs[rs1_rd] = ((int16_t)val1 < (int16_t)val2) ? 1 : 0;
-                this->pc += 2;
-            }
-            else if (funct4 == 0x3 && funct3 == 0x2) { // sltu (set less than unsigned)
-                this->regs[rs1_rd] = (val1 < val2) ? 1 : 0;
-                this->pc += 2;
-            }
-            else if (funct4 == 0x4 && funct3 == 0x3) { // sll (shift left logical)
-                this->regs[rs1_rd] = val1 << (val2 & 0xF); // Only use lower 4 bits for shift amount
-                this->pc += 2;
-            }
-            else if (funct4 == 0x5 && funct3 == 0x3) { // srl (shift right logical)
-                this->regs[rs1_rd] = val1 >> (val2 & 0xF);
-                this->pc += 2;
-            }
-            else if (funct4 == 0x6 && funct3 == 0x3) { // sra (shift right arithmetic)
-                this->regs[rs1_rd] = (int16_t)val1 >> (val2 & 0xF);
-                this->pc += 2;
-            }
-            else if (funct4 == 0x7 && funct3 == 0x4) { // or
-                this->regs[rs1_rd] = val1 | val2;
-                this->pc += 2;
+    if constexpr (Trace) {
+        if (!this->traceWriter) {
+            if (!this->conOut.empty()) {
+                z16sim::writeConsole(); // Keep program output in order with the trace
             }
-            else if (funct4 == 0x8 && funct3 == 0x5) { // and
-                this->regs[rs1_rd] = val1 & val2;
-                this->pc += 2;
+            if (!this->tracer) {
+                this->tracer.reset(new z16traceFormatter());
             }
-            else if (funct4 == 0x9 && funct3 == 0x6) { // xor
-                this->regs[rs1_rd] = val1 ^ val2;
-                this->pc += 2;
+            this->tracer->append(this->pc, instruction);
+            if (this->tracer->full()) {
+                z16sim::flushTrace();
             }
-            else if (funct4 == 0xA && funct3 == 0x7) { // mv (move)
-                this->regs[rs1_rd] = this->regs[rs2]; // rs1_rd is RD, rs2 is RS
-                this->pc += 2;
-            }
-            else if (funct4 == 0xB && funct3 == 0x0) { // jr (jump register)
-                this->pc = this->regs[rs1_rd]; // Jump to address in rs1_rd
-                return 0;
-            }
-            else if (funct4 == 0xC && funct3 == 0x0) { // jalr (jump and link register)
-                // this->regs[z16sim::RA_REG] = this->pc + 2; // Store return address
-                // this->pc = this->regs[rs1_rd]; // Jump to address in rs1_rd
-                uint8_t rd = rs1_rd;
-                uint8_t rs2 = (inst >> 9) & 0x7;
-                this->regs[rd] = this->pc + 2;
-                this->pc = this->regs[rs2];
-                return 0;
-            }
-            else {
-                std::cerr << "Unknown R-type instruction: 0x" << std::hex << inst << " at PC: 0x" << this->pc << std::endl;
-                return 2; // Unknown instruction error
-            }
-            break;
         }
+    }
 
-        case 0x1: { // I-type (addi, slti, etc.)
-            imm = (inst >> 9) & 0x7F; // 7-bit immediate
-            if (imm & 0x40) imm |= 0xFF80; // Sign-extend
-
-            uint16_t val1 = this->regs[rs1_rd]; // For I-type, rs1_rd is RS1 or RD
-
-            if (funct3 == 0x0) { // addi
-                this->regs[rs1_rd] = val1 + imm;
-                this->pc += 2;
-            } else if (funct3 == 0x1) { // slti (set less than immediate signed)
-                this->regs[rs1_rd] = ((int16_t)val1 < imm) ? 1 : 0;
-                this->pc += 2;
-            } else if (funct3 == 0x2) { // sltui (set less than immediate unsigned)
-                this->regs[rs1_rd] = (val1 < (uint16_t)imm) ? 1 : 0;
-                this->pc += 2;
-            } else if (funct3 == 0x3) { // Shift immediates
-                uint8_t shift_type = (imm >> 4) & 0x7;
-                uint8_t shamt = imm & 0xF;
-                if (shift_type == 0x1) { // slli
-                    this->regs[rs1_rd] = val1 << shamt;
-                    this->pc += 2;
-                } else if (shift_type == 0x2) { // srli
-                    this->regs[rs1_rd] = val1 >> shamt;
-                    this->pc += 2;
-                } else if (shift_type == 0x4) { // srai
-                    this->regs[rs1_rd] = (int16_t)val1 >> shamt;
-                    this->pc += 2;
-                } else {
-                     std::cerr << "Unknown I-type shift instruction: 0x" << std::hex << inst << " at PC: 0x" << this->pc << std::endl;
-                     return 2;
-                }
-            } else if (funct3 == 0x4) { // ori
-                this->regs[rs1_rd] = val1 | imm;
-                this->pc += 2;
-            } else if (funct3 == 0x5) { // andi
-                this->regs[rs1_rd] = val1 & imm;
-                this->pc += 2;
-            } else if (funct3 == 0x6) { // xori
-                this->regs[rs1_rd] = val1 ^ imm;
-                this->pc += 2;
-            } else if (funct3 == 0x7) { // li (load immediate)
-                this->regs[rs1_rd] = imm;
-                this->pc += 2;
-            } else {
-                std::cerr << "Unknown I-type instruction: 0x" << std::hex << inst << " at PC: 0x" << this->pc << std::endl;
-                return 2;
-            }
-            break;
+    // Execute the instruction; an ecall halt (1) still retires, errors do not
+    uint16_t inst_pc = this->pc;
+    uint16_t mem_addr = 0;
+    if constexpr (Profile) {
+        if (this->timing) {
+            mem_addr = z16timing::dataAddress(instruction, this->regs);
         }
-
-        case 0x2: { // B-type (branch)
-            uint8_t imm_high = (inst >> 12) & 0xF; // imm[4:1]
-            // rs1_rd is RS1, rs2 is RS2
-            int16_t offset = (imm_high << 1); // Reconstruct 5-bit signed offset
-            if (offset & 0x10) offset |= 0xFFE0; // Sign extend
-
-            // uint16_t target_addr = this->pc + offset;
-            uint16_t target_addr = this->pc + 2 + (offset * 2);
-
-            bool branch_taken = false;
-            if (funct3 == 0x0) { // beq
-                if (this->regs[rs1_rd] == this->regs[rs2]) branch_taken = true;
-            } else if (funct3 == 0x1) { // bne
-                if (this->regs[rs1_rd] != this->regs[rs2]) branch_taken = true;
-            } else if (funct3 == 0x2) { // bz (branch if zero) - rs2 is ignored
-                if (this->regs[rs1_rd] == 0) branch_taken = true;
-            } else if (funct3 == 0x3) { // bnz (branch if not zero) - rs2 is ignored
-                if (this->regs[rs1_rd] != 0) branch_taken = true;
-            } else if (funct3 == 0x4) { // blt (signed)
-                if ((int16_t)this->regs[rs1_rd] < (int16_t)this->regs[rs2]) branch_taken = true;
-            } else if (funct3 == 0x5) { // bge (signed)
-                if ((int16_t)this->regs[rs1_rd] >= (int16_t)this->regs[rs2]) branch_taken = true;
-            } else if (funct3 == 0x6) { // bltu (unsigned)
-                if (this->regs[rs1_rd] < this->regs[rs2]) branch_taken = true;
-            } else if (funct3 == 0x7) { // bgeu (unsigned)
-                if (this->regs[rs1_rd] >= this->regs[rs2]) branch_taken = true;
-
-            } else {
-                std::cerr << "Unknown B-type instruction: 0x" << std::hex << inst << " at PC: 0x" << this->pc << std::endl;
-                return 2;
-            }
-
-            if (branch_taken) {
-                if (!updatePC(target_addr, "Branch")) return 3; // Indicate error if PC update fails
-            } else {
-                this->pc += 2; // No branch, move to next instruction
+    }
+    if constexpr (Record) {
+        z16sim::recordUndo(instruction);
+    }
+    int status = z16sim::executeInstruction(instruction);
+    if (status <= 1) {
+        ++this->retired;
+        if constexpr (Trace) {
+            if (this->traceWriter) {
+                this->traceWriter->record(inst_pc, instruction, this->pc, this->regs);
             }
-            break;
         }
-
-        case 0x3: { // S-type (store)
-            uint8_t imm4 = (inst >> 12) & 0xF;
-            imm = (imm4 & 0x8) ? (imm4 | 0xFFF0) : imm4; // Sign extend 4-bit immediate
-            uint16_t base_addr = this->regs[rs1_rd]; // Base register
-            uint16_t data_val = this->regs[rs2];     // Data to store
-            uint16_t mem_addr = base_addr + imm;
-
-            if (mem_addr >= z16sim::MEM_SIZE) {
-                std::cerr << "Memory access out of bounds for store at 0x" << std::hex << mem_addr << " at PC: 0x" << this->pc << std::endl;
-                return 4; // Memory access error
+        if constexpr (Profile) {
+            if (this->profiler) {
+                this->profiler->record(inst_pc, instruction, this->pc);
             }
-
-            if (funct3 == 0x0) { // sb (store byte)
-                this->memory[mem_addr] = (unsigned char)(data_val & 0xFF);
-            } else if (funct3 == 0x1) { // sw (store word)
-                if (mem_addr + 1 >= z16sim::MEM_SIZE) { // Check bounds for second byte
-                     std::cerr << "Memory access out of bounds for word store at 0x" << std::hex << mem_addr << " at PC: 0x" << this->pc << std::endl;
-                     return 4;
-                }
-                this->memory[mem_addr] = (unsigned char)(data_val & 0xFF);
-                this->memory[mem_addr + 1] = (unsigned char)((data_val >> 8) & 0xFF);
-            } else {
-                std::cerr << "Unknown S-type instruction: 0x" << std::hex << inst << " at PC: 0x" << this->pc << std::endl;
-                return 2;
+            if (this->timing) {
+                this->timing->record(inst_pc, instruction, this->pc, mem_addr);
             }
-            this->pc += 2;
-            break;
         }
+    } else if constexpr (Record) {
+        --this->recorder->end;
+    }
+    return status;
+}
 
-        case 0x4: { // L-type (load)
-            uint8_t imm4 = (inst >> 12) & 0xF;
-            imm = (imm4 & 0x8) ? (imm4 | 0xFFF0) : imm4; // Sign extend 4-bit immediate
-            uint16_t base_addr = this->regs[rs2]; // Base register
-            uint16_t dest_reg = rs1_rd;           // Destination register
-            uint16_t mem_addr = base_addr + imm;
-
-            if (mem_addr >= z16sim::MEM_SIZE) {
-                std::cerr << "Memory access out of bounds for load at 0x" << std::hex << mem_addr << " at PC: 0x" << this->pc << std::endl;
-                return 4; // Memory access error
+template int z16sim::step<true>();
+template int z16sim::step<false>();
+template int z16sim::step<true, false, true>();
+
+// runLoop method definition
+template <bool Trace, bool Profile, bool Break, bool Record>
+int z16sim::runLoop(uint64_t max_instructions, int32_t stop_pc) {
+    uint16_t start_pc = this->pc;
+    for (uint64_t n = 0; n < max_instructions; ++n) {
+        if (this->retired >= this->nextEvent) {
+            int status = z16sim::serviceEvents();
+            if (status != 0) {
+                return status;
             }
-
-            if (funct3 == 0x0) { // lb (load byte signed)
-                this->regs[dest_reg] = (int8_t)this->memory[mem_addr]; // Sign-extend byte to 16-bit
-            } else if (funct3 == 0x1) { // lw (load word)
-                 if (mem_addr + 1 >= z16sim::MEM_SIZE) {
-                     std::cerr << "Memory access out of bounds for word load at 0x" << std::hex << mem_addr << " at PC: 0x" << this->pc << std::endl;
-                     return 4;
-                }
-                this->regs[dest_reg] = (this->memory[mem_addr + 1] << 8) | this->memory[mem_addr];
-            } else if (funct3 == 0x4) { // lbu (load byte unsigned)
-                this->regs[dest_reg] = this->memory[mem_addr]; // Zero-extend byte to 16-bit
-            } else {
-                std::cerr << "Unknown L-type instruction: 0x" << std::hex << inst << " at PC: 0x" << this->pc << std::endl;
-                return 2;
+        }
+        if (this->pc == stop_pc) {
+            return 0;
+        }
+        if constexpr (Break) {
+            if (z16sim::isBreakpoint(this->pc) && (n != 0 || this->pc != start_pc)) {
+                this->stopReason = {Z16_STOP_BREAKPOINT, this->pc};
+                return 5;
             }
-            this->pc += 2;
-            break;
         }
+        int status = z16sim::step<Trace, Profile, Record>();
+        if (status != 0) {
+            return status;
+        }
+    }
+    return this->stopRequested ? z16sim::serviceEvents() : 0; // A watchpoint on the last instruction
+}
 
-        case 0x5: { // J-type (j, jal)
-            uint8_t f = (inst >> 15) & 0x1;
-            uint8_t imm9to4 = (inst >> 9) & 0x3F;
-            uint8_t imm3to1 = (inst >> 3) & 0x7;
-            uint8_t rd = (inst >> 6) & 0x7;
-
-            // imm = (imm9to4 << 4) | (imm3to1 << 1); // Reconstruct 9-bit immediate (multiplied by 2)
-            // if (imm & 0x200) { // Check if bit 9 (sign bit) is set
-            //      imm |= 0xFC00; // Sign extend to 16-bit
-            // }
-            //
-            // uint16_t target_addr = this->pc + imm;
+// dispatch method definition: the loop for run() and run_until(). Only the
+// block engine runs quiet, unprofiled, untimed, unrecorded programs; the interpreter
+// loop is instantiated per combination so each only tests what it needs.
+int z16sim::dispatch(uint64_t max_instructions, int32_t stop_pc, bool trace) {
+    if (trace && this->traceWriter) {
+        this->traceWriter->sync(this->retired, this->regs);
+    }
+    if (this->recorder) {
+        if (this->recorder->end != this->retired) {
+            z16sim::restartRecording();
+        }
+        switch ((trace ? 1 : 0) | (this->profiler || this->timing ? 2 : 0)) {
+            case 0:  return z16sim::runLoop<false, false, true, true>(max_instructions, stop_pc);
+            case 1:  return z16sim::runLoop<true, false, true, true>(max_instructions, stop_pc);
+            case 2:  return z16sim::runLoop<false, true, true, true>(max_instructions, stop_pc);
+            default: return z16sim::runLoop<true, true, true, true>(max_instructions, stop_pc);
+        }
+    }
+    if (!trace && !this->profiler && !this->timing && this->engine != Z16_ENGINE_INTERP) {
+        return z16sim::runBlocks(max_instructions, stop_pc);
+    }
+    switch ((trace ? 1 : 0) | (this->profiler || this->timing ? 2 : 0) | (this->breakpointCount ? 4 : 0)) {
+        case 0:  return z16sim::runLoop<false>(max_instructions, stop_pc);
+        case 1:  return z16sim::runLoop<true>(max_instructions, stop_pc);
+        case 2:  return z16sim::runLoop<false, true>(max_instructions, stop_pc);
+        case 3:  return z16sim::runLoop<true, true>(max_instructions, stop_pc);
+        case 4:  return z16sim::runLoop<false, false, true>(max_instructions, stop_pc);
+        case 5:  return z16sim::runLoop<true, false, true>(max_instructions, stop_pc);
+        case 6:  return z16sim::runLoop<false, true, true>(max_instructions, stop_pc);
+        default: return z16sim::runLoop<true, true, true>(max_instructions, stop_pc);
+    }
+}
 
-            imm = ((imm9to4 << 4) | (imm3to1 << 1)); // imm[9:1] << 1, imm[0] is zero
-            if (imm & 0x200) imm |= 0xFC00;
+// run method definition
+int z16sim::run(uint64_t max_instructions, bool trace) {
+    int status = z16sim::dispatch(max_instructions, -1, trace);
+    z16sim::flushTrace();
+    return status;
+}
 
-            int16_t signed_offset = (int16_t)imm;
-            uint16_t target_addr = this->pc + signed_offset;
+// run_until method definition
+int z16sim::run_until(uint16_t target_pc, uint64_t max_instructions, bool trace) {
+    int status = z16sim::dispatch(max_instructions, target_pc, trace);
+    z16sim::flushTrace();
+    return status;
+}
 
+// executeInstruction method definition
+// Dispatch is a single decode-table load followed by the jump table in execute().
+int z16sim::executeInstruction(uint16_t inst) {
+    return z16sim::execute(z16decodeTable[inst], inst);
+}
 
-            if (f == 0) { // j (jump)
-                if (!updatePC(target_addr, "Jump")) return 3;
-            } else if (f == 1) { // jal (jump and link)
-                this->regs[rd] = this->pc + 2;
-                if (!updatePC(target_addr, "JumpAndLink")) return 3;
-            } else {
-                std::cerr << "Unknown J-type instruction: 0x" << std::hex << inst << " at PC: 0x" << this->pc << std::endl;
-                return 2;
-            }
+// ecall method definition: services take their argument in a0 and return
+// 0; exit (0x3FF) and unknown services halt with 1
+int z16sim::ecall(uint16_t svc) {
+    uint16_t& a0 = this->regs[z16sim::A0_REG];
+    switch (svc) {
+        case 0x000: // Print character
+            this->conOut += (char)(a0 & 0xFF);
+            break;
+        case 0x001: { // Read character (0xFFFF at end of input)
+            int c = z16sim::readConsole();
+            a0 = c < 0 ? 0xFFFF : (uint16_t)c;
             break;
         }
-
-        case 0x6: { // U-Type (lui, auipc)
-            uint8_t f = (inst >> 15) & 0x1;
-            uint16_t U_imm = ((inst >> 3) & 0x7) | ((inst >> 6) & 0x1F8);
-
-            if (f == 0) { // lui (load upper immediate)
-                this->regs[rs1_rd] = U_imm << 8; // rs1_rd is RD
-                this->pc += 2;
-            } else if (f == 1) { // auipc (add upper immediate to PC)
-                this->regs[rs1_rd] = this->pc + (U_imm << 8); // rs1_rd is RD
-                this->pc += 2;
-            } else {
-                std::cerr << "Unknown U-type instruction: 0x" << std::hex << inst << " at PC: 0x" << this->pc << std::endl;
-                return 2;
-            }
+        case 0x002: { // Print the NUL-terminated string at a0
+            const unsigned char* start = this->memory + a0;
+            const void* end = std::memchr(start, 0, z16sim::MEM_SIZE - a0);
+            this->conOut.append((const char*)start, end ? (const unsigned char*)end - start : z16sim::MEM_SIZE - a0);
             break;
         }
-
-        case 0x7: { // SYS-Type (ecall)
-            uint16_t svc = (inst >> 6) & 0x3FF; // 10-bit system-call number
-            uint8_t func3 = (inst >> 3) & 0x7;
-
-            if (func3 == 0x0) { // ecall
-                std::cout << "ECALL (Service: 0x" << std::hex << svc << ") encountered. Terminating simulation." << std::endl;
-                return 1; // Indicate halt/termination
-            } else {
-                std::cerr << "Unknown SYS-type instruction: 0x" << std::hex << inst << " at PC: 0x" << this->pc << std::endl;
-                return 2;
-            }
+        case 0x003: { // Print a0 as a signed decimal
+            char buf[8];
+            char* end = std::to_chars(buf, buf + sizeof(buf), (int16_t)a0).ptr;
+            this->conOut.append(buf, end - buf);
             break;
         }
+        case 0x3FC: // Dump registers
+            z16sim::flushConsole();
+            z16sim::dumpRegisters();
+            break;
+        case 0x3FD: // Return from interrupt
+            this->pc = this->epc - 2; // execute() steps past the ecall
+            z16sim::setInterruptsEnabled(true);
+            break;
+        default: // 0x3FF (exit) and services neither the simulator nor a device provides
+            if (svc != 0x3FF && z16sim::deviceService(svc)) {
+                break;
+            }
+            z16sim::flushConsole();
+            this->sink->print(Z16_CHAN_STATUS, "ECALL (Service: 0x%x) encountered. Terminating simulation.\n", svc);
+            this->fault = {Z16_STATUS_HALT, this->pc, z16sim::fetch(this->pc), svc, a0};
+            return Z16_STATUS_HALT;
+    }
+    if (this->conOut.size() >= z16sim::CONSOLE_BUFFER) {
+        z16sim::writeConsole();
+    }
+    return 0;
+}
 
-        default: {
-            std::cerr << "Unknown opcode: 0x" << std::hex << opcode << " at PC: 0x" << this->pc << std::endl;
-            return 2; // Unknown instruction error
+// deviceService method definition
+bool z16sim::deviceService(uint16_t svc) {
+    for (z16device* device : this->serviceDevices) {
+        if (device->service(*this, svc)) {
+            return true;
         }
     }
-    return 0;
+    return false;
+}
+
+// writeConsole method definition
+void z16sim::writeConsole() {
+    z16sim::flushTrace();
+    if (!this->conOut.empty()) {
+        this->sink->write(Z16_CHAN_CONSOLE, this->conOut.data(), this->conOut.size());
+        this->conOut.clear();
+    }
+}
+
+// flushTrace method definition
+void z16sim::flushTrace() {
+    if (this->tracer && this->tracer->size()) {
+        this->sink->write(Z16_CHAN_TRACE, this->tracer->data(), this->tracer->size());
+        this->tracer->clear();
+    }
+}
+
+// readConsole method definition
+// When the read-ahead is used up, blocks for one byte and then takes whatever
+// else the stream already has buffered, so piped input is consumed in large
+// reads.
+int z16sim::readConsole() {
+    if (this->conInPos == this->conInLen) {
+        z16sim::flushConsole(); // Show any prompt before blocking
+        int c = this->in->get();
+        if (c == std::char_traits<char>::eof()) {
+            return -1;
+        }
+        this->conIn.resize(z16sim::CONSOLE_BUFFER);
+        this->conIn[0] = (char)c;
+        this->conInPos = 0;
+        this->conInLen = 1 + this->in->readsome(this->conIn.data() + 1, z16sim::CONSOLE_BUFFER - 1);
+    }
+    return (unsigned char)this->conIn[this->conInPos++];
+}
+
+// trap method definition: shared handler for every invalid encoding
+int z16sim::trap(uint16_t inst) {
+    z16sim::flushConsole();
+    static const char* formats[8] = {"R", "I", "B", "S", "L", "J", "U", "SYS"};
+    uint8_t opcode = inst & 0x7;
+    bool shift = opcode == 0x1 && ((inst >> 3) & 0x7) == 0x3;
+    this->sink->print(Z16_CHAN_ERROR, "Unknown %s-type %sinstruction: 0x%x at PC: 0x%x\n", formats[opcode], shift ? "shift " : "",
+                      inst, this->pc);
+    this->fault = {Z16_STATUS_UNKNOWN_INSTRUCTION, this->pc, inst, 0};
+    return Z16_STATUS_UNKNOWN_INSTRUCTION;
+}
+
+// memoryFault method definition
+int z16sim::memoryFault(const char* problem, const char* access, uint16_t mem_addr) {
+    z16sim::flushConsole();
+    this->sink->print(Z16_CHAN_ERROR, "Memory access %s for %s at 0x%x at PC: 0x%x\n", problem, access, mem_addr, this->pc);
+    this->fault = {Z16_STATUS_MEMORY_FAULT, this->pc, z16sim::fetch(this->pc), mem_addr};
+    return Z16_STATUS_MEMORY_FAULT;
 }
 
 // reset method definition
@@ -406,18 +429,18 @@ void z16sim::reset() {
     std::memset(this->regs, 0, sizeof(this->regs));
     this->pc = 0;
     this->debug = false;
-    std::cout << "Simulator reset." << std::endl;
-}
-
-// updatePC method definition
-bool z16sim::updatePC(uint16_t new_pc, const char* instruction_name) {
-    if (new_pc >= z16sim::MEM_SIZE) {
-        std::cerr << "Error: " << instruction_name << " tried to set PC out of bounds to 0x"
-                  << std::hex << new_pc << std::endl;
-        return false; // Indicates an error or invalid jump
-    }
-    this->pc = new_pc;
-    return true; // Indicates PC updated successfully
+    this->retired = 0;
+    this->dirtyBase = 0;
+    this->events.clear(); // Queued times belong to the old cycle count
+    this->irqPending = 0;
+    this->irqMask = 0;
+    this->irqEnabled = false;
+    this->epc = 0;
+    this->stopRequested = false; // Breakpoints and watchpoints stay set
+    this->fault = z16fault();
+    z16sim::updateNextEvent();
+    z16sim::flushBlockCache();
+    this->sink->print(Z16_CHAN_STATUS, "Simulator reset.\n");
 }
 
 // disassemble method definition
@@ -582,7 +605,7 @@ void z16sim::disassemble(uint16_t inst, uint16_t current_pc, char *buf, size_t b
             if (imm & 0x200) imm |= 0xFC00; // Proper sign-extension for 10-bit
 
             int16_t signed_offset = (int16_t)imm; // Interpret as signed
-            uint16_t target_addr = this->pc + signed_offset;
+            uint16_t target_addr = current_pc + signed_offset;
 
 
             if (f == 0)
@@ -621,88 +644,3 @@ void z16sim::disassemble(uint16_t inst, uint16_t current_pc, char *buf, size_t b
             break;
     }
 }
-
-
-void printUsage(const char* progName) {
-    std::cerr << "Usage: " << progName << " [-i] <machine_code_file_name.bin>" << std::endl;
-    std::cerr << "  -i: Interactive mode (single-stepping)" << std::endl;
-}
-
-int main(int argc, char* argv[]) {
-    bool interactive = false;
-    const char* filename = nullptr;
-
-    // Parse command line arguments
-    if (argc == 2) {
-        // Normal mode: just filename
-        filename = argv[1];
-    } else if (argc == 3) {
-        // Check if first argument is -i
-        if (std::string(argv[1]) == "-i") {
-            interactive = true;
-            filename = argv[2];
-        } else {
-            printUsage(argv[0]);
-            return 1;
-        }
-    } else {
-        printUsage(argv[0]);
-        return 1;
-    }
-
-    z16sim simulator; // Create an instance of the simulator
-
-    // Load the machine code binary from the specified file
-    simulator.loadMemoryFromFile(filename);
-
-    if (interactive) {
-        std::cout << "Interactive mode enabled. Press ENTER to execute next instruction, 'q' then ENTER to quit." << std::endl;
-        std::cout << "Initial state:" << std::endl;
-        simulator.dumpRegisters();
-        std::cout << "PC: 0x" << std::hex << std::setw(4) << std::setfill('0')
-                  << simulator.getPC() << std::endl;
-        std::cout << std::endl;
-
-        // Interactive simulation
-        while (true) {
-            std::cout << "--- Press ENTER to continue (q then ENTER to quit): ";
-            std::cout.flush();
-
-            std::string line;
-            std::getline(std::cin, line); // Read the whole line
-
-            if (line == "q" || line == "Q") {
-                std::cout << "Simulation terminated by user." << std::endl;
-                break;
-            }
-
-            // Execute one instruction
-            if (!simulator.cycle()) {
-                std::cout << "Simulation terminated by instruction." << std::endl;
-                break;
-            }
-
-            // Dump register state
-            simulator.dumpRegisters();
-            std::cout << "PC: 0x" << std::hex << std::setw(4) << std::setfill('0')
-                      << simulator.getPC() << std::endl;
-            std::cout << std::endl;
-        }
-    } else {
-        // Normal simulation mode
-        while (simulator.cycle()) {
-            // Continue simulation as long as cycle() returns true
-        }
-    }
-
-    // Final register state
-    std::cout << "\n--- Final State ---" << std::endl;
-    simulator.dumpRegisters();
-    std::cout << "PC: 0x" << std::hex << std::setw(4) << std::setfill('0')
-              << simulator.getPC() << std::endl;
-    std::cout << "---------------------\n" << std::endl;
-
-    std::cout << "Simulation finished." << std::endl;
-    return 0;
-}
-
@@ -1,26 +1,153 @@
 #ifndef Z16SIM_H
 #define Z16SIM_H
 
+#include "z16block.h"
+#include "z16bus.h"
+#include "z16load.h"
+#include "z16prof.h"
+#include "z16reverse.h"
+#include "z16sink.h"
+#include "z16snapshot.h"
+#include "z16timing.h"
+#include "z16trace.h"
+#include "z16tracefile.h"
 #include <cstdint>
+#include <iosfwd>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
+// Execution engine used by run()/run_until()
+enum z16engine {
+    Z16_ENGINE_INTERP,  // Fetch/decode/execute one instruction at a time
+    Z16_ENGINE_BLOCKS,  // Cached, chained basic blocks (z16block.cpp)
+    Z16_ENGINE_JIT      // Block engine with hot blocks translated to x86-64 (z16jit.cpp)
+};
+
+// Status returned by run(), run_until() and executeInstruction()
+enum z16status : int {
+    Z16_STATUS_OK = 0,                  // Budget used up (run) or instruction retired
+    Z16_STATUS_HALT = 1,                // ecall 0x3FF or an unknown service
+    Z16_STATUS_UNKNOWN_INSTRUCTION = 2, // Invalid encoding; not retired
+    Z16_STATUS_PC_FAULT = 3,            // PC at the last byte of memory; not retired
+    Z16_STATUS_MEMORY_FAULT = 4,        // Misaligned or out-of-range access; not retired
+    Z16_STATUS_DEBUG_STOP = 5           // Breakpoint or watchpoint (getStopReason)
+};
+
+// The last halt or error, for hosts that do not read the messages
+// (z16sim::getFault)
+struct z16fault {
+    z16status status = Z16_STATUS_OK;
+    uint16_t pc = 0;   // Instruction that halted or faulted
+    uint16_t inst = 0; // Its encoding (0 for a PC fault)
+    uint16_t addr = 0; // Memory address for a memory fault, service for a halt
+    uint16_t code = 0; // a0 at a halt: the program's exit status
+};
+
+// Why a run stopped with status 5 (z16sim::getStopReason)
+enum z16stopKind {
+    Z16_STOP_NONE,
+    Z16_STOP_BREAKPOINT,   // Before executing the instruction at addr
+    Z16_STOP_WATCH_READ,   // After the instruction that read addr
+    Z16_STOP_WATCH_WRITE   // After the instruction that wrote addr
+};
+
+struct z16stopReason {
+    z16stopKind kind;
+    uint16_t addr;
+};
+
+// Watchpoint kinds for z16sim::setWatchpoint
+enum : int {
+    Z16_WATCH_READ = 1,
+    Z16_WATCH_WRITE = 2
+};
+
 class z16sim {
-private:
+    friend class z16jit;
+
+public:
     // Constants
     static const int MEM_SIZE = 65536;
     static const int NUM_REGS = 8;
     static const int RA_REG = 1; // ra register index
+    static const int A0_REG = 6; // a0: argument/result of the ecall services
+    static const int A1_REG = 7; // a1: second ecall argument
+    static const uint16_t MMIO_BASE = 0xF000; // Memory-mapped I/O window, up to 0xFFFF
+    static const size_t CONSOLE_BUFFER = 64 * 1024; // Bytes buffered per console direction
+    static const int NUM_VECTORS = 16; // Interrupt vectors at 0x0000-0x001E; 0 is reset
+
+    // Register name mappings
+    static const char* regNames[NUM_REGS];
 
+private:
     // Simulator state
     uint16_t regs[NUM_REGS];
     uint16_t pc;
     unsigned char memory[MEM_SIZE];
     bool debug;
+    uint64_t retired; // Instructions retired since construction/reset
+    z16engine engine;
+    size_t jitCodeSize; // Code buffer of the JIT made by the next run on Z16_ENGINE_JIT
+    z16sink* sink; // All output: console, trace, status and errors (z16sink::standard() by default)
+    std::unique_ptr<z16sink> ownedSink; // Made by the last setOutput(); kept until the next one
+    z16fault fault;
+    z16profiler* profiler; // Receives every retired instruction when set
+    z16timing* timing;     // Likewise, with the data address of loads and stores (z16timing.cpp)
+    z16recorder* recorder; // Logs what every instruction overwrites when set (z16reverse.cpp)
+    z16traceWriter* traceWriter; // Takes the trace of traced runs instead of the sink when set
+
+    // Console behind the ecall services. Output collects in conOut and is
+    // written to the sink when it fills up, before the simulator's own messages
+    // and on flushConsole(); input is read ahead from *in in bulk.
+    std::istream* in;
+    std::string conOut;
+    std::unique_ptr<z16traceFormatter> tracer; // Made by the first traced instruction
+    std::vector<char> conIn;
+    size_t conInPos, conInLen;
+
+    // Basic-block cache. codePages marks 256-byte pages covered by a cached
+    // block so the store path can detect self-modifying code cheaply.
+    std::unique_ptr<z16blockCache> blockCache;
+    unsigned char codePages[z16blockCache::NUM_PAGES];
+    bool codeInvalidated; // Set when a store drops a block or an event falls due; ends the current one
+
+    // Pages written since memory last matched the snapshot with id dirtyBase
+    // (0: no such snapshot, so restore() copies everything)
+    unsigned char dirtyPages[z16blockCache::NUM_PAGES];
+    uint64_t dirtyBase;
+
+    // Memory bus (z16bus.cpp): kind of every page, the trap bits the load/store
+    // fast paths test, and the handler behind each device page
+    z16pageKind pageKinds[z16blockCache::NUM_PAGES];
+    unsigned char busFlags[z16blockCache::NUM_PAGES];
+    z16device* devices[z16blockCache::NUM_PAGES];
+    int busTrapPages; // Pages with trap bits; translated code skips bus checks while 0
+    std::vector<z16device*> serviceDevices; // Each mapped device once, offered unknown ecalls
+
+    // Events and interrupts (z16irq.cpp). Time is the retired-instruction
+    // count. nextEvent is the one counter the run loops compare against: the
+    // first queued event, or now while an interrupt is deliverable.
+    std::vector<z16event> events; // Min-heap on when
+    uint64_t nextEvent;
+    uint16_t irqPending; // Bit per vector
+    uint16_t irqMask;
+    bool irqEnabled;     // Cleared on entry to a handler, set by ecall 0x3FD
+    uint16_t epc;        // PC the interrupted program resumes at
+
+    // Debugger (z16debug.cpp): one bit per byte address. Breakpoints are
+    // only tested by the loops run() picks while breakpointCount is nonzero;
+    // watched pages get bus trap bits, so only accesses to those pages leave
+    // the fast path. A watchpoint hit sets stopRequested and pulls nextEvent
+    // in, so the run stops after the accessing instruction.
+    uint64_t breakBits[MEM_SIZE / 64];
+    uint64_t watchBits[2][MEM_SIZE / 64]; // Read, write
+    int breakpointCount;
+    int watchpointCount; // Watched bytes, either kind
+    bool stopRequested;
+    z16stopReason stopReason;
 
-    // Register name mappings
-    static const char* regNames[NUM_REGS];
     std::unordered_map<std::string, int> regMap;
 
     // Assembler support
@@ -31,18 +158,183 @@ private:
     void initializeRegisterMap();
     int getRegisterIndex(const std::string& regName);
 
-    bool updatePC(uint16_t new_pc, const char* instruction_name);
+    // Instruction semantics (z16exec.h) and their out-of-line slow paths
+    inline int execute(const z16decoded& d, uint16_t inst);
+    int ecall(uint16_t svc);
+    int readConsole(); // Next input byte, -1 at end of input
+    bool deviceService(uint16_t svc);
+    int trap(uint16_t inst);
+    int memoryFault(const char* problem, const char* access, uint16_t mem_addr);
+    uint16_t fetch(uint16_t addr) const { return memory[addr] | (memory[addr + 1] << 8); } // addr < MEM_SIZE - 1
+    int busAccess(const z16decoded& d, uint16_t mem_addr); // Loads/stores on ROM, device and watched pages
+    void mapPages(uint16_t addr, uint32_t len, z16pageKind kind, z16device* device);
+    void updateBusFlags();
+    int serviceEvents(); // Stops for a watchpoint (5), else fires due events and takes a deliverable interrupt
+    void updateNextEvent();
+    void checkWatchpoint(uint16_t mem_addr, int len, bool store);
+    int dispatch(uint64_t max_instructions, int32_t stop_pc, bool trace);
+    inline void recordUndo(uint16_t inst);
+    void restartRecording();
+    void takeCheckpoint();
+    void undoLast();
+
+    // Fetch/execute one instruction. The trace variant adds the line cycle()
+    // prints to the trace buffer (z16trace.h), flushed at the end of the run,
+    // or the instruction's record to the binary trace (z16tracefile.h);
+    // the quiet variant does no formatting or stream I/O at all. The
+    // profiling variant reports each retired instruction to the profiler
+    // and the timing model, whichever are set.
+    // The recording variant logs what each one overwrites. The breakpoint
+    // variant of the loop checks breakBits before each one.
+    template <bool Trace, bool Profile = false, bool Record = false> int step();
+    template <bool Trace, bool Profile = false, bool Break = false, bool Record = false>
+    int runLoop(uint64_t max_instructions, int32_t stop_pc);
+
+    // Block engine (z16block.cpp)
+    z16block* lookupBlock(uint16_t start_pc);
+    z16block* buildBlock(uint16_t start_pc);
+    int runBlocks(uint64_t max_instructions, int32_t stop_pc);
+    void dropNativeCode();
+    void invalidateCode(uint16_t addr, int len);
+    // Idle-loop fast-forward for the block engine (z16idle.cpp)
+    void classifyLoop(z16block& block) const;
+    uint64_t skipCountdown(const z16block& block, uint64_t limit);
+    bool idleLoads(const z16block& block) const;
+    void writeConsole(); // Pending trace lines, then the console buffer
+    void flushTrace();
 
 public:
     z16sim();
     void dumpRegisters() const;
-    void loadMemoryFromFile(const char* filename); // For binary files
+    bool loadMemoryFromFile(const char* filename); // Any format, at address 0; false on error
+    // Copies an image into memory at options.base and sets the PC to its
+    // entry point. Reports problems on the error stream and returns false,
+    // leaving memory untouched, if the file cannot be read or parsed or the
+    // image does not fit.
+    bool loadImage(const char* filename, const z16loadOptions& options);
+    bool loadImage(const z16image& image, const z16loadOptions& options);
     bool cycle();
     int executeInstruction(uint16_t inst);
     void reset();
-    void disassemble(uint16_t inst, uint16_t current_pc, char *buf, size_t bufSize);
+    // Formats inst as if it were at current_pc; touches no simulator state
+    static void disassemble(uint16_t inst, uint16_t current_pc, char *buf, size_t bufSize);
     uint16_t getPC() const { return pc; }
+    void setPC(uint16_t new_pc) { pc = new_pc; }
+    uint16_t getReg(int idx) const { return regs[idx]; }
+    void setReg(int idx, uint16_t value) { regs[idx] = value; }
+    // Raw guest memory. Writes through it bypass block-cache invalidation and
+    // dirty-page tracking.
+    unsigned char* getMemory() { return memory; }
+    uint64_t getInstructionCount() const { return retired; }
     void setDebug(bool d) { debug = d; }
+    void setEngine(z16engine e) { engine = e; }
+    z16engine getEngine() const { return engine; }
+    // Size of the JIT's code buffer (z16jit::CODE_SIZE by default). Changing
+    // it drops the current JIT and every translation it made.
+    void setJitCodeSize(size_t bytes);
+    // Where output goes (nullptr: z16sink::standard()). The sink is not owned.
+    void setSink(z16sink* new_sink);
+    z16sink& getSink() const { return *sink; }
+    // Shorthand for a z16streamSink over the two streams, owned by the simulator
+    void setOutput(std::ostream& new_out, std::ostream& new_err);
+    // Status, PC and details of the last halt or error; cleared by reset()
+    const z16fault& getFault() const { return fault; }
+    // Input for ecall 0x001 (std::cin by default); drops any read-ahead
+    void setInput(std::istream& new_in) { in = &new_in; conInPos = conInLen = 0; }
+    // Writes buffered trace lines and program output to the sink. Hosts call this
+    // after a run that ran out of budget; halts and errors flush on their own.
+    void flushConsole() {
+        if (!conOut.empty() || (tracer && tracer->size())) {
+            writeConsole();
+        }
+    }
+    z16blockStats getBlockStats() const;
+    void flushBlockCache();
+    // Profile run()/run_until() (nullptr stops). Profiled runs always use the
+    // interpreter, whatever the engine setting.
+    void setProfiler(z16profiler* p) { profiler = p; }
+    // Cycle estimate of run()/run_until() (nullptr stops); like profiled
+    // runs, timed runs use the interpreter. The model is not owned.
+    void setTimingModel(z16timing* t) { timing = t; }
+    z16timing* getTimingModel() const { return timing; }
+    // Binary trace (nullptr stops): while set, traced runs and cycle() write
+    // one record per retired instruction to the open writer instead of text
+    // lines to the sink. The writer is not owned.
+    void setTraceWriter(z16traceWriter* w) { traceWriter = w; }
+
+    // Save the registers, PC, retired count and memory; restore() puts them back
+    z16snapshot snapshot();
+    void restore(const z16snapshot& snap);
+    // 64-bit hash of all of memory, for comparing machines cheaply
+    uint64_t memoryHash() const;
+    // Memory bus. The range is widened to whole 256-byte pages; devices are
+    // not owned. Loads from device pages and stores to ROM or device pages
+    // leave the RAM fast path. Writes from the host (loadMemoryFromFile,
+    // writeMemory, getMemory) always go to memory[], which is how ROM is filled.
+    void mapRAM(uint16_t addr, uint32_t len) { mapPages(addr, len, Z16_PAGE_RAM, nullptr); }
+    void mapROM(uint16_t addr, uint32_t len) { mapPages(addr, len, Z16_PAGE_ROM, nullptr); }
+    void mapDevice(uint16_t addr, uint32_t len, z16device* device) { mapPages(addr, len, Z16_PAGE_DEVICE, device); }
+    z16pageKind getPageKind(uint16_t addr) const { return pageKinds[addr >> z16blockCache::PAGE_SHIFT]; }
+
+    // Interrupts and device events (z16irq.cpp). An interrupt on line n
+    // (1-15) is taken between instructions while interrupts are enabled and
+    // n is unmasked: the PC goes to EPC, interrupts are disabled and execution
+    // continues at the vector 2 * n, which normally holds a jump to the
+    // handler. ecall 0x3FD returns to EPC and enables interrupts again. A
+    // pending line stays set until it is cleared.
+    uint64_t getCycle() const { return retired; }
+    void schedule(uint64_t when, z16device* device, uint32_t tag);
+    void cancel(z16device* device, uint32_t tag); // Drops the queued event with this device and tag, if any
+    size_t getEventCount() const { return events.size(); }
+    void raiseInterrupt(int line);
+    void clearInterrupts(uint16_t lines);
+    uint16_t getPendingInterrupts() const { return irqPending; }
+    void setInterruptMask(uint16_t mask);
+    uint16_t getInterruptMask() const { return irqMask; }
+    void setInterruptsEnabled(bool enabled);
+    bool getInterruptsEnabled() const { return irqEnabled; }
+    uint16_t getEPC() const { return epc; }
+    void setEPC(uint16_t new_epc) { epc = new_epc; }
+
+    // Breakpoints and watchpoints (z16debug.cpp). A run stops with status 5
+    // before executing an instruction at a breakpoint, except the first one
+    // of the run so that continuing from a breakpoint makes progress, and
+    // after an instruction whose load or store touched a watched byte.
+    // Instruction fetches, ecall services and host accesses do not trigger
+    // watchpoints. Setting or clearing them never changes program behaviour.
+    void setBreakpoint(uint16_t addr, bool enabled);
+    bool isBreakpoint(uint16_t addr) const { return (breakBits[addr >> 6] >> (addr & 63)) & 1; }
+    void setWatchpoint(uint16_t addr, uint32_t len, int kinds, bool enabled);
+    bool isWatched(uint16_t addr, int kind) const {
+        return (watchBits[kind == Z16_WATCH_WRITE][addr >> 6] >> (addr & 63)) & 1;
+    }
+    void clearDebugPoints();
+    z16stopReason getStopReason() const { return stopReason; }
+
+    // Reverse execution (z16reverse.cpp). While a recorder is set, run(),
+    // run_until() and cycle() use the interpreter and log every instruction;
+    // the log starts at the state current when it is set. The reverse
+    // methods only move within the log and fail (false, or 0 for
+    // reverseContinue) once the host changed the instruction count behind
+    // its back, e.g. with restore() or reset(), until the next run restarts it.
+    void setRecorder(z16recorder* r);
+    z16recorder* getRecorder() const { return recorder; }
+    bool reverseStep();
+    bool reverseTo(uint64_t count); // Back to the state after count instructions
+    int reverseContinue();          // 5 at a breakpoint or write watchpoint, 0 at the log start
+    // The newest logged store that wrote addr: its instruction count and PC
+    bool lastWriter(uint16_t addr, uint64_t& count, uint16_t& writer_pc) const;
+
+    // Memory writes from outside the program, tracked like guest stores
+    void writeMemory(uint16_t addr, const void* data, size_t len);
+    bool isPageDirty(int page) const { return dirtyPages[page] != 0; }
+
+    // Batch execution. Both stop early on ecall or an error and return that
+    // status (see executeInstruction), or 5 at a breakpoint or watchpoint;
+    // 0 means the budget ran out or, for run_until, that PC reached
+    // target_pc before executing it.
+    int run(uint64_t max_instructions, bool trace = false);
+    int run_until(uint16_t target_pc, uint64_t max_instructions = UINT64_MAX, bool trace = false);
 };
 
 #endif // Z16SIM_H
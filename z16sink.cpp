@@ -0,0 +1,52 @@
+#include "z16sink.h"
+#include <algorithm>
+#include <cstdarg>
+#include <iostream>
+
+// print method definition
+void z16sink::print(z16channel channel, const char* format, ...) {
+    char buf[1024];
+    va_list args;
+    va_start(args, format);
+    int len = std::vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (len > 0) {
+        this->write(channel, buf, std::min((size_t)len, sizeof(buf) - 1));
+    }
+}
+
+// standard method definition
+z16sink& z16sink::standard() {
+    static z16streamSink sink(std::cout, std::cerr);
+    return sink;
+}
+
+// z16bufferSink::write method definition
+void z16bufferSink::write(z16channel, const char* data, size_t len) {
+    this->text.append(data, len);
+}
+
+// z16fileSink::write method definition
+void z16fileSink::write(z16channel channel, const char* data, size_t len) {
+    if (channel == Z16_CHAN_ERROR) {
+        std::fflush(this->out);
+        std::fwrite(data, 1, len, this->err);
+        std::fflush(this->err);
+    } else {
+        std::fwrite(data, 1, len, this->out);
+    }
+}
+
+// z16streamSink::write method definition
+void z16streamSink::write(z16channel channel, const char* data, size_t len) {
+    if (channel == Z16_CHAN_ERROR) {
+        this->out.flush();
+        this->err.write(data, len);
+        this->err.flush();
+    } else {
+        this->out.write(data, len);
+        if (channel != Z16_CHAN_TRACE) {
+            this->out.flush();
+        }
+    }
+}
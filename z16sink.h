@@ -0,0 +1,93 @@
+#ifndef Z16SINK_H
+#define Z16SINK_H
+
+#include <cstddef>
+#include <cstdio>
+#include <functional>
+#include <iosfwd>
+#include <string>
+
+// What a piece of simulator output is (z16sink::write)
+enum z16channel {
+    Z16_CHAN_CONSOLE, // Guest program output from the ecall print services
+    Z16_CHAN_TRACE,   // One line per traced instruction
+    Z16_CHAN_STATUS,  // Load and halt messages, register dumps
+    Z16_CHAN_ERROR    // Faults, load errors and warnings
+};
+
+// Destination of everything the simulator core prints. Lines arrive whole,
+// ending in '\n'; console output arrives in the chunks the guest's buffer
+// was flushed in. A sink is not owned by the simulator and must outlive
+// it; one sink per simulator unless the sink does its own locking.
+class z16sink {
+public:
+    virtual ~z16sink() {}
+    virtual void write(z16channel channel, const char* data, size_t len) = 0;
+
+    // printf-style formatting into a stack buffer, then write(); output
+    // longer than 1 KiB is cut off
+    void print(z16channel channel, const char* format, ...)
+#if defined(__GNUC__)
+        __attribute__((format(printf, 3, 4)))
+#endif
+        ;
+
+    // std::cout / std::cerr, the default of every simulator
+    static z16sink& standard();
+};
+
+// Drops everything
+class z16nullSink : public z16sink {
+public:
+    void write(z16channel, const char*, size_t) override {}
+};
+
+// Collects every channel, in order, in one string
+class z16bufferSink : public z16sink {
+public:
+    void write(z16channel channel, const char* data, size_t len) override;
+    const std::string& str() const { return text; }
+    void clear() { text.clear(); }
+
+private:
+    std::string text;
+};
+
+// Writes to C streams: errors to err (nullptr: out), the rest to out. The
+// files are not closed.
+class z16fileSink : public z16sink {
+public:
+    explicit z16fileSink(FILE* out, FILE* err = nullptr) : out(out), err(err ? err : out) {}
+    void write(z16channel channel, const char* data, size_t len) override;
+
+private:
+    FILE* out;
+    FILE* err;
+};
+
+// Writes to C++ streams: errors to err, the rest to out. Trace lines are
+// left buffered; everything else is flushed, and out is flushed before an
+// error so the two interleave correctly on a terminal.
+class z16streamSink : public z16sink {
+public:
+    z16streamSink(std::ostream& out, std::ostream& err) : out(out), err(err) {}
+    void write(z16channel channel, const char* data, size_t len) override;
+
+private:
+    std::ostream& out;
+    std::ostream& err;
+};
+
+// Hands every write to a function
+class z16callbackSink : public z16sink {
+public:
+    typedef std::function<void(z16channel channel, const char* data, size_t len)> callback;
+
+    explicit z16callbackSink(callback fn) : fn(std::move(fn)) {}
+    void write(z16channel channel, const char* data, size_t len) override { fn(channel, data, len); }
+
+private:
+    callback fn;
+};
+
+#endif // Z16SINK_H
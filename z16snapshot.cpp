@@ -0,0 +1,75 @@
+#include "z16sim.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+static std::atomic<uint64_t> nextSnapshotId(1);
+
+// snapshot method definition
+z16snapshot z16sim::snapshot() {
+    z16snapshot snap;
+    snap.id = nextSnapshotId++;
+    std::memcpy(snap.regs, this->regs, sizeof(snap.regs));
+    snap.pc = this->pc;
+    snap.retired = this->retired;
+    snap.memory.assign(this->memory, this->memory + z16sim::MEM_SIZE);
+
+    std::memset(this->dirtyPages, 0, sizeof(this->dirtyPages));
+    this->dirtyBase = snap.id;
+    return snap;
+}
+
+// restore method definition: copies back only the dirty pages when memory
+// still derives from the same snapshot, otherwise all of it
+void z16sim::restore(const z16snapshot& snap) {
+    const int pageSize = 1 << z16blockCache::PAGE_SHIFT;
+
+    if (snap.id != 0 && snap.id == this->dirtyBase) {
+        for (int page = 0; page < z16blockCache::NUM_PAGES; ++page) {
+            if (!this->dirtyPages[page]) {
+                continue;
+            }
+            std::memcpy(this->memory + page * pageSize, snap.memory.data() + page * pageSize, pageSize);
+            if (this->codePages[page]) {
+                z16sim::invalidateCode((uint16_t)(page * pageSize), pageSize);
+            }
+        }
+    } else {
+        std::memcpy(this->memory, snap.memory.data(), z16sim::MEM_SIZE);
+        z16sim::flushBlockCache();
+    }
+
+    std::memset(this->dirtyPages, 0, sizeof(this->dirtyPages));
+    this->dirtyBase = snap.id;
+    std::memcpy(this->regs, snap.regs, sizeof(this->regs));
+    this->pc = snap.pc;
+    this->retired = snap.retired;
+}
+
+// memoryHash method definition: FNV-1a over 64-bit words
+uint64_t z16sim::memoryHash() const {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int addr = 0; addr < z16sim::MEM_SIZE; addr += 8) {
+        uint64_t word;
+        std::memcpy(&word, this->memory + addr, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// writeMemory method definition
+void z16sim::writeMemory(uint16_t addr, const void* data, size_t len) {
+    len = std::min(len, (size_t)(z16sim::MEM_SIZE - addr));
+    if (len == 0) {
+        return;
+    }
+    std::memcpy(this->memory + addr, data, len);
+    bool code = false;
+    for (size_t page = addr >> z16blockCache::PAGE_SHIFT; page <= (addr + len - 1) >> z16blockCache::PAGE_SHIFT; ++page) {
+        this->dirtyPages[page] = 1;
+        code = code || this->codePages[page];
+    }
+    if (code) {
+        z16sim::invalidateCode(addr, (int)len);
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef Z16SNAPSHOT_H
+#define Z16SNAPSHOT_H
+
+#include <cstdint>
+#include <vector>
+
+// Machine state saved by z16sim::snapshot(). A snapshot can be restored into
+// any z16sim; restoring the one most recently taken or restored by the same
+// simulator only copies back the memory pages written since.
+struct z16snapshot {
+    uint64_t id = 0; // Unique across all simulators, 0 for an empty snapshot
+    uint16_t regs[8] = {0};
+    uint16_t pc = 0;
+    uint64_t retired = 0;
+    std::vector<unsigned char> memory;
+};
+
+#endif // Z16SNAPSHOT_H
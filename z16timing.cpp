@@ -0,0 +1,297 @@
+#include "z16timing.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ostream>
+
+const char* z16timing::classNames[Z16_TIME_NUM_CLASSES] = {"alu", "load", "store", "branch", "jump", "system"};
+const char* z16timing::stallNames[z16timing::NUM_STALLS] = {
+    "taken branch", "direct jump", "indirect jump", "load-use", "I-cache miss", "D-cache miss", "writeback", "uncached"};
+
+// Unsigned number in decimal or 0x hex, nothing after it
+static bool parseValue(const std::string& text, uint32_t& value) {
+    char* end = nullptr;
+    unsigned long parsed = std::strtoul(text.c_str(), &end, 0);
+    if (text.empty() || *end != '\0' || parsed > 0xFFFFFFFFul) {
+        return false;
+    }
+    value = (uint32_t)parsed;
+    return true;
+}
+
+// SIZE:LINE:WAYS:PENALTY or off
+static bool parseCache(const std::string& text, z16cacheConfig& cache, std::string& error) {
+    if (text == "off") {
+        cache.size = 0;
+        return true;
+    }
+    uint32_t fields[4];
+    size_t start = 0;
+    for (int i = 0; i < 4; ++i) {
+        size_t colon = text.find(':', start);
+        if ((colon == std::string::npos) != (i == 3) || !parseValue(text.substr(start, colon - start), fields[i])) {
+            error = "cache " + text + " is not SIZE:LINE:WAYS:PENALTY";
+            return false;
+        }
+        start = colon + 1;
+    }
+    auto pow2 = [](uint32_t v) { return v && !(v & (v - 1)); };
+    if (!pow2(fields[0]) || !pow2(fields[1]) || fields[1] < 2 || fields[0] > 65536 || fields[1] > fields[0] ||
+        !fields[2] || fields[0] / fields[1] % fields[2] != 0 || !pow2(fields[0] / fields[1] / fields[2])) {
+        error = "cache " + text + ": sizes must be powers of two, with a power-of-two number of sets";
+        return false;
+    }
+    cache.size = fields[0];
+    cache.lineSize = fields[1];
+    cache.ways = fields[2];
+    cache.missPenalty = fields[3];
+    return true;
+}
+
+// parse method definition
+bool z16timingConfig::parse(const std::string& spec, std::string& error) {
+    size_t start = 0;
+    while (start < spec.size()) {
+        size_t comma = spec.find(',', start);
+        std::string item = spec.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        start = comma == std::string::npos ? spec.size() : comma + 1;
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            error = "expected key=value, got " + item;
+            return false;
+        }
+        std::string key = item.substr(0, eq);
+        std::string text = item.substr(eq + 1);
+        if (key == "icache" || key == "dcache") {
+            if (!parseCache(text, key == "icache" ? this->icache : this->dcache, error)) {
+                return false;
+            }
+            continue;
+        }
+        uint32_t* field = nullptr;
+        for (int c = 0; c < Z16_TIME_NUM_CLASSES; ++c) {
+            if (key == z16timing::classNames[c]) {
+                field = &this->latency[c];
+            }
+        }
+        if (key == "taken") field = &this->takenPenalty;
+        else if (key == "direct") field = &this->directPenalty;
+        else if (key == "indirect") field = &this->indirectPenalty;
+        else if (key == "load-use") field = &this->loadUsePenalty;
+        else if (key == "uncached") field = &this->uncachedLatency;
+        if (!field) {
+            error = "unknown timing setting " + key;
+            return false;
+        }
+        if (!parseValue(text, *field)) {
+            error = "bad value for " + key + ": " + text;
+            return false;
+        }
+    }
+    return true;
+}
+
+// configure method definition
+void z16cacheModel::configure(const z16cacheConfig& config) {
+    this->lineShift = 0;
+    this->lines.clear();
+    if (config.size == 0) {
+        return;
+    }
+    while ((1u << this->lineShift) < config.lineSize) {
+        ++this->lineShift;
+    }
+    this->ways = config.ways;
+    this->setMask = config.size / config.lineSize / config.ways - 1;
+    this->lines.resize(config.size / config.lineSize);
+    z16cacheModel::clear();
+}
+
+// z16cacheModel::clear method definition
+void z16cacheModel::clear() {
+    for (line& l : this->lines) {
+        l = {INVALID, false, 0};
+    }
+    this->lastTag = INVALID;
+    this->lastLine = nullptr;
+    this->clock = 0;
+    this->hits = this->misses = this->writebacks = 0;
+}
+
+// access method definition
+bool z16cacheModel::access(uint16_t addr, bool write, bool& dirtyEvict) {
+    uint32_t tag = addr >> this->lineShift;
+    if (tag == this->lastTag) { // Already the most recently used line
+        this->lastLine->dirty |= write;
+        ++this->hits;
+        return true;
+    }
+    line* set = &this->lines[(tag & this->setMask) * this->ways];
+    line* victim = set;
+    for (uint32_t w = 0; w < this->ways; ++w) {
+        if (set[w].tag == tag) {
+            set[w].used = ++this->clock;
+            set[w].dirty |= write;
+            this->lastTag = tag;
+            this->lastLine = &set[w];
+            ++this->hits;
+            return true;
+        }
+        if (set[w].used < victim->used) { // Empty lines have used 0
+            victim = &set[w];
+        }
+    }
+    dirtyEvict = victim->tag != INVALID && victim->dirty;
+    this->writebacks += dirtyEvict;
+    *victim = {tag, write, ++this->clock};
+    this->lastTag = tag;
+    this->lastLine = victim;
+    ++this->misses;
+    return false;
+}
+
+// z16timing constructor definition: per-op class and source registers
+z16timing::z16timing(const z16timingConfig& config) : config(config) {
+    for (int op = 0; op < Z16_NUM_OPS; ++op) {
+        uint8_t cls = Z16_TIME_ALU;
+        uint8_t reads = 1 | 2; // Two-operand R-type: rd = rd op rs2
+        if (op >= Z16_ADDI && op <= Z16_XORI) {
+            reads = 1;
+        } else if (op == Z16_LI || op == Z16_LUI || op == Z16_AUIPC || op == Z16_J || op == Z16_JAL) {
+            reads = 0;
+        } else if (op == Z16_MV || op == Z16_JALR) {
+            reads = 2;
+        } else if (op == Z16_JR || op == Z16_BZ || op == Z16_BNZ) {
+            reads = 1;
+        } else if (op >= Z16_LB && op <= Z16_LBU) {
+            reads = 2; // Base
+        } else if (op == Z16_ECALL) {
+            reads = 4;
+        }
+        if (op >= Z16_LB && op <= Z16_LBU) cls = Z16_TIME_LOAD;
+        else if (op == Z16_SB || op == Z16_SW) cls = Z16_TIME_STORE;
+        else if (op >= Z16_BEQ && op <= Z16_BGEU) cls = Z16_TIME_BRANCH;
+        else if (op == Z16_J || op == Z16_JAL || op == Z16_JR || op == Z16_JALR) cls = Z16_TIME_JUMP;
+        else if (op == Z16_ECALL) cls = Z16_TIME_SYSTEM;
+        this->opClass[op] = cls;
+        this->opReads[op] = reads;
+    }
+    this->icache.configure(config.icache);
+    this->dcache.configure(config.dcache);
+    z16timing::clear();
+}
+
+// z16timing::clear method definition
+void z16timing::clear() {
+    this->icache.clear();
+    this->dcache.clear();
+    this->loadDest = -1;
+    this->instructions = this->cycles = 0;
+    std::memset(this->classCounts, 0, sizeof(this->classCounts));
+    std::memset(this->classCycles, 0, sizeof(this->classCycles));
+    std::memset(this->stalls, 0, sizeof(this->stalls));
+}
+
+// record method definition
+void z16timing::record(uint16_t pc, uint16_t inst, uint16_t next_pc, uint16_t mem_addr) {
+    const z16decoded& d = z16decodeTable[inst];
+    int cls = this->opClass[d.op];
+    uint64_t stall[NUM_STALLS] = {};
+    bool dirty = false;
+
+    if (this->icache.enabled() && !this->icache.access(pc, false, dirty)) {
+        stall[STALL_ICACHE] = this->config.icache.missPenalty;
+    }
+    if (this->loadDest >= 0) {
+        uint8_t reads = this->opReads[d.op];
+        if (((reads & 1) && d.rd == this->loadDest) || ((reads & 2) && d.rs2 == this->loadDest) ||
+            ((reads & 4) && (this->loadDest == A0_REG || this->loadDest == A0_REG + 1))) {
+            stall[STALL_LOAD_USE] = this->config.loadUsePenalty;
+        }
+    }
+    this->loadDest = -1;
+
+    switch (cls) {
+        case Z16_TIME_LOAD:
+        case Z16_TIME_STORE:
+            if (mem_addr >= z16timing::UNCACHED_BASE) {
+                stall[STALL_UNCACHED] = this->config.uncachedLatency;
+            } else if (this->dcache.enabled()) {
+                dirty = false;
+                if (!this->dcache.access(mem_addr, cls == Z16_TIME_STORE, dirty)) {
+                    stall[STALL_DCACHE] = this->config.dcache.missPenalty;
+                    stall[STALL_WRITEBACK] = dirty ? this->config.dcache.missPenalty : 0;
+                }
+            }
+            if (cls == Z16_TIME_LOAD) {
+                this->loadDest = d.rd;
+            }
+            break;
+        case Z16_TIME_BRANCH:
+            if (next_pc != (uint16_t)(pc + 2)) {
+                stall[STALL_TAKEN] = this->config.takenPenalty;
+            }
+            break;
+        case Z16_TIME_JUMP:
+            if (d.op == Z16_J || d.op == Z16_JAL) {
+                stall[STALL_DIRECT] = this->config.directPenalty;
+            } else {
+                stall[STALL_INDIRECT] = this->config.indirectPenalty;
+            }
+            break;
+        default:
+            break;
+    }
+
+    uint64_t total = this->config.latency[cls];
+    for (int s = 0; s < NUM_STALLS; ++s) {
+        this->stalls[s] += stall[s];
+        total += stall[s];
+    }
+    ++this->instructions;
+    this->cycles += total;
+    ++this->classCounts[cls];
+    this->classCycles[cls] += total;
+}
+
+// writeReport method definition
+void z16timing::writeReport(std::ostream& os) const {
+    char buf[256];
+    std::snprintf(buf, sizeof(buf), "Cycles: %llu for %llu instructions, CPI %.3f\n", (unsigned long long)this->cycles,
+                  (unsigned long long)this->instructions,
+                  this->instructions ? (double)this->cycles / this->instructions : 0.0);
+    os << buf;
+    os << "  class           count          cycles     CPI\n";
+    for (int c = 0; c < Z16_TIME_NUM_CLASSES; ++c) {
+        if (this->classCounts[c]) {
+            std::snprintf(buf, sizeof(buf), "  %-6s %14llu  %14llu  %6.3f\n", z16timing::classNames[c],
+                          (unsigned long long)this->classCounts[c], (unsigned long long)this->classCycles[c],
+                          (double)this->classCycles[c] / this->classCounts[c]);
+            os << buf;
+        }
+    }
+    os << "Stall cycles:\n";
+    for (int s = 0; s < NUM_STALLS; ++s) {
+        std::snprintf(buf, sizeof(buf), "  %-14s %14llu  %6.2f%%\n", z16timing::stallNames[s],
+                      (unsigned long long)this->stalls[s], this->cycles ? 100.0 * this->stalls[s] / this->cycles : 0.0);
+        os << buf;
+    }
+    const z16cacheModel* caches[2] = {&this->icache, &this->dcache};
+    const z16cacheConfig* configs[2] = {&this->config.icache, &this->config.dcache};
+    for (int i = 0; i < 2; ++i) {
+        os << (i ? "D-cache: " : "I-cache: ");
+        if (!caches[i]->enabled()) {
+            os << "off\n";
+            continue;
+        }
+        uint64_t accesses = caches[i]->getHits() + caches[i]->getMisses();
+        std::snprintf(buf, sizeof(buf), "%u bytes, %u-way, %u-byte lines: %llu hits, %llu misses (%.2f%% hit rate)",
+                      configs[i]->size, configs[i]->ways, configs[i]->lineSize, (unsigned long long)caches[i]->getHits(),
+                      (unsigned long long)caches[i]->getMisses(), accesses ? 100.0 * caches[i]->getHits() / accesses : 0.0);
+        os << buf;
+        if (i) {
+            os << ", " << caches[i]->getWritebacks() << " writebacks";
+        }
+        os << "\n";
+    }
+}
@@ -0,0 +1,149 @@
+#ifndef Z16TIMING_H
+#define Z16TIMING_H
+
+#include "z16decode.h"
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+// Instruction classes of the timing model, each with its own latency
+enum z16timingClass {
+    Z16_TIME_ALU,    // R-type and I-type arithmetic, lui, auipc
+    Z16_TIME_LOAD,
+    Z16_TIME_STORE,
+    Z16_TIME_BRANCH, // B-type
+    Z16_TIME_JUMP,   // j, jal, jr, jalr
+    Z16_TIME_SYSTEM, // ecall
+    Z16_TIME_NUM_CLASSES
+};
+
+// One cache in front of memory[]. size 0 means no cache: every access hits
+// at no cost.
+struct z16cacheConfig {
+    uint32_t size = 4096;     // Bytes, a power of two
+    uint32_t lineSize = 16;   // Bytes, a power of two
+    uint32_t ways = 2;        // Lines per set; size / lineSize for fully associative
+    uint32_t missPenalty = 10; // Cycles to fill a line, and again to write back a dirty one
+};
+
+// Latencies and penalties in cycles. The defaults model a single-issue
+// five-stage pipeline: one cycle per instruction, a two-cycle bubble for a
+// taken branch or an indirect jump (resolved in execute), one for a direct
+// jump (resolved in decode) and one for an instruction that needs the
+// result of the load just before it.
+struct z16timingConfig {
+    uint32_t latency[Z16_TIME_NUM_CLASSES] = {1, 1, 1, 1, 1, 1};
+    uint32_t takenPenalty = 2;
+    uint32_t directPenalty = 1;   // j, jal
+    uint32_t indirectPenalty = 2; // jr, jalr
+    uint32_t loadUsePenalty = 1;
+    uint32_t uncachedLatency = 4; // Extra cycles for a load or store in the MMIO window, which is never cached
+    z16cacheConfig icache;
+    z16cacheConfig dcache;
+
+    // Applies a comma-separated list of key=value settings:
+    //   alu, load, store, branch, jump, system   latency per class
+    //   taken, direct, indirect, load-use        penalties
+    //   uncached                                 MMIO access latency
+    //   icache, dcache   SIZE:LINE:WAYS:PENALTY, or off
+    // Returns false with a message in error if a key or value is bad.
+    bool parse(const std::string& spec, std::string& error);
+};
+
+// Set-associative cache with LRU replacement, write-back and write-allocate.
+// Only tags are kept; the data stays in memory[].
+class z16cacheModel {
+public:
+    void configure(const z16cacheConfig& config);
+    void clear();
+    bool enabled() const { return lineShift != 0; }
+
+    // True on a hit; on a miss the line is filled, and dirtyEvict tells
+    // whether the line it replaced had to be written back
+    bool access(uint16_t addr, bool write, bool& dirtyEvict);
+
+    uint64_t getHits() const { return hits; }
+    uint64_t getMisses() const { return misses; }
+    uint64_t getWritebacks() const { return writebacks; }
+
+private:
+    struct line {
+        uint32_t tag; // Line address; INVALID when empty
+        bool dirty;
+        uint64_t used; // LRU stamp
+    };
+    static const uint32_t INVALID = 0xFFFFFFFF;
+
+    std::vector<line> lines; // Set-major
+    uint32_t ways = 0;
+    uint32_t setMask = 0;
+    int lineShift = 0;
+    uint32_t lastTag = INVALID; // Most recently used line, the fast path for sequential accesses
+    line* lastLine = nullptr;
+    uint64_t clock = 0;
+    uint64_t hits = 0, misses = 0, writebacks = 0;
+};
+
+// Cycle estimate of a run (z16sim::setTimingModel). The simulator reports
+// every retired instruction with the PC it moved to and, for loads and
+// stores, the address it accessed; the model charges the class latency, an
+// I-cache access for the fetch, a D-cache access for the data, and the
+// pipeline penalties, and keeps the stall cycles by cause.
+class z16timing {
+public:
+    static const char* classNames[Z16_TIME_NUM_CLASSES];
+    static const uint16_t UNCACHED_BASE = 0xF000; // z16sim::MMIO_BASE
+    static const int A0_REG = 6; // z16sim::A0_REG; ecall services read a0 and a1
+
+    explicit z16timing(const z16timingConfig& config = z16timingConfig());
+
+    // Address a load or store of inst would access with these registers;
+    // called before the instruction runs, as a load may overwrite its base
+    static uint16_t dataAddress(uint16_t inst, const uint16_t* regs) {
+        const z16decoded& d = z16decodeTable[inst];
+        return (uint16_t)(regs[(d.op == Z16_SB || d.op == Z16_SW) ? d.rd : d.rs2] + d.imm);
+    }
+
+    void record(uint16_t pc, uint16_t inst, uint16_t next_pc, uint16_t mem_addr);
+    // Back to zero cycles with empty caches
+    void clear();
+
+    const z16timingConfig& getConfig() const { return config; }
+    uint64_t getInstructions() const { return instructions; }
+    uint64_t getCycles() const { return cycles; }
+    const z16cacheModel& getICache() const { return icache; }
+    const z16cacheModel& getDCache() const { return dcache; }
+
+    // Cycles, CPI, cycles per class, stall breakdown and cache hit rates
+    void writeReport(std::ostream& os) const;
+
+private:
+    enum z16stall {
+        STALL_TAKEN,
+        STALL_DIRECT,
+        STALL_INDIRECT,
+        STALL_LOAD_USE,
+        STALL_ICACHE,
+        STALL_DCACHE,
+        STALL_WRITEBACK,
+        STALL_UNCACHED,
+        NUM_STALLS
+    };
+    static const char* stallNames[NUM_STALLS];
+
+    z16timingConfig config;
+    z16cacheModel icache;
+    z16cacheModel dcache;
+    uint8_t opClass[Z16_NUM_OPS];
+    uint8_t opReads[Z16_NUM_OPS]; // Registers read: bit 0 rd, bit 1 rs2, bit 2 a0 and a1
+    int loadDest; // Register the previous instruction loaded, -1 if it was no load
+
+    uint64_t instructions;
+    uint64_t cycles;
+    uint64_t classCounts[Z16_TIME_NUM_CLASSES];
+    uint64_t classCycles[Z16_TIME_NUM_CLASSES];
+    uint64_t stalls[NUM_STALLS];
+};
+
+#endif // Z16TIMING_H
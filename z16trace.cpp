@@ -0,0 +1,25 @@
+#include "z16trace.h"
+#include "z16sim.h"
+#include <algorithm>
+
+// z16traceFormatter constructor definition
+z16traceFormatter::z16traceFormatter()
+    : texts(new entry[65536]()), buf(new char[BUFFER + sizeof(entry)]), len(0) {}
+
+// fill method definition: disassembles at PC 0 and cuts off the target,
+// which disassemble() always prints last as 0x%04X
+void z16traceFormatter::fill(uint16_t inst) {
+    char text[256];
+    z16sim::disassemble(inst, 0, text, sizeof(text));
+    size_t n = std::strlen(text);
+    uint8_t op = z16decodeTable[inst].op;
+    entry& e = this->texts[inst];
+    e.flags = FILLED;
+    if ((op >= Z16_BEQ && op <= Z16_BGEU) || op == Z16_J || op == Z16_JAL) {
+        n -= 4;
+        e.flags |= PC_RELATIVE;
+    }
+    n = std::min(n, sizeof(e.text));
+    std::memcpy(e.text, text, n);
+    e.len = (uint8_t)n;
+}
@@ -0,0 +1,84 @@
+#ifndef Z16TRACE_H
+#define Z16TRACE_H
+
+#include "z16decode.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+// Formats trace lines ("PC: 0x0040 | Inst: 0x3442 | beq x1, x2, 0x004E")
+// into one reusable buffer with no printf, streams or allocation per line.
+// The disassembly of an encoding is produced by z16sim::disassemble() the
+// first time it is traced and kept; for B-type and J-type encodings the
+// target is left off the kept text and appended per line, as it is the only
+// part that depends on the PC. The owner hands the buffer to its sink when
+// full() and before any other output.
+class z16traceFormatter {
+public:
+    static const size_t BUFFER = 256 * 1024; // Bytes of lines between flushes
+    static const size_t MAX_LINE = 48;       // Longest line append() makes
+    static const size_t MAX_NOTE = 48;       // Longest annotate() text
+
+    z16traceFormatter();
+
+    void append(uint16_t pc, uint16_t inst) {
+        entry& e = this->texts[inst];
+        if (!(e.flags & FILLED)) {
+            z16traceFormatter::fill(inst);
+        }
+        char* p = this->buf.get() + this->len;
+        std::memcpy(p, "PC: 0x", 6);
+        p = z16traceFormatter::hex4(p + 6, pc, LOWER);
+        std::memcpy(p, " | Inst: 0x", 11);
+        p = z16traceFormatter::hex4(p + 11, inst, LOWER);
+        std::memcpy(p, " | ", 3);
+        std::memcpy(p + 3, e.text, sizeof(e.text)); // Whole entry; the buffer has room past the line
+        p += 3 + e.len;
+        if (e.flags & PC_RELATIVE) {
+            p = z16traceFormatter::hex4(p, (uint16_t)(pc + z16decodeTable[inst].imm), UPPER);
+        }
+        *p++ = '\n';
+        this->len = p - this->buf.get();
+    }
+
+    // Adds text to the end of the last line, before its newline
+    void annotate(const char* text, size_t n) {
+        std::memcpy(this->buf.get() + this->len - 1, text, n);
+        this->len += n;
+        this->buf[this->len - 1] = '\n';
+    }
+
+    bool full() const { return len > BUFFER - MAX_LINE - MAX_NOTE; }
+    const char* data() const { return buf.get(); }
+    size_t size() const { return len; }
+    void clear() { len = 0; }
+
+private:
+    // Longest disassembly is 19 characters, 15 without a branch target
+    struct entry {
+        char text[22];
+        uint8_t len;
+        uint8_t flags;
+    };
+    enum : uint8_t { FILLED = 1, PC_RELATIVE = 2 };
+
+    static constexpr const char* LOWER = "0123456789abcdef";
+    static constexpr const char* UPPER = "0123456789ABCDEF";
+
+    std::unique_ptr<entry[]> texts; // Per encoding
+    std::unique_ptr<char[]> buf;
+    size_t len;
+
+    void fill(uint16_t inst);
+
+    static char* hex4(char* p, uint16_t v, const char* digits) {
+        p[0] = digits[v >> 12];
+        p[1] = digits[(v >> 8) & 0xF];
+        p[2] = digits[(v >> 4) & 0xF];
+        p[3] = digits[v & 0xF];
+        return p + 4;
+    }
+};
+
+#endif // Z16TRACE_H
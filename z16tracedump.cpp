@@ -0,0 +1,108 @@
+// zx16_tracedump: turns a binary trace (zx16_simulator --trace-file) back
+// into the text trace the simulator prints, one "PC: ... | Inst: ... |"
+// line per instruction. --from seeks through the keyframe index, so only
+// the records from the keyframe before the start are decoded.
+
+#include "z16sim.h"
+#include "z16trace.h"
+#include "z16tracefile.h"
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+static void printUsage(const char* progName) {
+    std::cerr << "Usage: " << progName << " [options] <trace_file>" << std::endl;
+    std::cerr << "  --from=N: Start at instruction count N (default 0)" << std::endl;
+    std::cerr << "  --count=N: Print at most N instructions" << std::endl;
+    std::cerr << "  --pc=LO-HI: Only instructions with LO <= PC <= HI" << std::endl;
+    std::cerr << "  --regs: Append the register or memory each instruction changed" << std::endl;
+    std::cerr << "  --index: Print the keyframe index instead of the trace" << std::endl;
+}
+
+// Parses a number given in decimal or 0x hex
+static bool parseNumber(const char* text, uint64_t& value) {
+    char* end = nullptr;
+    value = std::strtoull(text, &end, 0);
+    return *text != '\0' && *end == '\0';
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t from = 0;
+    uint64_t count = UINT64_MAX;
+    uint64_t pcLow = 0, pcHigh = 0xFFFF;
+    bool regs = false;
+    bool index = false;
+    const char* filename = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool ok = true;
+        if (arg.rfind("--from=", 0) == 0) {
+            ok = parseNumber(argv[i] + 7, from);
+        } else if (arg.rfind("--count=", 0) == 0) {
+            ok = parseNumber(argv[i] + 8, count);
+        } else if (arg.rfind("--pc=", 0) == 0) {
+            size_t dash = arg.find('-', 5);
+            ok = dash != std::string::npos && parseNumber(arg.substr(5, dash - 5).c_str(), pcLow) &&
+                 parseNumber(arg.substr(dash + 1).c_str(), pcHigh) && pcLow <= pcHigh && pcHigh <= 0xFFFF;
+        } else if (arg == "--regs") {
+            regs = true;
+        } else if (arg == "--index") {
+            index = true;
+        } else if (arg[0] != '-' && filename == nullptr) {
+            filename = argv[i];
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (filename == nullptr) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    z16traceReader reader;
+    if (!reader.open(filename, std::cerr)) {
+        return 1;
+    }
+    if (index) {
+        std::printf("%s: keyframe interval %u, %zu keyframes%s\n", filename, reader.getInterval(),
+                    reader.getKeyframes().size(), reader.hasIndex() ? "" : " (no index; rebuilt by scanning)");
+        for (const auto& key : reader.getKeyframes()) {
+            std::printf("  %llu at offset %llu\n", (unsigned long long)key.first, (unsigned long long)key.second);
+        }
+        return 0;
+    }
+
+    reader.seek(from);
+    z16traceFormatter out;
+    z16traceRecord rec;
+    uint64_t printed = 0;
+    while (printed < count && reader.next(rec)) {
+        if (rec.pc < pcLow || rec.pc > pcHigh) {
+            continue;
+        }
+        out.append(rec.pc, rec.inst);
+        if (regs) {
+            char note[z16traceFormatter::MAX_NOTE];
+            int n = 0;
+            if (rec.reg >= 0) {
+                n = std::snprintf(note, sizeof(note), "  ; %s = 0x%04x", z16sim::regNames[rec.reg], rec.value);
+            } else if (rec.storeSize) {
+                n = std::snprintf(note, sizeof(note), rec.storeSize == 1 ? "  ; [0x%04x] = 0x%02x" : "  ; [0x%04x] = 0x%04x",
+                                  rec.addr, rec.data);
+            }
+            out.annotate(note, n);
+        }
+        if (out.full()) {
+            std::fwrite(out.data(), 1, out.size(), stdout);
+            out.clear();
+        }
+        ++printed;
+    }
+    std::fwrite(out.data(), 1, out.size(), stdout);
+    return 0;
+}
@@ -0,0 +1,442 @@
+#include "z16tracefile.h"
+#include "z16decode.h"
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+
+// 64-bit file positions: traces of long runs pass 2 GB
+static void seekFile(FILE* file, uint64_t where, int whence) {
+#ifdef _WIN32
+    _fseeki64(file, (__int64)where, whence);
+#else
+    fseeko(file, (off_t)where, whence);
+#endif
+}
+
+static uint64_t tellFile(FILE* file) {
+#ifdef _WIN32
+    return (uint64_t)_ftelli64(file);
+#else
+    return (uint64_t)ftello(file);
+#endif
+}
+
+namespace {
+
+unsigned char* put16(unsigned char* p, uint16_t v) {
+    p[0] = (unsigned char)(v & 0xFF);
+    p[1] = (unsigned char)(v >> 8);
+    return p + 2;
+}
+
+unsigned char* put64(unsigned char* p, uint64_t v) {
+    for (int i = 0; i < 8; ++i) {
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+    return p + 8;
+}
+
+uint16_t get16(const unsigned char* p) {
+    return p[0] | (p[1] << 8);
+}
+
+uint64_t get64(const unsigned char* p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+}
+
+// z16traceWriter constructor definition
+z16traceWriter::z16traceWriter(uint32_t interval)
+    : file(nullptr), buf(new unsigned char[BUFFER]), len(0), offset(0), failed(false),
+      interval(interval ? interval : 1), count(0), nextKeyframe(0), keyframeDue(true), nextPC(0),
+      shadow(), records(0) {}
+
+// z16traceWriter destructor definition: a writer that was never closed
+// still gets its index
+z16traceWriter::~z16traceWriter() {
+    if (this->file) {
+        z16traceWriter::finish();
+    }
+}
+
+// z16traceWriter::open method definition
+bool z16traceWriter::open(const std::string& path, std::ostream& err) {
+    if (this->file) {
+        z16traceWriter::finish();
+    }
+    this->file = std::fopen(path.c_str(), "wb");
+    if (!this->file) {
+        err << "Error: Could not open trace file " << path << std::endl;
+        return false;
+    }
+    this->path = path;
+    this->failed = false;
+    this->offset = 0;
+    this->records = 0;
+    this->index.clear();
+    this->keyframeDue = true;
+
+    unsigned char* p = this->buf.get();
+    std::memcpy(p, z16tracefmt::MAGIC, 8);
+    p = put16(p + 8, z16tracefmt::VERSION);
+    p = put16(p, 0);
+    p[0] = (unsigned char)(this->interval & 0xFF);
+    p[1] = (unsigned char)((this->interval >> 8) & 0xFF);
+    p[2] = (unsigned char)((this->interval >> 16) & 0xFF);
+    p[3] = (unsigned char)(this->interval >> 24);
+    this->len = z16tracefmt::HEADER_SIZE;
+    return true;
+}
+
+// z16traceWriter::close method definition
+bool z16traceWriter::close(std::ostream& err) {
+    if (!this->file) {
+        return true;
+    }
+    if (!z16traceWriter::finish()) {
+        err << "Error: Could not write trace file " << this->path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// finish method definition: buffered records, then the index
+bool z16traceWriter::finish() {
+    z16traceWriter::flush();
+    for (const auto& key : this->index) {
+        unsigned char entry[16];
+        put64(put64(entry, key.first), key.second);
+        this->failed |= std::fwrite(entry, 1, sizeof(entry), this->file) != sizeof(entry);
+    }
+    unsigned char trailer[16];
+    put64(trailer, this->index.size());
+    std::memcpy(trailer + 8, z16tracefmt::INDEX_MAGIC, 8);
+    this->failed |= std::fwrite(trailer, 1, sizeof(trailer), this->file) != sizeof(trailer);
+    this->failed |= std::fclose(this->file) != 0;
+    this->file = nullptr;
+    return !this->failed;
+}
+
+// z16traceWriter::flush method definition
+void z16traceWriter::flush() {
+    if (this->len && std::fwrite(this->buf.get(), 1, this->len, this->file) != this->len) {
+        this->failed = true;
+    }
+    this->offset += this->len;
+    this->len = 0;
+}
+
+// sync method definition: the next record starts with a keyframe if the
+// machine is not where the last record left it
+void z16traceWriter::sync(uint64_t count, const uint16_t* regs) {
+    if (count != this->count || std::memcmp(regs, this->shadow, sizeof(this->shadow)) != 0) {
+        this->count = count;
+        std::memcpy(this->shadow, regs, sizeof(this->shadow));
+        this->keyframeDue = true;
+    }
+}
+
+// keyframe method definition: the state before the instruction at pc
+void z16traceWriter::keyframe(uint16_t pc) {
+    this->index.push_back({this->count, this->offset + this->len});
+    unsigned char* p = this->buf.get() + this->len;
+    *p++ = z16tracefmt::KEYFRAME;
+    p = put64(p, this->count);
+    p = put16(p, pc);
+    for (int r = 0; r < 8; ++r) {
+        p = put16(p, this->shadow[r]);
+    }
+    this->len += z16tracefmt::KEYFRAME_SIZE;
+    this->nextPC = pc;
+    this->keyframeDue = false;
+    this->nextKeyframe = this->count - this->count % this->interval + this->interval;
+}
+
+// record method definition: called after the instruction at pc retired,
+// with the PC and registers it left behind. Instructions change at most one
+// register; if anything else changed more (a device service), the change
+// is left out and a keyframe follows.
+void z16traceWriter::record(uint16_t pc, uint16_t inst, uint16_t next_pc, const uint16_t* regs) {
+    if (this->keyframeDue || this->count >= this->nextKeyframe) {
+        z16traceWriter::keyframe(pc);
+    }
+    unsigned char* start = this->buf.get() + this->len;
+    unsigned char* p = start + 1;
+    uint8_t flags = 0;
+    if (pc != this->nextPC) {
+        flags |= z16tracefmt::PC_GIVEN;
+        p = put16(p, pc);
+    }
+    p = put16(p, inst);
+
+    int changed = -1;
+    for (int r = 0; r < 8; ++r) {
+        if (regs[r] != this->shadow[r]) {
+            if (changed >= 0) {
+                this->keyframeDue = true;
+                break;
+            }
+            changed = r;
+        }
+    }
+    if (changed >= 0 && !this->keyframeDue) {
+        int16_t delta = (int16_t)(uint16_t)(regs[changed] - this->shadow[changed]);
+        uint16_t zigzag = (uint16_t)(((uint16_t)delta << 1) ^ (uint16_t)(delta >> 15));
+        flags |= z16tracefmt::REG_CHANGED | (uint8_t)(changed << 4);
+        while (zigzag >= 0x80) {
+            *p++ = (unsigned char)(zigzag | 0x80);
+            zigzag >>= 7;
+        }
+        *p++ = (unsigned char)zigzag;
+    }
+
+    const z16decoded& d = z16decodeTable[inst];
+    this->nextPC = pc + 2;
+    if (d.op == Z16_J || d.op == Z16_JAL) {
+        this->nextPC = pc + d.imm;
+    } else if (d.op >= Z16_BEQ && d.op <= Z16_BGEU && next_pc == (uint16_t)(pc + d.imm)) {
+        flags |= z16tracefmt::TAKEN;
+        this->nextPC = next_pc;
+    } else if (d.op == Z16_SB || d.op == Z16_SW) {
+        flags |= z16tracefmt::STORE;
+        p = put16(p, (uint16_t)(regs[d.rd] + d.imm));
+        if (d.op == Z16_SW) {
+            flags |= z16tracefmt::STORE_WORD;
+            p = put16(p, regs[d.rs2]);
+        } else {
+            *p++ = (unsigned char)(regs[d.rs2] & 0xFF);
+        }
+    }
+
+    *start = flags;
+    this->len = p - this->buf.get();
+    std::memcpy(this->shadow, regs, sizeof(this->shadow));
+    ++this->count;
+    ++this->records;
+    if (this->len > z16traceWriter::BUFFER - z16tracefmt::MAX_RECORD - z16tracefmt::KEYFRAME_SIZE) {
+        z16traceWriter::flush();
+    }
+}
+
+// z16traceReader constructor definition
+z16traceReader::z16traceReader()
+    : file(nullptr), buf(new unsigned char[BUFFER]), pos(0), len(0), offset(0), dataEnd(0), interval(0),
+      indexed(false), count(0), nextPC(0), regs(), pending(false) {}
+
+// z16traceReader destructor definition
+z16traceReader::~z16traceReader() {
+    if (this->file) {
+        std::fclose(this->file);
+    }
+}
+
+// z16traceReader::open method definition: reads the header and the index,
+// or rebuilds the index if the writer never got to write it
+bool z16traceReader::open(const std::string& path, std::ostream& err) {
+    if (this->file) {
+        std::fclose(this->file);
+    }
+    this->file = std::fopen(path.c_str(), "rb");
+    if (!this->file) {
+        err << "Error: Could not open trace file " << path << std::endl;
+        return false;
+    }
+    unsigned char header[z16tracefmt::HEADER_SIZE];
+    if (std::fread(header, 1, sizeof(header), this->file) != sizeof(header) ||
+        std::memcmp(header, z16tracefmt::MAGIC, 8) != 0) {
+        err << "Error: " << path << " is not a zx16 trace file" << std::endl;
+        return false;
+    }
+    if (get16(header + 8) != z16tracefmt::VERSION) {
+        err << "Error: " << path << " has unsupported trace version " << get16(header + 8) << std::endl;
+        return false;
+    }
+    this->interval = header[12] | (header[13] << 8) | (header[14] << 16) | ((uint32_t)header[15] << 24);
+
+    seekFile(this->file, 0, SEEK_END);
+    uint64_t size = tellFile(this->file);
+    this->dataEnd = size;
+    this->index.clear();
+    this->indexed = false;
+    unsigned char trailer[16];
+    if (size >= z16tracefmt::HEADER_SIZE + sizeof(trailer)) {
+        seekFile(this->file, size - sizeof(trailer), SEEK_SET);
+        if (std::fread(trailer, 1, sizeof(trailer), this->file) == sizeof(trailer) &&
+            std::memcmp(trailer + 8, z16tracefmt::INDEX_MAGIC, 8) == 0 &&
+            get64(trailer) <= (size - z16tracefmt::HEADER_SIZE - sizeof(trailer)) / 16) {
+            uint64_t n = get64(trailer);
+            uint64_t start = size - sizeof(trailer) - n * 16;
+            z16traceReader::moveTo(start);
+            this->index.reserve(n);
+            for (uint64_t i = 0; i < n && z16traceReader::fill(16); ++i) {
+                this->index.push_back({get64(this->buf.get() + this->pos), get64(this->buf.get() + this->pos + 8)});
+                this->pos += 16;
+            }
+            this->indexed = this->index.size() == n;
+            this->dataEnd = start;
+        }
+    }
+    if (!this->indexed) {
+        z16traceReader::scanKeyframes();
+    }
+    return z16traceReader::seek(0);
+}
+
+// moveTo method definition
+void z16traceReader::moveTo(uint64_t where) {
+    seekFile(this->file, where, SEEK_SET);
+    this->offset = where;
+    this->pos = this->len = 0;
+}
+
+// fill method definition: true once need bytes are buffered; never reads
+// past dataEnd
+bool z16traceReader::fill(size_t need) {
+    if (this->len - this->pos >= need) {
+        return true;
+    }
+    std::memmove(this->buf.get(), this->buf.get() + this->pos, this->len - this->pos);
+    this->offset += this->pos;
+    this->len -= this->pos;
+    this->pos = 0;
+    uint64_t at = this->offset + this->len;
+    size_t want = (size_t)std::min<uint64_t>(BUFFER - this->len, this->dataEnd > at ? this->dataEnd - at : 0);
+    this->len += std::fread(this->buf.get() + this->len, 1, want, this->file);
+    return this->len - this->pos >= need;
+}
+
+// parse method definition: the record or keyframe at the read position.
+// Returns 1 for a record, 2 for a keyframe, 0 at the end or when the rest
+// is too short to be a whole record.
+int z16traceReader::parse(z16traceRecord& rec) {
+    z16traceReader::fill(z16tracefmt::KEYFRAME_SIZE);
+    const unsigned char* p = this->buf.get() + this->pos;
+    const unsigned char* end = this->buf.get() + this->len;
+    if (p >= end) {
+        return 0;
+    }
+    uint8_t flags = *p++;
+    if (flags == z16tracefmt::KEYFRAME) {
+        if (end - p < (ptrdiff_t)z16tracefmt::KEYFRAME_SIZE - 1) {
+            return 0;
+        }
+        this->count = get64(p);
+        this->nextPC = get16(p + 8);
+        for (int r = 0; r < 8; ++r) {
+            this->regs[r] = get16(p + 10 + 2 * r);
+        }
+        this->pos += z16tracefmt::KEYFRAME_SIZE;
+        return 2;
+    }
+    if (flags & 0x80) {
+        return 0;
+    }
+    size_t size = 3 + ((flags & z16tracefmt::PC_GIVEN) ? 2 : 0) +
+                  ((flags & z16tracefmt::STORE) ? ((flags & z16tracefmt::STORE_WORD) ? 4 : 3) : 0);
+    if (end - p < (ptrdiff_t)size - 1) {
+        return 0;
+    }
+    rec.count = this->count;
+    rec.pc = this->nextPC;
+    if (flags & z16tracefmt::PC_GIVEN) {
+        rec.pc = get16(p);
+        p += 2;
+    }
+    rec.inst = get16(p);
+    p += 2;
+    rec.reg = -1;
+    if (flags & z16tracefmt::REG_CHANGED) {
+        uint32_t zigzag = 0;
+        int shift = 0;
+        do {
+            if (p >= end || shift > 14) {
+                return 0;
+            }
+            zigzag |= (uint32_t)(*p & 0x7F) << shift;
+            shift += 7;
+        } while (*p++ & 0x80);
+        uint16_t delta = (uint16_t)((zigzag >> 1) ^ (0 - (zigzag & 1)));
+        rec.reg = (flags >> 4) & 0x7;
+        this->regs[rec.reg] = (uint16_t)(this->regs[rec.reg] + delta);
+        rec.value = this->regs[rec.reg];
+    }
+    rec.storeSize = 0;
+    if (flags & z16tracefmt::STORE) {
+        if (end - p < ((flags & z16tracefmt::STORE_WORD) ? 4 : 3)) {
+            return 0;
+        }
+        rec.addr = get16(p);
+        if (flags & z16tracefmt::STORE_WORD) {
+            rec.storeSize = 2;
+            rec.data = get16(p + 2);
+            p += 4;
+        } else {
+            rec.storeSize = 1;
+            rec.data = p[2];
+            p += 3;
+        }
+    }
+    const z16decoded& d = z16decodeTable[rec.inst];
+    this->nextPC = rec.pc + 2;
+    if (d.op == Z16_J || d.op == Z16_JAL || (d.op >= Z16_BEQ && d.op <= Z16_BGEU && (flags & z16tracefmt::TAKEN))) {
+        this->nextPC = rec.pc + d.imm;
+    }
+    this->pos = p - this->buf.get();
+    ++this->count;
+    return 1;
+}
+
+// scanKeyframes method definition: rebuilds the index of a trace without one
+void z16traceReader::scanKeyframes() {
+    this->index.clear();
+    z16traceReader::moveTo(z16tracefmt::HEADER_SIZE);
+    z16traceRecord rec;
+    for (;;) {
+        uint64_t at = this->offset + this->pos;
+        int kind = z16traceReader::parse(rec);
+        if (kind == 0) {
+            break;
+        }
+        if (kind == 2) {
+            this->index.push_back({this->count, at});
+        }
+    }
+    this->dataEnd = this->offset + this->pos; // Anything after is a cut-off record
+}
+
+// seek method definition: from the last keyframe at or before n
+bool z16traceReader::seek(uint64_t n) {
+    auto it = std::upper_bound(this->index.begin(), this->index.end(), std::make_pair(n, UINT64_MAX));
+    z16traceReader::moveTo(it == this->index.begin() ? z16tracefmt::HEADER_SIZE : std::prev(it)->second);
+    this->count = 0;
+    this->nextPC = 0;
+    std::fill(std::begin(this->regs), std::end(this->regs), 0);
+    this->pending = false;
+    while (z16traceReader::next(this->held)) {
+        if (this->held.count >= n) {
+            this->pending = true;
+            break;
+        }
+    }
+    return true;
+}
+
+// next method definition
+bool z16traceReader::next(z16traceRecord& rec) {
+    if (this->pending) {
+        this->pending = false;
+        rec = this->held;
+        return true;
+    }
+    for (;;) {
+        int kind = z16traceReader::parse(rec);
+        if (kind != 2) {
+            return kind == 1;
+        }
+    }
+}
@@ -0,0 +1,153 @@
+#ifndef Z16TRACEFILE_H
+#define Z16TRACEFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Binary execution trace (z16sim::setTraceWriter, zx16_tracedump). The file
+// is a 16-byte header ("ZX16TRCE", version, keyframe interval), the records,
+// and on close() an index of the keyframes:
+//
+//   record    flags, [pc], inst, [register delta], [store address, value]
+//             flags bit 0: pc given; otherwise the instruction follows the
+//                          previous record's, or is its J-type target or
+//                          taken B-type target
+//                   bit 1: a register changed; bits 4-6 name it, and the
+//                          difference from its old value follows as a
+//                          zigzag LEB128 varint (1-3 bytes)
+//                   bit 2: a store; bit 3 set for a word (2-byte value)
+//                   bit 3 on a B-type instruction: the branch was taken
+//   keyframe  0x80, instruction count (8 bytes), pc, the 8 registers:
+//             the state before the next record
+//   index     (count, file offset) per keyframe, 16 bytes each, then the
+//             number of keyframes (8 bytes) and "ZX16TIDX"
+//
+// All fields are little-endian. A typical record is 3-4 bytes. A file cut
+// off before its index (a crashed run) is still readable; the reader then
+// finds the keyframes by scanning.
+namespace z16tracefmt {
+const char MAGIC[8] = {'Z', 'X', '1', '6', 'T', 'R', 'C', 'E'};
+const char INDEX_MAGIC[8] = {'Z', 'X', '1', '6', 'T', 'I', 'D', 'X'};
+const uint16_t VERSION = 1;
+const size_t HEADER_SIZE = 16;
+const size_t MAX_RECORD = 12;
+const size_t KEYFRAME_SIZE = 27;
+
+enum : uint8_t {
+    PC_GIVEN = 0x01,
+    REG_CHANGED = 0x02,
+    STORE = 0x04,
+    STORE_WORD = 0x08,
+    TAKEN = 0x08,
+    KEYFRAME = 0x80
+};
+}
+
+// One retired instruction read back from a trace
+struct z16traceRecord {
+    uint64_t count; // Instruction count (0 for the first instruction after reset)
+    uint16_t pc;
+    uint16_t inst;
+    int reg;        // Register the instruction changed, -1 if none
+    uint16_t value; // Its new value
+    int storeSize;  // 0, or bytes stored (1 or 2)
+    uint16_t addr;
+    uint16_t data;
+};
+
+// Writes the records of a traced run to a file through one buffer. The
+// simulator calls sync() when a run starts and record() after every
+// retired instruction; the writer keeps its own copy of the registers and
+// writes a keyframe whenever that copy is out of step with the machine
+// (the first record, or the host changed something between runs) and every
+// interval instructions.
+class z16traceWriter {
+public:
+    static const uint32_t DEFAULT_INTERVAL = 65536;
+    static const size_t BUFFER = 256 * 1024;
+
+    explicit z16traceWriter(uint32_t interval = DEFAULT_INTERVAL);
+    ~z16traceWriter();
+
+    // Errors go to err; open() truncates path
+    bool open(const std::string& path, std::ostream& err);
+    // Writes the index and closes the file; false if any write failed
+    bool close(std::ostream& err);
+    bool isOpen() const { return file != nullptr; }
+    uint64_t getRecordCount() const { return records; }
+
+    void sync(uint64_t count, const uint16_t* regs);
+
+    void record(uint16_t pc, uint16_t inst, uint16_t next_pc, const uint16_t* regs);
+
+private:
+    FILE* file;
+    std::string path;
+    std::unique_ptr<unsigned char[]> buf;
+    size_t len;
+    uint64_t offset; // File offset of buf[0]
+    bool failed;
+    uint32_t interval;
+    uint64_t count;       // Instruction count of the next record
+    uint64_t nextKeyframe;
+    bool keyframeDue;
+    uint16_t nextPC;      // PC the next record is assumed to have
+    uint16_t shadow[8];   // Registers before the next record
+    uint64_t records;
+    std::vector<std::pair<uint64_t, uint64_t> > index; // (count, offset) per keyframe
+
+    void keyframe(uint16_t pc);
+    void flush();
+    bool finish();
+};
+
+// Reads a trace written by z16traceWriter, front to back or from a seek()
+// target, reconstructing the registers along the way
+class z16traceReader {
+public:
+    static const size_t BUFFER = 256 * 1024;
+
+    z16traceReader();
+    ~z16traceReader();
+
+    bool open(const std::string& path, std::ostream& err);
+    uint32_t getInterval() const { return interval; }
+    bool hasIndex() const { return indexed; }
+    const std::vector<std::pair<uint64_t, uint64_t> >& getKeyframes() const { return index; }
+
+    // Positions the reader so that next() returns instruction count n, or
+    // the first one after it; replays at most one keyframe interval
+    bool seek(uint64_t n);
+    // False at the end of the trace or at a damaged record
+    bool next(z16traceRecord& rec);
+    // Registers after the record next() returned last
+    const uint16_t* getRegs() const { return regs; }
+
+private:
+    FILE* file;
+    std::unique_ptr<unsigned char[]> buf;
+    size_t pos, len;
+    uint64_t offset;  // File offset of buf[0]
+    uint64_t dataEnd; // Where the records stop (the index, or the end of the file)
+    uint32_t interval;
+    bool indexed;     // The index was read from the file rather than rebuilt
+    std::vector<std::pair<uint64_t, uint64_t> > index;
+    uint64_t count;
+    uint16_t nextPC;
+    uint16_t regs[8];
+    z16traceRecord held; // The record seek() stopped at, returned by the next next()
+    bool pending;
+
+    bool fill(size_t need);
+    void moveTo(uint64_t where);
+    int parse(z16traceRecord& rec);
+    void scanKeyframes();
+};
+
+#endif // Z16TRACEFILE_H